@@ -0,0 +1,430 @@
+/*
+ * Performance regression comparator.
+ *
+ * Runs a bundled set of short read, write, copy and metadata benchmarks, each --reps times, and
+ * either stores the samples as a baseline or compares them against one:
+ *
+ *   bench_compare record baseline.json          run and write every sample to baseline.json
+ *   bench_compare compare baseline.json         run and compare with baseline.json
+ *
+ * Every sample is the mean cost of one operation in ns. Repetitions are interleaved across
+ * benchmarks so slow drift (thermal throttling, background work) spreads over all of them, and one
+ * warm-up round is discarded. The comparison reports the median and MAD of both runs and a
+ * two-sided Mann-Whitney U test on the samples. A benchmark is flagged as a regression when its
+ * median got slower by more than --threshold percent and p < --alpha; the process then exits with 1.
+ *
+ * Usage: bench_compare record|compare baseline.json [--dir path] [--reps n] [--threshold pct]
+ *                      [--alpha p] [--save current.json]
+ */
+#include "../include/yfile.h"
+#include <math.h>
+
+#define MAX_REPS    64
+#define MAX_BENCH   16
+
+typedef struct bench_env {
+    char dir[MAX_PATH];
+    char big[MAX_PATH];        // 64 MiB fixture
+    char copy_src[MAX_PATH];   // 16 MiB fixture
+    char *buf;                 // 1 MiB scratch buffer
+} bench_env;
+
+// Runs one repetition and returns its cost in ns per operation, or a negative value on failure.
+typedef double (*bench_fn)(bench_env *env);
+
+typedef struct bench_result {
+    const char *name;
+    double samples[MAX_REPS];
+    int count;
+} bench_result;
+
+static LARGE_INTEGER qpc_freq;
+
+static double now_ns(void) {
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1e9 / (double)qpc_freq.QuadPart;
+}
+
+static int make_file(const char *path, uint64_t size, const char *fill) {
+    FILE *fp = file_open(path, "wb");
+    if (fp == NULL) return -1;
+    int ret = 0;
+    for (uint64_t done = 0; done < size && ret == 0; done += 1 << 20)
+        if (file_write(fp, fill, 1 << 20) != (1 << 20)) ret = -1;
+    return file_close(fp) == 0 ? ret : -1;
+}
+
+static void join(char *out, const bench_env *env, const char *name) {
+    snprintf(out, MAX_PATH, "%s\\%s", env->dir, name);
+}
+
+static double bench_read_seq_1m(bench_env *env) {
+    FILE *fp = file_open(env->big, "rb");
+    if (fp == NULL) return -1;
+    double t0 = now_ns();
+    int ops = 0;
+    while (file_read(fp, env->buf, 1 << 20) == (1 << 20)) ops++;
+    double t = now_ns() - t0;
+    file_close(fp);
+    return ops > 0 ? t / ops : -1;
+}
+
+static double bench_pread_rand_4k(bench_env *env) {
+    FILE *fp = file_open(env->big, "rb");
+    if (fp == NULL) return -1;
+    uint64_t rng = 0x2545f4914f6cdd1dull;
+    const int ops = 8192;
+    double t0 = now_ns();
+    for (int i = 0; i < ops; i++) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        if (file_pread(fp, env->buf, 4096, (int64_t)(rng % (64 << 8)) << 12) != 4096) { file_close(fp); return -1; }
+    }
+    double t = now_ns() - t0;
+    file_close(fp);
+    return t / ops;
+}
+
+static double bench_write_seq_64k(bench_env *env) {
+    char path[MAX_PATH];
+    join(path, env, "write_seq.dat");
+    FILE *fp = file_open(path, "wb");
+    if (fp == NULL) return -1;
+    const int ops = 512;                        // 32 MiB
+    double t0 = now_ns();
+    for (int i = 0; i < ops; i++)
+        if (file_write(fp, env->buf, 64 << 10) != (64 << 10)) { file_close(fp); return -1; }
+    int ret = file_flush(fp);
+    double t = now_ns() - t0;
+    file_close(fp);
+    file_delete(path);
+    return ret == 0 ? t / ops : -1;
+}
+
+static double bench_write_small_16b(bench_env *env) {
+    char path[MAX_PATH];
+    join(path, env, "write_small.dat");
+    FILE *fp = file_open(path, "wb");
+    if (fp == NULL) return -1;
+    const int ops = 200000;
+    double t0 = now_ns();
+    for (int i = 0; i < ops; i++)
+        if (file_write(fp, env->buf, 16) != 16) { file_close(fp); return -1; }
+    int ret = file_flush(fp);
+    double t = now_ns() - t0;
+    file_close(fp);
+    file_delete(path);
+    return ret == 0 ? t / ops : -1;
+}
+
+static double bench_copy_16m(bench_env *env) {
+    char path[MAX_PATH];
+    join(path, env, "copy.dst");
+    double t0 = now_ns();
+    int ret = file_copy_ex(env->copy_src, path, 0);
+    double t = now_ns() - t0;
+    file_delete(path);
+    return ret == 0 ? t : -1;
+}
+
+static double bench_secure_delete_16m(bench_env *env) {
+    char path[MAX_PATH];
+    join(path, env, "secure.dat");
+    if (make_file(path, 16 << 20, env->buf) != 0) return -1;
+    double t0 = now_ns();
+    int ret = file_secure_delete_ex(path, 1 << 20);
+    double t = now_ns() - t0;
+    return ret == 0 ? t : -1;
+}
+
+static double bench_create_delete(bench_env *env) {
+    char path[MAX_PATH];
+    const int files = 1000;
+    double t0 = now_ns();
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s\\cd%d", env->dir, i);
+        FILE *fp = file_open(path, "wb");
+        if (fp == NULL) return -1;
+        file_close(fp);
+    }
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s\\cd%d", env->dir, i);
+        if (file_delete(path) != 0) return -1;
+    }
+    return (now_ns() - t0) / (2 * files);
+}
+
+static double bench_exists(bench_env *env) {
+    char path[MAX_PATH];
+    const int ops = 20000;
+    double t0 = now_ns();
+    // Alternates hits on the fixtures with misses next to them.
+    for (int i = 0; i < ops; i++) {
+        snprintf(path, sizeof(path), "%s\\%s", env->dir, (i & 1) ? "missing.dat" : "big.dat");
+        if (file_exists(path) != (i & 1)) return -1;
+    }
+    return (now_ns() - t0) / ops;
+}
+
+static double bench_ensure_directory(bench_env *env) {
+    char path[MAX_PATH];
+    const int ops = 400;
+    double t0 = now_ns();
+    // Every other call finds its directory already there.
+    for (int i = 0; i < ops; i++) {
+        snprintf(path, sizeof(path), "%s\\tree\\a%d\\b%d\\c", env->dir, i / 2 % 20, i / 2);
+        if (file_ensure_directory_ex(path, NULL) != 0) return -1;
+    }
+    double t = now_ns() - t0;
+    for (int i = 0; i < ops / 2; i++) {
+        snprintf(path, sizeof(path), "%s\\tree\\a%d\\b%d\\c", env->dir, i % 20, i);
+        RemoveDirectoryA(path);
+        snprintf(path, sizeof(path), "%s\\tree\\a%d\\b%d", env->dir, i % 20, i);
+        RemoveDirectoryA(path);
+    }
+    for (int i = 0; i < 20; i++) {
+        snprintf(path, sizeof(path), "%s\\tree\\a%d", env->dir, i);
+        RemoveDirectoryA(path);
+    }
+    snprintf(path, sizeof(path), "%s\\tree", env->dir);
+    RemoveDirectoryA(path);
+    return t / ops;
+}
+
+typedef struct bench_def {
+    const char *name;
+    bench_fn fn;
+} bench_def;
+
+static const bench_def benches[] = {
+    { "read_seq_1m",       bench_read_seq_1m },
+    { "pread_rand_4k",     bench_pread_rand_4k },
+    { "write_seq_64k",     bench_write_seq_64k },
+    { "write_small_16b",   bench_write_small_16b },
+    { "copy_16m",          bench_copy_16m },
+    { "secure_delete_16m", bench_secure_delete_16m },
+    { "create_delete",     bench_create_delete },
+    { "exists",            bench_exists },
+    { "ensure_directory",  bench_ensure_directory },
+};
+
+#define BENCH_COUNT ((int)(sizeof(benches) / sizeof(benches[0])))
+
+static int run_all(const char *dir, int reps, bench_result *results) {
+    bench_env env;
+    memset(&env, 0, sizeof(env));
+    snprintf(env.dir, sizeof(env.dir), "%s\\bench_compare.tmp", dir);
+    join(env.big, &env, "big.dat");
+    join(env.copy_src, &env, "copy.src");
+    if (file_ensure_directory_ex(env.dir, NULL) != 0 || (env.buf = (char *)file_buffer_alloc(1 << 20)) == NULL) return -1;
+    for (int i = 0; i < (1 << 20); i++) env.buf[i] = (char)(i * 7 + 3);
+    if (make_file(env.big, 64 << 20, env.buf) != 0 || make_file(env.copy_src, 16 << 20, env.buf) != 0) return -1;
+
+    for (int b = 0; b < BENCH_COUNT; b++) {
+        results[b].name = benches[b].name;
+        results[b].count = 0;
+    }
+    for (int r = -1; r < reps; r++) {           // Round -1 warms the caches and is discarded.
+        for (int b = 0; b < BENCH_COUNT; b++) {
+            double ns = benches[b].fn(&env);
+            if (r >= 0 && ns >= 0) results[b].samples[results[b].count++] = ns;
+        }
+        fprintf(stderr, "\rround %d/%d", r + 1, reps);
+    }
+    fprintf(stderr, "\n");
+
+    file_delete(env.big);
+    file_delete(env.copy_src);
+    RemoveDirectoryA(env.dir);
+    file_buffer_free(env.buf, 1 << 20);
+    return 0;
+}
+
+static int save_results(const char *path, const bench_result *results, int count) {
+    FILE *fp = file_open(path, "w");
+    if (fp == NULL) return -1;
+    fprintf(fp, "{\n  \"unit\": \"ns/op\",\n  \"benchmarks\": [");
+    for (int b = 0; b < count; b++) {
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"samples\": [", b ? "," : "", results[b].name);
+        for (int i = 0; i < results[b].count; i++) fprintf(fp, "%s%.1f", i ? ", " : "", results[b].samples[i]);
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    return file_close(fp);
+}
+
+// Reads a file written by save_results; returns the number of benchmarks, or -1.
+static int load_results(const char *path, bench_result *results, char names[][64]) {
+    FILE *fp = file_open(path, "rb");
+    if (fp == NULL) return -1;
+    int64_t size = file_get_size(fp);
+    char *text = size >= 0 ? (char *)malloc((size_t)size + 1) : NULL;
+    if (text == NULL || file_read(fp, text, (size_t)size) != (size_t)size) {
+        free(text);
+        file_close(fp);
+        return -1;
+    }
+    file_close(fp);
+    text[size] = '\0';
+
+    int count = 0;
+    for (char *p = text; count < MAX_BENCH && (p = strstr(p, "\"name\"")) != NULL; count++) {
+        char *q = strchr(p + 6, '"');
+        char *end = q != NULL ? strchr(q + 1, '"') : NULL;
+        char *s = end != NULL ? strstr(end, "\"samples\"") : NULL;
+        char *open = s != NULL ? strchr(s, '[') : NULL;
+        if (open == NULL) break;
+        size_t len = (size_t)(end - q - 1) < 63 ? (size_t)(end - q - 1) : 63;
+        memcpy(names[count], q + 1, len);
+        names[count][len] = '\0';
+        results[count].name = names[count];
+        results[count].count = 0;
+        p = open + 1;
+        while (*p != ']' && *p != '\0' && results[count].count < MAX_REPS) {
+            char *next;
+            double v = strtod(p, &next);
+            if (next == p) { p++; continue; }
+            results[count].samples[results[count].count++] = v;
+            p = next;
+        }
+    }
+    free(text);
+    return count;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double median(const double *v, int n) {
+    double s[MAX_REPS];
+    memcpy(s, v, sizeof(double) * (size_t)n);
+    qsort(s, (size_t)n, sizeof(double), compare_double);
+    return n % 2 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+}
+
+// Median absolute deviation from the median.
+static double mad(const double *v, int n) {
+    double m = median(v, n), d[MAX_REPS];
+    for (int i = 0; i < n; i++) d[i] = fabs(v[i] - m);
+    return median(d, n);
+}
+
+typedef struct ranked {
+    double value;
+    int group;
+} ranked;
+
+static int compare_ranked(const void *a, const void *b) {
+    double x = ((const ranked *)a)->value, y = ((const ranked *)b)->value;
+    return x < y ? -1 : x > y;
+}
+
+// Two-sided Mann-Whitney U test, normal approximation with tie and continuity corrections.
+static double mann_whitney_p(const double *a, int na, const double *b, int nb) {
+    ranked all[2 * MAX_REPS];
+    int n = na + nb;
+    for (int i = 0; i < na; i++) { all[i].value = a[i]; all[i].group = 0; }
+    for (int i = 0; i < nb; i++) { all[na + i].value = b[i]; all[na + i].group = 1; }
+    qsort(all, (size_t)n, sizeof(ranked), compare_ranked);
+
+    double rank_sum_a = 0, ties = 0;
+    for (int i = 0; i < n; ) {
+        int j = i;
+        while (j < n && all[j].value == all[i].value) j++;
+        double rank = (i + 1 + j) / 2.0;        // Average of ranks i+1 .. j.
+        for (int k = i; k < j; k++) if (all[k].group == 0) rank_sum_a += rank;
+        double t = j - i;
+        ties += t * t * t - t;
+        i = j;
+    }
+    double u = rank_sum_a - na * (na + 1) / 2.0;
+    double mean = na * (double)nb / 2.0;
+    double var = na * (double)nb / 12.0 * ((n + 1) - ties / ((double)n * (n - 1)));
+    if (var <= 0) return 1.0;
+    double diff = fabs(u - mean) - 0.5;
+    if (diff < 0) diff = 0;
+    return erfc(diff / sqrt(var) / sqrt(2.0));
+}
+
+static int compare_results(const bench_result *base, int nbase, const bench_result *cur, int ncur,
+                           double threshold, double alpha) {
+    int regressions = 0;
+    printf("%-18s %12s %7s %12s %7s %8s %7s  %s\n",
+           "benchmark", "base ns/op", "MAD", "new ns/op", "MAD", "change", "p", "verdict");
+    for (int c = 0; c < ncur; c++) {
+        const bench_result *b = NULL;
+        for (int i = 0; i < nbase; i++) if (strcmp(base[i].name, cur[c].name) == 0) b = &base[i];
+        if (b == NULL || b->count < 2 || cur[c].count < 2) {
+            printf("%-18s %12s %7s %12s %7s %8s %7s  %s\n", cur[c].name, "-", "-", "-", "-", "-", "-",
+                   cur[c].count < 2 ? "failed" : "no baseline");
+            continue;
+        }
+        double bm = median(b->samples, b->count), cm = median(cur[c].samples, cur[c].count);
+        double change = (cm - bm) / bm * 100;
+        double p = mann_whitney_p(b->samples, b->count, cur[c].samples, cur[c].count);
+        const char *verdict = "ok";
+        if (p < alpha && change > threshold) { verdict = "REGRESSION"; regressions++; }
+        else if (p < alpha && change < -threshold) verdict = "improved";
+        else if (p >= alpha && fabs(change) > threshold) verdict = "noisy";
+        printf("%-18s %12.1f %6.1f%% %12.1f %6.1f%% %+7.1f%% %7.4f  %s\n",
+               cur[c].name, bm, mad(b->samples, b->count) / bm * 100,
+               cm, mad(cur[c].samples, cur[c].count) / cm * 100, change, p, verdict);
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3 || (strcmp(argv[1], "record") != 0 && strcmp(argv[1], "compare") != 0)) {
+        fprintf(stderr, "usage: bench_compare record|compare baseline.json [--dir path] [--reps n] "
+                        "[--threshold pct] [--alpha p] [--save current.json]\n");
+        return 2;
+    }
+    int record = strcmp(argv[1], "record") == 0;
+    const char *baseline = argv[2];
+    const char *dir = ".";
+    const char *save = NULL;
+    int reps = 15;
+    double threshold = 5.0, alpha = 0.01;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) dir = argv[++i];
+        else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) reps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc) alpha = atof(argv[++i]);
+        else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) save = argv[++i];
+        else { fprintf(stderr, "unknown option %s\n", argv[i]); return 2; }
+    }
+    if (reps < 3) reps = 3;
+    if (reps > MAX_REPS) reps = MAX_REPS;
+    QueryPerformanceFrequency(&qpc_freq);
+
+    static bench_result base[MAX_BENCH], cur[MAX_BENCH];
+    static char names[MAX_BENCH][64];
+    int nbase = 0;
+    if (!record && (nbase = load_results(baseline, base, names)) <= 0) {
+        fprintf(stderr, "cannot read baseline %s\n", baseline);
+        return 2;
+    }
+    if (run_all(dir, reps, cur) != 0) {
+        fprintf(stderr, "cannot set up fixtures in %s (error %lu)\n", dir, file_last_error());
+        return 2;
+    }
+    if (record || save != NULL) {
+        const char *path = record ? baseline : save;
+        if (save_results(path, cur, BENCH_COUNT) != 0) {
+            fprintf(stderr, "cannot write %s (error %lu)\n", path, file_last_error());
+            return 2;
+        }
+    }
+    if (record) {
+        for (int b = 0; b < BENCH_COUNT; b++) {
+            if (cur[b].count == 0) { printf("%-18s failed\n", cur[b].name); continue; }
+            double m = median(cur[b].samples, cur[b].count);
+            printf("%-18s %12.1f ns/op  MAD %5.1f%%  (%d samples)\n",
+                   cur[b].name, m, mad(cur[b].samples, cur[b].count) / m * 100, cur[b].count);
+        }
+        return 0;
+    }
+    return compare_results(base, nbase, cur, BENCH_COUNT, threshold, alpha) > 0 ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copy, move and secure-delete benchmark.
+ *
+ * Times each yfile call against a baseline measured in the same run, for every file size and
+ * buffer size:
+ *   - copy:           file_copy_ex vs. a dd-style ReadFile/WriteFile loop with the given buffer,
+ *   - move:           file_move within --dir vs. rename(), and file_move from --dir to --dir2
+ *                     vs. copy-then-delete (what mv does across devices),
+ *   - secure delete:  file_secure_delete_ex vs. a dd-style zero overwrite, flush and delete.
+ * file_copy_ex (CopyFileA) and file_move pick their own buffers, so only the baselines and
+ * file_secure_delete_ex follow the buffer size; file_secure_delete_ex always makes one zero pass.
+ *
+ * For the cross-device rows, point --dir2 at another volume (a second RAM disk, or a mounted VHD).
+ * MoveFileA does not copy across volumes, so file_move fails there and the row says so.
+ * Sources are freshly written before each repetition and so come from the file cache; the result
+ * is the median of --reps repetitions, as GB/s (10^9 bytes per second). Output is one JSON array,
+ * with a table on stderr.
+ *
+ * Usage: bench_copy [--dir path] [--dir2 path] [--max-size MiB] [--reps n] [--out file.json]
+ */
+#include "../include/yfile.h"
+
+#define MAX_REPS 32
+
+static double now_seconds(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+}
+
+static char *fill;                              // 1 MiB of non-zero data for new files.
+
+static int make_file(const char *path, uint64_t size) {
+    FILE *fp = file_open(path, "wb");
+    if (fp == NULL) return -1;
+    int ret = 0;
+    for (uint64_t done = 0; done < size && ret == 0; ) {
+        size_t n = size - done < (1 << 20) ? (size_t)(size - done) : (1 << 20);
+        if (file_write(fp, fill, n) != n) ret = -1;
+        done += n;
+    }
+    if (file_close(fp) != 0) ret = -1;
+    return ret;
+}
+
+// dd if=src of=dst bs=buffer
+static int dd_copy(const char *src, const char *dst, size_t buffer) {
+    HANDLE in = CreateFileA(src, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (in == INVALID_HANDLE_VALUE) return -1;
+    HANDLE out = CreateFileA(dst, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (out == INVALID_HANDLE_VALUE) { CloseHandle(in); return -1; }
+    char *buf = (char *)file_buffer_alloc(buffer);
+    int ret = buf != NULL ? 0 : -1;
+    DWORD n, put;
+    while (ret == 0 && ReadFile(in, buf, (DWORD)buffer, &n, NULL) && n > 0)
+        if (!WriteFile(out, buf, n, &put, NULL) || put != n) ret = -1;
+    if (buf != NULL) file_buffer_free(buf, buffer);
+    CloseHandle(in);
+    if (!CloseHandle(out)) ret = -1;
+    return ret;
+}
+
+// dd if=/dev/zero of=path bs=buffer conv=notrunc,fsync && rm path
+static int dd_zero_delete(const char *path, uint64_t size, size_t buffer) {
+    HANDLE h = CreateFileA(path, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return -1;
+    char *buf = (char *)file_buffer_alloc(buffer);
+    int ret = buf != NULL ? 0 : -1;
+    if (buf != NULL) memset(buf, 0, buffer);
+    for (uint64_t done = 0; ret == 0 && done < size; ) {
+        DWORD n = (DWORD)(size - done < buffer ? size - done : buffer), put;
+        if (!WriteFile(h, buf, n, &put, NULL) || put != n) ret = -1;
+        done += n;
+    }
+    if (ret == 0 && !FlushFileBuffers(h)) ret = -1;
+    if (buf != NULL) file_buffer_free(buf, buffer);
+    CloseHandle(h);
+    return ret == 0 && DeleteFileA(path) ? 0 : -1;
+}
+
+typedef enum { OP_COPY, OP_MOVE, OP_MOVE_CROSS, OP_SECURE_DELETE } bench_op;
+
+static const char *op_names[] = { "copy", "move", "move_cross_device", "secure_delete" };
+
+typedef struct bench_case {
+    bench_op op;
+    int baseline;
+    uint64_t size;
+    size_t buffer;
+    const char *src;
+    const char *dst;
+} bench_case;
+
+// Prepares the input (untimed), then times one run.
+static double run_once(const bench_case *c) {
+    file_delete(c->dst);
+    if (make_file(c->src, c->size) != 0) return -1;
+    double t0 = now_seconds();
+    int ret;
+    switch (c->op) {
+    case OP_COPY:
+        ret = c->baseline ? dd_copy(c->src, c->dst, c->buffer) : file_copy_ex(c->src, c->dst, 0);
+        break;
+    case OP_MOVE:
+        ret = c->baseline ? rename(c->src, c->dst) : file_move(c->src, c->dst);
+        break;
+    case OP_MOVE_CROSS:
+        ret = c->baseline ? (dd_copy(c->src, c->dst, c->buffer) == 0 && DeleteFileA(c->src) ? 0 : -1)
+                          : file_move(c->src, c->dst);
+        break;
+    default:
+        ret = c->baseline ? dd_zero_delete(c->src, c->size, c->buffer) : file_secure_delete_ex(c->src, c->buffer);
+        break;
+    }
+    double t = now_seconds() - t0;
+    return ret == 0 ? t : -1;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int first_result = 1;
+
+static double run_case(FILE *json, const bench_case *c, int reps) {
+    double times[MAX_REPS];
+    int failed = 0;
+    for (int r = 0; r < reps; r++)
+        if ((times[r] = run_once(c)) < 0) failed = 1;
+    file_delete(c->src);
+    file_delete(c->dst);
+
+    qsort(times, (size_t)reps, sizeof(times[0]), compare_double);
+    double median = failed ? 0 : times[reps / 2];
+    double gb_s = median > 0 ? (double)c->size / median / 1e9 : 0;
+    fprintf(json, "%s\n  {\"op\": \"%s\", \"impl\": \"%s\", \"size\": %llu, \"buffer\": %zu, \"reps\": %d, "
+                  "\"median_s\": %.6f, \"gb_s\": %.3f, \"failed\": %s}",
+            first_result ? "" : ",", op_names[c->op], c->baseline ? "baseline" : "yfile",
+            (unsigned long long)c->size, c->buffer, reps, median, gb_s, failed ? "true" : "false");
+    first_result = 0;
+    return failed ? -1 : gb_s;
+}
+
+static void run_pair(FILE *json, bench_case c, int reps) {
+    c.baseline = 0;
+    double mine = run_case(json, &c, reps);
+    c.baseline = 1;
+    double base = run_case(json, &c, reps);
+    char mine_s[16], base_s[16];
+    if (mine < 0) snprintf(mine_s, sizeof(mine_s), "failed");
+    else snprintf(mine_s, sizeof(mine_s), "%.3f", mine);
+    if (base < 0) snprintf(base_s, sizeof(base_s), "failed");
+    else snprintf(base_s, sizeof(base_s), "%.3f", base);
+    fprintf(stderr, "%-18s %10llu KiB  buf %6zu KiB  yfile %8s GB/s  baseline %8s GB/s",
+            op_names[c.op], (unsigned long long)(c.size >> 10), c.buffer >> 10, mine_s, base_s);
+    if (mine > 0 && base > 0) fprintf(stderr, "  x%.2f", mine / base);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+    const char *dir = ".";
+    const char *dir2 = NULL;
+    uint64_t max_size = (uint64_t)1 << 30;
+    int reps = 5;
+    const char *out = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) dir = argv[++i];
+        else if (strcmp(argv[i], "--dir2") == 0 && i + 1 < argc) dir2 = argv[++i];
+        else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) max_size = strtoull(argv[++i], NULL, 10) << 20;
+        else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) reps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) out = argv[++i];
+        else {
+            fprintf(stderr, "usage: bench_copy [--dir path] [--dir2 path] [--max-size MiB] [--reps n] [--out file.json]\n");
+            return 2;
+        }
+    }
+    if (reps < 1) reps = 1;
+    if (reps > MAX_REPS) reps = MAX_REPS;
+
+    FILE *json = out != NULL ? file_open(out, "w") : stdout;
+    if (json == NULL || (fill = (char *)file_buffer_alloc(1 << 20)) == NULL) {
+        fprintf(stderr, "setup failed (error %lu)\n", file_last_error());
+        return 1;
+    }
+    for (int i = 0; i < (1 << 20); i++) fill[i] = (char)(i * 31 + 1);
+
+    char src[MAX_PATH], dst[MAX_PATH], cross[MAX_PATH];
+    snprintf(src, sizeof(src), "%s\\bench_copy.src", dir);
+    snprintf(dst, sizeof(dst), "%s\\bench_copy.dst", dir);
+    if (dir2 != NULL) snprintf(cross, sizeof(cross), "%s\\bench_copy.dst", dir2);
+
+    static const size_t buffers[] = { 64 << 10, 1 << 20, 8 << 20 };
+    const int nbuffers = (int)(sizeof(buffers) / sizeof(buffers[0]));
+
+    fprintf(json, "[");
+    for (uint64_t size = 64 << 10; size <= max_size; size <<= 4) {
+        bench_case c;
+        memset(&c, 0, sizeof(c));
+        c.size = size;
+        c.src = src;
+
+        // Same-volume move does not depend on the buffer size on either side, so it runs once per file size.
+        for (int b = 0; b < nbuffers; b++) {
+            c.buffer = buffers[b];
+            c.op = OP_COPY;
+            c.dst = dst;
+            run_pair(json, c, reps);
+            c.op = OP_SECURE_DELETE;
+            run_pair(json, c, reps);
+            if (dir2 != NULL) {
+                c.op = OP_MOVE_CROSS;
+                c.dst = cross;
+                run_pair(json, c, reps);
+            }
+        }
+        c.op = OP_MOVE;
+        c.buffer = 0;
+        c.dst = dst;
+        run_pair(json, c, reps);
+    }
+    fprintf(json, "\n]\n");
+    if (json != stdout) file_close(json);
+    file_buffer_free(fill, 1 << 20);
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Large-page benchmark.
+ *
+ * Compares normal and large-page pool buffers on two workloads:
+ *   - a TLB-bound scan that touches one cache line per 4 KiB page in random page order, and
+ *   - a sequential copy through a single bulk buffer (read whole buffer, checksum, write).
+ * It also times a checksum over a mapped file with and without FILE_MAPPING_PREFETCH; that row only
+ * shows a difference when the file is not already in the file cache, e.g. a file larger than RAM.
+ *
+ * Windows has no user-mode TLB-miss counter, so the TLB effect shows up as the ns/page figure of
+ * the scan. To count misses directly, run the benchmark under WPR with the DTLB PMU sources enabled.
+ * Large pages need the "Lock pages in memory" user right; without it only the normal-page rows run.
+ *
+ * Usage: bench_large_pages [file] [buffer MiB]
+ */
+#include "../include/yfile.h"
+
+static double now_seconds(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+}
+
+static uint64_t checksum(const unsigned char *p, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i += 64) sum += p[i];
+    return sum;
+}
+
+// Touches every 4 KiB page of buf once in a scrambled order; returns ns per page.
+static double tlb_scan(unsigned char *buf, size_t size) {
+    size_t pages = size >> 12;
+    volatile uint64_t sink = 0;
+    double best = 1e30;
+    for (int round = 0; round < 5; round++) {
+        double t0 = now_seconds();
+        size_t page = 0;
+        for (size_t i = 0; i < pages; i++) {
+            page = (page + 7919) % pages;       // 7919 is prime, so every page is visited.
+            sink += buf[(page << 12) + (i & 63) * 64];
+        }
+        double t = (now_seconds() - t0) * 1e9 / (double)pages;
+        if (t < best) best = t;
+    }
+    (void)sink;
+    return best;
+}
+
+static double copy_file(const char *src, const char *dst, unsigned char *buf, size_t bufsize) {
+    FILE *in = file_open(src, "rb");
+    FILE *out = file_open(dst, "wb");
+    if (in == NULL || out == NULL) return 0;
+    volatile uint64_t sink = 0;
+    uint64_t total = 0;
+    double t0 = now_seconds();
+    size_t n;
+    while ((n = file_read(in, (char *)buf, bufsize)) > 0) {
+        sink += checksum(buf, n);
+        file_write(out, (char *)buf, n);
+        total += n;
+    }
+    file_flush(out);
+    double t = now_seconds() - t0;
+    file_close(in);
+    file_close(out);
+    (void)sink;
+    return (double)total / (1 << 20) / t;
+}
+
+static double scan_mapping(const char *path, int flags) {
+    FILE *fp = file_open(path, "rb");
+    file_mapping m;
+    if (fp == NULL || file_map(fp, 0, 0, flags, &m) != 0) return 0;
+    double t0 = now_seconds();
+    volatile uint64_t sink = checksum((const unsigned char *)m.data, m.size);
+    double t = now_seconds() - t0;
+    (void)sink;
+    size_t size = m.size;
+    file_unmap(&m);
+    file_close(fp);
+    return (double)size / (1 << 20) / t;
+}
+
+static void run(const char *label, const char *path, size_t bufsize) {
+    unsigned char *buf = (unsigned char *)file_buffer_alloc(bufsize);
+    if (buf == NULL) { printf("%-8s allocation failed\n", label); return; }
+    memset(buf, 1, bufsize);                    // Commit every page before timing.
+    printf("%-8s scan %6.2f ns/page   copy %8.1f MiB/s\n",
+           label, tlb_scan(buf, bufsize), copy_file(path, "bench_large_pages.out", buf, bufsize));
+    file_buffer_free(buf, bufsize);
+    file_buffer_pool_trim();                    // Make the next run allocate fresh pages.
+    file_delete("bench_large_pages.out");
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "bench_large_pages.dat";
+    size_t bufsize = (size_t)(argc > 2 ? atoi(argv[2]) : 64) << 20;
+
+    if (argc <= 1) {
+        // Generate a 1 GiB input file.
+        FILE *fp = file_open(path, "wb");
+        char *chunk = (char *)file_buffer_alloc(1 << 20);
+        if (fp == NULL || chunk == NULL) return 1;
+        for (int i = 0; i < (1 << 20); i++) chunk[i] = (char)i;
+        for (int i = 0; i < 1024; i++) file_write(fp, chunk, 1 << 20);
+        file_buffer_free(chunk, 1 << 20);
+        file_close(fp);
+    }
+
+    run("4K", path, bufsize);
+    if (file_buffer_pool_large_pages(bufsize) == 0) {
+        run("large", path, bufsize);
+        file_buffer_stats stats;
+        file_buffer_get_stats(&stats);
+        printf("large-page allocations: %llu, fallbacks: %llu\n",
+               (unsigned long long)stats.large_page_allocs, (unsigned long long)stats.large_page_fallbacks);
+        file_buffer_pool_large_pages(0);
+    } else {
+        printf("large    unavailable (error %lu)\n", file_last_error());
+    }
+
+    printf("mapped   %8.1f MiB/s   mapped+prefetch %8.1f MiB/s\n",
+           scan_mapping(path, 0), scan_mapping(path, FILE_MAPPING_PREFETCH));
+
+    if (argc <= 1) file_delete(path);
+    return 0;
+}
@@ -0,0 +1,374 @@
+/*
+ * Metadata-scale benchmark.
+ *
+ * Builds a synthetic tree of --entries files in one of three shapes:
+ *   - wide:     every file in a single directory,
+ *   - deep:     64 files per leaf at the bottom of a 16-level chain of directories,
+ *   - sharded:  files spread by hash over 256 x 256 directories, the way content stores lay out objects,
+ * and measures ops/s for each phase in turn:
+ *   ensure_directory  file_ensure_directory_ex on every file's parent (mostly already there),
+ *   create            CreateFileA(CREATE_NEW) + CloseHandle, to populate the tree,
+ *   exists            file_exists on every file,
+ *   exists_miss       file_exists on a missing sibling of every file (see --negcache),
+ *   has_attributes    file_has_attributes(parent, FILE_ATTRIBUTE_DIRECTORY) for every file,
+ *   enumerate         FindFirstFileExA walk of the whole tree, one op per entry returned,
+ *   delete            file_delete on every file.
+ * Every shape runs once single-threaded and once with --threads threads; threads take the entries
+ * in an interleaved order, so they share directories the way parallel jobs on one tree do.
+ *
+ * The probe phases run warm, right after the tree was built. With --cold they run a second time
+ * after purging the standby list, which drops the cached MFT and directory pages; this is the
+ * closest Windows gets to drop_caches. It needs an elevated process with
+ * SeProfileSingleProcessPrivilege, and the cold rows are skipped when the purge is refused.
+ * NTFS still keeps recently used file control blocks in memory, so cold numbers are a lower bound.
+ *
+ * Usage: bench_meta [--dir path] [--entries n] [--threads n] [--shape wide|deep|sharded]
+ *                   [--cold] [--negcache entries] [--out file.json]
+ */
+#include "../include/yfile.h"
+
+#define MAX_THREADS     64
+#define DEEP_LEVELS     16
+#define DEEP_PER_LEAF   64
+
+typedef enum { SHAPE_WIDE, SHAPE_DEEP, SHAPE_SHARDED, SHAPE_COUNT } meta_shape;
+
+static const char *shape_names[] = { "wide", "deep", "sharded" };
+
+typedef enum {
+    PHASE_ENSURE_DIRECTORY, PHASE_CREATE, PHASE_EXISTS, PHASE_EXISTS_MISS,
+    PHASE_HAS_ATTRIBUTES, PHASE_ENUMERATE, PHASE_DELETE
+} meta_phase;
+
+static const char *phase_names[] = {
+    "ensure_directory", "create", "exists", "exists_miss", "has_attributes", "enumerate", "delete"
+};
+
+typedef struct meta_run {
+    meta_shape shape;
+    meta_phase phase;
+    const char *root;
+    uint64_t entries;
+    int threads;
+    char (*subdirs)[MAX_PATH];      // enumerate: top-level directories, shared out between threads
+    size_t nsubdirs;
+    volatile LONG64 ops;
+    volatile LONG64 errors;
+} meta_run;
+
+typedef struct meta_worker {
+    meta_run *run;
+    int index;
+} meta_worker;
+
+static double now_seconds(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+}
+
+static uint32_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+// Writes the parent directory of entry i; returns its length.
+static int dir_path(const meta_run *r, uint64_t i, char *out) {
+    switch (r->shape) {
+    case SHAPE_WIDE:
+        return snprintf(out, MAX_PATH, "%s", r->root);
+    case SHAPE_DEEP: {
+        int n = snprintf(out, MAX_PATH, "%s\\c%llu", r->root, (unsigned long long)(i / DEEP_PER_LEAF));
+        for (int level = 1; level < DEEP_LEVELS; level++) n += snprintf(out + n, MAX_PATH - n, "\\d%d", level);
+        return n;
+    }
+    default: {
+        uint32_t h = mix(i);
+        return snprintf(out, MAX_PATH, "%s\\%02x\\%02x", r->root, h & 0xff, (h >> 8) & 0xff);
+    }
+    }
+}
+
+static void file_path_of(const meta_run *r, uint64_t i, char *out, const char *suffix) {
+    int n = dir_path(r, i, out);
+    snprintf(out + n, MAX_PATH - n, "\\f%llu%s", (unsigned long long)i, suffix);
+}
+
+// Lists dir, recursing into subdirectories; returns the number of entries seen.
+static uint64_t walk(const char *dir) {
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileExA(pattern, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    uint64_t n = 0;
+    do {
+        if (fd.cFileName[0] == '.' && (fd.cFileName[1] == '\0' || (fd.cFileName[1] == '.' && fd.cFileName[2] == '\0'))) continue;
+        n++;
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            char child[MAX_PATH];
+            snprintf(child, sizeof(child), "%s\\%s", dir, fd.cFileName);
+            n += walk(child);
+        }
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+    return n;
+}
+
+static DWORD WINAPI worker_main(LPVOID arg) {
+    meta_worker *w = (meta_worker *)arg;
+    meta_run *r = w->run;
+    char path[MAX_PATH];
+    LONG64 ops = 0, errors = 0;
+
+    if (r->phase == PHASE_ENUMERATE) {
+        for (size_t k = (size_t)w->index; k < r->nsubdirs; k += (size_t)r->threads) ops += (LONG64)walk(r->subdirs[k]);
+        InterlockedExchangeAdd64(&r->ops, ops);
+        return 0;
+    }
+
+    for (uint64_t i = (uint64_t)w->index; i < r->entries; i += (uint64_t)r->threads) {
+        int ok;
+        switch (r->phase) {
+        case PHASE_ENSURE_DIRECTORY:
+            dir_path(r, i, path);
+            ok = file_ensure_directory_ex(path, NULL) == 0;
+            break;
+        case PHASE_CREATE: {
+            file_path_of(r, i, path, "");
+            HANDLE h = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+            ok = h != INVALID_HANDLE_VALUE && CloseHandle(h);
+            break;
+        }
+        case PHASE_EXISTS:
+            file_path_of(r, i, path, "");
+            ok = file_exists(path) == 0;
+            break;
+        case PHASE_EXISTS_MISS:
+            file_path_of(r, i, path, ".missing");
+            ok = file_exists(path) == 1;
+            break;
+        case PHASE_HAS_ATTRIBUTES:
+            dir_path(r, i, path);
+            ok = file_has_attributes(path, FILE_ATTRIBUTE_DIRECTORY) == 0;
+            break;
+        default:
+            file_path_of(r, i, path, "");
+            ok = file_delete(path) == 0;
+            break;
+        }
+        ops++;
+        if (!ok) errors++;
+    }
+    InterlockedExchangeAdd64(&r->ops, ops);
+    InterlockedExchangeAdd64(&r->errors, errors);
+    return 0;
+}
+
+// Collects the root's subdirectories for a parallel walk; returns the number of entries directly in root.
+static uint64_t list_root(meta_run *r) {
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s\\*", r->root);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileExA(pattern, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    uint64_t n = 0;
+    size_t capacity = 0;
+    do {
+        if (fd.cFileName[0] == '.' && (fd.cFileName[1] == '\0' || (fd.cFileName[1] == '.' && fd.cFileName[2] == '\0'))) continue;
+        n++;
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) continue;
+        if (r->nsubdirs == capacity) {
+            size_t grown = capacity ? capacity * 2 : 256;
+            char (*p)[MAX_PATH] = (char (*)[MAX_PATH])realloc(r->subdirs, grown * MAX_PATH);
+            if (p == NULL) { r->errors++; break; }
+            r->subdirs = p;
+            capacity = grown;
+        }
+        snprintf(r->subdirs[r->nsubdirs++], MAX_PATH, "%s\\%s", r->root, fd.cFileName);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+    return n;
+}
+
+static int first_result = 1;
+
+static void report(FILE *json, const meta_run *r, const char *cache, double seconds) {
+    double ops_s = seconds > 0 ? (double)r->ops / seconds : 0;
+    fprintf(stderr, "%-8s %-17s %-5s %2d thr %10llu ops %12.0f ops/s%s\n",
+            shape_names[r->shape], phase_names[r->phase], cache, r->threads,
+            (unsigned long long)r->ops, ops_s, r->errors ? "  (errors)" : "");
+    fprintf(json, "%s\n  {\"shape\": \"%s\", \"phase\": \"%s\", \"cache\": \"%s\", \"threads\": %d, \"entries\": %llu, "
+                  "\"ops\": %llu, \"errors\": %llu, \"seconds\": %.6f, \"ops_s\": %.1f}",
+            first_result ? "" : ",", shape_names[r->shape], phase_names[r->phase], cache, r->threads,
+            (unsigned long long)r->entries, (unsigned long long)r->ops, (unsigned long long)r->errors, seconds, ops_s);
+    first_result = 0;
+}
+
+static void run_phase(FILE *json, meta_run *r, meta_phase phase, const char *cache) {
+    meta_worker workers[MAX_THREADS];
+    HANDLE threads[MAX_THREADS];
+    r->phase = phase;
+    r->ops = 0;
+    r->errors = 0;
+    r->subdirs = NULL;
+    r->nsubdirs = 0;
+
+    double t0 = now_seconds();
+    if (phase == PHASE_ENUMERATE) r->ops = (LONG64)list_root(r);
+    int started = 0;
+    for (int t = 0; t < r->threads; t++) {
+        workers[t].run = r;
+        workers[t].index = t;
+        if ((threads[t] = CreateThread(NULL, 0, worker_main, &workers[t], 0, NULL)) == NULL) break;
+        started++;
+    }
+    for (int t = 0; t < started; t++) {
+        WaitForSingleObject(threads[t], INFINITE);
+        CloseHandle(threads[t]);
+    }
+    double seconds = now_seconds() - t0;
+    free(r->subdirs);
+    r->subdirs = NULL;
+    if (started < r->threads) r->errors++;
+    report(json, r, cache, seconds);
+}
+
+// Removes a directory tree bottom-up (untimed cleanup).
+static void remove_tree(const char *dir) {
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileExA(pattern, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, 0);
+    if (h != INVALID_HANDLE_VALUE) {
+        do {
+            if (fd.cFileName[0] == '.' && (fd.cFileName[1] == '\0' || (fd.cFileName[1] == '.' && fd.cFileName[2] == '\0'))) continue;
+            char child[MAX_PATH];
+            snprintf(child, sizeof(child), "%s\\%s", dir, fd.cFileName);
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) remove_tree(child);
+            else file_delete(child);
+        } while (FindNextFileA(h, &fd));
+        FindClose(h);
+    }
+    RemoveDirectoryA(dir);
+}
+
+typedef LONG (WINAPI *nt_set_system_information_fn)(int, PVOID, ULONG);
+
+#define SYSTEM_MEMORY_LIST_INFORMATION 80
+#define MEMORY_FLUSH_MODIFIED_LIST     3
+#define MEMORY_PURGE_STANDBY_LIST      4
+
+// Writes back modified pages and empties the standby list. Returns 0 on success.
+static int purge_file_cache(void) {
+    static nt_set_system_information_fn set_info = NULL;
+    static int privileged = -1;
+    if (privileged < 0) {
+        privileged = 0;
+        HANDLE token;
+        if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+            TOKEN_PRIVILEGES tp;
+            tp.PrivilegeCount = 1;
+            tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+            privileged = LookupPrivilegeValueA(NULL, "SeProfileSingleProcessPrivilege", &tp.Privileges[0].Luid) &&
+                         AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) &&
+                         GetLastError() != ERROR_NOT_ALL_ASSIGNED;
+            CloseHandle(token);
+        }
+        HMODULE ntdll = GetModuleHandleA("ntdll.dll");
+        if (ntdll != NULL) set_info = (nt_set_system_information_fn)(void (*)(void))GetProcAddress(ntdll, "NtSetSystemInformation");
+    }
+    if (!privileged || set_info == NULL) return -1;
+    int command = MEMORY_FLUSH_MODIFIED_LIST;
+    if (set_info(SYSTEM_MEMORY_LIST_INFORMATION, &command, sizeof(command)) != 0) return -1;
+    command = MEMORY_PURGE_STANDBY_LIST;
+    return set_info(SYSTEM_MEMORY_LIST_INFORMATION, &command, sizeof(command)) == 0 ? 0 : -1;
+}
+
+static void run_shape(FILE *json, meta_run *r, int cold) {
+    static const meta_phase probes[] = { PHASE_EXISTS, PHASE_EXISTS_MISS, PHASE_HAS_ATTRIBUTES, PHASE_ENUMERATE };
+    remove_tree(r->root);
+    if (file_ensure_directory_ex(r->root, NULL) != 0) {
+        fprintf(stderr, "cannot create %s (error %lu)\n", r->root, file_last_error());
+        return;
+    }
+    run_phase(json, r, PHASE_ENSURE_DIRECTORY, "warm");
+    run_phase(json, r, PHASE_CREATE, "warm");
+    for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) run_phase(json, r, probes[p], "warm");
+    if (cold) {
+        for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+            if (purge_file_cache() != 0) {
+                fprintf(stderr, "cold runs skipped: purging the standby list needs an elevated process\n");
+                break;
+            }
+            run_phase(json, r, probes[p], "cold");
+        }
+    }
+    run_phase(json, r, PHASE_DELETE, "warm");
+    remove_tree(r->root);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = ".";
+    uint64_t entries = 100000;
+    int max_threads = 8;
+    int only_shape = -1;
+    int cold = 0;
+    size_t negcache = 0;
+    const char *out = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) dir = argv[++i];
+        else if (strcmp(argv[i], "--entries") == 0 && i + 1 < argc) entries = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) max_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--shape") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            for (int s = 0; s < SHAPE_COUNT; s++) if (strcmp(name, shape_names[s]) == 0) only_shape = s;
+            if (only_shape < 0) { fprintf(stderr, "unknown shape %s\n", name); return 2; }
+        }
+        else if (strcmp(argv[i], "--cold") == 0) cold = 1;
+        else if (strcmp(argv[i], "--negcache") == 0 && i + 1 < argc) negcache = (size_t)strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) out = argv[++i];
+        else {
+            fprintf(stderr, "usage: bench_meta [--dir path] [--entries n] [--threads n] [--shape wide|deep|sharded] "
+                            "[--cold] [--negcache entries] [--out file.json]\n");
+            return 2;
+        }
+    }
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+
+    FILE *json = out != NULL ? file_open(out, "w") : stdout;
+    if (json == NULL) {
+        fprintf(stderr, "cannot open %s (error %lu)\n", out, file_last_error());
+        return 1;
+    }
+    // Missing-path probes are answered from memory once a directory's misses are cached.
+    if (negcache > 0 && file_negcache_enable(negcache) != 0) fprintf(stderr, "negative cache unavailable\n");
+
+    fprintf(json, "[");
+    for (int s = 0; s < SHAPE_COUNT; s++) {
+        if (only_shape >= 0 && s != only_shape) continue;
+        char root[MAX_PATH];
+        snprintf(root, sizeof(root), "%s\\bench_meta.%s", dir, shape_names[s]);
+        meta_run r;
+        memset(&r, 0, sizeof(r));
+        r.shape = (meta_shape)s;
+        r.root = root;
+        r.entries = entries;
+        r.threads = 1;
+        run_shape(json, &r, cold);
+        if (max_threads > 1) {
+            r.threads = max_threads;
+            run_shape(json, &r, cold);
+        }
+    }
+    fprintf(json, "\n]\n");
+    if (json != stdout) file_close(json);
+    if (negcache > 0) file_negcache_disable();
+    return 0;
+}
@@ -0,0 +1,320 @@
+/*
+ * Read/write benchmark.
+ *
+ * Sweeps record sizes from 16 B to 16 MiB over every combination of
+ *   - mode:     buffered (file_read/file_write through the CRT stream and the file cache),
+ *               direct (FILE_FLAG_NO_BUFFERING, records of 4 KiB and up only), and
+ *               mmap (memcpy to and from a file_map view),
+ *   - pattern:  sequential or random record-aligned offsets,
+ *   - op:       read or write, and
+ *   - threads:  1, 2, 4, ... up to --threads, each thread on its own file,
+ * for every --dir given. Pass a RAM-disk directory and a directory on a real disk to compare the
+ * two; Windows has no tmpfs, so any RAM-disk driver (ImDisk, a ReFS RAM volume, ...) does the job.
+ *
+ * Each run lasts --seconds. Every operation is timed and counted in a log-linear histogram
+ * (file_hist_bucket), and the results are written as one JSON array with throughput, IOPS and
+ * p50/p99/p99.9 latency per run. Progress goes to stderr.
+ *
+ * Direct mode talks to the handle with ReadFile/WriteFile because file_pread and file_pwrite
+ * reopen the file through the cache.
+ *
+ * Usage: bench_rw [--dir path]... [--size MiB] [--seconds s] [--threads n] [--out file.json] [--quick]
+ */
+#include "../include/yfile.h"
+
+#define MAX_DIRS    8
+#define MAX_THREADS 64
+
+typedef enum { MODE_BUFFERED, MODE_DIRECT, MODE_MMAP } bench_mode;
+
+static const char *mode_names[] = { "buffered", "direct", "mmap" };
+
+typedef struct bench_worker {
+    HANDLE thread;
+    char path[MAX_PATH];
+    bench_mode mode;
+    int random;
+    int write;
+    size_t record;
+    uint64_t file_size;
+    HANDLE start;
+    volatile LONG *stop;
+    uint64_t ops;
+    uint64_t bytes;
+    int failed;
+    uint64_t hist[FILE_HIST_BUCKETS];
+} bench_worker;
+
+static LARGE_INTEGER qpc_freq;
+
+static uint64_t now_ns(void) {
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (uint64_t)((double)t.QuadPart * 1e9 / (double)qpc_freq.QuadPart);
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+// Next record offset; sequential runs wrap at the end of the file.
+static uint64_t next_offset(bench_worker *w, uint64_t *pos, uint64_t *rng) {
+    uint64_t records = w->file_size / w->record;
+    if (w->random) return (xorshift(rng) % records) * w->record;
+    uint64_t off = *pos;
+    *pos = off + w->record >= records * w->record ? 0 : off + w->record;
+    return off;
+}
+
+static void record_op(bench_worker *w, uint64_t t0, size_t n) {
+    w->hist[file_hist_bucket(now_ns() - t0)]++;
+    w->ops++;
+    w->bytes += n;
+}
+
+static void run_buffered(bench_worker *w, char *buf, uint64_t *rng) {
+    FILE *fp = file_open(w->path, w->write ? "r+b" : "rb");
+    if (fp == NULL) { w->failed = 1; return; }
+    uint64_t pos = 0;
+    WaitForSingleObject(w->start, INFINITE);
+    while (!*w->stop) {
+        uint64_t off = next_offset(w, &pos, rng);
+        uint64_t t0 = now_ns();
+        // Sequential runs only seek when they wrap, so the stream buffer does its job for small records.
+        if ((w->random || off == 0) && file_set_offset(fp, (int64_t)off) != 0) { w->failed = 1; break; }
+        size_t n = w->write ? file_write(fp, buf, w->record) : file_read(fp, buf, w->record);
+        if (n != w->record) { w->failed = 1; break; }
+        record_op(w, t0, n);
+    }
+    file_close(fp);
+}
+
+static void run_direct(bench_worker *w, char *buf, uint64_t *rng) {
+    HANDLE h = CreateFileA(w->path, w->write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                           FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+    if (h == INVALID_HANDLE_VALUE) { w->failed = 1; return; }
+    uint64_t pos = 0;
+    WaitForSingleObject(w->start, INFINITE);
+    while (!*w->stop) {
+        uint64_t off = next_offset(w, &pos, rng);
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)off;
+        ov.OffsetHigh = (DWORD)(off >> 32);
+        DWORD n = 0;
+        uint64_t t0 = now_ns();
+        BOOL ok = w->write ? WriteFile(h, buf, (DWORD)w->record, &n, &ov) : ReadFile(h, buf, (DWORD)w->record, &n, &ov);
+        if (!ok || n != w->record) { w->failed = 1; break; }
+        record_op(w, t0, n);
+    }
+    CloseHandle(h);
+}
+
+static void run_mmap(bench_worker *w, char *buf, uint64_t *rng) {
+    FILE *fp = file_open(w->path, w->write ? "r+b" : "rb");
+    file_mapping m;
+    if (fp == NULL || file_map(fp, 0, (size_t)w->file_size, w->write ? FILE_MAPPING_WRITE : 0, &m) != 0) {
+        if (fp != NULL) file_close(fp);
+        w->failed = 1;
+        return;
+    }
+    uint64_t pos = 0;
+    WaitForSingleObject(w->start, INFINITE);
+    while (!*w->stop) {
+        char *p = (char *)m.data + next_offset(w, &pos, rng);
+        uint64_t t0 = now_ns();
+        if (w->write) memcpy(p, buf, w->record);
+        else memcpy(buf, p, w->record);
+        record_op(w, t0, w->record);
+    }
+    file_unmap(&m);
+    file_close(fp);
+}
+
+static DWORD WINAPI worker_main(LPVOID arg) {
+    bench_worker *w = (bench_worker *)arg;
+    char *buf = (char *)file_buffer_alloc(w->record);
+    if (buf == NULL) {
+        w->failed = 1;
+        WaitForSingleObject(w->start, INFINITE);
+        return 0;
+    }
+    memset(buf, 0x5a, w->record);
+    uint64_t rng = 0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)w;
+    if (w->mode == MODE_BUFFERED) run_buffered(w, buf, &rng);
+    else if (w->mode == MODE_DIRECT) run_direct(w, buf, &rng);
+    else run_mmap(w, buf, &rng);
+    file_buffer_free(buf, w->record);
+    return 0;
+}
+
+static void data_path(char *out, const char *dir, int thread) {
+    snprintf(out, MAX_PATH, "%s\\bench_rw.%d.dat", dir, thread);
+}
+
+// Creates one fully written file per thread so reads never hit holes.
+static int create_files(const char *dir, int threads, uint64_t size) {
+    const size_t chunk = 1 << 20;
+    char *buf = (char *)file_buffer_alloc(chunk);
+    if (buf == NULL) return -1;
+    for (size_t i = 0; i < chunk; i++) buf[i] = (char)(i * 31);
+    int ret = 0;
+    for (int t = 0; t < threads && ret == 0; t++) {
+        char path[MAX_PATH];
+        data_path(path, dir, t);
+        FILE *fp = file_open(path, "wb");
+        if (fp == NULL) { ret = -1; break; }
+        for (uint64_t done = 0; done < size && ret == 0; done += chunk)
+            if (file_write(fp, buf, chunk) != chunk) ret = -1;
+        if (file_close(fp) != 0) ret = -1;
+    }
+    file_buffer_free(buf, chunk);
+    return ret;
+}
+
+static void delete_files(const char *dir, int threads) {
+    for (int t = 0; t < threads; t++) {
+        char path[MAX_PATH];
+        data_path(path, dir, t);
+        file_delete(path);
+    }
+}
+
+static int first_result = 1;
+
+static void run_case(FILE *json, const char *dir, bench_mode mode, int random, int write,
+                     size_t record, int threads, uint64_t file_size, double seconds) {
+    static bench_worker workers[MAX_THREADS];
+    static uint64_t hist[FILE_HIST_BUCKETS];
+    volatile LONG stop = 0;
+    HANDLE start = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (start == NULL) return;
+
+    int started = 0;
+    for (int t = 0; t < threads; t++) {
+        bench_worker *w = &workers[t];
+        memset(w, 0, sizeof(*w));
+        data_path(w->path, dir, t);
+        w->mode = mode;
+        w->random = random;
+        w->write = write;
+        w->record = record;
+        w->file_size = file_size;
+        w->start = start;
+        w->stop = &stop;
+        if ((w->thread = CreateThread(NULL, 0, worker_main, w, 0, NULL)) == NULL) break;
+        started++;
+    }
+
+    Sleep(50);                                  // Let the workers open and map their files.
+    uint64_t t0 = now_ns();
+    SetEvent(start);
+    Sleep((DWORD)(seconds * 1000));
+    InterlockedExchange(&stop, 1);
+    for (int t = 0; t < started; t++) WaitForSingleObject(workers[t].thread, INFINITE);
+    double elapsed = (double)(now_ns() - t0) / 1e9;
+    CloseHandle(start);
+
+    uint64_t ops = 0, bytes = 0;
+    int failed = started < threads;
+    memset(hist, 0, sizeof(hist));
+    for (int t = 0; t < started; t++) {
+        bench_worker *w = &workers[t];
+        CloseHandle(w->thread);
+        ops += w->ops;
+        bytes += w->bytes;
+        failed |= w->failed;
+        for (uint32_t b = 0; b < FILE_HIST_BUCKETS; b++) hist[b] += w->hist[b];
+    }
+
+    double mib_s = (double)bytes / (1 << 20) / elapsed;
+    double iops = (double)ops / elapsed;
+    uint64_t p50 = file_hist_percentile(hist, 50.0);
+    uint64_t p99 = file_hist_percentile(hist, 99.0);
+    uint64_t p999 = file_hist_percentile(hist, 99.9);
+
+    fprintf(stderr, "%-12s %-8s %-10s %-5s %9zu B %2d thr %10.1f MiB/s %12.0f IOPS  p50 %8llu  p99 %8llu  p99.9 %8llu ns%s\n",
+            dir, mode_names[mode], random ? "random" : "sequential", write ? "write" : "read", record, threads,
+            mib_s, iops, (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999,
+            failed ? "  (failed)" : "");
+
+    fprintf(json, "%s\n  {\"dir\": \"", first_result ? "" : ",");
+    for (const char *c = dir; *c; c++) {
+        if (*c == '\\' || *c == '"') fputc('\\', json);
+        fputc(*c, json);
+    }
+    fprintf(json, "\", \"mode\": \"%s\", \"pattern\": \"%s\", \"op\": \"%s\", \"record\": %zu, \"threads\": %d, "
+                  "\"seconds\": %.3f, \"ops\": %llu, \"bytes\": %llu, \"mib_s\": %.2f, \"iops\": %.1f, "
+                  "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"failed\": %s}",
+            mode_names[mode], random ? "random" : "sequential", write ? "write" : "read", record, threads,
+            elapsed, (unsigned long long)ops, (unsigned long long)bytes, mib_s, iops,
+            (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999,
+            failed ? "true" : "false");
+    first_result = 0;
+}
+
+int main(int argc, char **argv) {
+    const char *dirs[MAX_DIRS];
+    int ndirs = 0;
+    uint64_t size_mib = 256;
+    double seconds = 1.0;
+    int max_threads = 4;
+    const char *out = NULL;
+    int quick = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc && ndirs < MAX_DIRS) dirs[ndirs++] = argv[++i];
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) size_mib = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) max_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) out = argv[++i];
+        else if (strcmp(argv[i], "--quick") == 0) quick = 1;
+        else {
+            fprintf(stderr, "usage: bench_rw [--dir path]... [--size MiB] [--seconds s] [--threads n] [--out file.json] [--quick]\n");
+            return 2;
+        }
+    }
+    if (ndirs == 0) dirs[ndirs++] = ".";
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+    if (size_mib < 16) size_mib = 16;           // Room for at least one 16 MiB record.
+    if (quick) seconds = 0.2;
+
+    FILE *json = out != NULL ? file_open(out, "w") : stdout;
+    if (json == NULL) {
+        fprintf(stderr, "cannot open %s (error %lu)\n", out, file_last_error());
+        return 1;
+    }
+    QueryPerformanceFrequency(&qpc_freq);
+    uint64_t file_size = size_mib << 20;
+
+    fprintf(json, "[");
+    for (int d = 0; d < ndirs; d++) {
+        if (create_files(dirs[d], max_threads, file_size) != 0) {
+            fprintf(stderr, "cannot create data files in %s (error %lu)\n", dirs[d], file_last_error());
+            delete_files(dirs[d], max_threads);
+            continue;
+        }
+        // Thread counts double up to --threads, which always gets a run of its own.
+        for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+            for (int mode = MODE_BUFFERED; mode <= MODE_MMAP; mode++)
+                for (int random = 0; random <= 1; random++)
+                    for (int write = 0; write <= 1; write++)
+                        // --quick keeps every fourth size step: 16 B, 4 KiB, 1 MiB.
+                        for (size_t record = 16; record <= ((size_t)16 << 20); record <<= quick ? 8 : 2) {
+                            if (mode == MODE_DIRECT && record < 4096) continue;
+                            run_case(json, dirs[d], (bench_mode)mode, random, write, record, threads, file_size, seconds);
+                        }
+            if (threads == max_threads) break;
+        }
+        delete_files(dirs[d], max_threads);
+    }
+    fprintf(json, "\n]\n");
+    if (json != stdout) file_close(json);
+    return 0;
+}
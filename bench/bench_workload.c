@@ -0,0 +1,587 @@
+/*
+ * Synthetic workload generator driven by a declarative profile.
+ *
+ * A profile is a text file of "key = value" lines ('#' starts a comment). Extra "key=value"
+ * arguments on the command line override it, and any op= argument replaces the profile's ops,
+ * so one profile can be swept from a script. Example:
+ *
+ *   # 70% 4K random reads, 30% 64K appends, 8 threads, 20 files of 1GB
+ *   threads   = 8
+ *   files     = 20
+ *   file_size = 1G
+ *   seconds   = 30
+ *   op = read   70% 4K random
+ *   op = append 30% 64K
+ *
+ * Keys:
+ *   threads, files, file_size, seconds, seed
+ *   loop = closed | open   closed: each thread issues its next op when the last one returns.
+ *                          open: ops arrive at `rate` per second in total (Poisson arrivals), and
+ *                          latency is measured from the arrival, so time spent queued behind a
+ *                          slow op counts (no coordinated omission).
+ *   rate                   ops per second for loop = open.
+ *   stream_buffer          setvbuf size of every stream (0 keeps the CRT default).
+ *   cache, cache_block     file_cache_enable budget and block size for random reads (0 = off).
+ *   prefetch = NxSIZE      file_prefetch_enable slots and slot size on read streams (0 = off).
+ *   durability = none | data | full | write_through    for write and append streams (file_open_ex).
+ *   writeback              file_set_writeback chunk on write and append streams (0 = off).
+ *   op = NAME WEIGHT[%] [SIZE] [random | sequential]
+ *
+ * Ops, and the calls they make:
+ *   read     random: file_pread at a size-aligned offset of a random file.
+ *            sequential: file_read through the thread's own file, wrapping at file_size.
+ *   write    random: file_pwrite; sequential: file_write, as for read.
+ *   append   file_write to a random file opened "ab".
+ *   flush    file_flush of the stream this thread last wrote (applies `durability`).
+ *   stat     file_has_attributes of a random file.
+ *   open     file_open and file_close of a random file.
+ *   create   create a new file of SIZE bytes; delete removes the oldest one this thread created.
+ *
+ * Data files (workload.N.dat in --dir) are filled on the first run and reused afterwards, so
+ * tuning runs on large data sets do not pay for the setup every time; appends grow them. Output
+ * is JSON with count, throughput and a latency distribution per op, with a table on stderr.
+ *
+ * Usage: bench_workload [profile.txt] [key=value]... [--dir path] [--out file.json]
+ */
+#include "../include/yfile.h"
+#include <math.h>
+
+#define MAX_THREADS 64
+#define MAX_OPS     16
+#define MAX_FILES   256
+
+typedef enum { OP_READ, OP_WRITE, OP_APPEND, OP_FLUSH, OP_STAT, OP_OPEN, OP_CREATE, OP_DELETE, OP_KINDS } op_kind;
+
+static const char *op_names[] = { "read", "write", "append", "flush", "stat", "open", "create", "delete" };
+
+typedef struct op_spec {
+    op_kind kind;
+    double weight;
+    size_t size;
+    int random;
+} op_spec;
+
+typedef struct profile {
+    int threads;
+    int files;
+    uint64_t file_size;
+    double seconds;
+    uint64_t seed;
+    int open_loop;
+    double rate;
+    size_t stream_buffer;
+    uint64_t cache;
+    uint32_t cache_block;
+    uint32_t prefetch_slots, prefetch_size;
+    file_durability durability;
+    uint64_t writeback;
+    op_spec ops[MAX_OPS];
+    int nops;
+} profile;
+
+typedef struct op_stats {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t hist[FILE_HIST_BUCKETS];
+} op_stats;
+
+typedef struct worker {
+    HANDLE thread;
+    int index;
+    const profile *p;
+    const char *dir;
+    HANDLE start;
+    volatile LONG *stop;
+    uint64_t rng;
+    FILE *rd[MAX_FILES], *wr[MAX_FILES], *app[MAX_FILES];    // Per data file, opened on first use.
+    FILE *last_written;
+    uint64_t read_pos, write_pos;      // Sequential positions in the thread's own file.
+    uint64_t created, deleted;         // Scratch files workload.T.N.tmp, N in [deleted, created).
+    op_stats stats[MAX_OPS];
+} worker;
+
+static LARGE_INTEGER qpc_freq;
+
+static uint64_t now_ns(void) {
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (uint64_t)((double)t.QuadPart * 1e9 / (double)qpc_freq.QuadPart);
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+// Uniform in (0, 1].
+static double uniform(uint64_t *s) {
+    return (double)((xorshift(s) >> 11) + 1) / 9007199254740992.0;
+}
+
+// 4K, 64k, 1M, 1G, or plain bytes. Returns -1 on garbage.
+static int parse_size(const char *s, uint64_t *out) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) return -1;
+    switch (*end) {
+    case 'k': case 'K': v *= 1024.0; end++; break;
+    case 'm': case 'M': v *= 1024.0 * 1024.0; end++; break;
+    case 'g': case 'G': v *= 1024.0 * 1024.0 * 1024.0; end++; break;
+    case 't': case 'T': v *= 1024.0 * 1024.0 * 1024.0 * 1024.0; end++; break;
+    default: break;
+    }
+    if (*end == 'i') end++;
+    if (*end == 'b' || *end == 'B') end++;
+    if (*end != '\0') return -1;
+    *out = (uint64_t)v;
+    return 0;
+}
+
+// 30, 30s, 500ms, 2m.
+static int parse_seconds(const char *s, double *out) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) return -1;
+    if (strcmp(end, "ms") == 0) v /= 1000.0;
+    else if (strcmp(end, "m") == 0) v *= 60.0;
+    else if (strcmp(end, "h") == 0) v *= 3600.0;
+    else if (*end != '\0' && strcmp(end, "s") != 0) return -1;
+    *out = v;
+    return 0;
+}
+
+static char *trim(char *s) {
+    while (*s == ' ' || *s == '\t') s++;
+    char *e = s + strlen(s);
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r' || e[-1] == '\n')) *--e = '\0';
+    return s;
+}
+
+// "read 70% 4K random"
+static int parse_op(profile *p, char *value) {
+    if (p->nops == MAX_OPS) return -1;
+    op_spec *o = &p->ops[p->nops];
+    memset(o, 0, sizeof(*o));
+    o->weight = -1;
+    int kind = -1;
+    for (char *tok = strtok(value, " \t"); tok != NULL; tok = strtok(NULL, " \t")) {
+        uint64_t size;
+        if (kind < 0) {
+            for (int k = 0; k < OP_KINDS; k++)
+                if (strcmp(tok, op_names[k]) == 0) kind = k;
+            if (kind < 0) return -1;
+        } else if (strcmp(tok, "random") == 0) {
+            o->random = 1;
+        } else if (strcmp(tok, "sequential") == 0) {
+            o->random = 0;
+        } else if (o->weight < 0) {
+            char *end;
+            o->weight = strtod(tok, &end);
+            if (end == tok || (*end != '\0' && strcmp(end, "%") != 0) || o->weight < 0) return -1;
+        } else if (parse_size(tok, &size) == 0 && size > 0 && size <= ((uint64_t)1 << 30)) {
+            o->size = (size_t)size;
+        } else {
+            return -1;
+        }
+    }
+    if (kind < 0 || o->weight < 0) return -1;
+    o->kind = (op_kind)kind;
+    if (o->size == 0 && (kind == OP_READ || kind == OP_WRITE || kind == OP_APPEND)) o->size = 4096;
+    p->nops++;
+    return 0;
+}
+
+static int parse_setting(profile *p, const char *key, char *value) {
+    uint64_t n;
+    if (strcmp(key, "op") == 0) return parse_op(p, value);
+    if (strcmp(key, "threads") == 0) return (p->threads = atoi(value)) >= 1 && p->threads <= MAX_THREADS ? 0 : -1;
+    if (strcmp(key, "files") == 0) return (p->files = atoi(value)) >= 1 && p->files <= MAX_FILES ? 0 : -1;
+    if (strcmp(key, "file_size") == 0) return parse_size(value, &p->file_size);
+    if (strcmp(key, "seconds") == 0) return parse_seconds(value, &p->seconds);
+    if (strcmp(key, "seed") == 0) { p->seed = strtoull(value, NULL, 0); return 0; }
+    if (strcmp(key, "rate") == 0) return (p->rate = atof(value)) >= 0 ? 0 : -1;
+    if (strcmp(key, "loop") == 0) {
+        if (strcmp(value, "open") != 0 && strcmp(value, "closed") != 0) return -1;
+        p->open_loop = strcmp(value, "open") == 0;
+        return 0;
+    }
+    if (strcmp(key, "stream_buffer") == 0) {
+        if (parse_size(value, &n) != 0) return -1;
+        p->stream_buffer = (size_t)n;
+        return 0;
+    }
+    if (strcmp(key, "cache") == 0) return parse_size(value, &p->cache);
+    if (strcmp(key, "cache_block") == 0) {
+        if (parse_size(value, &n) != 0 || n > UINT32_MAX) return -1;
+        p->cache_block = (uint32_t)n;
+        return 0;
+    }
+    if (strcmp(key, "prefetch") == 0) {
+        char *x = strchr(value, 'x');
+        if (x == NULL) { p->prefetch_slots = 0; return strcmp(value, "0") == 0 ? 0 : -1; }
+        *x = '\0';
+        if (parse_size(x + 1, &n) != 0 || n == 0 || n > UINT32_MAX) return -1;
+        p->prefetch_slots = (uint32_t)atoi(value);
+        p->prefetch_size = (uint32_t)n;
+        return p->prefetch_slots >= 1 && p->prefetch_slots <= 64 ? 0 : -1;
+    }
+    if (strcmp(key, "durability") == 0) {
+        static const char *levels[] = { "none", "data", "full", "write_through" };
+        for (int i = 0; i < 4; i++)
+            if (strcmp(value, levels[i]) == 0) { p->durability = (file_durability)i; return 0; }
+        return -1;
+    }
+    if (strcmp(key, "writeback") == 0) return parse_size(value, &p->writeback);
+    return -1;
+}
+
+// Applies one "key = value" line. Lines from the command line replace the file's ops on the first op=.
+static int apply_line(profile *p, char *line, int *ops_replaced) {
+    char *hash = strchr(line, '#');
+    if (hash != NULL) *hash = '\0';
+    line = trim(line);
+    if (*line == '\0') return 0;
+    char *eq = strchr(line, '=');
+    if (eq == NULL) return -1;
+    *eq = '\0';
+    char *key = trim(line), *value = trim(eq + 1);
+    if (ops_replaced != NULL && strcmp(key, "op") == 0 && !*ops_replaced) {
+        p->nops = 0;
+        *ops_replaced = 1;
+    }
+    return parse_setting(p, key, value);
+}
+
+static int load_profile(profile *p, const char *path) {
+    FILE *fp = file_open(path, "r");
+    if (fp == NULL) return -1;
+    char line[512];
+    int ret = 0, lineno = 0;
+    while (ret == 0 && fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        char copy[512];
+        memcpy(copy, line, sizeof(copy));
+        if ((ret = apply_line(p, line, NULL)) != 0) fprintf(stderr, "%s:%d: cannot parse: %s", path, lineno, copy);
+    }
+    file_close(fp);
+    return ret;
+}
+
+static void data_path(char *out, const char *dir, int file) {
+    snprintf(out, MAX_PATH, "%s\\workload.%d.dat", dir, file);
+}
+
+static void scratch_path(char *out, const char *dir, int thread, uint64_t n) {
+    snprintf(out, MAX_PATH, "%s\\workload.%d.%llu.tmp", dir, thread, (unsigned long long)n);
+}
+
+// Opens stream `which` (0 read, 1 write, 2 append) of a data file with the profile's tuning applied.
+static FILE *stream(worker *w, int file, int which) {
+    FILE **slot = which == 0 ? &w->rd[file] : which == 1 ? &w->wr[file] : &w->app[file];
+    if (*slot != NULL) return *slot;
+    const profile *p = w->p;
+    char path[MAX_PATH];
+    data_path(path, w->dir, file);
+    FILE *fp = which == 0 ? file_open(path, "rb") : file_open_ex(path, which == 1 ? "r+b" : "ab", p->durability);
+    if (fp == NULL) return NULL;
+    if (p->stream_buffer > 0) setvbuf(fp, NULL, _IOFBF, p->stream_buffer);
+    if (which == 0 && p->prefetch_slots > 0) file_prefetch_enable(fp, p->prefetch_slots, p->prefetch_size);
+    if (which != 0 && p->writeback > 0) file_set_writeback(fp, p->writeback);
+    return *slot = fp;
+}
+
+// Runs one op. Returns bytes moved, 0 if there was nothing to do, -1 on failure.
+static int64_t run_op(worker *w, const op_spec *o, char *buf) {
+    const profile *p = w->p;
+    int file = (int)(xorshift(&w->rng) % (uint64_t)p->files);
+    int home = w->index % p->files;
+    uint64_t records = p->file_size / (o->size ? o->size : 1);
+    int64_t offset = (int64_t)((xorshift(&w->rng) % (records ? records : 1)) * o->size);
+    char path[MAX_PATH];
+    FILE *fp;
+
+    switch (o->kind) {
+    case OP_READ:
+        if (o->random) return (fp = stream(w, file, 0)) != NULL ? file_pread(fp, buf, o->size, offset) : -1;
+        if ((fp = stream(w, home, 0)) == NULL) return -1;
+        if (w->read_pos + o->size > p->file_size) {
+            if (file_set_offset(fp, 0) != 0) return -1;
+            w->read_pos = 0;
+        }
+        if (file_read(fp, buf, o->size) != o->size) return -1;
+        w->read_pos += o->size;
+        return (int64_t)o->size;
+    case OP_WRITE:
+        if (o->random) {
+            if ((fp = stream(w, file, 1)) == NULL) return -1;
+            w->last_written = fp;
+            return file_pwrite(fp, buf, o->size, offset) == 0 ? (int64_t)o->size : -1;
+        }
+        if ((fp = stream(w, home, 1)) == NULL) return -1;
+        if (w->write_pos + o->size > p->file_size) {
+            if (file_set_offset(fp, 0) != 0) return -1;
+            w->write_pos = 0;
+        }
+        w->last_written = fp;
+        if (file_write(fp, buf, o->size) != o->size) return -1;
+        w->write_pos += o->size;
+        return (int64_t)o->size;
+    case OP_APPEND:
+        if ((fp = stream(w, file, 2)) == NULL) return -1;
+        w->last_written = fp;
+        return file_write(fp, buf, o->size) == o->size ? (int64_t)o->size : -1;
+    case OP_FLUSH:
+        return w->last_written == NULL ? 0 : file_flush(w->last_written) == 0 ? 0 : -1;
+    case OP_STAT:
+        data_path(path, w->dir, file);
+        return file_has_attributes(path, 0) >= 0 ? 0 : -1;
+    case OP_OPEN:
+        data_path(path, w->dir, file);
+        if ((fp = file_open(path, "rb")) == NULL) return -1;
+        return file_close(fp) == 0 ? 0 : -1;
+    case OP_CREATE: {
+        scratch_path(path, w->dir, w->index, w->created++);
+        if ((fp = file_open(path, "wb")) == NULL) return -1;
+        int ok = o->size == 0 || file_write(fp, buf, o->size) == o->size;
+        if (file_close(fp) != 0) ok = 0;
+        return ok ? (int64_t)o->size : -1;
+    }
+    default:
+        if (w->deleted == w->created) return 0;
+        scratch_path(path, w->dir, w->index, w->deleted++);
+        return file_delete(path) == 0 ? 0 : -1;
+    }
+}
+
+static int pick_op(worker *w, double total) {
+    double r = uniform(&w->rng) * total;
+    for (int i = 0; i < w->p->nops; i++)
+        if ((r -= w->p->ops[i].weight) <= 0) return i;
+    return w->p->nops - 1;
+}
+
+static DWORD WINAPI worker_main(LPVOID arg) {
+    worker *w = (worker *)arg;
+    const profile *p = w->p;
+    size_t buf_size = 4096;
+    double total = 0;
+    for (int i = 0; i < p->nops; i++) {
+        if (p->ops[i].size > buf_size) buf_size = p->ops[i].size;
+        total += p->ops[i].weight;
+    }
+    char *buf = (char *)file_buffer_alloc(buf_size);
+    if (buf != NULL) memset(buf, 0x5a, buf_size);
+    // Open loop: each thread takes an equal share of the rate, so the sum is a Poisson process at `rate`.
+    double mean_gap_ns = p->open_loop ? 1e9 * p->threads / p->rate : 0;
+
+    WaitForSingleObject(w->start, INFINITE);
+    uint64_t due = now_ns();
+    while (buf != NULL && !*w->stop) {
+        if (p->open_loop) {
+            due += (uint64_t)(-log(uniform(&w->rng)) * mean_gap_ns);
+            for (uint64_t t = now_ns(); t < due && !*w->stop; t = now_ns()) {
+                if (due - t > 2000000) Sleep((DWORD)((due - t) / 1000000 - 1));
+                else SwitchToThread();
+            }
+            if (*w->stop) break;
+        }
+        int i = pick_op(w, total);
+        uint64_t t0 = now_ns();
+        int64_t n = run_op(w, &p->ops[i], buf);
+        uint64_t t1 = now_ns();
+        uint64_t ns = t1 - (p->open_loop && due < t0 ? due : t0);
+        op_stats *s = &w->stats[i];
+        s->count++;
+        if (n < 0) s->errors++;
+        else s->bytes += (uint64_t)n;
+        s->sum_ns += ns;
+        if (ns > s->max_ns) s->max_ns = ns;
+        s->hist[file_hist_bucket(ns)]++;
+    }
+
+    for (int f = 0; f < p->files; f++) {
+        if (w->rd[f] != NULL) file_close(w->rd[f]);
+        if (w->wr[f] != NULL) file_close(w->wr[f]);
+        if (w->app[f] != NULL) file_close(w->app[f]);
+    }
+    for (; w->deleted < w->created; w->deleted++) {
+        char path[MAX_PATH];
+        scratch_path(path, w->dir, w->index, w->deleted);
+        file_delete(path);
+    }
+    if (buf != NULL) file_buffer_free(buf, buf_size);
+    return 0;
+}
+
+// Fills data files that are missing or shorter than file_size, so reads never hit holes.
+static int prepare_files(const char *dir, const profile *p) {
+    const size_t chunk = 1 << 20;
+    char *buf = (char *)file_buffer_alloc(chunk);
+    if (buf == NULL) return -1;
+    for (size_t i = 0; i < chunk; i++) buf[i] = (char)(i * 31);
+    int ret = 0;
+    for (int f = 0; f < p->files && ret == 0; f++) {
+        char path[MAX_PATH];
+        data_path(path, dir, f);
+        FILE *fp = file_open(path, "ab");
+        if (fp == NULL) { ret = -1; break; }
+        int64_t size = file_get_size(fp);
+        if (size < 0) ret = -1;
+        for (uint64_t done = (uint64_t)(size > 0 ? size : 0); ret == 0 && done < p->file_size; done += chunk) {
+            size_t n = p->file_size - done < chunk ? (size_t)(p->file_size - done) : chunk;
+            if (file_write(fp, buf, n) != n) ret = -1;
+        }
+        if (file_close(fp) != 0) ret = -1;
+    }
+    file_buffer_free(buf, chunk);
+    return ret;
+}
+
+static void print_profile(FILE *json, const profile *p) {
+    static const char *levels[] = { "none", "data", "full", "write_through" };
+    fprintf(json, "  \"profile\": {\"threads\": %d, \"files\": %d, \"file_size\": %llu, \"seconds\": %.3f, \"seed\": %llu, "
+                  "\"loop\": \"%s\", \"rate\": %.1f, \"stream_buffer\": %zu, \"cache\": %llu, \"cache_block\": %u, "
+                  "\"prefetch_slots\": %u, \"prefetch_size\": %u, \"durability\": \"%s\", \"writeback\": %llu},\n",
+            p->threads, p->files, (unsigned long long)p->file_size, p->seconds, (unsigned long long)p->seed,
+            p->open_loop ? "open" : "closed", p->rate, p->stream_buffer, (unsigned long long)p->cache, p->cache_block,
+            p->prefetch_slots, p->prefetch_size, levels[p->durability], (unsigned long long)p->writeback);
+}
+
+int main(int argc, char **argv) {
+    profile p;
+    memset(&p, 0, sizeof(p));
+    p.threads = 1;
+    p.files = 1;
+    p.file_size = (uint64_t)64 << 20;
+    p.seconds = 10;
+    p.seed = 1;
+    p.cache_block = 64 << 10;
+    const char *dir = ".";
+    const char *out = NULL;
+    int ops_replaced = 0;
+
+    for (int i = 1; i < argc; i++) {
+        int bad;
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) { dir = argv[++i]; continue; }
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) { out = argv[++i]; continue; }
+        if (argv[i][0] == '-') bad = 1;
+        else if (strchr(argv[i], '=') != NULL) {
+            char line[512];
+            snprintf(line, sizeof(line), "%s", argv[i]);
+            bad = apply_line(&p, line, &ops_replaced) != 0;
+        } else {
+            bad = load_profile(&p, argv[i]) != 0;
+        }
+        if (bad) {
+            fprintf(stderr, "bad argument or profile: %s\n"
+                            "usage: bench_workload [profile.txt] [key=value]... [--dir path] [--out file.json]\n", argv[i]);
+            return 2;
+        }
+    }
+    if (p.nops == 0) {
+        fprintf(stderr, "the profile has no op= lines\n");
+        return 2;
+    }
+    if (p.open_loop && p.rate <= 0) {
+        fprintf(stderr, "loop = open needs a rate\n");
+        return 2;
+    }
+    for (int i = 0; i < p.nops; i++) {
+        if ((p.ops[i].kind == OP_READ || p.ops[i].kind == OP_WRITE) && p.ops[i].size > p.file_size) {
+            fprintf(stderr, "op %d: %zu-byte records do not fit in file_size\n", i + 1, p.ops[i].size);
+            return 2;
+        }
+    }
+
+    FILE *json = out != NULL ? file_open(out, "w") : stdout;
+    if (json == NULL) {
+        fprintf(stderr, "cannot open %s (error %lu)\n", out, file_last_error());
+        return 1;
+    }
+    QueryPerformanceFrequency(&qpc_freq);
+    if (file_ensure_directory_ex(dir, NULL) != 0 || prepare_files(dir, &p) != 0) {
+        fprintf(stderr, "cannot create data files in %s (error %lu)\n", dir, file_last_error());
+        return 1;
+    }
+    if (p.cache > 0 && file_cache_enable(p.cache, p.cache_block) != 0) {
+        fprintf(stderr, "cannot enable the block cache (budget %llu, block %u)\n", (unsigned long long)p.cache, p.cache_block);
+        return 1;
+    }
+
+    worker *workers = (worker *)calloc((size_t)p.threads, sizeof(worker));
+    HANDLE start = CreateEventA(NULL, TRUE, FALSE, NULL);
+    volatile LONG stop = 0;
+    if (workers == NULL || start == NULL) {
+        fprintf(stderr, "setup failed (error %lu)\n", file_last_error());
+        return 1;
+    }
+    int started = 0;
+    for (int t = 0; t < p.threads; t++) {
+        worker *w = &workers[t];
+        w->index = t;
+        w->p = &p;
+        w->dir = dir;
+        w->start = start;
+        w->stop = &stop;
+        w->rng = (p.seed + 1) * 0x9e3779b97f4a7c15ull ^ (uint64_t)(t + 1) * 0xbf58476d1ce4e5b9ull;
+        if (w->rng == 0) w->rng = 1;
+        if ((w->thread = CreateThread(NULL, 0, worker_main, w, 0, NULL)) == NULL) break;
+        started++;
+    }
+
+    uint64_t t0 = now_ns();
+    SetEvent(start);
+    Sleep((DWORD)(p.seconds * 1000));
+    InterlockedExchange(&stop, 1);
+    for (int t = 0; t < started; t++) WaitForSingleObject(workers[t].thread, INFINITE);
+    double elapsed = (double)(now_ns() - t0) / 1e9;
+    CloseHandle(start);
+    if (p.cache > 0) file_cache_disable();
+
+    fprintf(json, "{\n");
+    print_profile(json, &p);
+    fprintf(json, "  \"threads_started\": %d,\n  \"elapsed_s\": %.3f,\n  \"ops\": [", started, elapsed);
+    static op_stats sum;
+    for (int i = 0; i < p.nops; i++) {
+        const op_spec *o = &p.ops[i];
+        memset(&sum, 0, sizeof(sum));
+        for (int t = 0; t < started; t++) {
+            const op_stats *s = &workers[t].stats[i];
+            sum.count += s->count;
+            sum.errors += s->errors;
+            sum.bytes += s->bytes;
+            sum.sum_ns += s->sum_ns;
+            if (s->max_ns > sum.max_ns) sum.max_ns = s->max_ns;
+            for (uint32_t b = 0; b < FILE_HIST_BUCKETS; b++) sum.hist[b] += s->hist[b];
+        }
+        double ops_s = (double)sum.count / elapsed;
+        double mib_s = (double)sum.bytes / (1 << 20) / elapsed;
+        uint64_t mean = sum.count ? sum.sum_ns / sum.count : 0;
+        uint64_t p50 = file_hist_percentile(sum.hist, 50.0), p90 = file_hist_percentile(sum.hist, 90.0);
+        uint64_t p99 = file_hist_percentile(sum.hist, 99.0), p999 = file_hist_percentile(sum.hist, 99.9);
+        const char *pattern = o->kind == OP_READ || o->kind == OP_WRITE ? (o->random ? "random" : "sequential") : "";
+
+        fprintf(json, "%s\n    {\"op\": \"%s\", \"pattern\": \"%s\", \"weight\": %g, \"size\": %zu, \"count\": %llu, "
+                      "\"errors\": %llu, \"bytes\": %llu, \"ops_s\": %.1f, \"mib_s\": %.2f, \"mean_ns\": %llu, "
+                      "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+                i ? "," : "", op_names[o->kind], pattern, o->weight, o->size, (unsigned long long)sum.count,
+                (unsigned long long)sum.errors, (unsigned long long)sum.bytes, ops_s, mib_s, (unsigned long long)mean,
+                (unsigned long long)p50, (unsigned long long)p90, (unsigned long long)p99, (unsigned long long)p999,
+                (unsigned long long)sum.max_ns);
+        fprintf(stderr, "%-7s %-10s %9zu B %10.0f ops/s %9.1f MiB/s  mean %9llu  p50 %9llu  p99 %9llu  p99.9 %9llu  max %10llu ns%s\n",
+                op_names[o->kind], pattern, o->size, ops_s, mib_s, (unsigned long long)mean, (unsigned long long)p50,
+                (unsigned long long)p99, (unsigned long long)p999, (unsigned long long)sum.max_ns,
+                sum.errors ? "  (errors)" : "");
+    }
+    fprintf(json, "\n  ]\n}\n");
+    if (json != stdout) file_close(json);
+    for (int t = 0; t < started; t++) CloseHandle(workers[t].thread);
+    free(workers);
+    return started == p.threads ? 0 : 1;
+}
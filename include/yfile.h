@@ -9,6 +9,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <io.h>
+#include <intrin.h>
+#include <math.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,6 +20,330 @@ extern "C" {
 #define FILE_ERROR   -1
 #define FILE_FALSE    1
 
+    /**
+     * @brief Durability levels accepted by the write, flush and close paths.
+     *
+     * FILE_DURABILITY_NONE only drains the CRT buffer into the OS cache (plain fflush).
+     * FILE_DURABILITY_DATA makes the file data durable without forcing unrelated metadata
+     * (NtFlushBuffersFileEx data-sync when available, FlushFileBuffers otherwise).
+     * FILE_DURABILITY_FULL makes data and metadata durable (FlushFileBuffers).
+     * FILE_DURABILITY_WRITE_THROUGH is the O_DSYNC analogue: the handle is opened with
+     * FILE_FLAG_WRITE_THROUGH so every write reaches stable storage before it returns.
+     */
+    typedef enum file_durability {
+        FILE_DURABILITY_NONE = 0,
+        FILE_DURABILITY_DATA,
+        FILE_DURABILITY_FULL,
+        FILE_DURABILITY_WRITE_THROUGH
+    } file_durability;
+
+    /**
+     * @brief Operations reported by the instrumentation hooks (see YFILE_ENABLE_HISTOGRAMS).
+     */
+    typedef enum file_op {
+        FILE_OP_OPEN = 0,
+        FILE_OP_CLOSE,
+        FILE_OP_READ,
+        FILE_OP_WRITE,
+        FILE_OP_FLUSH,
+        FILE_OP_SEEK,
+        FILE_OP_GET_SIZE,
+        FILE_OP_TRUNCATE,
+        FILE_OP_STAT,
+        FILE_OP_EXISTS,
+        FILE_OP_SET_ATTRIBUTES,
+        FILE_OP_COPY,
+        FILE_OP_MOVE,
+        FILE_OP_DELETE,
+        FILE_OP_LOCK,
+        FILE_OP_UNLOCK,
+        FILE_OP_ENSURE_DIRECTORY,
+        FILE_OP_SECURE_DELETE,
+        FILE_OP_PREAD,
+        FILE_OP_PWRITE,
+        FILE_OP_SPLICE,
+        FILE_OP_SYNC,
+        FILE_OP_RING_APPEND,
+        FILE_OP_RING_NEXT,
+        FILE_OP_TRIM_HEAD,
+        FILE_OP_MAP,
+        FILE_OP_SHM_READ,
+        FILE_OP_READ_CACHED,
+        FILE_OP_COUNT
+    } file_op;
+
+    /**
+     * @brief I/O accounting counters (see YFILE_ENABLE_ACCOUNTING).
+     */
+    typedef struct file_io_counters {
+        uint64_t read_ops;         // file_read, file_pread, file_ring_next, file_shm_cache_read, file_read_cached.
+        uint64_t write_ops;        // file_write, file_pwrite, file_splice, file_tee, file_ring_append.
+        uint64_t other_ops;        // Everything else: open, close, flush, metadata, locking, ...
+        uint64_t bytes_read;
+        uint64_t bytes_written;
+        uint64_t syscalls;         // OS calls; stdio-buffered reads and writes are estimated from their size.
+        uint64_t short_reads;      // Reads that returned less than requested without failing.
+        uint64_t errors;
+    } file_io_counters;
+
+    // Per-FILE* bookkeeping for features that need state beyond the CRT stream.
+    // Entries are created on demand and released by file_close.
+    typedef struct yfile_state {
+        FILE *fp;
+        struct yfile_state *next;
+        file_durability durability;        // Default level used by file_flush/file_close.
+        uint64_t writeback_chunk;          // Background writeback threshold, 0 = disabled.
+        uint64_t writeback_dirty;          // Bytes written since the last writeback was queued.
+        volatile LONG writeback_busy;      // 1 while a writer is queueing a background flush.
+        HANDLE writeback_idle;             // Manual-reset event, signaled while no background flush is in flight.
+        HANDLE read_handle;                // Private handle for positional reads, or NULL.
+        int has_identity;                  // Set once volume/file_index have been resolved.
+        DWORD volume;
+        uint64_t file_index;
+        struct yfile_prefetch *prefetch;   // Readahead state, see file_prefetch_enable.
+        file_io_counters io;               // Per-handle accounting, see YFILE_ENABLE_ACCOUNTING.
+        int io_prefix;                     // 1 + index of the accounting prefix the path matched, 0 = none.
+        uint32_t fault_paths;              // Fault rules whose path pattern matches fault_path, one bit per rule.
+        LONG fault_generation;             // Rule-set generation fault_paths was resolved against.
+        char *fault_path;                  // Path the handle was opened with, see yfile_fault_opened.
+        volatile LONG cache_dirty;         // file_write data may still be in the CRT buffer, see yfile_cache_note_flush.
+        struct yfile_compress *compress;   // Compressed stream state, see file_compress_enable.
+    } yfile_state;
+
+    void yfile_prefetch_free(struct yfile_prefetch *p);
+    void yfile_compress_free(struct yfile_compress *z);
+
+#define YFILE_STATE_BUCKETS 256
+
+    yfile_state *yfile_state_table[YFILE_STATE_BUCKETS];
+    SRWLOCK yfile_state_lock = SRWLOCK_INIT;
+    volatile LONG yfile_state_count = 0;
+
+    size_t yfile_state_bucket(FILE *fp) {
+        uintptr_t h = (uintptr_t)fp;
+        return (size_t)((h >> 4) ^ (h >> 12)) & (YFILE_STATE_BUCKETS - 1);
+    }
+
+    // Returns the state for fp, or NULL if none has been attached.
+    yfile_state *yfile_state_find(FILE *fp) {
+        if (fp == NULL || yfile_state_count == 0) { return NULL; }
+        AcquireSRWLockShared(&yfile_state_lock);
+        yfile_state *s = yfile_state_table[yfile_state_bucket(fp)];
+        while (s != NULL && s->fp != fp) { s = s->next; }
+        ReleaseSRWLockShared(&yfile_state_lock);
+        return s;
+    }
+
+    // Returns the state for fp, creating it if needed. NULL on allocation failure.
+    yfile_state *yfile_state_acquire(FILE *fp) {
+        if (fp == NULL) { return NULL; }
+        yfile_state *s = yfile_state_find(fp);
+        if (s != NULL) { return s; }
+
+        AcquireSRWLockExclusive(&yfile_state_lock);
+        size_t b = yfile_state_bucket(fp);
+        for (s = yfile_state_table[b]; s != NULL && s->fp != fp; s = s->next) {}
+        if (s == NULL && (s = (yfile_state *)calloc(1, sizeof(yfile_state))) != NULL) {
+            s->fp = fp;
+            s->next = yfile_state_table[b];
+            yfile_state_table[b] = s;
+            InterlockedIncrement(&yfile_state_count);
+        }
+        ReleaseSRWLockExclusive(&yfile_state_lock);
+        return s;
+    }
+
+    // Detaches and frees the state for fp. Waits for any background writeback to finish first.
+    void yfile_state_release(FILE *fp) {
+        if (fp == NULL || yfile_state_count == 0) { return; }
+        AcquireSRWLockExclusive(&yfile_state_lock);
+        yfile_state **link = &yfile_state_table[yfile_state_bucket(fp)];
+        while (*link != NULL && (*link)->fp != fp) { link = &(*link)->next; }
+        yfile_state *s = *link;
+        if (s != NULL) {
+            *link = s->next;
+            InterlockedDecrement(&yfile_state_count);
+        }
+        ReleaseSRWLockExclusive(&yfile_state_lock);
+        if (s == NULL) { return; }
+
+        if (s->writeback_idle != NULL) {
+            WaitForSingleObject(s->writeback_idle, INFINITE);
+            CloseHandle(s->writeback_idle);
+        }
+        if (s->read_handle != NULL) { CloseHandle(s->read_handle); }
+        if (s->prefetch != NULL) { yfile_prefetch_free(s->prefetch); }
+        if (s->compress != NULL) { yfile_compress_free(s->compress); }
+        free(s->fault_path);
+        free(s);
+    }
+
+    typedef struct yfile_io_status_block {
+        union { LONG Status; PVOID Pointer; } u;
+        ULONG_PTR Information;
+    } yfile_io_status_block;
+
+    typedef LONG (WINAPI *yfile_nt_flush_buffers_file_ex_fn)(HANDLE, ULONG, PVOID, ULONG, yfile_io_status_block *);
+
+#define YFILE_FLUSH_FLAGS_FILE_DATA_SYNC_ONLY 0x00000004
+
+    // Flushes an OS handle to the requested durability level.
+    // Returns 0 on success, -1 on failure.
+    int yfile_flush_handle(HANDLE h, file_durability durability) {
+        static yfile_nt_flush_buffers_file_ex_fn nt_flush = NULL;
+        static volatile LONG nt_flush_resolved = 0;
+
+        if (h == INVALID_HANDLE_VALUE) { return -1; }
+        if (durability == FILE_DURABILITY_NONE || durability == FILE_DURABILITY_WRITE_THROUGH) { return 0; }
+
+        if (durability == FILE_DURABILITY_DATA) {
+            if (!nt_flush_resolved) {
+                HMODULE ntdll = GetModuleHandleA("ntdll.dll");
+                if (ntdll != NULL) {
+                    nt_flush = (yfile_nt_flush_buffers_file_ex_fn)(void (*)(void))GetProcAddress(ntdll, "NtFlushBuffersFileEx");
+                }
+                InterlockedExchange(&nt_flush_resolved, 1);
+            }
+            // Data-sync flush is Windows 10 1709+ and NTFS only; anything else falls back to a full flush.
+            if (nt_flush != NULL) {
+                yfile_io_status_block iosb;
+                if (nt_flush(h, YFILE_FLUSH_FLAGS_FILE_DATA_SYNC_ONLY, NULL, 0, &iosb) >= 0) { return 0; }
+            }
+        }
+
+        return FlushFileBuffers(h) ? 0 : -1;
+    }
+
+    // Background writeback job: flushes a duplicate of the file handle on the thread pool.
+    typedef struct yfile_writeback_job {
+        HANDLE h;
+        HANDLE idle;               // The state's writeback_idle event.
+    } yfile_writeback_job;
+
+    void CALLBACK yfile_writeback_run(PTP_CALLBACK_INSTANCE instance, PVOID context) {
+        yfile_writeback_job *job = (yfile_writeback_job *)context;
+        yfile_flush_handle(job->h, FILE_DURABILITY_DATA);
+        CloseHandle(job->h);
+        // The pool signals idle once the callback has fully returned, so a waiting yfile_state_release
+        // can free the state and close the event without racing the tail of this function.
+        SetEventWhenCallbackReturns(instance, job->idle);
+        free(job);
+    }
+
+    // Accounts len freshly written bytes against the handle's writeback threshold and, once it is
+    // exceeded, pushes the CRT buffer to the OS and queues an asynchronous data flush. Spreading the
+    // writeback out this way keeps the final flush from having to drain one huge dirty burst.
+    void yfile_writeback_note(FILE *fp, size_t len) {
+        yfile_state *s = yfile_state_find(fp);
+        if (s == NULL || s->writeback_chunk == 0) { return; }
+
+        s->writeback_dirty += len;
+        if (s->writeback_dirty < s->writeback_chunk) { return; }
+        // Another writer is queueing, or a flush is still running; keep accumulating and retry on the next write.
+        if (InterlockedCompareExchange(&s->writeback_busy, 1, 0) != 0) { return; }
+        if (WaitForSingleObject(s->writeback_idle, 0) != WAIT_OBJECT_0) {
+            InterlockedExchange(&s->writeback_busy, 0);
+            return;
+        }
+
+        yfile_writeback_job *job = (yfile_writeback_job *)malloc(sizeof(yfile_writeback_job));
+        HANDLE h = (HANDLE)_get_osfhandle(_fileno(fp));
+        if (job == NULL || fflush(fp) != 0 || h == INVALID_HANDLE_VALUE ||
+            !DuplicateHandle(GetCurrentProcess(), h, GetCurrentProcess(), &job->h, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+            free(job);
+            InterlockedExchange(&s->writeback_busy, 0);
+            return;
+        }
+        job->idle = s->writeback_idle;
+        s->writeback_dirty = 0;
+
+        ResetEvent(s->writeback_idle);
+        if (!TrySubmitThreadpoolCallback(yfile_writeback_run, job, NULL)) {
+            CloseHandle(job->h);
+            free(job);
+            SetEvent(s->writeback_idle);
+        }
+        InterlockedExchange(&s->writeback_busy, 0);
+    }
+
+    // Aligned I/O buffers from the size-classed pool, see file_buffer_alloc.
+    void *file_buffer_alloc(size_t size);
+    void file_buffer_free(void *buf, size_t size);
+
+    // Set while the block cache is enabled; writes are then reported through yfile_cache_note_write.
+    // file_write's bytes may still sit in the CRT buffer, where a file_pread cannot see them and would
+    // cache the old contents, so the flush and close paths report them again once they reach the OS.
+    volatile LONG yfile_cache_active = 0;
+    void yfile_cache_note_write(FILE *fp);
+    void yfile_cache_note_buffered_write(FILE *fp);
+    void yfile_cache_note_flush(FILE *fp);
+
+    // Readahead hooks for file_read/file_write on handles with prefetching enabled.
+    size_t yfile_prefetch_read(struct yfile_prefetch *p, FILE *fp, char *buf, size_t max_len);
+    void yfile_prefetch_note_write(FILE *fp);
+
+    // Compressed streams, see file_compress_enable. The flush and close paths drain the background
+    // compressor before they touch the CRT buffer.
+    size_t yfile_compress_read(struct yfile_compress *z, char *buf, size_t max_len, int *failed);
+    size_t yfile_compress_write(struct yfile_compress *z, const char *buf, size_t len);
+    int yfile_compress_flush(FILE *fp);
+    int yfile_compress_finish(FILE *fp);
+
+    // Set while the negative lookup cache is enabled; file_exists then goes through yfile_negcache_exists.
+    volatile LONG yfile_negcache_active = 0;
+    int yfile_negcache_exists(const char *filename);
+
+#if defined(YFILE_ENABLE_HISTOGRAMS) || defined(YFILE_ENABLE_ACCOUNTING) || defined(YFILE_ENABLE_TRACING) || \
+    defined(YFILE_ENABLE_SLOW_IO) || defined(YFILE_ENABLE_RECORDING)
+#define YFILE_INSTRUMENTED 1
+#endif
+
+#ifdef YFILE_INSTRUMENTED
+    // One instrumented call in flight. Public functions open one with YFILE_OP_BEGIN once their
+    // arguments are validated and close it with YFILE_OP_END on every path that returns after that.
+    typedef struct yfile_op_ctx {
+        file_op op;
+        FILE *fp;
+        const char *path;
+        const char *aux;                   // Second string argument: open mode, copy/move target, lock kind.
+        int64_t offset;                    // Explicit file offset, -1 if the call has none.
+        uint64_t length;                   // Bytes requested, 0 if the call has no length.
+        int64_t start;                     // QueryPerformanceCounter ticks.
+        yfile_state *state;                // fp's state when the call began, if it has one.
+        int io_prefix;                     // Accounting prefix of fp, captured before file_close frees the state.
+        int slow_tracked;                  // Set when the slow-I/O detector registered the call as in flight.
+        int record_outer;                  // Set when the recorder logs this call (outermost call on its thread).
+    } yfile_op_ctx;
+
+    void yfile_op_begin(yfile_op_ctx *ctx, file_op op, FILE *fp, const char *path);
+    void yfile_op_end(yfile_op_ctx *ctx, uint64_t bytes, int failed);
+
+#define YFILE_OP_BEGIN(op, fp, path) yfile_op_ctx yfile_op; yfile_op_begin(&yfile_op, (op), (fp), (path))
+#define YFILE_OP_ARGS(off, len)      (yfile_op.offset = (int64_t)(off), yfile_op.length = (uint64_t)(len))
+#define YFILE_OP_FILE(f)             (yfile_op.fp = (f))
+#define YFILE_OP_AUX(s)              (yfile_op.aux = (s))
+#define YFILE_OP_END(bytes, failed)  yfile_op_end(&yfile_op, (uint64_t)(bytes), (failed))
+#else
+#define YFILE_OP_BEGIN(op, fp, path) ((void)0)
+#define YFILE_OP_ARGS(off, len)      ((void)0)
+#define YFILE_OP_FILE(f)             ((void)0)
+#define YFILE_OP_AUX(s)              ((void)0)
+#define YFILE_OP_END(bytes, failed)  ((void)0)
+#endif
+
+#ifdef YFILE_ENABLE_FAULTS
+    // Fault points sit in front of the OS or CRT call they stand for. A non-zero result is the
+    // Win32 error the call must fail with; *len may come back shorter for a short transfer.
+    DWORD yfile_fault_inject(file_op op, FILE *fp, const char *path, size_t *len);
+    void yfile_fault_opened(FILE *fp, const char *path);
+
+#define YFILE_FAULT(op, fp, path, len) yfile_fault_inject((op), (fp), (path), (len))
+#define YFILE_FAULT_OPENED(fp, path)   yfile_fault_opened((fp), (path))
+#else
+#define YFILE_FAULT(op, fp, path, len) ((DWORD)0)
+#define YFILE_FAULT_OPENED(fp, path)   ((void)0)
+#endif
+
     /**
      * @brief Checks if a file has the specified attributes.
      * @param filename The path to the file.
@@ -26,7 +352,9 @@ extern "C" {
      */
     int file_has_attributes(const char *filename, unsigned long attributes) {
         if (filename == NULL) return -1;
-        unsigned long attr = GetFileAttributesA(filename);
+        YFILE_OP_BEGIN(FILE_OP_STAT, NULL, filename);
+        unsigned long attr = YFILE_FAULT(FILE_OP_STAT, NULL, filename, NULL) != 0 ? INVALID_FILE_ATTRIBUTES : GetFileAttributesA(filename);
+        YFILE_OP_END(0, attr == INVALID_FILE_ATTRIBUTES);
         return attr == INVALID_FILE_ATTRIBUTES ? -1 : ((attr & attributes) == attributes ? 0 : 1);
     }
 
@@ -38,7 +366,10 @@ extern "C" {
      */
     int file_set_attributes(const char *filename, unsigned long attributes) {
         if (filename == NULL) return -1;
-        return SetFileAttributesA(filename, attributes) ? 0 : -1;
+        YFILE_OP_BEGIN(FILE_OP_SET_ATTRIBUTES, NULL, filename);
+        int ret = SetFileAttributesA(filename, attributes) ? 0 : -1;
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     /**
@@ -47,7 +378,12 @@ extern "C" {
      * @return 0 if file exists, 1 if not.
      */
     int file_exists(const char *filename) {
-        return GetFileAttributesA(filename) != INVALID_FILE_ATTRIBUTES ? 0 : 1;
+        YFILE_OP_BEGIN(FILE_OP_EXISTS, NULL, filename);
+        int ret;
+        if (yfile_negcache_active && filename != NULL) ret = yfile_negcache_exists(filename);
+        else ret = GetFileAttributesA(filename) != INVALID_FILE_ATTRIBUTES ? 0 : 1;
+        YFILE_OP_END(0, 0);
+        return ret;
     }
 
     /**
@@ -57,7 +393,10 @@ extern "C" {
      */
     int file_accessible(const char *filename) {
         if (filename == NULL) return -1;
-        return GetFileAttributesA(filename) == INVALID_FILE_ATTRIBUTES ? 1 : 0;
+        YFILE_OP_BEGIN(FILE_OP_STAT, NULL, filename);
+        int ret = GetFileAttributesA(filename) == INVALID_FILE_ATTRIBUTES ? 1 : 0;
+        YFILE_OP_END(0, 0);
+        return ret;
     }
 
     /**
@@ -68,17 +407,17 @@ extern "C" {
      */
     FILE *file_open(const char *filename, const char *mode) {
         if (!filename || !mode || !mode[0]) return NULL;
-        return fopen(filename, mode);
+        YFILE_OP_BEGIN(FILE_OP_OPEN, NULL, filename);
+        YFILE_OP_AUX(mode);
+        FILE *fp = YFILE_FAULT(FILE_OP_OPEN, NULL, filename, NULL) != 0 ? NULL : fopen(filename, mode);
+        YFILE_FAULT_OPENED(fp, filename);
+        YFILE_OP_FILE(fp);
+        YFILE_OP_END(0, fp == NULL);
+        return fp;
     }
 
-    /**
-     * @brief Opens a UTF-8 encoded file using wide-character Windows API.
-     * @param filename UTF-8 encoded file path.
-     * @param mode UTF-8 encoded mode string (e.g., "r", "w").
-     * @return FILE pointer on success, NULL on failure.
-     */
-    FILE *file_open_utf8(const char *filename, const char *mode) {
-        if (!filename || !mode || !mode[0]) return NULL;
+    // Converts the UTF-8 path and mode to UTF-16 and opens the file with _wfopen.
+    FILE *yfile_open_utf8(const char *filename, const char *mode) {
         int wlen_path = MultiByteToWideChar(CP_UTF8, 0, filename, -1, NULL, 0);
         if (!wlen_path) return NULL;
         wchar_t *wpath = (wchar_t *)malloc(sizeof(wchar_t) * wlen_path);
@@ -96,13 +435,43 @@ extern "C" {
         return fp;
     }
 
+    /**
+     * @brief Opens a UTF-8 encoded file using wide-character Windows API.
+     * @param filename UTF-8 encoded file path.
+     * @param mode UTF-8 encoded mode string (e.g., "r", "w").
+     * @return FILE pointer on success, NULL on failure.
+     */
+    FILE *file_open_utf8(const char *filename, const char *mode) {
+        if (!filename || !mode || !mode[0]) return NULL;
+        YFILE_OP_BEGIN(FILE_OP_OPEN, NULL, filename);
+        YFILE_OP_AUX(mode);
+        FILE *fp = YFILE_FAULT(FILE_OP_OPEN, NULL, filename, NULL) != 0 ? NULL : yfile_open_utf8(filename, mode);
+        YFILE_FAULT_OPENED(fp, filename);
+        YFILE_OP_FILE(fp);
+        YFILE_OP_END(0, fp == NULL);
+        return fp;
+    }
+
     /**
      * @brief Closes a file.
      * @param fp Pointer to FILE.
      * @return 0 on success, -1 on error.
      */
     int file_close(FILE *fp) {
-        return (fp == NULL) ? -1 : (fclose(fp) == 0 ? 0 : -1);
+        if (fp == NULL) return -1;
+        YFILE_OP_BEGIN(FILE_OP_CLOSE, fp, NULL);
+        DWORD fault = YFILE_FAULT(FILE_OP_CLOSE, fp, NULL, NULL);     // Like a real failed close, the stream is gone either way.
+        int ret = yfile_compress_finish(fp);
+        if (yfile_cache_active && fflush(fp) == 0) yfile_cache_note_flush(fp);
+        yfile_state *s = yfile_state_find(fp);
+        if (s != NULL && s->durability != FILE_DURABILITY_NONE) {
+            if (fflush(fp) != 0 || yfile_flush_handle((HANDLE)_get_osfhandle(_fileno(fp)), s->durability) != 0) ret = -1;
+        }
+        yfile_state_release(fp);
+        if (fclose(fp) != 0) ret = -1;
+        if (fault != 0) { SetLastError(fault); ret = -1; }
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     /**
@@ -126,7 +495,12 @@ extern "C" {
         HANDLE hFile = file_get_handle(fp);
         if (hFile == INVALID_HANDLE_VALUE) return -1;
         OVERLAPPED ov = { 0 };
-        return LockFileEx(hFile, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, MAXDWORD, MAXDWORD, &ov) ? 0 : -1;
+        YFILE_OP_BEGIN(FILE_OP_LOCK, fp, NULL);
+        YFILE_OP_AUX(exclusive ? "exclusive" : "shared");
+        int ret = YFILE_FAULT(FILE_OP_LOCK, fp, NULL, NULL) == 0 &&
+                  LockFileEx(hFile, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, MAXDWORD, MAXDWORD, &ov) ? 0 : -1;
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     /**
@@ -139,7 +513,10 @@ extern "C" {
         HANDLE hFile = file_get_handle(fp);
         if (hFile == INVALID_HANDLE_VALUE) return -1;
         OVERLAPPED ov = { 0 };
-        return UnlockFileEx(hFile, 0, MAXDWORD, MAXDWORD, &ov) ? 0 : -1;
+        YFILE_OP_BEGIN(FILE_OP_UNLOCK, fp, NULL);
+        int ret = UnlockFileEx(hFile, 0, MAXDWORD, MAXDWORD, &ov) ? 0 : -1;
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     /**
@@ -151,7 +528,11 @@ extern "C" {
      */
     int file_copy_ex(const char *src, const char *dst, int fail_if_exists) {
         if (!src || !dst) return -1;
-        return CopyFileA(src, dst, fail_if_exists) ? 0 : -1;
+        YFILE_OP_BEGIN(FILE_OP_COPY, NULL, src);
+        YFILE_OP_AUX(dst);
+        int ret = YFILE_FAULT(FILE_OP_COPY, NULL, src, NULL) == 0 && CopyFileA(src, dst, fail_if_exists) ? 0 : -1;
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     /**
@@ -171,13 +552,20 @@ extern "C" {
      * @return 0 on success, -1 on error.
      */
     int file_move(const char *src, const char *dst) {
-        return MoveFileA(src, dst) ? 0 : -1;
+        YFILE_OP_BEGIN(FILE_OP_MOVE, NULL, src);
+        YFILE_OP_AUX(dst);
+        int ret = YFILE_FAULT(FILE_OP_MOVE, NULL, src, NULL) == 0 && MoveFileA(src, dst) ? 0 : -1;
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     // Deletes the file specified by filename.
     // Returns 0 on success, -1 on failure.
     int file_delete(const char *filename) {
-        return DeleteFileA(filename) ? 0 : -1;
+        YFILE_OP_BEGIN(FILE_OP_DELETE, NULL, filename);
+        int ret = YFILE_FAULT(FILE_OP_DELETE, NULL, filename, NULL) == 0 && DeleteFileA(filename) ? 0 : -1;
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     // Returns the current file offset in bytes or -1 on failure.
@@ -194,16 +582,31 @@ extern "C" {
     // @return Number of bytes written; returns 0 on failure.
     size_t file_write(FILE *fp, const char *buf, size_t len) {
         if (fp == NULL || buf == NULL || len == 0) return 0;
+        YFILE_OP_BEGIN(FILE_OP_WRITE, fp, NULL);
+        YFILE_OP_ARGS(-1, len);
+
+        yfile_state *s = yfile_state_find(fp);
+        if (s != NULL && s->compress != NULL) {
+            size_t put = YFILE_FAULT(FILE_OP_WRITE, fp, NULL, NULL) != 0 ? 0 : yfile_compress_write(s->compress, buf, len);
+            YFILE_OP_END(put, put == 0);
+            return put;
+        }
 
         size_t total = 0;
 
         // Write in a loop to handle partial writes (especially relevant for pipes or slow I/O).
         while (total < len) {
-            size_t written = fwrite(buf + total, sizeof(char), len - total, fp);
+            size_t chunk = len - total;
+            if (YFILE_FAULT(FILE_OP_WRITE, fp, NULL, &chunk) != 0) {
+                YFILE_OP_END(total, 1);
+                return 0;
+            }
+            size_t written = fwrite(buf + total, sizeof(char), chunk, fp);
 
             // fwrite returns 0 on error or if no data was written
             if (written == 0) {
                 if (ferror(fp)) {
+                    YFILE_OP_END(total, 1);
                     return 0;
                 }
                 break;
@@ -212,13 +615,15 @@ extern "C" {
             total += written;
         }
 
+        yfile_writeback_note(fp, total);
+        if (yfile_cache_active) yfile_cache_note_buffered_write(fp);
+        yfile_prefetch_note_write(fp);
+        YFILE_OP_END(total, 0);
         return total;
     }
 
-    // Gets the total size of the file in bytes or -1 on failure.
-    // It saves the current position, seeks to end to get size, then restores position.
-    int64_t file_get_size(FILE *fp) {
-        if (fp == NULL) { return -1; }
+    // Saves the current position, seeks to end to get size, then restores position.
+    int64_t yfile_get_size(FILE *fp) {
         int64_t current, size;
         if ((current = file_get_offset(fp)) == -1) { return -1; }
         if (file_set_offset_ex(fp, 0, SEEK_END) != 0) { return -1; }
@@ -227,11 +632,17 @@ extern "C" {
         return size;
     }
 
-    // Securely deletes a file by overwriting its contents with zeros before deleting it.
-    // buffer_length specifies the size of the buffer used for writing zeros in chunks.
-    // Returns 0 on success, -1 on failure.
-    int file_secure_delete_ex(const char *filename, size_t buffer_length) {
-        if (filename == NULL) { return -1; }
+    // Gets the total size of the file in bytes or -1 on failure.
+    int64_t file_get_size(FILE *fp) {
+        if (fp == NULL) { return -1; }
+        YFILE_OP_BEGIN(FILE_OP_GET_SIZE, fp, NULL);
+        int64_t size = yfile_get_size(fp);
+        YFILE_OP_END(0, size < 0);
+        return size;
+    }
+
+    // Overwrites the file with zeros in buffer_length chunks, then deletes it.
+    int yfile_secure_delete(const char *filename, size_t buffer_length) {
 
         // Open file for read/write binary, using UTF-8 aware open (you presumably have this function).
         FILE *fp = file_open_utf8(filename, "r+b");
@@ -250,8 +661,8 @@ extern "C" {
         // Buffer size to use for zeroing out the file.
         size_t buflen = filesz > buffer_length ? buffer_length : filesz;
 
-        // Allocate a buffer filled with zeros.
-        char *tempbuf = (char *)malloc(sizeof(char) * buflen);
+        // Take a zeroed buffer from the pool.
+        char *tempbuf = (char *)file_buffer_alloc(buflen);
         if (tempbuf == NULL) { file_close(fp); return -1; }
         memset(tempbuf, 0, buflen);
 
@@ -259,38 +670,31 @@ extern "C" {
         size_t loopcount = (size_t)(filesz / buflen);
 
         // Reset file pointer to beginning.
-        if (file_set_offset(fp, 0) != 0) { free(tempbuf); file_close(fp); return -1; }
+        if (file_set_offset(fp, 0) != 0) { file_buffer_free(tempbuf, buflen); file_close(fp); return -1; }
 
         // Overwrite file chunk by chunk with zeros.
         for (size_t i = 0; i < loopcount; i++) {
             // file_write returns 0 on failure, so if that happens return -1.
             if (file_write(fp, tempbuf, buflen) == 0) {
-                free(tempbuf);
+                file_buffer_free(tempbuf, buflen);
                 file_close(fp);
                 return -1;
             }
         }
-        free(tempbuf);
 
         // Handle remaining bytes if file size not divisible by buffer length.
+        // The remainder is shorter than the buffer, so the same zeroed buffer is reused.
         size_t remainingbytes = filesz - (loopcount * buflen);
-        if (remainingbytes > 0) {
-            // Allocate smaller buffer for remaining bytes.
-            char *tempbuf_rem = (char *)malloc(sizeof(char) * remainingbytes);
-            if (tempbuf_rem == NULL) { file_close(fp); return -1; }
-            memset(tempbuf_rem, 0, remainingbytes);
-
-            // Write the remaining zero bytes.
-            if (file_write(fp, tempbuf_rem, remainingbytes) == 0) {
-                free(tempbuf_rem);
-                file_close(fp);
-                return -1;
-            }
-            free(tempbuf_rem);
+        if (remainingbytes > 0 && file_write(fp, tempbuf, remainingbytes) == 0) {
+            file_buffer_free(tempbuf, buflen);
+            file_close(fp);
+            return -1;
         }
+        file_buffer_free(tempbuf, buflen);
 
         // Flush buffer to disk to ensure data is written.
         if (file_flush(fp) != 0) { file_close(fp); return -1; }
+        if (yfile_flush_handle(file_get_handle(fp), FILE_DURABILITY_DATA) != 0) { file_close(fp); return -1; }
 
         // Close the file.
         if (file_close(fp) == -1) { return -1; }
@@ -299,6 +703,17 @@ extern "C" {
         return file_delete(filename);
     }
 
+    // Securely deletes a file by overwriting its contents with zeros before deleting it.
+    // buffer_length specifies the size of the buffer used for writing zeros in chunks.
+    // Returns 0 on success, -1 on failure.
+    int file_secure_delete_ex(const char *filename, size_t buffer_length) {
+        if (filename == NULL) { return -1; }
+        YFILE_OP_BEGIN(FILE_OP_SECURE_DELETE, NULL, filename);
+        int ret = YFILE_FAULT(FILE_OP_SECURE_DELETE, NULL, filename, NULL) == 0 ? yfile_secure_delete(filename, buffer_length) : -1;
+        YFILE_OP_END(0, ret != 0);
+        return ret;
+    }
+
     // Sets the file position of the given FILE* fp to offset relative to origin (SEEK_SET, SEEK_CUR, SEEK_END).
     // Returns 0 on success, -1 on failure.
     int file_set_offset_ex(FILE *fp, int64_t offset, int origin) {
@@ -306,7 +721,11 @@ extern "C" {
         if ((origin != SEEK_CUR && origin != SEEK_END && (origin != SEEK_SET || offset < 0)) || fp == NULL) { return -1; }
 
         // _fseeki64 is Windows-specific 64-bit file seek function.
-        return _fseeki64(fp, offset, origin) != 0 ? -1 : 0;
+        YFILE_OP_BEGIN(FILE_OP_SEEK, fp, NULL);
+        YFILE_OP_ARGS(origin == SEEK_SET ? offset : -1, 0);
+        int ret = _fseeki64(fp, offset, origin) != 0 ? -1 : 0;
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     // Sets file offset to an absolute position offset bytes from start (SEEK_SET).
@@ -337,8 +756,13 @@ extern "C" {
         if (fp == NULL) { return -1; }
         HANDLE h;
         if ((h = file_get_handle(fp)) == INVALID_HANDLE_VALUE) { return -1; }
-        if (file_set_offset(fp, size) != 0) { return -1; }
-        return SetEndOfFile(h) ? 0 : -1;
+        YFILE_OP_BEGIN(FILE_OP_TRUNCATE, fp, NULL);
+        YFILE_OP_ARGS(size, 0);
+        int ret = YFILE_FAULT(FILE_OP_TRUNCATE, fp, NULL, NULL) == 0 && file_set_offset(fp, size) == 0 && SetEndOfFile(h) ? 0 : -1;
+        if (ret == 0 && yfile_cache_active) yfile_cache_note_write(fp);
+        if (ret == 0) yfile_prefetch_note_write(fp);
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     // Checks if given filename is a directory.
@@ -359,15 +783,13 @@ extern "C" {
         return create_directory_part_ex(partial_path, NULL);
     }
 
-    // Ensures that the entire directory path exists by creating any missing directories.
-    // Returns 0 on success, -1 on failure.
-    // Supports paths like "C:\\folder1\\folder2\\folder3"
-    int file_ensure_directory_ex(const char *path, LPSECURITY_ATTRIBUTES attributes) {
-        if (path == NULL || path[0] == '\0') { return -1; }
+    // Creates every missing directory along path, prefix by prefix.
+    int yfile_ensure_directory(const char *path, LPSECURITY_ATTRIBUTES attributes) {
 
-        // Copy path to mutable buffer.
+        // Copy path to mutable buffer; only paths longer than MAX_PATH need the heap.
+        char stackbuf[MAX_PATH];
         size_t pathlen = strlen(path);
-        char *tmp = (char *)malloc(sizeof(char) * (pathlen + 1));
+        char *tmp = pathlen < sizeof(stackbuf) ? stackbuf : (char *)malloc(sizeof(char) * (pathlen + 1));
         if (tmp == NULL) { return -1; }
         memcpy(tmp, path, pathlen);
         tmp[pathlen] = '\0';
@@ -388,7 +810,7 @@ extern "C" {
         // Finally create last directory in path.
         int ret = create_directory_part(tmp);
 
-        free(tmp);
+        if (tmp != stackbuf) { free(tmp); }
 
         // If directory already exists, treat as success.
         if (ret != 0) {
@@ -401,10 +823,30 @@ extern "C" {
         return 0;
     }
 
+    // Ensures that the entire directory path exists by creating any missing directories.
+    // Returns 0 on success, -1 on failure.
+    // Supports paths like "C:\\folder1\\folder2\\folder3"
+    int file_ensure_directory_ex(const char *path, LPSECURITY_ATTRIBUTES attributes) {
+        if (path == NULL || path[0] == '\0') { return -1; }
+        YFILE_OP_BEGIN(FILE_OP_ENSURE_DIRECTORY, NULL, path);
+        int ret = YFILE_FAULT(FILE_OP_ENSURE_DIRECTORY, NULL, path, NULL) == 0 ? yfile_ensure_directory(path, attributes) : -1;
+        YFILE_OP_END(0, ret != 0);
+        return ret;
+    }
+
+    // Flushes the CRT buffer, then applies the handle's default durability (see file_open_ex).
     // Returns 0 on success, non-zero on failure.
     int file_flush(FILE *fp) {
         if (fp == NULL) return -1;
-        return fflush(fp);
+        YFILE_OP_BEGIN(FILE_OP_FLUSH, fp, NULL);
+        int ret = YFILE_FAULT(FILE_OP_FLUSH, fp, NULL, NULL) != 0 || yfile_compress_flush(fp) != 0 || fflush(fp) != 0 ? -1 : 0;
+        if (ret == 0 && yfile_cache_active) yfile_cache_note_flush(fp);
+        yfile_state *s = yfile_state_find(fp);
+        if (ret == 0 && s != NULL && s->durability != FILE_DURABILITY_NONE) {
+            ret = yfile_flush_handle(file_get_handle(fp), s->durability);
+        }
+        YFILE_OP_END(0, ret != 0);
+        return ret;
     }
 
     // Reads up to max_len bytes from a file into a buffer.
@@ -415,8 +857,27 @@ extern "C" {
     // @return Number of bytes successfully read; returns 0 on error.
     size_t file_read(FILE *fp, char *buf, size_t max_len) {
         if (fp == NULL || buf == NULL || max_len == 0) return 0;
-        size_t read = fread(buf, 1, max_len, fp);
-        if (ferror(fp)) return 0;
+        YFILE_OP_BEGIN(FILE_OP_READ, fp, NULL);
+        YFILE_OP_ARGS(-1, max_len);
+        size_t read;
+        yfile_state *s = yfile_state_find(fp);
+        if (YFILE_FAULT(FILE_OP_READ, fp, NULL, &max_len) != 0) {
+            YFILE_OP_END(0, 1);
+            return 0;
+        }
+        if (s != NULL && s->compress != NULL) {
+            int failed;
+            read = yfile_compress_read(s->compress, buf, max_len, &failed);
+            YFILE_OP_END(read, failed);
+            return read;
+        }
+        if (s != NULL && s->prefetch != NULL) {
+            read = yfile_prefetch_read(s->prefetch, fp, buf, max_len);
+        } else {
+            read = fread(buf, 1, max_len, fp);
+            if (ferror(fp)) read = 0;
+        }
+        YFILE_OP_END(read, ferror(fp) != 0);
         return read;
     }
     /**
@@ -436,6 +897,6464 @@ extern "C" {
         return file_last_error() == (unsigned long)err ? 0 : 1;
     }
 
+    // Translates an fopen-style mode string into CreateFile access/disposition and _open_osfhandle flags.
+    // Returns 0 on success, -1 on an unrecognised mode.
+    int yfile_parse_mode(const char *mode, DWORD *access, DWORD *disposition, int *crt_flags) {
+        if (mode == NULL) { return -1; }
+        int plus = strchr(mode, '+') != NULL;
+        int exclusive = strchr(mode, 'x') != NULL;
+        int flags = strchr(mode, 'b') != NULL ? _O_BINARY : _O_TEXT;
+
+        switch (mode[0]) {
+        case 'r':
+            *access = plus ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+            *disposition = OPEN_EXISTING;
+            flags |= plus ? _O_RDWR : _O_RDONLY;
+            break;
+        case 'w':
+            *access = plus ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_WRITE;
+            *disposition = exclusive ? CREATE_NEW : CREATE_ALWAYS;
+            flags |= plus ? _O_RDWR : _O_WRONLY;
+            break;
+        case 'a':
+            *access = plus ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_WRITE;
+            *disposition = OPEN_ALWAYS;
+            flags |= (plus ? _O_RDWR : _O_WRONLY) | _O_APPEND;
+            break;
+        default:
+            return -1;
+        }
+
+        *crt_flags = flags;
+        return 0;
+    }
+
+    // Wraps an OS handle in a FILE* stream. Closes the handle if wrapping fails.
+    FILE *yfile_fdopen_handle(HANDLE h, const char *mode, int crt_flags) {
+        int fd = _open_osfhandle((intptr_t)h, crt_flags);
+        if (fd == -1) { CloseHandle(h); return NULL; }
+        FILE *fp = _fdopen(fd, mode);
+        if (fp == NULL) { _close(fd); }
+        return fp;
+    }
+
+    // Opens the stream, through CreateFileA when write-through is requested, and records its durability.
+    FILE *yfile_open_ex(const char *filename, const char *mode, file_durability durability) {
+        FILE *fp;
+        if (durability == FILE_DURABILITY_WRITE_THROUGH) {
+            DWORD access, disposition;
+            int crt_flags;
+            if (yfile_parse_mode(mode, &access, &disposition, &crt_flags) != 0) return NULL;
+            HANDLE h = CreateFileA(filename, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, disposition,
+                                   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH, NULL);
+            if (h == INVALID_HANDLE_VALUE) return NULL;
+            fp = yfile_fdopen_handle(h, mode, crt_flags);
+        } else {
+            fp = fopen(filename, mode);
+        }
+        if (fp == NULL) return NULL;
+
+        if (durability != FILE_DURABILITY_NONE) {
+            yfile_state *s = yfile_state_acquire(fp);
+            if (s == NULL) { fclose(fp); return NULL; }
+            s->durability = durability;
+        }
+        return fp;
+    }
+
+    /**
+     * @brief Opens a file with a default durability level.
+     * @param filename File path.
+     * @param mode fopen-style mode string.
+     * @param durability Level applied by file_flush and file_close on this handle.
+     *        FILE_DURABILITY_WRITE_THROUGH opens the handle with FILE_FLAG_WRITE_THROUGH.
+     * @return FILE pointer on success, NULL on failure.
+     */
+    FILE *file_open_ex(const char *filename, const char *mode, file_durability durability) {
+        if (!filename || !mode || !mode[0]) return NULL;
+        YFILE_OP_BEGIN(FILE_OP_OPEN, NULL, filename);
+        YFILE_OP_AUX(mode);
+        FILE *fp = YFILE_FAULT(FILE_OP_OPEN, NULL, filename, NULL) != 0 ? NULL : yfile_open_ex(filename, mode, durability);
+        YFILE_FAULT_OPENED(fp, filename);
+        YFILE_OP_FILE(fp);
+        YFILE_OP_END(0, fp == NULL);
+        return fp;
+    }
+
+    /**
+     * @brief Changes the default durability level used by file_flush and file_close.
+     * @param fp Pointer to FILE.
+     * @param durability New default level. FILE_DURABILITY_WRITE_THROUGH only takes effect
+     *        for handles opened that way and is otherwise treated as FILE_DURABILITY_NONE.
+     * @return 0 on success, -1 on error.
+     */
+    int file_set_durability(FILE *fp, file_durability durability) {
+        if (fp == NULL) return -1;
+        yfile_state *s = yfile_state_acquire(fp);
+        if (s == NULL) return -1;
+        s->durability = durability;
+        return 0;
+    }
+
+    /**
+     * @brief Flushes a file to an explicit durability level.
+     * @param fp Pointer to FILE.
+     * @param durability Level to reach before returning.
+     * @return 0 on success, -1 on failure.
+     */
+    int file_flush_ex(FILE *fp, file_durability durability) {
+        if (fp == NULL) return -1;
+        YFILE_OP_BEGIN(FILE_OP_FLUSH, fp, NULL);
+        int ret = YFILE_FAULT(FILE_OP_FLUSH, fp, NULL, NULL) != 0 || yfile_compress_flush(fp) != 0 || fflush(fp) != 0 ? -1 : 0;
+        if (ret == 0 && yfile_cache_active) yfile_cache_note_flush(fp);
+        if (ret == 0) ret = yfile_flush_handle(file_get_handle(fp), durability);
+        YFILE_OP_END(0, ret != 0);
+        return ret;
+    }
+
+    /**
+     * @brief Writes a buffer and flushes it to the requested durability level.
+     * @param fp A valid file pointer opened for writing.
+     * @param buf Pointer to the data buffer to write.
+     * @param len Number of bytes to write.
+     * @param durability Level the written bytes must reach before returning.
+     * @return Number of bytes written; returns 0 on failure (including a failed flush).
+     */
+    size_t file_write_ex(FILE *fp, const char *buf, size_t len, file_durability durability) {
+        size_t written = file_write(fp, buf, len);
+        if (written == 0) return 0;
+        return file_flush_ex(fp, durability) == 0 ? written : 0;
+    }
+
+    /**
+     * @brief Flushes a file to the requested durability level and closes it.
+     * @param fp Pointer to FILE.
+     * @param durability Level to reach before the handle is closed.
+     * @return 0 on success, -1 on error. The file is closed in either case.
+     */
+    int file_close_ex(FILE *fp, file_durability durability) {
+        if (fp == NULL) return -1;
+        YFILE_OP_BEGIN(FILE_OP_CLOSE, fp, NULL);
+        DWORD fault = YFILE_FAULT(FILE_OP_CLOSE, fp, NULL, NULL);
+        int ret = yfile_compress_finish(fp);
+        // Flush directly like file_close: going through file_flush_ex would record a nested flush op and fault check.
+        if (fflush(fp) != 0) ret = -1;
+        else if (yfile_cache_active) yfile_cache_note_flush(fp);
+        if (yfile_flush_handle(file_get_handle(fp), durability) != 0) ret = -1;
+        yfile_state_release(fp);
+        if (fclose(fp) != 0) ret = -1;
+        if (fault != 0) { SetLastError(fault); ret = -1; }
+        YFILE_OP_END(0, ret != 0);
+        return ret;
+    }
+
+    /**
+     * @brief Enables background writeback for a handle.
+     *
+     * Once chunk_bytes have been written through file_write, the CRT buffer is pushed to the OS and a
+     * data flush is queued on the thread pool, so dirty pages are written out incrementally instead of
+     * in one burst at the final flush. Windows has no sync_file_range; the queued flush covers the whole
+     * file, but only the bytes written since the previous one are dirty.
+     * @param fp Pointer to FILE.
+     * @param chunk_bytes Writeback threshold in bytes, 0 to disable.
+     * @return 0 on success, -1 on error.
+     */
+    int file_set_writeback(FILE *fp, uint64_t chunk_bytes) {
+        if (fp == NULL) return -1;
+        yfile_state *s = yfile_state_acquire(fp);
+        if (s == NULL) return -1;
+        if (chunk_bytes > 0 && s->writeback_idle == NULL && (s->writeback_idle = CreateEventA(NULL, TRUE, TRUE, NULL)) == NULL) return -1;
+        s->writeback_chunk = chunk_bytes;
+        s->writeback_dirty = 0;
+        return 0;
+    }
+
+#define FILE_SYNC_PARENT_DIRS  0x1   // Also flush each distinct parent directory once.
+#define FILE_SYNC_ALLOW_VOLUME 0x2   // Allow a single volume flush when every file shares one volume.
+
+#define YFILE_SYNC_MAX_WORKERS      64
+#define YFILE_SYNC_VOLUME_THRESHOLD 64
+
+    // Shared work list for file_sync_many_ex workers.
+    typedef struct yfile_sync_batch {
+        HANDLE *handles;
+        size_t count;
+        file_durability durability;
+        volatile LONG next;
+        volatile LONG failures;
+    } yfile_sync_batch;
+
+    DWORD WINAPI yfile_sync_worker(LPVOID param) {
+        yfile_sync_batch *batch = (yfile_sync_batch *)param;
+        for (;;) {
+            size_t i = (size_t)InterlockedIncrement(&batch->next) - 1;
+            if (i >= batch->count) { break; }
+            if (batch->handles[i] == INVALID_HANDLE_VALUE) { continue; }
+            if (yfile_flush_handle(batch->handles[i], batch->durability) != 0) {
+                InterlockedIncrement(&batch->failures);
+            }
+        }
+        return 0;
+    }
+
+    // Flushes every handle in the list, spreading the work over up to YFILE_SYNC_MAX_WORKERS threads.
+    // Returns the number of handles that failed to flush, or -1 if no worker could be started.
+    long yfile_sync_parallel(HANDLE *handles, size_t count, file_durability durability) {
+        if (count == 0) { return 0; }
+
+        yfile_sync_batch batch = { handles, count, durability, 0, 0 };
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        // Flushes block on the device, not the CPU, so oversubscribe to keep the queue deep.
+        size_t workers = (size_t)si.dwNumberOfProcessors * 4;
+        if (workers > YFILE_SYNC_MAX_WORKERS) { workers = YFILE_SYNC_MAX_WORKERS; }
+        if (workers > count) { workers = count; }
+
+        HANDLE threads[YFILE_SYNC_MAX_WORKERS];
+        DWORD started = 0;
+        for (size_t i = 1; i < workers; i++) {
+            HANDLE t = CreateThread(NULL, 64 * 1024, yfile_sync_worker, &batch, 0, NULL);
+            if (t != NULL) { threads[started++] = t; }
+        }
+
+        // The calling thread works the list too, so a failed CreateThread only costs parallelism.
+        yfile_sync_worker(&batch);
+        if (started > 0) {
+            WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+            for (DWORD i = 0; i < started; i++) { CloseHandle(threads[i]); }
+        }
+        return batch.failures;
+    }
+
+    // Writes the parent directory of the file behind h into dir. Returns 0 on success, -1 on failure.
+    int yfile_handle_parent_dir(HANDLE h, char *dir, DWORD dirlen) {
+        DWORD n = GetFinalPathNameByHandleA(h, dir, dirlen, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+        if (n == 0 || n >= dirlen) { return -1; }
+        char *slash = strrchr(dir, '\\');
+        if (slash == NULL) { return -1; }
+        *slash = '\0';
+        return 0;
+    }
+
+    int yfile_compare_strings(const void *a, const void *b) {
+        return strcmp(*(const char *const *)a, *(const char *const *)b);
+    }
+
+    // Opens each distinct parent directory of the handles once and flushes them in parallel.
+    // Best effort: NTFS journals directory updates, so a directory that cannot be opened for write is skipped.
+    void yfile_sync_parent_dirs(HANDLE *handles, size_t count, file_durability durability) {
+        char **dirs = (char **)calloc(count, sizeof(char *));
+        if (dirs == NULL) { return; }
+
+        size_t ndirs = 0;
+        for (size_t i = 0; i < count; i++) {
+            char path[MAX_PATH * 4];
+            if (handles[i] == INVALID_HANDLE_VALUE) { continue; }
+            if (yfile_handle_parent_dir(handles[i], path, sizeof(path)) != 0) { continue; }
+            size_t len = strlen(path);
+            if ((dirs[ndirs] = (char *)malloc(len + 1)) == NULL) { continue; }
+            memcpy(dirs[ndirs++], path, len + 1);
+        }
+        qsort(dirs, ndirs, sizeof(char *), yfile_compare_strings);
+
+        HANDLE *dir_handles = (HANDLE *)malloc(sizeof(HANDLE) * (ndirs ? ndirs : 1));
+        size_t nopen = 0;
+        for (size_t i = 0; i < ndirs; i++) {
+            if (dir_handles == NULL || (i > 0 && strcmp(dirs[i], dirs[i - 1]) == 0)) { continue; }
+            HANDLE d = CreateFileA(dirs[i], GENERIC_READ | GENERIC_WRITE,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                                   OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+            if (d != INVALID_HANDLE_VALUE) { dir_handles[nopen++] = d; }
+        }
+        for (size_t i = 0; i < ndirs; i++) { free(dirs[i]); }
+        free(dirs);
+        if (dir_handles == NULL) { return; }
+
+        yfile_sync_parallel(dir_handles, nopen, durability);
+        for (size_t i = 0; i < nopen; i++) { CloseHandle(dir_handles[i]); }
+        free(dir_handles);
+    }
+
+    // Flushes the whole volume that holds h (the syncfs analogue). Needs administrator rights.
+    // Returns 0 on success, -1 if the volume could not be opened or flushed.
+    int yfile_sync_volume(HANDLE h) {
+        char path[MAX_PATH * 4], root[MAX_PATH];
+        DWORD n = GetFinalPathNameByHandleA(h, path, sizeof(path), FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+        if (n == 0 || n >= sizeof(path)) { return -1; }
+        // Strip the \\?\ prefix so GetVolumePathNameA sees a plain drive path.
+        const char *plain = strncmp(path, "\\\\?\\", 4) == 0 ? path + 4 : path;
+        if (!GetVolumePathNameA(plain, root, sizeof(root)) || root[0] == '\0' || root[1] != ':') { return -1; }
+
+        char device[8] = "\\\\.\\X:";
+        device[4] = root[0];
+        HANDLE vol = CreateFileA(device, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                 NULL, OPEN_EXISTING, 0, NULL);
+        if (vol == INVALID_HANDLE_VALUE) { return -1; }
+        int ret = FlushFileBuffers(vol) ? 0 : -1;
+        CloseHandle(vol);
+        return ret;
+    }
+
+    /**
+     * @brief Makes many files durable at once.
+     *
+     * CRT buffers are drained on the calling thread, then the OS flushes are issued concurrently from a
+     * small worker pool. With FILE_SYNC_ALLOW_VOLUME, a batch of at least YFILE_SYNC_VOLUME_THRESHOLD
+     * files that all live on one volume is committed with a single volume flush instead (requires
+     * administrator rights; falls back to per-file flushes otherwise). With FILE_SYNC_PARENT_DIRS, each
+     * distinct parent directory is flushed once after the files.
+     * @param handles Array of open FILE pointers. NULL entries are skipped.
+     * @param count Number of entries in handles.
+     * @param durability FILE_DURABILITY_DATA or FILE_DURABILITY_FULL.
+     * @param flags Combination of FILE_SYNC_* flags.
+     * @return 0 on success, -1 if any file failed to flush.
+     */
+    int file_sync_many_ex(FILE **handles, size_t count, file_durability durability, int flags) {
+        if (handles == NULL) return -1;
+        if (count == 0) return 0;
+        YFILE_OP_BEGIN(FILE_OP_SYNC, NULL, NULL);
+
+        HANDLE *os = (HANDLE *)malloc(sizeof(HANDLE) * count);
+        if (os == NULL) { YFILE_OP_END(0, 1); return -1; }
+
+        int ret = 0;
+        int same_volume = 1;
+        DWORD volume = 0;
+        size_t live = 0;
+        for (size_t i = 0; i < count; i++) {
+            os[i] = INVALID_HANDLE_VALUE;
+            if (handles[i] == NULL) continue;
+            if (fflush(handles[i]) != 0) { ret = -1; continue; }
+            os[i] = file_get_handle(handles[i]);
+            if (os[i] == INVALID_HANDLE_VALUE) { ret = -1; continue; }
+
+            BY_HANDLE_FILE_INFORMATION info;
+            if (!GetFileInformationByHandle(os[i], &info)) { same_volume = 0; }
+            else if (live == 0) { volume = info.dwVolumeSerialNumber; }
+            else if (info.dwVolumeSerialNumber != volume) { same_volume = 0; }
+            live++;
+        }
+
+        int done = 0;
+        if ((flags & FILE_SYNC_ALLOW_VOLUME) && same_volume && live >= YFILE_SYNC_VOLUME_THRESHOLD) {
+            for (size_t i = 0; i < count && !done; i++) {
+                if (os[i] != INVALID_HANDLE_VALUE) { done = yfile_sync_volume(os[i]) == 0; break; }
+            }
+        }
+        if (!done && yfile_sync_parallel(os, count, durability) != 0) ret = -1;
+        if (!done && (flags & FILE_SYNC_PARENT_DIRS)) yfile_sync_parent_dirs(os, count, durability);
+
+        free(os);
+        YFILE_OP_END(0, ret != 0);
+        return ret;
+    }
+
+    /**
+     * @brief Makes many files and their parent directories fully durable.
+     * @param handles Array of open FILE pointers.
+     * @param count Number of entries in handles.
+     * @return 0 on success, -1 if any file failed to flush.
+     */
+    int file_sync_many(FILE **handles, size_t count) {
+        return file_sync_many_ex(handles, count, FILE_DURABILITY_FULL, FILE_SYNC_PARENT_DIRS | FILE_SYNC_ALLOW_VOLUME);
+    }
+
+    // Positional read on an OS handle. Returns the number of bytes read (short at end of file), or -1 on error.
+    int64_t yfile_pread(HANDLE h, void *buf, size_t len, uint64_t offset) {
+        size_t total = 0;
+        while (total < len) {
+            OVERLAPPED ov = { 0 };
+            uint64_t pos = offset + total;
+            ov.Offset = (DWORD)pos;
+            ov.OffsetHigh = (DWORD)(pos >> 32);
+            DWORD chunk = (len - total) > 0x40000000 ? 0x40000000 : (DWORD)(len - total);
+            DWORD got = 0;
+            if (!ReadFile(h, (char *)buf + total, chunk, &got, &ov)) {
+                if (GetLastError() == ERROR_HANDLE_EOF) { break; }
+                return -1;
+            }
+            if (got == 0) { break; }
+            total += got;
+        }
+        return (int64_t)total;
+    }
+
+    // Positional write on an OS handle. Returns 0 when all len bytes were written, -1 otherwise.
+    int yfile_pwrite(HANDLE h, const void *buf, size_t len, uint64_t offset) {
+        size_t total = 0;
+        while (total < len) {
+            OVERLAPPED ov = { 0 };
+            uint64_t pos = offset + total;
+            ov.Offset = (DWORD)pos;
+            ov.OffsetHigh = (DWORD)(pos >> 32);
+            DWORD chunk = (len - total) > 0x40000000 ? 0x40000000 : (DWORD)(len - total);
+            DWORD put = 0;
+            if (!WriteFile(h, (const char *)buf + total, chunk, &put, &ov) || put == 0) { return -1; }
+            total += put;
+        }
+        return 0;
+    }
+
+    // 32-bit FNV-1a, used to detect torn or overwritten records.
+    uint32_t yfile_hash32(const void *data, size_t len) {
+        const unsigned char *p = (const unsigned char *)data;
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < len; i++) { h = (h ^ p[i]) * 16777619u; }
+        return h;
+    }
+
+#define FILE_RING_MAGIC        0x31474E4952465959ULL   // "YYFRING1"
+#define FILE_RING_HEADER_SIZE  4096
+#define FILE_RING_RECORD_SIZE  16
+#define FILE_RING_PAD          0xFFFFFFFFu
+
+    // On-disk header kept in the first page of a ring file. Positions are logical byte counts that
+    // only ever grow; the physical offset is FILE_RING_HEADER_SIZE + position % capacity.
+    typedef struct file_ring_header {
+        uint64_t magic;
+        uint64_t capacity;     // Size of the data area in bytes (multiple of 8).
+        uint64_t head;         // Logical position where the next record is written.
+        uint64_t tail;         // Logical position of the oldest live record.
+        uint64_t tail_seq;     // Sequence number of the record at tail.
+        uint64_t next_seq;     // Sequence number the next record will get.
+    } file_ring_header;
+
+    // Record framing: the payload follows, padded to 8 bytes.
+    typedef struct file_ring_record {
+        uint32_t len;          // Payload length, or FILE_RING_PAD for a wrap marker.
+        uint32_t hash;         // yfile_hash32 of the payload.
+        uint64_t seq;
+    } file_ring_record;
+
+    /**
+     * @brief Writer side of a fixed-size circular log file.
+     * Appends are positional writes into a preallocated file; the oldest records are overwritten.
+     */
+    typedef struct file_ring {
+        HANDLE h;
+        file_ring_header hdr;
+        SRWLOCK lock;
+    } file_ring;
+
+    /**
+     * @brief Reader side of a ring file. Yields records oldest first and can follow a live writer.
+     */
+    typedef struct file_ring_reader {
+        HANDLE h;
+        uint64_t pos;          // Logical position of the next record to return.
+        uint64_t seq;          // Expected sequence number at pos.
+        uint64_t skipped;      // Records lost because the writer overwrote them before they were read.
+    } file_ring_reader;
+
+    uint64_t yfile_ring_span(uint32_t len) {
+        return ((uint64_t)FILE_RING_RECORD_SIZE + len + 7) & ~(uint64_t)7;
+    }
+
+    uint64_t yfile_ring_physical(const file_ring_header *hdr, uint64_t pos) {
+        return FILE_RING_HEADER_SIZE + pos % hdr->capacity;
+    }
+
+    int yfile_ring_read_header(HANDLE h, file_ring_header *hdr) {
+        if (yfile_pread(h, hdr, sizeof(*hdr), 0) != (int64_t)sizeof(*hdr)) { return -1; }
+        return (hdr->magic == FILE_RING_MAGIC && hdr->capacity >= 64 && hdr->capacity % 8 == 0) ? 0 : -1;
+    }
+
+    // Creates the file at its final size so appends never extend it.
+    int yfile_ring_preallocate(HANDLE h, uint64_t total) {
+        LARGE_INTEGER size;
+        size.QuadPart = (LONGLONG)total;
+        if (!SetFilePointerEx(h, size, NULL, FILE_BEGIN) || !SetEndOfFile(h)) { return -1; }
+        // Advancing the valid data length needs SE_MANAGE_VOLUME_NAME; without it, zero the file once
+        // so the first lap does not pay for lazy zero-fill.
+        if (SetFileValidData(h, (LONGLONG)total)) { return 0; }
+
+        size_t chunk = 1 << 20;
+        char *zeros = (char *)file_buffer_alloc(chunk);
+        if (zeros == NULL) { return -1; }
+        memset(zeros, 0, chunk);
+        int ret = 0;
+        for (uint64_t off = 0; off < total && ret == 0; off += chunk) {
+            size_t n = (total - off) < chunk ? (size_t)(total - off) : chunk;
+            ret = yfile_pwrite(h, zeros, n, off);
+        }
+        file_buffer_free(zeros, chunk);
+        return ret;
+    }
+
+    /**
+     * @brief Opens a ring file, creating and preallocating it if it does not exist.
+     * @param filename File path.
+     * @param capacity Size of the data area in bytes for a new file (rounded up to 8, minimum 64).
+     *        Ignored when opening an existing ring.
+     * @return Ring handle on success, NULL on failure.
+     */
+    file_ring *file_ring_open(const char *filename, uint64_t capacity) {
+        if (filename == NULL) return NULL;
+        file_ring *ring = (file_ring *)calloc(1, sizeof(file_ring));
+        if (ring == NULL) return NULL;
+        InitializeSRWLock(&ring->lock);
+
+        ring->h = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+        if (ring->h == INVALID_HANDLE_VALUE) { free(ring); return NULL; }
+
+        if (GetLastError() != ERROR_ALREADY_EXISTS) {
+            capacity = (capacity + 7) & ~(uint64_t)7;
+            if (capacity < 64) capacity = 64;
+            ring->hdr.magic = FILE_RING_MAGIC;
+            ring->hdr.capacity = capacity;
+            if (yfile_ring_preallocate(ring->h, FILE_RING_HEADER_SIZE + capacity) != 0 ||
+                yfile_pwrite(ring->h, &ring->hdr, sizeof(ring->hdr), 0) != 0) {
+                CloseHandle(ring->h);
+                DeleteFileA(filename);
+                free(ring);
+                return NULL;
+            }
+        } else if (yfile_ring_read_header(ring->h, &ring->hdr) != 0) {
+            CloseHandle(ring->h);
+            free(ring);
+            return NULL;
+        }
+        return ring;
+    }
+
+    // file_ring_append without the instrumentation hooks.
+    int yfile_ring_append(file_ring *ring, const void *buf, uint32_t len) {
+        if (ring == NULL || (buf == NULL && len > 0) || len == FILE_RING_PAD) return -1;
+        file_ring_header *hdr = &ring->hdr;
+        uint64_t need = yfile_ring_span(len);
+        if (need > hdr->capacity) return -1;
+
+        AcquireSRWLockExclusive(&ring->lock);
+        uint64_t head = hdr->head;
+        uint64_t to_end = hdr->capacity - head % hdr->capacity;
+        uint64_t pad = to_end < need ? to_end : 0;
+
+        // Retire records that the pad and the new record will overwrite. The header is published
+        // before any of their bytes change so readers never trust a record that is being replaced.
+        uint64_t old_tail = hdr->tail;
+        while (hdr->tail < head && head + pad + need - hdr->tail > hdr->capacity) {
+            uint64_t tail_to_end = hdr->capacity - hdr->tail % hdr->capacity;
+            file_ring_record rec;
+            if (tail_to_end < FILE_RING_RECORD_SIZE) { hdr->tail += tail_to_end; continue; }
+            if (yfile_pread(ring->h, &rec, sizeof(rec), yfile_ring_physical(hdr, hdr->tail)) != (int64_t)sizeof(rec)) {
+                ReleaseSRWLockExclusive(&ring->lock);
+                return -1;
+            }
+            if (rec.len == FILE_RING_PAD) { hdr->tail += tail_to_end; continue; }
+            hdr->tail += yfile_ring_span(rec.len);
+            hdr->tail_seq++;
+        }
+        // Every live record was retired (the pad plus the new record span most of the ring): restart
+        // empty where the new record goes, whatever stale lengths the last steps read.
+        if (hdr->tail >= head) {
+            hdr->tail = head + pad;
+            hdr->tail_seq = hdr->next_seq;
+        }
+        if (hdr->tail != old_tail && yfile_pwrite(ring->h, hdr, sizeof(*hdr), 0) != 0) {
+            ReleaseSRWLockExclusive(&ring->lock);
+            return -1;
+        }
+
+        if (pad > 0) {
+            if (pad >= FILE_RING_RECORD_SIZE) {
+                file_ring_record marker = { FILE_RING_PAD, 0, 0 };
+                if (yfile_pwrite(ring->h, &marker, sizeof(marker), yfile_ring_physical(hdr, head)) != 0) {
+                    ReleaseSRWLockExclusive(&ring->lock);
+                    return -1;
+                }
+            }
+            head += pad;
+        }
+
+        // Small records go out as a single write; large ones as header + payload.
+        file_ring_record rec = { len, yfile_hash32(buf, len), hdr->next_seq };
+        uint64_t at = yfile_ring_physical(hdr, head);
+        int ret;
+        if (need <= 512) {
+            char frame[512];
+            memcpy(frame, &rec, sizeof(rec));
+            if (len > 0) memcpy(frame + sizeof(rec), buf, len);
+            ret = yfile_pwrite(ring->h, frame, (size_t)(sizeof(rec) + len), at);
+        } else {
+            ret = yfile_pwrite(ring->h, &rec, sizeof(rec), at);
+            if (ret == 0) ret = yfile_pwrite(ring->h, buf, len, at + sizeof(rec));
+        }
+
+        if (ret == 0) {
+            hdr->head = head + need;
+            hdr->next_seq++;
+            ret = yfile_pwrite(ring->h, hdr, sizeof(*hdr), 0);
+        }
+        ReleaseSRWLockExclusive(&ring->lock);
+        return ret;
+    }
+
+    /**
+     * @brief Appends one record, overwriting the oldest records when the ring is full.
+     * @param ring Ring handle.
+     * @param buf Record payload.
+     * @param len Payload length; the framed record must fit in the ring's capacity.
+     * @return 0 on success, -1 on error.
+     */
+    int file_ring_append(file_ring *ring, const void *buf, uint32_t len) {
+        if (ring == NULL) return -1;
+        YFILE_OP_BEGIN(FILE_OP_RING_APPEND, NULL, NULL);
+        YFILE_OP_ARGS(-1, len);
+        int ret = yfile_ring_append(ring, buf, len);
+        YFILE_OP_END(ret == 0 ? len : 0, ret != 0);
+        return ret;
+    }
+
+    /**
+     * @brief Flushes a ring file to the requested durability level.
+     * @param ring Ring handle.
+     * @param durability Level to reach before returning.
+     * @return 0 on success, -1 on failure.
+     */
+    int file_ring_flush(file_ring *ring, file_durability durability) {
+        if (ring == NULL) return -1;
+        return yfile_flush_handle(ring->h, durability);
+    }
+
+    /**
+     * @brief Closes a ring file.
+     * @param ring Ring handle.
+     * @return 0 on success, -1 on error.
+     */
+    int file_ring_close(file_ring *ring) {
+        if (ring == NULL) return -1;
+        int ret = CloseHandle(ring->h) ? 0 : -1;
+        free(ring);
+        return ret;
+    }
+
+    /**
+     * @brief Opens a ring file for reading, positioned at the oldest live record.
+     * The file may be open for writing by another handle or process at the same time.
+     * @param filename File path.
+     * @return Reader on success, NULL on failure.
+     */
+    file_ring_reader *file_ring_reader_open(const char *filename) {
+        if (filename == NULL) return NULL;
+        file_ring_reader *r = (file_ring_reader *)calloc(1, sizeof(file_ring_reader));
+        if (r == NULL) return NULL;
+        r->h = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+        file_ring_header hdr;
+        if (r->h == INVALID_HANDLE_VALUE || yfile_ring_read_header(r->h, &hdr) != 0) {
+            if (r->h != INVALID_HANDLE_VALUE) CloseHandle(r->h);
+            free(r);
+            return NULL;
+        }
+        r->pos = hdr.tail;
+        r->seq = hdr.tail_seq;
+        return r;
+    }
+
+    // file_ring_next without the instrumentation hooks.
+    int yfile_ring_next(file_ring_reader *r, void *buf, uint32_t buflen, uint32_t *len, uint64_t *seq) {
+        if (r == NULL || len == NULL) return -1;
+
+        for (;;) {
+            file_ring_header hdr;
+            if (yfile_ring_read_header(r->h, &hdr) != 0) return -1;
+            if (r->pos < hdr.tail) {
+                r->skipped += hdr.tail_seq - r->seq;
+                r->pos = hdr.tail;
+                r->seq = hdr.tail_seq;
+            }
+            if (r->pos >= hdr.head) return 1;
+
+            uint64_t to_end = hdr.capacity - r->pos % hdr.capacity;
+            if (to_end < FILE_RING_RECORD_SIZE) { r->pos += to_end; continue; }
+
+            file_ring_record rec;
+            if (yfile_pread(r->h, &rec, sizeof(rec), yfile_ring_physical(&hdr, r->pos)) != (int64_t)sizeof(rec)) return -1;
+            if (rec.len == FILE_RING_PAD) { r->pos += to_end; continue; }
+            int valid = rec.seq == r->seq && yfile_ring_span(rec.len) <= to_end;
+            if (valid) {
+                *len = rec.len;
+                if (rec.len > buflen || (buf == NULL && rec.len > 0)) return -1;
+                if (yfile_pread(r->h, buf, rec.len, yfile_ring_physical(&hdr, r->pos) + sizeof(rec)) != (int64_t)rec.len) return -1;
+                valid = yfile_hash32(buf, rec.len) == rec.hash;
+            }
+
+            // The record is only trustworthy if the writer did not retire it while we were copying.
+            // A bad record that has not been retired means the file itself is damaged.
+            file_ring_header after;
+            if (yfile_ring_read_header(r->h, &after) != 0) return -1;
+            if (after.tail > r->pos) continue;
+            if (!valid) { SetLastError(ERROR_INVALID_DATA); return -1; }
+
+            if (seq != NULL) *seq = rec.seq;
+            r->pos += yfile_ring_span(rec.len);
+            r->seq++;
+            return 0;
+        }
+    }
+
+    /**
+     * @brief Reads the next record in time order.
+     *
+     * If the writer has overwritten records the reader had not reached yet, the reader jumps to the
+     * new oldest record and adds the lost count to reader->skipped.
+     * @param r Reader.
+     * @param buf Destination buffer.
+     * @param buflen Size of buf.
+     * @param len Receives the payload length (also set when buf is too small).
+     * @param seq Optional; receives the record's sequence number.
+     * @return 0 when a record was read, 1 when the reader has caught up with the writer, -1 on error
+     *         or if buf is too small (the record is not consumed).
+     */
+    int file_ring_next(file_ring_reader *r, void *buf, uint32_t buflen, uint32_t *len, uint64_t *seq) {
+        if (r == NULL || len == NULL) return -1;
+        YFILE_OP_BEGIN(FILE_OP_RING_NEXT, NULL, NULL);
+        YFILE_OP_ARGS(-1, buflen);
+        int ret = yfile_ring_next(r, buf, buflen, len, seq);
+        YFILE_OP_END(ret == 0 ? *len : 0, ret < 0);
+        return ret;
+    }
+
+    /**
+     * @brief Closes a ring reader.
+     * @param r Reader.
+     * @return 0 on success, -1 on error.
+     */
+    int file_ring_reader_close(file_ring_reader *r) {
+        if (r == NULL) return -1;
+        int ret = CloseHandle(r->h) ? 0 : -1;
+        free(r);
+        return ret;
+    }
+
+#define YFILE_TRIM_STREAM ":yfile.start"
+
+    // Opens the alternate data stream that records a file's logical start offset.
+    // Returns INVALID_HANDLE_VALUE on failure (e.g. the volume has no stream support).
+    HANDLE yfile_open_start_stream(HANDLE h, DWORD access, DWORD disposition) {
+        char path[MAX_PATH * 4];
+        DWORD n = GetFinalPathNameByHandleA(h, path, sizeof(path), FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+        if (n == 0 || n + sizeof(YFILE_TRIM_STREAM) > sizeof(path)) { return INVALID_HANDLE_VALUE; }
+        memcpy(path + n, YFILE_TRIM_STREAM, sizeof(YFILE_TRIM_STREAM));
+        return CreateFileA(path, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+
+    /**
+     * @brief Gets the logical start offset left behind by file_trim_head.
+     * Bytes before this offset have been discarded and read back as zeros.
+     * @param fp Pointer to FILE.
+     * @return Logical start offset in bytes (0 for a file that was never trimmed), or -1 on failure.
+     */
+    int64_t file_get_logical_start(FILE *fp) {
+        if (fp == NULL) { return -1; }
+        HANDLE h = file_get_handle(fp);
+        if (h == INVALID_HANDLE_VALUE) { return -1; }
+
+        HANDLE s = yfile_open_start_stream(h, GENERIC_READ, OPEN_EXISTING);
+        if (s == INVALID_HANDLE_VALUE) {
+            DWORD err = GetLastError();
+            return (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND) ? 0 : -1;
+        }
+        uint64_t start = 0;
+        int64_t got = yfile_pread(s, &start, sizeof(start), 0);
+        CloseHandle(s);
+        if (got == 0) { return 0; }
+        return got == (int64_t)sizeof(start) ? (int64_t)start : -1;
+    }
+
+    // file_trim_head without the instrumentation hooks.
+    int yfile_trim_head(FILE *fp, uint64_t bytes) {
+        if (fp == NULL) { return -1; }
+        if (bytes == 0) { return 0; }
+        if (fflush(fp) != 0) { return -1; }
+
+        HANDLE h = file_get_handle(fp);
+        LARGE_INTEGER size;
+        if (h == INVALID_HANDLE_VALUE || !GetFileSizeEx(h, &size)) { return -1; }
+
+        int64_t start = file_get_logical_start(fp);
+        if (start < 0) { return -1; }
+        uint64_t end = (uint64_t)start + bytes;
+        if (end > (uint64_t)size.QuadPart) { end = (uint64_t)size.QuadPart; }
+        if (end <= (uint64_t)start) { return 0; }
+
+        DWORD ret;
+        if (!DeviceIoControl(h, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &ret, NULL)) { return -1; }
+
+        // Record the new start first: a crash between the two steps then leaves a file whose head is
+        // logically gone but still allocated, never one whose live data has been zeroed. The punch
+        // always starts at 0 so a head left allocated that way is released by the next trim.
+        HANDLE s = yfile_open_start_stream(h, GENERIC_WRITE, OPEN_ALWAYS);
+        if (s == INVALID_HANDLE_VALUE) { return -1; }
+        uint64_t stored = end;
+        int ok = yfile_pwrite(s, &stored, sizeof(stored), 0) == 0;
+        CloseHandle(s);
+        if (!ok) { return -1; }
+
+        FILE_ZERO_DATA_INFORMATION zero;
+        zero.FileOffset.QuadPart = 0;
+        zero.BeyondFinalZero.QuadPart = (LONGLONG)end;
+        if (!DeviceIoControl(h, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), NULL, 0, &ret, NULL)) { return -1; }
+        // The head now reads as zeros; drop cached blocks and read-ahead that still hold the old data.
+        if (yfile_cache_active) { yfile_cache_note_write(fp); }
+        yfile_prefetch_note_write(fp);
+        return 0;
+    }
+
+    /**
+     * @brief Discards bytes from the head of a file without rewriting the rest.
+     *
+     * Windows has no equivalent of FALLOC_FL_COLLAPSE_RANGE, so the head is always released by
+     * hole punching: the file is marked sparse and FSCTL_SET_ZERO_DATA deallocates the trimmed
+     * clusters. Offsets of the remaining data do not change; the new logical start is recorded in
+     * the file's ":yfile.start" alternate data stream and returned by file_get_logical_start.
+     * Requires NTFS or ReFS and a handle opened for writing.
+     * @param fp Pointer to FILE.
+     * @param bytes Number of bytes to trim past the current logical start.
+     * @return 0 on success, -1 on failure.
+     */
+    int file_trim_head(FILE *fp, uint64_t bytes) {
+        if (fp == NULL) { return -1; }
+        YFILE_OP_BEGIN(FILE_OP_TRIM_HEAD, fp, NULL);
+        YFILE_OP_ARGS(-1, bytes);
+        int ret = yfile_trim_head(fp, bytes);
+        YFILE_OP_END(0, ret != 0);
+        return ret;
+    }
+
+    // Resolves and remembers the volume/file index identity of the file behind fp.
+    // Returns the state on success, NULL on failure.
+    yfile_state *yfile_state_identity(FILE *fp) {
+        yfile_state *s = yfile_state_acquire(fp);
+        if (s == NULL || s->has_identity) { return s; }
+        BY_HANDLE_FILE_INFORMATION info;
+        HANDLE h = file_get_handle(fp);
+        if (h == INVALID_HANDLE_VALUE || !GetFileInformationByHandle(h, &info)) { return NULL; }
+        s->volume = info.dwVolumeSerialNumber;
+        s->file_index = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+        s->has_identity = 1;
+        return s;
+    }
+
+    // Returns a read-only handle to the same file that positional reads can use without moving the
+    // FILE* position (a synchronous ReadFile with an OVERLAPPED offset updates the file pointer).
+    HANDLE yfile_state_read_handle(FILE *fp) {
+        yfile_state *s = yfile_state_acquire(fp);
+        if (s == NULL) { return INVALID_HANDLE_VALUE; }
+        if (s->read_handle == NULL) {
+            HANDLE h = file_get_handle(fp);
+            if (h == INVALID_HANDLE_VALUE) { return INVALID_HANDLE_VALUE; }
+            HANDLE r = ReOpenFile(h, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_RANDOM_ACCESS);
+            if (r == INVALID_HANDLE_VALUE) { return INVALID_HANDLE_VALUE; }
+            if (InterlockedCompareExchangePointer(&s->read_handle, r, NULL) != NULL) { CloseHandle(r); }
+        }
+        return s->read_handle;
+    }
+
+    uint64_t yfile_now_ns(void) {
+        static LONGLONG freq = 0;
+        LARGE_INTEGER now;
+        if (freq == 0) {
+            LARGE_INTEGER f;
+            QueryPerformanceFrequency(&f);
+            freq = f.QuadPart;
+        }
+        QueryPerformanceCounter(&now);
+        return (uint64_t)(now.QuadPart / freq) * 1000000000ULL + (uint64_t)(now.QuadPart % freq) * 1000000000ULL / (uint64_t)freq;
+    }
+
+    uint64_t yfile_mix64(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    /**
+     * @brief Block cache counters. Latencies are totals in nanoseconds over file_pread calls.
+     */
+    typedef struct file_cache_stats {
+        uint64_t hits;             // Blocks served from memory.
+        uint64_t misses;           // Blocks read from the file.
+        uint64_t ghost_hits;       // Misses on recently evicted blocks (these steer the ARC target).
+        uint64_t evictions;
+        uint64_t invalidations;    // Files whose cached blocks were dropped because of a write.
+        uint64_t resident_bytes;
+        uint64_t budget_bytes;
+        uint64_t hit_calls;        // file_pread calls served entirely from memory...
+        uint64_t hit_ns;           // ...and their total latency.
+        uint64_t miss_calls;       // file_pread calls that touched the file...
+        uint64_t miss_ns;          // ...and their total latency.
+    } file_cache_stats;
+
+#define YFILE_CACHE_SHARD_BITS 4
+#define YFILE_CACHE_SHARDS     (1 << YFILE_CACHE_SHARD_BITS)
+#define YFILE_CACHE_NONE   (-1)
+
+    enum { YFILE_ARC_T1, YFILE_ARC_T2, YFILE_ARC_B1, YFILE_ARC_B2, YFILE_ARC_FREE };
+
+    typedef struct yfile_block_key {
+        uint64_t file_index;
+        uint64_t block;
+        DWORD volume;
+        DWORD generation;
+    } yfile_block_key;
+
+    typedef struct yfile_cache_entry {
+        yfile_block_key key;
+        char *data;                // NULL for ghost (B1/B2) entries.
+        uint32_t len;              // Valid bytes; shorter than the block size at end of file.
+        int list;
+        int prev, next;            // Links within the entry's ARC list.
+        int hnext;                 // Hash chain.
+    } yfile_cache_entry;
+
+    typedef struct yfile_arc_list {
+        int head, tail;            // head = MRU, tail = LRU.
+        size_t size;
+    } yfile_arc_list;
+
+    // One independently locked ARC instance. Every shard holds capacity resident blocks plus as
+    // many ghost keys.
+    typedef struct yfile_cache_shard {
+        SRWLOCK lock;
+        size_t capacity;
+        uint32_t block_size;
+        size_t target;             // ARC's p: desired size of T1.
+        yfile_cache_entry *entries;
+        int *buckets;
+        size_t nbuckets;
+        int free_list;
+        yfile_arc_list lists[4];
+        volatile LONG64 hits, misses;  // Counted outside the lock, lookups only hold it shared.
+        uint64_t ghost_hits, evictions;
+    } yfile_cache_shard;
+
+    // Per-file write generation; bumping it orphans every cached block of the file at once.
+    typedef struct yfile_cache_gen {
+        uint64_t file_index;
+        DWORD volume;
+        volatile LONG generation;
+        struct yfile_cache_gen *next;
+    } yfile_cache_gen;
+
+#define YFILE_CACHE_GEN_BUCKETS 1024
+
+    typedef struct yfile_cache {
+        uint32_t block_size;
+        uint64_t budget;
+        yfile_cache_shard shards[YFILE_CACHE_SHARDS];
+        SRWLOCK gen_lock;
+        yfile_cache_gen *gens[YFILE_CACHE_GEN_BUCKETS];
+        volatile LONG64 invalidations;
+        volatile LONG64 hit_calls, hit_ns, miss_calls, miss_ns;
+    } yfile_cache;
+
+    yfile_cache *yfile_block_cache = NULL;
+
+    size_t yfile_cache_gen_bucket(DWORD volume, uint64_t file_index) {
+        return (size_t)(yfile_mix64(file_index ^ ((uint64_t)volume << 40)) & (YFILE_CACHE_GEN_BUCKETS - 1));
+    }
+
+    // Returns the current generation for a file, registering the file if create is set.
+    DWORD yfile_cache_generation(yfile_cache *c, DWORD volume, uint64_t file_index, int create) {
+        size_t b = yfile_cache_gen_bucket(volume, file_index);
+        AcquireSRWLockShared(&c->gen_lock);
+        yfile_cache_gen *g = c->gens[b];
+        while (g != NULL && (g->volume != volume || g->file_index != file_index)) { g = g->next; }
+        DWORD gen = g != NULL ? (DWORD)g->generation : 0;
+        ReleaseSRWLockShared(&c->gen_lock);
+        if (g != NULL || !create) { return gen; }
+
+        AcquireSRWLockExclusive(&c->gen_lock);
+        for (g = c->gens[b]; g != NULL && (g->volume != volume || g->file_index != file_index); g = g->next) {}
+        if (g == NULL && (g = (yfile_cache_gen *)calloc(1, sizeof(yfile_cache_gen))) != NULL) {
+            g->volume = volume;
+            g->file_index = file_index;
+            g->next = c->gens[b];
+            c->gens[b] = g;
+        }
+        gen = g != NULL ? (DWORD)g->generation : 0;
+        ReleaseSRWLockExclusive(&c->gen_lock);
+        return gen;
+    }
+
+    // Bumps a file's generation if it has ever been cached. Returns 1 if it was, 0 otherwise.
+    int yfile_cache_bump(yfile_cache *c, DWORD volume, uint64_t file_index) {
+        size_t b = yfile_cache_gen_bucket(volume, file_index);
+        AcquireSRWLockShared(&c->gen_lock);
+        yfile_cache_gen *g = c->gens[b];
+        while (g != NULL && (g->volume != volume || g->file_index != file_index)) { g = g->next; }
+        if (g != NULL) { InterlockedIncrement(&g->generation); }
+        ReleaseSRWLockShared(&c->gen_lock);
+        return g != NULL;
+    }
+
+    size_t yfile_cache_key_hash(const yfile_block_key *k) {
+        return (size_t)yfile_mix64(k->file_index * 31 + k->block + ((uint64_t)k->volume << 32) + ((uint64_t)k->generation << 48));
+    }
+
+    // Shards take the top bits of the key hash and buckets within a shard the bottom ones, so keys of
+    // one shard still spread over all of its buckets.
+    size_t yfile_cache_shard_of(const yfile_block_key *k) {
+        return yfile_cache_key_hash(k) >> (sizeof(size_t) * 8 - YFILE_CACHE_SHARD_BITS);
+    }
+
+    int yfile_cache_key_eq(const yfile_block_key *a, const yfile_block_key *b) {
+        return a->file_index == b->file_index && a->block == b->block && a->volume == b->volume && a->generation == b->generation;
+    }
+
+    void yfile_arc_unlink(yfile_cache_shard *sh, int i) {
+        yfile_cache_entry *e = &sh->entries[i];
+        yfile_arc_list *l = &sh->lists[e->list];
+        if (e->prev != YFILE_CACHE_NONE) sh->entries[e->prev].next = e->next; else l->head = e->next;
+        if (e->next != YFILE_CACHE_NONE) sh->entries[e->next].prev = e->prev; else l->tail = e->prev;
+        l->size--;
+    }
+
+    void yfile_arc_push_mru(yfile_cache_shard *sh, int i, int list) {
+        yfile_cache_entry *e = &sh->entries[i];
+        yfile_arc_list *l = &sh->lists[list];
+        e->list = list;
+        e->prev = YFILE_CACHE_NONE;
+        e->next = l->head;
+        if (l->head != YFILE_CACHE_NONE) sh->entries[l->head].prev = i; else l->tail = i;
+        l->head = i;
+        l->size++;
+    }
+
+    int yfile_arc_find(yfile_cache_shard *sh, const yfile_block_key *k) {
+        int i = sh->buckets[yfile_cache_key_hash(k) & (sh->nbuckets - 1)];
+        while (i != YFILE_CACHE_NONE && !yfile_cache_key_eq(&sh->entries[i].key, k)) { i = sh->entries[i].hnext; }
+        return i;
+    }
+
+    void yfile_arc_hash_remove(yfile_cache_shard *sh, int i) {
+        int *link = &sh->buckets[yfile_cache_key_hash(&sh->entries[i].key) & (sh->nbuckets - 1)];
+        while (*link != i) { link = &sh->entries[*link].hnext; }
+        *link = sh->entries[i].hnext;
+    }
+
+    // Drops the LRU entry of a ghost list entirely.
+    void yfile_arc_drop_lru(yfile_cache_shard *sh, int list) {
+        int i = sh->lists[list].tail;
+        if (i == YFILE_CACHE_NONE) return;
+        yfile_arc_unlink(sh, i);
+        yfile_arc_hash_remove(sh, i);
+        if (sh->entries[i].data != NULL) file_buffer_free(sh->entries[i].data, sh->block_size);
+        sh->entries[i].data = NULL;
+        sh->entries[i].list = YFILE_ARC_FREE;
+        sh->entries[i].hnext = sh->free_list;
+        sh->free_list = i;
+    }
+
+    // Moves the LRU of a resident list to the matching ghost list, releasing its data.
+    void yfile_arc_demote(yfile_cache_shard *sh, int from, int to) {
+        int i = sh->lists[from].tail;
+        if (i == YFILE_CACHE_NONE) return;
+        yfile_arc_unlink(sh, i);
+        file_buffer_free(sh->entries[i].data, sh->block_size);
+        sh->entries[i].data = NULL;
+        yfile_arc_push_mru(sh, i, to);
+        sh->evictions++;
+    }
+
+    // ARC's REPLACE: evicts one resident block, from T1 or T2 depending on the adaptive target.
+    void yfile_arc_replace(yfile_cache_shard *sh, int in_b2) {
+        size_t t1 = sh->lists[YFILE_ARC_T1].size;
+        if (t1 >= 1 && ((in_b2 && t1 == sh->target) || t1 > sh->target)) {
+            yfile_arc_demote(sh, YFILE_ARC_T1, YFILE_ARC_B1);
+        } else if (sh->lists[YFILE_ARC_T2].size > 0) {
+            yfile_arc_demote(sh, YFILE_ARC_T2, YFILE_ARC_B2);
+        } else {
+            yfile_arc_demote(sh, YFILE_ARC_T1, YFILE_ARC_B1);
+        }
+    }
+
+    // Looks a block up and copies up to len bytes from offset within it. Returns the number of valid
+    // bytes in the block, or -1 on a miss.
+    // The copy runs under the shared lock, so hits on the same shard proceed in parallel. Moving the
+    // block to the MRU end of T2 needs the exclusive lock and is skipped when the shard is busy; the
+    // block then keeps its place until its next hit.
+    int64_t yfile_arc_get(yfile_cache_shard *sh, const yfile_block_key *k, char *dst, uint32_t offset, uint32_t len) {
+        AcquireSRWLockShared(&sh->lock);
+        int i = yfile_arc_find(sh, k);
+        if (i == YFILE_CACHE_NONE || sh->entries[i].data == NULL) {
+            ReleaseSRWLockShared(&sh->lock);
+            InterlockedIncrement64(&sh->misses);
+            return -1;
+        }
+        yfile_cache_entry *e = &sh->entries[i];
+        if (offset < e->len) {
+            uint32_t n = e->len - offset < len ? e->len - offset : len;
+            memcpy(dst, e->data + offset, n);
+        }
+        int64_t valid = e->len;
+        int promote = e->list != YFILE_ARC_T2 || sh->lists[YFILE_ARC_T2].head != i;
+        ReleaseSRWLockShared(&sh->lock);
+        InterlockedIncrement64(&sh->hits);
+
+        if (promote && TryAcquireSRWLockExclusive(&sh->lock)) {
+            i = yfile_arc_find(sh, k);
+            if (i != YFILE_CACHE_NONE && sh->entries[i].data != NULL) {
+                yfile_arc_unlink(sh, i);
+                yfile_arc_push_mru(sh, i, YFILE_ARC_T2);
+            }
+            ReleaseSRWLockExclusive(&sh->lock);
+        }
+        return valid;
+    }
+
+    // Inserts a freshly read block following ARC's miss cases. Takes ownership of data.
+    void yfile_arc_put(yfile_cache_shard *sh, const yfile_block_key *k, char *data, uint32_t len) {
+        AcquireSRWLockExclusive(&sh->lock);
+        size_t c = sh->capacity;
+        yfile_arc_list *L = sh->lists;
+        int i = yfile_arc_find(sh, k);
+
+        if (i != YFILE_CACHE_NONE && sh->entries[i].data != NULL) {
+            // Another thread filled it first.
+            ReleaseSRWLockExclusive(&sh->lock);
+            file_buffer_free(data, sh->block_size);
+            return;
+        }
+
+        if (i != YFILE_CACHE_NONE && sh->entries[i].list == YFILE_ARC_B1) {
+            size_t delta = L[YFILE_ARC_B2].size > L[YFILE_ARC_B1].size ? L[YFILE_ARC_B2].size / L[YFILE_ARC_B1].size : 1;
+            sh->target = sh->target + delta > c ? c : sh->target + delta;
+            if (L[YFILE_ARC_T1].size + L[YFILE_ARC_T2].size >= c) yfile_arc_replace(sh, 0);
+            yfile_arc_unlink(sh, i);
+            sh->ghost_hits++;
+        } else if (i != YFILE_CACHE_NONE) {
+            size_t delta = L[YFILE_ARC_B1].size > L[YFILE_ARC_B2].size ? L[YFILE_ARC_B1].size / L[YFILE_ARC_B2].size : 1;
+            sh->target = sh->target > delta ? sh->target - delta : 0;
+            if (L[YFILE_ARC_T1].size + L[YFILE_ARC_T2].size >= c) yfile_arc_replace(sh, 1);
+            yfile_arc_unlink(sh, i);
+            sh->ghost_hits++;
+        } else {
+            size_t l1 = L[YFILE_ARC_T1].size + L[YFILE_ARC_B1].size;
+            size_t total = l1 + L[YFILE_ARC_T2].size + L[YFILE_ARC_B2].size;
+            if (l1 >= c) {
+                if (L[YFILE_ARC_T1].size < c) {
+                    yfile_arc_drop_lru(sh, YFILE_ARC_B1);
+                    yfile_arc_replace(sh, 0);
+                } else {
+                    // T1 alone fills the cache: evict its LRU outright rather than keep a ghost.
+                    yfile_arc_demote(sh, YFILE_ARC_T1, YFILE_ARC_B1);
+                    yfile_arc_drop_lru(sh, YFILE_ARC_B1);
+                }
+            } else if (total >= c) {
+                if (total >= 2 * c) yfile_arc_drop_lru(sh, YFILE_ARC_B2);
+                if (L[YFILE_ARC_T1].size + L[YFILE_ARC_T2].size >= c) yfile_arc_replace(sh, 0);
+            }
+            i = sh->free_list;
+            if (i == YFILE_CACHE_NONE) {
+                ReleaseSRWLockExclusive(&sh->lock);
+                file_buffer_free(data, sh->block_size);
+                return;
+            }
+            sh->free_list = sh->entries[i].hnext;
+            sh->entries[i].key = *k;
+            size_t b = yfile_cache_key_hash(k) & (sh->nbuckets - 1);
+            sh->entries[i].hnext = sh->buckets[b];
+            sh->buckets[b] = i;
+            sh->entries[i].data = data;
+            sh->entries[i].len = len;
+            yfile_arc_push_mru(sh, i, YFILE_ARC_T1);
+            ReleaseSRWLockExclusive(&sh->lock);
+            return;
+        }
+
+        sh->entries[i].data = data;
+        sh->entries[i].len = len;
+        yfile_arc_push_mru(sh, i, YFILE_ARC_T2);
+        ReleaseSRWLockExclusive(&sh->lock);
+    }
+
+    void yfile_cache_free(yfile_cache *c) {
+        if (c == NULL) return;
+        for (int s = 0; s < YFILE_CACHE_SHARDS; s++) {
+            yfile_cache_shard *sh = &c->shards[s];
+            if (sh->entries != NULL) {
+                for (size_t i = 0; i < 2 * sh->capacity; i++) {
+                    if (sh->entries[i].data != NULL) file_buffer_free(sh->entries[i].data, sh->block_size);
+                }
+            }
+            free(sh->entries);
+            free(sh->buckets);
+        }
+        for (int b = 0; b < YFILE_CACHE_GEN_BUCKETS; b++) {
+            while (c->gens[b] != NULL) {
+                yfile_cache_gen *g = c->gens[b];
+                c->gens[b] = g->next;
+                free(g);
+            }
+        }
+        free(c);
+    }
+
+    /**
+     * @brief Enables the process-wide block cache used by file_pread.
+     *
+     * The cache is split into independently locked shards, each running ARC replacement. Writes made
+     * through file_write (again when they are flushed), file_pwrite, file_truncate and
+     * file_cache_invalidate drop a file's cached blocks; writes by other processes are not seen.
+     * @param budget_bytes Memory budget for cached data.
+     * @param block_size Cache block size in bytes (power of two, at least 512).
+     * @return 0 on success, -1 on failure (including when the cache is already enabled).
+     */
+    int file_cache_enable(uint64_t budget_bytes, uint32_t block_size) {
+        if (block_size < 512 || (block_size & (block_size - 1)) != 0) return -1;
+        if (budget_bytes < (uint64_t)block_size * YFILE_CACHE_SHARDS) return -1;
+        if (yfile_block_cache != NULL) return -1;
+
+        yfile_cache *c = (yfile_cache *)calloc(1, sizeof(yfile_cache));
+        if (c == NULL) return -1;
+        c->block_size = block_size;
+        c->budget = budget_bytes;
+        InitializeSRWLock(&c->gen_lock);
+
+        size_t per_shard = (size_t)(budget_bytes / block_size / YFILE_CACHE_SHARDS);
+        for (int s = 0; s < YFILE_CACHE_SHARDS; s++) {
+            yfile_cache_shard *sh = &c->shards[s];
+            InitializeSRWLock(&sh->lock);
+            sh->capacity = per_shard;
+            sh->block_size = block_size;
+            sh->nbuckets = 1;
+            while (sh->nbuckets < 2 * per_shard) sh->nbuckets <<= 1;
+            sh->entries = (yfile_cache_entry *)calloc(2 * per_shard, sizeof(yfile_cache_entry));
+            sh->buckets = (int *)malloc(sizeof(int) * sh->nbuckets);
+            if (sh->entries == NULL || sh->buckets == NULL) { yfile_cache_free(c); return -1; }
+            for (size_t b = 0; b < sh->nbuckets; b++) sh->buckets[b] = YFILE_CACHE_NONE;
+            for (int l = 0; l < 4; l++) { sh->lists[l].head = sh->lists[l].tail = YFILE_CACHE_NONE; }
+            for (size_t i = 0; i < 2 * per_shard; i++) {
+                sh->entries[i].list = YFILE_ARC_FREE;
+                sh->entries[i].hnext = i + 1 < 2 * per_shard ? (int)(i + 1) : YFILE_CACHE_NONE;
+            }
+            sh->free_list = 0;
+        }
+
+        if (InterlockedCompareExchangePointer((PVOID volatile *)&yfile_block_cache, c, NULL) != NULL) {
+            yfile_cache_free(c);
+            return -1;
+        }
+        InterlockedExchange(&yfile_cache_active, 1);
+        return 0;
+    }
+
+    /**
+     * @brief Disables the block cache and frees its memory.
+     * Must not race with file_pread calls on other threads.
+     */
+    void file_cache_disable(void) {
+        InterlockedExchange(&yfile_cache_active, 0);
+        yfile_cache *c = (yfile_cache *)InterlockedExchangePointer((PVOID volatile *)&yfile_block_cache, NULL);
+        yfile_cache_free(c);
+    }
+
+    /**
+     * @brief Drops every cached block of a file.
+     * @param fp Pointer to FILE.
+     * @return 0 on success, -1 on error.
+     */
+    int file_cache_invalidate(FILE *fp) {
+        if (fp == NULL) return -1;
+        yfile_cache *c = yfile_block_cache;
+        if (c == NULL) return 0;
+        yfile_state *s = yfile_state_identity(fp);
+        if (s == NULL) return -1;
+        if (yfile_cache_bump(c, s->volume, s->file_index)) InterlockedIncrement64(&c->invalidations);
+        return 0;
+    }
+
+    void yfile_cache_note_write(FILE *fp) {
+        file_cache_invalidate(fp);
+    }
+
+    void yfile_cache_note_buffered_write(FILE *fp) {
+        file_cache_invalidate(fp);
+        yfile_state *s = yfile_state_find(fp);
+        if (s != NULL) InterlockedExchange(&s->cache_dirty, 1);
+    }
+
+    // Drops the file's blocks once more after buffered writes have been pushed to the OS.
+    void yfile_cache_note_flush(FILE *fp) {
+        yfile_state *s = yfile_state_find(fp);
+        if (s != NULL && InterlockedExchange(&s->cache_dirty, 0) != 0) file_cache_invalidate(fp);
+    }
+
+    /**
+     * @brief Gets block cache counters.
+     * @param out Receives the counters; all zero while the cache is disabled.
+     * @return 0 on success, -1 on invalid input.
+     */
+    int file_cache_get_stats(file_cache_stats *out) {
+        if (out == NULL) return -1;
+        memset(out, 0, sizeof(*out));
+        yfile_cache *c = yfile_block_cache;
+        if (c == NULL) return 0;
+        for (int s = 0; s < YFILE_CACHE_SHARDS; s++) {
+            yfile_cache_shard *sh = &c->shards[s];
+            AcquireSRWLockShared(&sh->lock);
+            out->hits += (uint64_t)sh->hits;
+            out->misses += (uint64_t)sh->misses;
+            out->ghost_hits += sh->ghost_hits;
+            out->evictions += sh->evictions;
+            out->resident_bytes += (uint64_t)(sh->lists[YFILE_ARC_T1].size + sh->lists[YFILE_ARC_T2].size) * c->block_size;
+            ReleaseSRWLockShared(&sh->lock);
+        }
+        out->invalidations = (uint64_t)c->invalidations;
+        out->budget_bytes = c->budget;
+        out->hit_calls = (uint64_t)c->hit_calls;
+        out->hit_ns = (uint64_t)c->hit_ns;
+        out->miss_calls = (uint64_t)c->miss_calls;
+        out->miss_ns = (uint64_t)c->miss_ns;
+        return 0;
+    }
+
+    // Positional read through the block cache when it is enabled.
+    int64_t yfile_cached_pread(FILE *fp, void *buf, size_t len, int64_t offset) {
+        HANDLE h = yfile_state_read_handle(fp);
+        if (h == INVALID_HANDLE_VALUE) return -1;
+
+        yfile_cache *c = yfile_block_cache;
+        if (c == NULL) return yfile_pread(h, buf, len, (uint64_t)offset);
+
+        yfile_state *s = yfile_state_identity(fp);
+        if (s == NULL) return yfile_pread(h, buf, len, (uint64_t)offset);
+
+        uint64_t start = yfile_now_ns();
+        int missed = 0;
+        yfile_block_key key;
+        key.volume = s->volume;
+        key.file_index = s->file_index;
+        key.generation = yfile_cache_generation(c, s->volume, s->file_index, 1);
+
+        size_t total = 0;
+        while (total < len) {
+            uint64_t pos = (uint64_t)offset + total;
+            key.block = pos / c->block_size;
+            uint32_t within = (uint32_t)(pos % c->block_size);
+            uint32_t want = (len - total) < (size_t)(c->block_size - within) ? (uint32_t)(len - total) : c->block_size - within;
+            yfile_cache_shard *sh = &c->shards[yfile_cache_shard_of(&key)];
+
+            int64_t valid = yfile_arc_get(sh, &key, (char *)buf + total, within, want);
+            if (valid < 0) {
+                missed = 1;
+                char *block = (char *)file_buffer_alloc(c->block_size);
+                if (block == NULL) return -1;
+                valid = yfile_pread(h, block, c->block_size, key.block * c->block_size);
+                if (valid < 0) { file_buffer_free(block, c->block_size); return -1; }
+                if ((uint64_t)valid > within) {
+                    uint32_t n = (uint32_t)valid - within < want ? (uint32_t)valid - within : want;
+                    memcpy((char *)buf + total, block + within, n);
+                }
+                if (valid > 0) yfile_arc_put(sh, &key, block, (uint32_t)valid);
+                else file_buffer_free(block, c->block_size);
+            }
+
+            if ((uint64_t)valid <= within) break;
+            uint32_t got = (uint32_t)valid - within < want ? (uint32_t)valid - within : want;
+            total += got;
+            if (got < want) break;
+        }
+
+        uint64_t elapsed = yfile_now_ns() - start;
+        InterlockedIncrement64(missed ? &c->miss_calls : &c->hit_calls);
+        InterlockedExchangeAdd64(missed ? &c->miss_ns : &c->hit_ns, (LONG64)elapsed);
+        return (int64_t)total;
+    }
+
+    /**
+     * @brief Reads from an absolute offset without moving the file position.
+     *
+     * Reads go through a private handle, so data still sitting in the CRT write buffer of fp is not
+     * visible; call file_flush first after buffered writes. When the block cache is enabled, the read
+     * is served block by block from memory and only missing blocks touch the file.
+     * @param fp Pointer to FILE.
+     * @param buf Destination buffer.
+     * @param len Number of bytes to read.
+     * @param offset Absolute file offset.
+     * @return Number of bytes read (short at end of file), or -1 on error.
+     */
+    int64_t file_pread(FILE *fp, void *buf, size_t len, int64_t offset) {
+        if (fp == NULL || buf == NULL || offset < 0) return -1;
+        if (len == 0) return 0;
+        YFILE_OP_BEGIN(FILE_OP_PREAD, fp, NULL);
+        YFILE_OP_ARGS(offset, len);
+        int64_t got = YFILE_FAULT(FILE_OP_PREAD, fp, NULL, &len) == 0 ? yfile_cached_pread(fp, buf, len, offset) : -1;
+        YFILE_OP_END(got > 0 ? got : 0, got < 0);
+        return got;
+    }
+
+    /**
+     * @brief Writes at an absolute offset without moving the file position, and drops the file's cached blocks.
+     * Goes straight to the OS handle; buffered data in fp is flushed first so the two cannot interleave.
+     * @param fp Pointer to FILE opened for writing.
+     * @param buf Data to write.
+     * @param len Number of bytes to write.
+     * @param offset Absolute file offset.
+     * @return 0 on success, -1 on error.
+     */
+    int file_pwrite(FILE *fp, const void *buf, size_t len, int64_t offset) {
+        if (fp == NULL || buf == NULL || offset < 0) return -1;
+        if (len == 0) return 0;
+        if (fflush(fp) != 0) return -1;
+        HANDLE h = file_get_handle(fp);
+        if (h == INVALID_HANDLE_VALUE) return -1;
+        YFILE_OP_BEGIN(FILE_OP_PWRITE, fp, NULL);
+        YFILE_OP_ARGS(offset, len);
+
+        // A synchronous positional WriteFile moves the file pointer; restore it for the CRT stream.
+        LARGE_INTEGER zero, pos;
+        zero.QuadPart = 0;
+        int ret = -1;
+        if (YFILE_FAULT(FILE_OP_PWRITE, fp, NULL, NULL) == 0 && SetFilePointerEx(h, zero, &pos, FILE_CURRENT)) {
+            ret = yfile_pwrite(h, buf, len, (uint64_t)offset);
+            if (!SetFilePointerEx(h, pos, NULL, FILE_BEGIN)) ret = -1;
+            if (yfile_cache_active) yfile_cache_note_write(fp);
+            if (ret == 0) yfile_prefetch_note_write(fp);
+        }
+        YFILE_OP_END(ret == 0 ? len : 0, ret != 0);
+        return ret;
+    }
+
+    /**
+     * @brief Access patterns recognised by the readahead detector.
+     */
+    typedef enum file_access_pattern {
+        FILE_PATTERN_UNKNOWN = 0,
+        FILE_PATTERN_SEQUENTIAL,
+        FILE_PATTERN_STRIDED,
+        FILE_PATTERN_RANDOM
+    } file_access_pattern;
+
+    /**
+     * @brief Readahead counters for one handle.
+     */
+    typedef struct file_prefetch_stats {
+        file_access_pattern pattern;   // Current detector verdict.
+        uint64_t reads;                // file_read calls observed.
+        uint64_t served_reads;         // Calls satisfied entirely from prefetched data.
+        uint64_t issued;               // Prefetch requests sent to the OS.
+        uint64_t useful;               // Prefetch requests at least partly consumed.
+        uint64_t issued_bytes;
+        uint64_t served_bytes;         // Bytes copied out of prefetch buffers.
+        uint64_t wasted_bytes;         // Prefetched bytes discarded without being read.
+    } file_prefetch_stats;
+
+    enum { YFILE_SLOT_EMPTY, YFILE_SLOT_PENDING, YFILE_SLOT_READY };
+
+    typedef struct yfile_prefetch_slot {
+        OVERLAPPED ov;
+        char *buf;
+        uint64_t offset;
+        uint32_t len;                  // Requested bytes while pending, valid bytes once ready.
+        uint32_t used;                 // Bytes copied out so far (a byte range may be copied twice).
+        int state;
+    } yfile_prefetch_slot;
+
+    typedef struct yfile_prefetch {
+        HANDLE h;                      // Overlapped read handle to the same file.
+        yfile_prefetch_slot *slots;
+        uint32_t nslots;
+        uint32_t slot_size;
+        uint32_t next_victim;
+        uint64_t last_offset;
+        uint64_t last_len;
+        int64_t stride;
+        int confidence;                // Consecutive accesses that matched the current pattern.
+        file_prefetch_stats stats;
+    } yfile_prefetch;
+
+    // Waits for a pending slot to complete and marks it ready (or empty on failure).
+    void yfile_prefetch_complete(yfile_prefetch *p, yfile_prefetch_slot *sl) {
+        DWORD got = 0;
+        if (sl->state != YFILE_SLOT_PENDING) return;
+        if (!GetOverlappedResult(p->h, &sl->ov, &got, TRUE)) got = 0;
+        sl->len = got;
+        sl->state = got > 0 ? YFILE_SLOT_READY : YFILE_SLOT_EMPTY;
+    }
+
+    // Returns a slot to the empty state, cancelling its read and accounting unread bytes as waste.
+    void yfile_prefetch_retire(yfile_prefetch *p, yfile_prefetch_slot *sl) {
+        if (sl->state == YFILE_SLOT_PENDING) {
+            CancelIoEx(p->h, &sl->ov);
+            yfile_prefetch_complete(p, sl);
+        }
+        if (sl->state == YFILE_SLOT_READY) {
+            if (sl->used > 0) p->stats.useful++;
+            p->stats.wasted_bytes += sl->used < sl->len ? sl->len - sl->used : 0;
+        }
+        sl->state = YFILE_SLOT_EMPTY;
+        sl->used = 0;
+    }
+
+    void yfile_prefetch_free(yfile_prefetch *p) {
+        if (p == NULL) return;
+        for (uint32_t i = 0; i < p->nslots; i++) {
+            yfile_prefetch_retire(p, &p->slots[i]);
+            if (p->slots[i].ov.hEvent != NULL) CloseHandle(p->slots[i].ov.hEvent);
+            if (p->slots[i].buf != NULL) file_buffer_free(p->slots[i].buf, p->slot_size);
+        }
+        if (p->h != INVALID_HANDLE_VALUE) CloseHandle(p->h);
+        free(p->slots);
+        free(p);
+    }
+
+    // Returns the slot whose data covers offset, or NULL.
+    yfile_prefetch_slot *yfile_prefetch_lookup(yfile_prefetch *p, uint64_t offset) {
+        for (uint32_t i = 0; i < p->nslots; i++) {
+            yfile_prefetch_slot *sl = &p->slots[i];
+            if (sl->state != YFILE_SLOT_EMPTY && offset >= sl->offset && offset < sl->offset + sl->len) return sl;
+        }
+        return NULL;
+    }
+
+    // Starts an asynchronous read of [offset, offset + len) unless it is already covered.
+    // Only empty slots and slots outside the window [cursor, cursor + horizon) are reused, so data
+    // the reader is about to consume is never displaced by data further ahead.
+    void yfile_prefetch_issue(yfile_prefetch *p, uint64_t offset, uint32_t len, uint64_t cursor, uint64_t horizon) {
+        if (len == 0 || yfile_prefetch_lookup(p, offset) != NULL) return;
+        if (len > p->slot_size) len = p->slot_size;
+
+        yfile_prefetch_slot *sl = NULL;
+        for (uint32_t i = 0; i < p->nslots && sl == NULL; i++) {
+            if (p->slots[i].state == YFILE_SLOT_EMPTY) sl = &p->slots[i];
+        }
+        for (uint32_t i = 0; i < p->nslots && sl == NULL; i++) {
+            yfile_prefetch_slot *c = &p->slots[(p->next_victim + i) % p->nslots];
+            if (c->offset + c->len <= cursor || c->offset >= cursor + horizon) {
+                sl = c;
+                p->next_victim = (p->next_victim + i + 1) % p->nslots;
+            }
+        }
+        if (sl == NULL) return;
+        yfile_prefetch_retire(p, sl);
+
+        HANDLE ev = sl->ov.hEvent;
+        memset(&sl->ov, 0, sizeof(sl->ov));
+        sl->ov.hEvent = ev;
+        sl->ov.Offset = (DWORD)offset;
+        sl->ov.OffsetHigh = (DWORD)(offset >> 32);
+        sl->offset = offset;
+        sl->len = len;
+        sl->used = 0;
+        if (!ReadFile(p->h, sl->buf, len, NULL, &sl->ov) && GetLastError() != ERROR_IO_PENDING) {
+            sl->state = YFILE_SLOT_EMPTY;
+            return;
+        }
+        sl->state = YFILE_SLOT_PENDING;
+        p->stats.issued++;
+        p->stats.issued_bytes += len;
+    }
+
+    // Feeds one access into the detector and queues reads for the ranges it predicts next.
+    void yfile_prefetch_observe(yfile_prefetch *p, uint64_t offset, uint64_t len) {
+        int64_t delta = (int64_t)(offset - p->last_offset);
+        file_access_pattern seen;
+        if (p->stats.reads == 0) {
+            seen = FILE_PATTERN_UNKNOWN;
+        } else if (offset == p->last_offset + p->last_len) {
+            seen = FILE_PATTERN_SEQUENTIAL;
+        } else if (delta != 0 && delta == p->stride) {
+            seen = FILE_PATTERN_STRIDED;
+        } else {
+            seen = FILE_PATTERN_RANDOM;
+        }
+
+        p->confidence = (seen == p->stats.pattern && seen != FILE_PATTERN_RANDOM) ? p->confidence + 1 : 0;
+        // A new stride only becomes a pattern once it repeats.
+        p->stats.pattern = (seen == FILE_PATTERN_RANDOM && p->stride == 0) ? FILE_PATTERN_UNKNOWN : seen;
+        p->stride = p->stats.reads == 0 ? 0 : delta;
+        p->last_offset = offset;
+        p->last_len = len;
+        p->stats.reads++;
+
+        if (p->confidence < 1) return;
+        uint64_t cursor = offset + len;
+        if (p->stats.pattern == FILE_PATTERN_SEQUENTIAL) {
+            // Keep the whole ring filled ahead of the reader.
+            uint64_t horizon = (uint64_t)p->nslots * p->slot_size;
+            uint64_t next = cursor;
+            for (uint32_t i = 0; i < p->nslots; i++, next += p->slot_size) {
+                yfile_prefetch_slot *sl = yfile_prefetch_lookup(p, next);
+                if (sl != NULL) { next = sl->offset + sl->len - p->slot_size; continue; }
+                yfile_prefetch_issue(p, next, p->slot_size, cursor, horizon);
+            }
+        } else if (p->stats.pattern == FILE_PATTERN_STRIDED && p->stride > 0) {
+            uint32_t want = len < p->slot_size ? (uint32_t)len : p->slot_size;
+            uint64_t horizon = (uint64_t)p->nslots * (uint64_t)p->stride;
+            for (uint32_t i = 1; i <= p->nslots; i++) {
+                yfile_prefetch_issue(p, offset + (uint64_t)p->stride * i, want, cursor, horizon);
+            }
+        }
+    }
+
+    size_t yfile_prefetch_read(yfile_prefetch *p, FILE *fp, char *buf, size_t max_len) {
+        int64_t pos = _ftelli64(fp);
+        if (pos < 0) {
+            size_t read = fread(buf, 1, max_len, fp);
+            return ferror(fp) ? 0 : read;
+        }
+
+        size_t total = 0;
+        while (total < max_len) {
+            yfile_prefetch_slot *sl = yfile_prefetch_lookup(p, (uint64_t)pos + total);
+            if (sl == NULL) break;
+            yfile_prefetch_complete(p, sl);
+            if (sl->state != YFILE_SLOT_READY) continue;
+            uint64_t within = (uint64_t)pos + total - sl->offset;
+            if (within >= sl->len) continue;
+            size_t n = (size_t)(sl->len - within) < max_len - total ? (size_t)(sl->len - within) : max_len - total;
+            memcpy(buf + total, sl->buf + within, n);
+            sl->used = sl->used + n > sl->len ? sl->len : sl->used + (uint32_t)n;
+            total += n;
+        }
+
+        if (total > 0) {
+            p->stats.served_bytes += total;
+            if (_fseeki64(fp, pos + (int64_t)total, SEEK_SET) != 0) return 0;
+        }
+        if (total == max_len) {
+            p->stats.served_reads++;
+        } else {
+            total += fread(buf + total, 1, max_len - total, fp);
+            if (ferror(fp)) return 0;
+        }
+
+        yfile_prefetch_observe(p, (uint64_t)pos, max_len);
+        return total;
+    }
+
+    void yfile_prefetch_note_write(FILE *fp) {
+        yfile_state *s = yfile_state_find(fp);
+        if (s == NULL || s->prefetch == NULL) return;
+        for (uint32_t i = 0; i < s->prefetch->nslots; i++) yfile_prefetch_retire(s->prefetch, &s->prefetch->slots[i]);
+    }
+
+    /**
+     * @brief Enables adaptive readahead for file_read on a handle.
+     *
+     * Each file_read is fed to a pattern detector. Once a sequential or strided pattern repeats,
+     * asynchronous reads for the predicted ranges are issued into a ring of buffers on a separate
+     * overlapped handle, and later file_read calls are served from those buffers. Random access
+     * issues nothing. Use binary-mode streams: offsets are byte offsets.
+     * @param fp Pointer to FILE opened for reading.
+     * @param slots Number of prefetch buffers (1..64).
+     * @param slot_size Size of each buffer in bytes.
+     * @return 0 on success, -1 on failure.
+     */
+    int file_prefetch_enable(FILE *fp, uint32_t slots, uint32_t slot_size) {
+        if (fp == NULL || slots == 0 || slots > 64 || slot_size == 0) return -1;
+        yfile_state *s = yfile_state_acquire(fp);
+        HANDLE h = file_get_handle(fp);
+        if (s == NULL || h == INVALID_HANDLE_VALUE || s->prefetch != NULL) return -1;
+
+        yfile_prefetch *p = (yfile_prefetch *)calloc(1, sizeof(yfile_prefetch));
+        if (p == NULL) return -1;
+        p->nslots = slots;
+        p->slot_size = slot_size;
+        p->h = ReOpenFile(h, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_OVERLAPPED);
+        p->slots = (yfile_prefetch_slot *)calloc(slots, sizeof(yfile_prefetch_slot));
+        if (p->h == INVALID_HANDLE_VALUE || p->slots == NULL) { yfile_prefetch_free(p); return -1; }
+        for (uint32_t i = 0; i < slots; i++) {
+            p->slots[i].buf = (char *)file_buffer_alloc(slot_size);
+            p->slots[i].ov.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+            if (p->slots[i].buf == NULL || p->slots[i].ov.hEvent == NULL) { yfile_prefetch_free(p); return -1; }
+        }
+
+        s->prefetch = p;
+        return 0;
+    }
+
+    /**
+     * @brief Gets readahead counters for a handle.
+     * Prediction accuracy is useful / issued; requests still buffered count once consumed or discarded.
+     * @param fp Pointer to FILE.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 if prefetching is not enabled on fp.
+     */
+    int file_prefetch_get_stats(FILE *fp, file_prefetch_stats *out) {
+        if (fp == NULL || out == NULL) return -1;
+        yfile_state *s = yfile_state_find(fp);
+        if (s == NULL || s->prefetch == NULL) return -1;
+        *out = s->prefetch->stats;
+        return 0;
+    }
+
+    /**
+     * @brief Disables readahead on a handle and releases its buffers.
+     * @param fp Pointer to FILE.
+     * @return 0 on success, -1 if prefetching was not enabled.
+     */
+    int file_prefetch_disable(FILE *fp) {
+        yfile_state *s = yfile_state_find(fp);
+        if (s == NULL || s->prefetch == NULL) return -1;
+        yfile_prefetch_free(s->prefetch);
+        s->prefetch = NULL;
+        return 0;
+    }
+
+    /**
+     * @brief Counters of a compressed stream (see file_compress_enable).
+     */
+    typedef struct file_compress_stats {
+        uint64_t bytes;                // Uncompressed bytes passed through file_write or returned by file_read.
+        uint64_t packed_bytes;         // Bytes written to or read from the file, frame headers included.
+        uint64_t blocks;
+        uint64_t stored_blocks;        // Written uncompressed because LZ4 did not shrink them.
+        uint64_t wait_ns;              // Time the caller spent waiting for the background thread.
+    } file_compress_stats;
+
+#define YFILE_LZ4_MAGIC      0x184D2204u
+#define YFILE_LZ4_HASH_LOG   16
+#define YFILE_LZ4_MAX_OFFSET 65535
+#define YFILE_LZ4_HISTORY    (64 * 1024)
+
+    uint32_t yfile_lz4_read32(const uint8_t *p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    uint64_t yfile_lz4_read64(const uint8_t *p) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return v;
+    }
+
+    void yfile_lz4_write32(uint8_t *p, uint32_t v) {
+        memcpy(p, &v, 4);
+    }
+
+    uint32_t yfile_lz4_hash(uint32_t v) {
+        return (v * 2654435761u) >> (32 - YFILE_LZ4_HASH_LOG);
+    }
+
+    // Frame header checksum: the second byte of XXH32 (seed 0) over the descriptor. Descriptors are
+    // shorter than 16 bytes, so only the short-input path of XXH32 is needed.
+    uint32_t yfile_lz4_header_checksum(const uint8_t *p, size_t len) {
+        uint32_t h = 374761393u + (uint32_t)len;
+        for (; len >= 4; p += 4, len -= 4) {
+            h += yfile_lz4_read32(p) * 3266489917u;
+            h = ((h << 17) | (h >> 15)) * 668265263u;
+        }
+        for (; len > 0; p++, len--) {
+            h += *p * 374761393u;
+            h = ((h << 11) | (h >> 21)) * 2654435761u;
+        }
+        h ^= h >> 15;
+        h *= 2246822519u;
+        h ^= h >> 13;
+        h *= 3266489917u;
+        h ^= h >> 16;
+        return (h >> 8) & 0xFF;
+    }
+
+    uint8_t *yfile_lz4_put_length(uint8_t *op, size_t len) {
+        for (; len >= 255; len -= 255) *op++ = 255;
+        *op++ = (uint8_t)len;
+        return op;
+    }
+
+    // Compresses one independent LZ4 block with a greedy single-probe match finder.
+    // Returns the compressed size, or 0 if it would not fit in cap.
+    size_t yfile_lz4_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap, uint32_t *table) {
+        const uint8_t *ip = src, *anchor = src, *iend = src + len;
+        uint8_t *op = dst, *oend = dst + cap;
+        if (len >= 13) {
+            // The format wants the last match to start 12 bytes before the end and the last 5 bytes as literals.
+            const uint8_t *mflimit = iend - 12, *matchlimit = iend - 5;
+            unsigned misses = 0;
+            // The table is not cleared between blocks: stale entries are only candidates and get verified.
+            while (ip < mflimit) {
+                uint32_t seq = yfile_lz4_read32(ip);
+                uint32_t h = yfile_lz4_hash(seq);
+                const uint8_t *ref = src + table[h];
+                table[h] = (uint32_t)(ip - src);
+                if (ref >= ip || ip - ref > YFILE_LZ4_MAX_OFFSET || yfile_lz4_read32(ref) != seq) {
+                    ip += 1 + (misses++ >> 6);     // Skip faster through data that does not compress.
+                    continue;
+                }
+                misses = 0;
+                while (ip > anchor && ref > src && ip[-1] == ref[-1]) { ip--; ref--; }
+
+                const uint8_t *mp = ip + 4, *rp = ref + 4;
+                while (mp + 8 <= matchlimit) {
+                    uint64_t diff = yfile_lz4_read64(mp) ^ yfile_lz4_read64(rp);
+                    if (diff != 0) {
+                        unsigned long bit;
+#if defined(_WIN64)
+                        _BitScanForward64(&bit, diff);
+#else
+                        // _BitScanForward64 is x64/ARM64 only; scan the halves on 32-bit targets.
+                        if ((uint32_t)diff != 0) {
+                            _BitScanForward(&bit, (unsigned long)diff);
+                        } else {
+                            _BitScanForward(&bit, (unsigned long)(diff >> 32));
+                            bit += 32;
+                        }
+#endif
+                        mp += bit >> 3;
+                        goto matched;
+                    }
+                    mp += 8;
+                    rp += 8;
+                }
+                while (mp < matchlimit && *mp == *rp) { mp++; rp++; }
+            matched:;
+                size_t lit = (size_t)(ip - anchor), mlen = (size_t)(mp - ip) - 4;
+                if ((size_t)(oend - op) < 1 + lit + lit / 255 + 1 + 2 + mlen / 255 + 1) return 0;
+                uint8_t *token = op++;
+                *token = (uint8_t)((lit < 15 ? lit : 15) << 4);
+                if (lit >= 15) op = yfile_lz4_put_length(op, lit - 15);
+                memcpy(op, anchor, lit);
+                op += lit;
+                *op++ = (uint8_t)(ip - ref);
+                *op++ = (uint8_t)((ip - ref) >> 8);
+                *token |= (uint8_t)(mlen < 15 ? mlen : 15);
+                if (mlen >= 15) op = yfile_lz4_put_length(op, mlen - 15);
+                ip = anchor = mp;
+                if (ip < mflimit) table[yfile_lz4_hash(yfile_lz4_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+            }
+        }
+        size_t lit = (size_t)(iend - anchor);
+        if ((size_t)(oend - op) < 1 + lit + lit / 255 + 1) return 0;
+        *op++ = (uint8_t)((lit < 15 ? lit : 15) << 4);
+        if (lit >= 15) op = yfile_lz4_put_length(op, lit - 15);
+        memcpy(op, anchor, lit);
+        return (size_t)(op + lit - dst);
+    }
+
+    // Decodes one LZ4 block. dict holds the output that precedes dst, for frames with linked blocks.
+    // Returns the decoded size, or -1 on malformed input.
+    int64_t yfile_lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap, const uint8_t *dict, size_t dict_len) {
+        const uint8_t *ip = src, *iend = src + len;
+        uint8_t *op = dst, *oend = dst + cap;
+        while (ip < iend) {
+            unsigned token = *ip++, b;
+            size_t lit = token >> 4;
+            if (lit == 15) {
+                do {
+                    if (ip >= iend) return -1;
+                    lit += b = *ip++;
+                } while (b == 255);
+            }
+            if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return -1;
+            memcpy(op, ip, lit);
+            op += lit;
+            ip += lit;
+            if (ip == iend) return op - dst;         // The last sequence has literals only.
+
+            if (iend - ip < 2) return -1;
+            size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8, mlen = token & 15;
+            ip += 2;
+            if (mlen == 15) {
+                do {
+                    if (ip >= iend) return -1;
+                    mlen += b = *ip++;
+                } while (b == 255);
+            }
+            mlen += 4;
+            size_t out = (size_t)(op - dst);
+            if (offset == 0 || offset > out + dict_len || (size_t)(oend - op) < mlen) return -1;
+            if (offset > out) {
+                size_t back = offset - out, n = back < mlen ? back : mlen;
+                memcpy(op, dict + dict_len - back, n);
+                op += n;
+                mlen -= n;
+            }
+            if (offset == 1) {
+                memset(op, op[-1], mlen);
+                op += mlen;
+            } else {
+                // Overlapping matches repeat the last offset bytes, so copy in pieces no longer than offset.
+                while (mlen > 0) {
+                    size_t n = mlen < offset ? mlen : offset;
+                    memcpy(op, op - offset, n);
+                    op += n;
+                    mlen -= n;
+                }
+            }
+        }
+        return -1;
+    }
+
+    enum { YFILE_COMPRESS_FREE, YFILE_COMPRESS_QUEUED, YFILE_COMPRESS_READY };
+
+    typedef struct yfile_compress_buf {
+        char *data;
+        uint32_t len;                  // Bytes filled (writing) or decoded (reading).
+        uint32_t size;                 // Allocated bytes.
+        volatile LONG state;
+    } yfile_compress_buf;
+
+    typedef struct yfile_compress {
+        FILE *fp;
+        int writing;
+        uint32_t block_size;           // Writing: the frame's block size. Reading: largest block size seen.
+        yfile_compress_buf bufs[2];    // The caller fills or drains one while the thread works on the other.
+        uint32_t cur;                  // Buffer on the caller side.
+        uint32_t pos;                  // Reading: bytes of bufs[cur] already returned.
+        HANDLE thread;
+        HANDLE wake;                   // Auto-reset; a buffer was handed to the thread, or stop was set.
+        HANDLE done;                   // Auto-reset; the thread handed a buffer back.
+        volatile LONG stop;
+        volatile LONG failed;          // Sticky; error holds the Win32 code.
+        DWORD error;
+        // Owned by the thread.
+        char *packed;                  // One compressed block.
+        uint32_t packed_size;
+        uint32_t *table;               // Match finder hash table.
+        char *history;                 // Tail of the decoded output, for frames with linked blocks.
+        uint32_t history_len;
+        int in_frame, linked, block_checksum, content_checksum;
+        file_compress_stats stats;
+    } yfile_compress;
+
+    int yfile_compress_fail(yfile_compress *z, DWORD error) {
+        if (InterlockedExchange(&z->failed, 1) == 0) z->error = error;
+        return -1;
+    }
+
+    // Grows a pool buffer to at least size bytes; its contents are not kept.
+    int yfile_compress_reserve(char **buf, uint32_t *have, uint32_t size) {
+        if (*have >= size) return 0;
+        if (*buf != NULL) file_buffer_free(*buf, *have);
+        *have = 0;
+        if ((*buf = (char *)file_buffer_alloc(size)) == NULL) return -1;
+        *have = size;
+        return 0;
+    }
+
+    // Reads exactly len bytes of the compressed stream. Returns 1, 0 at a clean end of file when
+    // eof_ok is set, or -1 on a read error or truncated stream.
+    int yfile_compress_fill(yfile_compress *z, void *dst, size_t len, int eof_ok) {
+        size_t got = fread(dst, 1, len, z->fp);
+        z->stats.packed_bytes += got;
+        if (got == len) return 1;
+        if (ferror(z->fp)) return yfile_compress_fail(z, GetLastError() != 0 ? GetLastError() : ERROR_READ_FAULT);
+        if (got == 0 && eof_ok) return 0;
+        return yfile_compress_fail(z, ERROR_BAD_FORMAT);
+    }
+
+    // Reads the next frame header, skipping skippable frames. Returns 1, 0 at end of file, -1 on error.
+    int yfile_compress_read_frame(yfile_compress *z) {
+        uint8_t hdr[16];
+        for (;;) {
+            int r = yfile_compress_fill(z, hdr, 4, 1);
+            if (r <= 0) return r;
+            uint32_t magic = yfile_lz4_read32(hdr);
+            if ((magic & 0xFFFFFFF0u) == 0x184D2A50u) {
+                if (yfile_compress_fill(z, hdr, 4, 0) != 1) return -1;
+                uint32_t skip = yfile_lz4_read32(hdr);
+                if (_fseeki64(z->fp, skip, SEEK_CUR) != 0) return yfile_compress_fail(z, ERROR_BAD_FORMAT);
+                z->stats.packed_bytes += skip;
+                continue;
+            }
+            if (magic != YFILE_LZ4_MAGIC || yfile_compress_fill(z, hdr, 2, 0) != 1) return yfile_compress_fail(z, ERROR_BAD_FORMAT);
+            uint8_t flg = hdr[0], bd = hdr[1];
+            if ((flg >> 6) != 1 || (flg & 0x02) != 0 || (bd & 0x8F) != 0 || (bd >> 4) < 4) return yfile_compress_fail(z, ERROR_BAD_FORMAT);
+            // A dictionary ID means the frame needs a preset dictionary, which nothing here can supply.
+            if (flg & 0x01) return yfile_compress_fail(z, ERROR_NOT_SUPPORTED);
+            size_t desc = 2 + ((flg & 0x08) ? 8 : 0);
+            if (yfile_compress_fill(z, hdr + 2, desc - 1, 0) != 1) return -1;
+            if (hdr[desc] != yfile_lz4_header_checksum(hdr, desc)) return yfile_compress_fail(z, ERROR_CRC);
+
+            uint32_t block_size = 1u << (8 + 2 * (bd >> 4));
+            if (block_size > z->block_size) z->block_size = block_size;
+            z->linked = !(flg & 0x20);
+            z->block_checksum = (flg & 0x10) != 0;
+            z->content_checksum = (flg & 0x04) != 0;
+            z->history_len = 0;
+            if (z->linked && z->history == NULL && (z->history = (char *)malloc(YFILE_LZ4_HISTORY)) == NULL) {
+                return yfile_compress_fail(z, ERROR_NOT_ENOUGH_MEMORY);
+            }
+            z->in_frame = 1;
+            return 1;
+        }
+    }
+
+    // Decodes the next block of the stream into b. Returns 1, 0 at end of stream, -1 on error.
+    // Checksums other than the header's are skipped, not verified.
+    int yfile_compress_read_block(yfile_compress *z, yfile_compress_buf *b) {
+        uint8_t word[4];
+        for (;;) {
+            if (!z->in_frame) {
+                int r = yfile_compress_read_frame(z);
+                if (r <= 0) return r;
+            }
+            if (yfile_compress_fill(z, word, 4, 0) != 1) return -1;
+            uint32_t size = yfile_lz4_read32(word);
+            if (size == 0) {
+                if (z->content_checksum && yfile_compress_fill(z, word, 4, 0) != 1) return -1;
+                z->in_frame = 0;
+                continue;
+            }
+            int stored = (size & 0x80000000u) != 0;
+            size &= 0x7FFFFFFFu;
+            if (size > z->block_size) return yfile_compress_fail(z, ERROR_BAD_FORMAT);
+            if (yfile_compress_reserve(&b->data, &b->size, z->block_size) != 0 ||
+                (!stored && yfile_compress_reserve(&z->packed, &z->packed_size, z->block_size) != 0)) {
+                return yfile_compress_fail(z, ERROR_NOT_ENOUGH_MEMORY);
+            }
+            if (stored) {
+                if (yfile_compress_fill(z, b->data, size, 0) != 1) return -1;
+                b->len = size;
+            } else {
+                if (yfile_compress_fill(z, z->packed, size, 0) != 1) return -1;
+                int64_t n = yfile_lz4_decompress((const uint8_t *)z->packed, size, (uint8_t *)b->data, z->block_size,
+                                                 (const uint8_t *)z->history, z->linked ? z->history_len : 0);
+                if (n < 0) return yfile_compress_fail(z, ERROR_BAD_FORMAT);
+                b->len = (uint32_t)n;
+            }
+            if (z->block_checksum && yfile_compress_fill(z, word, 4, 0) != 1) return -1;
+            if (b->len == 0) continue;              // Would read as end of stream.
+
+            if (z->linked) {
+                if (b->len >= YFILE_LZ4_HISTORY) {
+                    memcpy(z->history, b->data + b->len - YFILE_LZ4_HISTORY, YFILE_LZ4_HISTORY);
+                    z->history_len = YFILE_LZ4_HISTORY;
+                } else {
+                    uint32_t keep = z->history_len < YFILE_LZ4_HISTORY - b->len ? z->history_len : YFILE_LZ4_HISTORY - b->len;
+                    memmove(z->history, z->history + z->history_len - keep, keep);
+                    memcpy(z->history + keep, b->data, b->len);
+                    z->history_len = keep + b->len;
+                }
+            }
+            z->stats.blocks++;
+            if (stored) z->stats.stored_blocks++;
+            return 1;
+        }
+    }
+
+    // Compresses b and appends it to the frame, stored raw when LZ4 does not shrink it.
+    int yfile_compress_write_block(yfile_compress *z, yfile_compress_buf *b) {
+        uint8_t *out = (uint8_t *)z->packed;
+        size_t n = yfile_lz4_compress((const uint8_t *)b->data, b->len, out + 4, b->len - 1, z->table);
+        int ok;
+        if (n == 0) {
+            yfile_lz4_write32(out, b->len | 0x80000000u);
+            ok = fwrite(out, 1, 4, z->fp) == 4 && fwrite(b->data, 1, b->len, z->fp) == b->len;
+            n = b->len;
+            z->stats.stored_blocks++;
+        } else {
+            yfile_lz4_write32(out, (uint32_t)n);
+            ok = fwrite(out, 1, n + 4, z->fp) == n + 4;
+        }
+        z->stats.packed_bytes += n + 4;
+        z->stats.blocks++;
+        return ok ? 0 : yfile_compress_fail(z, GetLastError() != 0 ? GetLastError() : ERROR_WRITE_FAULT);
+    }
+
+    // Background thread: takes the two buffers in turn, compressing queued ones (writing) or
+    // decoding into free ones (reading), and hands each back through the done event.
+    DWORD WINAPI yfile_compress_worker(LPVOID param) {
+        yfile_compress *z = (yfile_compress *)param;
+        LONG want = z->writing ? YFILE_COMPRESS_QUEUED : YFILE_COMPRESS_FREE;
+        for (uint32_t i = 0;; i ^= 1) {
+            yfile_compress_buf *b = &z->bufs[i];
+            while (b->state != want && !z->stop) WaitForSingleObject(z->wake, INFINITE);
+            // A writer's stop only comes after every queued buffer was drained.
+            if (b->state != want || (z->stop && !z->writing)) return 0;
+
+            if (z->writing) {
+                if (!z->failed) yfile_compress_write_block(z, b);
+                b->len = 0;
+                InterlockedExchange(&b->state, YFILE_COMPRESS_FREE);
+            } else {
+                int r = z->failed ? -1 : yfile_compress_read_block(z, b);
+                if (r <= 0) b->len = 0;
+                InterlockedExchange(&b->state, YFILE_COMPRESS_READY);
+                if (r <= 0) { SetEvent(z->done); return 0; }
+            }
+            SetEvent(z->done);
+        }
+    }
+
+    void yfile_compress_wait(yfile_compress *z, yfile_compress_buf *b, LONG state) {
+        if (b->state == state) return;
+        uint64_t start = yfile_now_ns();
+        while (b->state != state) WaitForSingleObject(z->done, INFINITE);
+        z->stats.wait_ns += yfile_now_ns() - start;
+    }
+
+    void yfile_compress_submit(yfile_compress *z) {
+        InterlockedExchange(&z->bufs[z->cur].state, YFILE_COMPRESS_QUEUED);
+        SetEvent(z->wake);
+        z->cur ^= 1;
+    }
+
+    size_t yfile_compress_write(yfile_compress *z, const char *buf, size_t len) {
+        size_t total = 0;
+        while (total < len && !z->failed) {
+            yfile_compress_buf *b = &z->bufs[z->cur];
+            yfile_compress_wait(z, b, YFILE_COMPRESS_FREE);
+            size_t n = z->block_size - b->len < len - total ? z->block_size - b->len : len - total;
+            memcpy(b->data + b->len, buf + total, n);
+            b->len += (uint32_t)n;
+            total += n;
+            if (b->len == z->block_size) yfile_compress_submit(z);
+        }
+        z->stats.bytes += total;
+        if (z->failed) { SetLastError(z->error); return 0; }
+        return total;
+    }
+
+    size_t yfile_compress_read(yfile_compress *z, char *buf, size_t max_len, int *failed) {
+        size_t total = 0;
+        while (total < max_len) {
+            yfile_compress_buf *b = &z->bufs[z->cur];
+            yfile_compress_wait(z, b, YFILE_COMPRESS_READY);
+            if (b->len == 0) break;                 // End of stream or error; the thread has exited.
+            size_t n = b->len - z->pos < max_len - total ? b->len - z->pos : max_len - total;
+            memcpy(buf + total, b->data + z->pos, n);
+            z->pos += (uint32_t)n;
+            total += n;
+            if (z->pos == b->len) {
+                z->pos = 0;
+                InterlockedExchange(&b->state, YFILE_COMPRESS_FREE);
+                SetEvent(z->wake);
+                z->cur ^= 1;
+            }
+        }
+        z->stats.bytes += total;
+        *failed = total == 0 && z->failed;
+        if (*failed) SetLastError(z->error);
+        return total;
+    }
+
+    // Queues the partly filled block and waits until both buffers are written out.
+    int yfile_compress_drain(yfile_compress *z) {
+        if (!z->writing) return 0;
+        if (z->bufs[z->cur].len > 0) yfile_compress_submit(z);
+        yfile_compress_wait(z, &z->bufs[0], YFILE_COMPRESS_FREE);
+        yfile_compress_wait(z, &z->bufs[1], YFILE_COMPRESS_FREE);
+        if (z->failed) { SetLastError(z->error); return -1; }
+        return 0;
+    }
+
+    void yfile_compress_free(yfile_compress *z) {
+        if (z == NULL) return;
+        if (z->thread != NULL) {
+            InterlockedExchange(&z->stop, 1);
+            SetEvent(z->wake);
+            WaitForSingleObject(z->thread, INFINITE);
+            CloseHandle(z->thread);
+        }
+        for (int i = 0; i < 2; i++) {
+            if (z->bufs[i].data != NULL) file_buffer_free(z->bufs[i].data, z->bufs[i].size);
+        }
+        if (z->packed != NULL) file_buffer_free(z->packed, z->packed_size);
+        if (z->wake != NULL) CloseHandle(z->wake);
+        if (z->done != NULL) CloseHandle(z->done);
+        free(z->table);
+        free(z->history);
+        free(z);
+    }
+
+    int yfile_compress_flush(FILE *fp) {
+        yfile_state *s = yfile_state_find(fp);
+        return s != NULL && s->compress != NULL ? yfile_compress_drain(s->compress) : 0;
+    }
+
+    // Drains a compressing handle and ends its frame, or stops a decompressing one. The stream then
+    // behaves like a plain one again.
+    int yfile_compress_finish(FILE *fp) {
+        yfile_state *s = yfile_state_find(fp);
+        if (s == NULL || s->compress == NULL) return 0;
+        yfile_compress *z = s->compress;
+        int ret = yfile_compress_drain(z);
+        if (z->writing && ret == 0) {
+            static const char end_mark[4] = { 0 };
+            if (fwrite(end_mark, 1, sizeof(end_mark), fp) != sizeof(end_mark)) ret = -1;
+        }
+        s->compress = NULL;
+        yfile_compress_free(z);
+        return ret;
+    }
+
+    /**
+     * @brief Turns a handle into a compressed stream.
+     *
+     * Data goes through file_write and file_read as usual, but the file holds LZ4 frames that the
+     * lz4 command line tool and liblz4 read and write. Writing starts a new frame at the current
+     * position; file_write copies into one of two block buffers while a background thread
+     * compresses and writes the other. Reading decodes up to two blocks ahead on the same kind
+     * of thread, accepts concatenated and skippable frames and linked or independent blocks, and
+     * checks the frame header checksum but not block or content checksums.
+     * file_flush and file_flush_ex write out the partial block first, so the file decodes up to
+     * the flushed data; file_close ends the frame. Other calls (offsets, pread, truncate, ...)
+     * see the compressed bytes and must not be mixed in. Use binary-mode streams.
+     * @param fp Pointer to FILE, positioned where the frame starts or is to be written.
+     * @param writing 1 to compress what is written, 0 to decompress what is read.
+     * @param block_size Uncompressed block size when writing, rounded up to 64 KiB, 256 KiB, 1 MiB
+     *        or 4 MiB; 0 picks 1 MiB. Larger blocks compress better but delay the first write.
+     * @return 0 on success, -1 on failure.
+     */
+    int file_compress_enable(FILE *fp, int writing, uint32_t block_size) {
+        if (fp == NULL) return -1;
+        yfile_state *s = yfile_state_acquire(fp);
+        if (s == NULL || s->compress != NULL) return -1;
+        yfile_compress *z = (yfile_compress *)calloc(1, sizeof(yfile_compress));
+        if (z == NULL) return -1;
+        z->fp = fp;
+        z->writing = writing != 0;
+        z->wake = CreateEventA(NULL, FALSE, FALSE, NULL);
+        z->done = CreateEventA(NULL, FALSE, FALSE, NULL);
+        int ok = z->wake != NULL && z->done != NULL;
+
+        if (ok && z->writing) {
+            uint8_t id = 4;
+            if (block_size == 0) block_size = 1 << 20;
+            while (id < 7 && (1u << (8 + 2 * id)) < block_size) id++;
+            z->block_size = 1u << (8 + 2 * id);
+            ok = yfile_compress_reserve(&z->bufs[0].data, &z->bufs[0].size, z->block_size) == 0 &&
+                 yfile_compress_reserve(&z->bufs[1].data, &z->bufs[1].size, z->block_size) == 0 &&
+                 yfile_compress_reserve(&z->packed, &z->packed_size, z->block_size + 4) == 0 &&
+                 (z->table = (uint32_t *)calloc((size_t)1 << YFILE_LZ4_HASH_LOG, sizeof(uint32_t))) != NULL;
+            // Independent blocks, no checksums besides the header's, no content size.
+            uint8_t header[7] = { 0x04, 0x22, 0x4D, 0x18, 0x60, (uint8_t)(id << 4), 0 };
+            header[6] = (uint8_t)yfile_lz4_header_checksum(header + 4, 2);
+            if (ok && fwrite(header, 1, sizeof(header), fp) != sizeof(header)) ok = 0;
+            z->stats.packed_bytes = sizeof(header);
+        }
+        if (ok) ok = (z->thread = CreateThread(NULL, 64 * 1024, yfile_compress_worker, z, 0, NULL)) != NULL;
+        if (!ok) {
+            yfile_compress_free(z);
+            return -1;
+        }
+        s->compress = z;
+        return 0;
+    }
+
+    /**
+     * @brief Opens a compressed stream (see file_compress_enable).
+     * @param filename File path.
+     * @param mode "r" to decompress, "w" or "a" to compress; "a" adds a new frame after the
+     *        existing ones. "b" is implied, "x" is honoured and "+" is not supported.
+     * @param block_size Block size when writing, 0 for the default.
+     * @return FILE pointer on success, NULL on failure.
+     */
+    FILE *file_open_compressed(const char *filename, const char *mode, uint32_t block_size) {
+        if (!filename || !mode || (mode[0] != 'r' && mode[0] != 'w' && mode[0] != 'a') || strchr(mode, '+') != NULL) return NULL;
+        char crt_mode[4] = { mode[0], 'b', strchr(mode, 'x') != NULL ? 'x' : '\0', '\0' };
+        FILE *fp = file_open(filename, crt_mode);
+        if (fp == NULL) return NULL;
+        if (file_compress_enable(fp, mode[0] != 'r', block_size) != 0) {
+            DWORD error = GetLastError();
+            file_close(fp);
+            SetLastError(error);
+            return NULL;
+        }
+        return fp;
+    }
+
+    /**
+     * @brief Gets the counters of a compressed stream.
+     * Counters updated by the background thread are exact once a file_flush has returned.
+     * @param fp Pointer to FILE.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 if fp is not a compressed stream.
+     */
+    int file_compress_get_stats(FILE *fp, file_compress_stats *out) {
+        if (fp == NULL || out == NULL) return -1;
+        yfile_state *s = yfile_state_find(fp);
+        if (s == NULL || s->compress == NULL) return -1;
+        *out = s->compress->stats;
+        return 0;
+    }
+
+    size_t yfile_path_root_len(const char *path);
+
+    // A change-notification watch on one directory. The generation is bumped from the thread pool
+    // whenever something in the directory changes, so callers can check for changes without a syscall.
+    // Each watch links to a names-only watch on its parent directory, up to the root, so renaming or
+    // deleting any ancestor counts as a change too: the handles follow the directory object, not its path.
+    // Watches are reference counted (cache entries and child watches hold references) and closed with
+    // the last one, so an open directory handle never outlives the entries that need it.
+    typedef struct yfile_dir_watch {
+        char *dir;                 // Absolute path.
+        int names_only;            // Watches subdirectory names only (ancestor link).
+        HANDLE change;             // FindFirstChangeNotification handle.
+        HANDLE wait;               // RegisterWaitForSingleObject registration.
+        volatile LONG generation;
+        volatile LONG refs;        // Dropped under the exclusive list lock, see yfile_dir_watch_put.
+        struct yfile_dir_watch *parent;
+        struct yfile_dir_watch *next;
+    } yfile_dir_watch;
+
+#define YFILE_DIR_WATCH_MAX 256
+
+    yfile_dir_watch *yfile_dir_watches = NULL;
+    size_t yfile_dir_watch_count = 0;
+    SRWLOCK yfile_dir_watch_lock = SRWLOCK_INIT;
+
+    void CALLBACK yfile_dir_watch_fired(PVOID context, BOOLEAN timed_out) {
+        yfile_dir_watch *w = (yfile_dir_watch *)context;
+        (void)timed_out;
+        // Publish before re-arming: until the bump is visible the handle stays signaled, and changes
+        // that land before the re-arm are recorded by the system and signal it again immediately.
+        InterlockedIncrement(&w->generation);
+        FindNextChangeNotification(w->change);
+    }
+
+    // Returns the generation of a watch and all its ancestors. Each part only grows, so the sum
+    // changes whenever any of them does.
+    LONG yfile_dir_watch_generation(yfile_dir_watch *w) {
+        LONG gen = 0;
+        for (; w != NULL; w = w->parent) { gen += w->generation; }
+        return gen;
+    }
+
+    // Returns 1 if nothing in the watched directory or its ancestors changed since generation was read
+    // with yfile_dir_watch_generation, 0 otherwise. Polls the notification handles as well, so a change
+    // the thread pool has not handled yet counts.
+    int yfile_dir_watch_unchanged(yfile_dir_watch *w, LONG generation) {
+        if (w == NULL || yfile_dir_watch_generation(w) != generation) { return 0; }
+        for (; w != NULL; w = w->parent) {
+            if (WaitForSingleObject(w->change, 0) != WAIT_TIMEOUT) { return 0; }
+        }
+        return 1;
+    }
+
+    // Takes another reference on a watch the caller already holds one on.
+    yfile_dir_watch *yfile_dir_watch_ref(yfile_dir_watch *w) {
+        if (w != NULL) { InterlockedIncrement(&w->refs); }
+        return w;
+    }
+
+    // Drops a reference. The last one unlinks the watch, closes its handles and releases its parent.
+    void yfile_dir_watch_put(yfile_dir_watch *w) {
+        while (w != NULL) {
+            // Lookups only add references under the list lock, so a count above one can drop without it.
+            LONG refs = w->refs;
+            if (refs > 1) {
+                if (InterlockedCompareExchange(&w->refs, refs - 1, refs) != refs) { continue; }
+                return;
+            }
+            AcquireSRWLockExclusive(&yfile_dir_watch_lock);
+            if (InterlockedDecrement(&w->refs) != 0) {
+                ReleaseSRWLockExclusive(&yfile_dir_watch_lock);
+                return;
+            }
+            yfile_dir_watch **link = &yfile_dir_watches;
+            while (*link != w) { link = &(*link)->next; }
+            *link = w->next;
+            yfile_dir_watch_count--;
+            ReleaseSRWLockExclusive(&yfile_dir_watch_lock);
+
+            // Waits for a running yfile_dir_watch_fired before the handle goes away.
+            UnregisterWaitEx(w->wait, INVALID_HANDLE_VALUE);
+            FindCloseChangeNotification(w->change);
+            yfile_dir_watch *parent = w->parent;
+            free(w->dir);
+            free(w);
+            w = parent;
+        }
+    }
+
+    // Copies the directory part of path into dir. Returns 0 on success, -1 if there is none or it is too long.
+    int yfile_dir_part(const char *path, char *dir, size_t size) {
+        const char *slash = strrchr(path, '\\');
+        const char *fwd = strrchr(path, '/');
+        if (fwd > slash) { slash = fwd; }
+        if (slash == NULL) { return -1; }
+        size_t dirlen = (size_t)(slash - path);
+        // Keep the separator for root directories; "C:" alone would mean the drive's current directory.
+        if (dirlen == 0 || path[dirlen - 1] == ':') { dirlen++; }
+        if (dirlen >= size) { return -1; }
+        memcpy(dir, path, dirlen);
+        dir[dirlen] = '\0';
+        return 0;
+    }
+
+    // Returns a reference to the watch on an absolute directory, creating it and its ancestor chain if possible.
+    yfile_dir_watch *yfile_dir_watch_open(const char *dir, int names_only) {
+        AcquireSRWLockShared(&yfile_dir_watch_lock);
+        yfile_dir_watch *w = yfile_dir_watches;
+        while (w != NULL && (w->names_only != names_only || strcmp(w->dir, dir) != 0)) { w = w->next; }
+        if (w != NULL) { InterlockedIncrement(&w->refs); }
+        ReleaseSRWLockShared(&yfile_dir_watch_lock);
+        if (w != NULL) { return w; }
+
+        // The root cannot be renamed; every other directory needs its parent watched first.
+        yfile_dir_watch *parent = NULL;
+        if (strlen(dir) > yfile_path_root_len(dir)) {
+            char up[MAX_PATH * 4];
+            if (yfile_dir_part(dir, up, sizeof(up)) != 0 || (parent = yfile_dir_watch_open(up, 1)) == NULL) { return NULL; }
+        }
+
+        AcquireSRWLockExclusive(&yfile_dir_watch_lock);
+        if (yfile_dir_watch_count >= YFILE_DIR_WATCH_MAX || (w = (yfile_dir_watch *)calloc(1, sizeof(yfile_dir_watch))) == NULL) {
+            ReleaseSRWLockExclusive(&yfile_dir_watch_lock);
+            yfile_dir_watch_put(parent);
+            return NULL;
+        }
+        // Recheck under the exclusive lock: another thread may have added the watch meanwhile.
+        for (yfile_dir_watch *x = yfile_dir_watches; x != NULL; x = x->next) {
+            if (x->names_only == names_only && strcmp(x->dir, dir) == 0) {
+                InterlockedIncrement(&x->refs);
+                free(w);
+                ReleaseSRWLockExclusive(&yfile_dir_watch_lock);
+                yfile_dir_watch_put(parent);
+                return x;
+            }
+        }
+        w->refs = 1;
+        w->names_only = names_only;
+        w->parent = parent;
+        w->dir = (char *)malloc(strlen(dir) + 1);
+        if (w->dir != NULL) {
+            strcpy(w->dir, dir);
+            w->change = FindFirstChangeNotificationA(w->dir, FALSE, names_only ? FILE_NOTIFY_CHANGE_DIR_NAME :
+                FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+        }
+        if (w->dir == NULL || w->change == INVALID_HANDLE_VALUE ||
+            !RegisterWaitForSingleObject(&w->wait, w->change, yfile_dir_watch_fired, w, INFINITE, WT_EXECUTEDEFAULT)) {
+            if (w->dir != NULL && w->change != INVALID_HANDLE_VALUE) { FindCloseChangeNotification(w->change); }
+            free(w->dir);
+            free(w);
+            ReleaseSRWLockExclusive(&yfile_dir_watch_lock);
+            yfile_dir_watch_put(parent);
+            return NULL;
+        }
+        w->next = yfile_dir_watches;
+        yfile_dir_watches = w;
+        yfile_dir_watch_count++;
+        ReleaseSRWLockExclusive(&yfile_dir_watch_lock);
+        return w;
+    }
+
+    // Returns a reference to the watch for the directory part of path, creating it if possible; release
+    // it with yfile_dir_watch_put. Relative paths are resolved against the current directory first.
+    // Returns NULL when the directory cannot be watched (or the watch limit is reached); callers then
+    // revalidate every time.
+    yfile_dir_watch *yfile_dir_watch_get(const char *path) {
+        char full[MAX_PATH * 4], dir[MAX_PATH * 4];
+        DWORD n = GetFullPathNameA(path, (DWORD)sizeof(full), full, NULL);
+        if (n == 0 || n >= sizeof(full) || yfile_dir_part(full, dir, sizeof(dir)) != 0) { return NULL; }
+        return yfile_dir_watch_open(dir, 0);
+    }
+
+    /**
+     * @brief An immutable, reference-counted snapshot of a whole file.
+     * data is NUL-terminated for convenience; size excludes the terminator.
+     */
+    typedef struct file_content {
+        const char *data;
+        size_t size;
+        volatile LONG refs;
+    } file_content;
+
+    /**
+     * @brief Whole-file content cache counters.
+     */
+    typedef struct file_content_stats {
+        uint64_t hits;             // Served without touching the file system.
+        uint64_t validated_hits;   // Served after a full identity check (the directory changed or the TTL ran out).
+        uint64_t loads;            // Files read from disk.
+        uint64_t evictions;
+        uint64_t resident_bytes;
+        uint64_t budget_bytes;
+    } file_content_stats;
+
+    typedef struct yfile_content_entry {
+        char *path;
+        file_content *content;
+        uint64_t file_size;
+        FILETIME write_time;
+        LONGLONG change_time;      // FILE_BASIC_INFO.ChangeTime: also moves on metadata-only updates.
+        DWORD volume;              // Volume serial number and file index: the identity of the file.
+        uint64_t file_index;
+        yfile_dir_watch *watch;    // Referenced; released with the entry.
+        LONG watch_generation;     // Directory generation when the entry was last known valid.
+        ULONGLONG checked_at;      // GetTickCount64 when the entry was last known valid.
+        struct yfile_content_entry *prev, *next;   // LRU, head = most recent.
+        struct yfile_content_entry *hnext;
+    } yfile_content_entry;
+
+#define YFILE_CONTENT_BUCKETS 1024
+#define YFILE_CONTENT_TTL_MS  1000   // Longest a hit goes unverified while the notifications stay quiet.
+
+    typedef struct yfile_content_cache {
+        SRWLOCK lock;
+        yfile_content_entry *buckets[YFILE_CONTENT_BUCKETS];
+        yfile_content_entry *head, *tail;
+        uint64_t budget;
+        file_content_stats stats;
+    } yfile_content_cache;
+
+    yfile_content_cache yfile_contents = { SRWLOCK_INIT, { 0 }, NULL, NULL, 64ULL << 20, { 0 } };
+
+    /**
+     * @brief Releases a reference returned by file_read_cached.
+     * @param content Snapshot to release. NULL is ignored.
+     */
+    void file_content_release(const file_content *content) {
+        if (content == NULL) return;
+        if (InterlockedDecrement(&((file_content *)content)->refs) == 0) free((void *)content);
+    }
+
+    void yfile_content_unlink(yfile_content_cache *c, yfile_content_entry *e) {
+        if (e->prev != NULL) e->prev->next = e->next; else c->head = e->next;
+        if (e->next != NULL) e->next->prev = e->prev; else c->tail = e->prev;
+        e->prev = e->next = NULL;
+    }
+
+    void yfile_content_push_front(yfile_content_cache *c, yfile_content_entry *e) {
+        e->prev = NULL;
+        e->next = c->head;
+        if (c->head != NULL) c->head->prev = e; else c->tail = e;
+        c->head = e;
+    }
+
+    // Removes an entry from the hash and LRU and drops the cache's reference to its content.
+    void yfile_content_drop(yfile_content_cache *c, yfile_content_entry *e) {
+        yfile_content_entry **link = &c->buckets[yfile_hash32(e->path, strlen(e->path)) & (YFILE_CONTENT_BUCKETS - 1)];
+        while (*link != e) link = &(*link)->hnext;
+        *link = e->hnext;
+        yfile_content_unlink(c, e);
+        c->stats.resident_bytes -= e->content->size;
+        file_content_release(e->content);
+        yfile_dir_watch_put(e->watch);
+        free(e->path);
+        free(e);
+    }
+
+    int yfile_filetime_eq(FILETIME a, FILETIME b) {
+        return a.dwLowDateTime == b.dwLowDateTime && a.dwHighDateTime == b.dwHighDateTime;
+    }
+
+    // Reads a whole file into a new snapshot and fills in its validation attributes.
+    file_content *yfile_content_load(const char *path, yfile_content_entry *attrs) {
+        HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (h == INVALID_HANDLE_VALUE) return NULL;
+
+        BY_HANDLE_FILE_INFORMATION info;
+        FILE_BASIC_INFO basic;
+        file_content *content = NULL;
+        if (GetFileInformationByHandle(h, &info) && GetFileInformationByHandleEx(h, FileBasicInfo, &basic, sizeof(basic))) {
+            uint64_t size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+            if (size < (uint64_t)SIZE_MAX - sizeof(file_content) - 1 &&
+                (content = (file_content *)malloc(sizeof(file_content) + (size_t)size + 1)) != NULL) {
+                char *data = (char *)(content + 1);
+                if (yfile_pread(h, data, (size_t)size, 0) != (int64_t)size) {
+                    free(content);
+                    content = NULL;
+                } else {
+                    data[size] = '\0';
+                    content->data = data;
+                    content->size = (size_t)size;
+                    content->refs = 1;
+                    attrs->file_size = size;
+                    attrs->write_time = info.ftLastWriteTime;
+                    attrs->change_time = basic.ChangeTime.QuadPart;
+                    attrs->volume = info.dwVolumeSerialNumber;
+                    attrs->file_index = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+                }
+            }
+        }
+        CloseHandle(h);
+        return content;
+    }
+
+    // Returns 1 if the file at path is still the one loaded (same volume serial and file index) and its
+    // size, last-write time and change time are unchanged. Creation time is not compared: tunneling
+    // carries it over to a file that replaces another under the same name.
+    int yfile_content_valid(const char *path, const yfile_content_entry *attrs) {
+        HANDLE h = CreateFileA(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                               OPEN_EXISTING, 0, NULL);
+        if (h == INVALID_HANDLE_VALUE) return 0;
+        BY_HANDLE_FILE_INFORMATION info;
+        FILE_BASIC_INFO basic;
+        BOOL ok = GetFileInformationByHandle(h, &info) && GetFileInformationByHandleEx(h, FileBasicInfo, &basic, sizeof(basic));
+        CloseHandle(h);
+        return ok && info.dwVolumeSerialNumber == attrs->volume &&
+               (((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow) == attrs->file_index &&
+               (((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow) == attrs->file_size &&
+               yfile_filetime_eq(info.ftLastWriteTime, attrs->write_time) && basic.ChangeTime.QuadPart == attrs->change_time;
+    }
+
+    /**
+     * @brief Sets the memory budget of the whole-file content cache (default 64 MiB).
+     * Files larger than a quarter of the budget are returned but not cached.
+     * @param budget_bytes New budget; shrinking it evicts least recently used files immediately.
+     *                     0 disables caching, which empties the cache and closes its directory watches.
+     * @return 0 on success.
+     */
+    int file_content_cache_configure(uint64_t budget_bytes) {
+        yfile_content_cache *c = &yfile_contents;
+        AcquireSRWLockExclusive(&c->lock);
+        c->budget = budget_bytes;
+        while (c->stats.resident_bytes > c->budget && c->tail != NULL) {
+            yfile_content_drop(c, c->tail);
+            c->stats.evictions++;
+        }
+        ReleaseSRWLockExclusive(&c->lock);
+        return 0;
+    }
+
+    // file_read_cached without the instrumentation hooks.
+    const file_content *yfile_read_cached(const char *path) {
+        if (path == NULL) return NULL;
+        yfile_content_cache *c = &yfile_contents;
+        size_t pathlen = strlen(path);
+        size_t b = yfile_hash32(path, pathlen) & (YFILE_CONTENT_BUCKETS - 1);
+
+        // Copy what the check needs and pin the snapshot under the shared lock, then validate unlocked.
+        AcquireSRWLockShared(&c->lock);
+        yfile_content_entry *e = c->buckets[b];
+        while (e != NULL && strcmp(e->path, path) != 0) e = e->hnext;
+        yfile_content_entry seen;
+        file_content *cached = NULL;
+        if (e != NULL) {
+            seen = *e;
+            cached = e->content;
+            InterlockedIncrement(&cached->refs);
+            yfile_dir_watch_ref(seen.watch);   // The entry, and its reference, may go while we check.
+        }
+        ReleaseSRWLockShared(&c->lock);
+        if (cached != NULL) {
+            // While the directory chain is quiet nothing can have been renamed over the file, so a recent
+            // check still holds; otherwise, or once the TTL runs out (bounding how long a lost or late
+            // notification can go unnoticed), the file is opened and compared in full.
+            ULONGLONG now = GetTickCount64();
+            LONG gen = yfile_dir_watch_generation(seen.watch);
+            int quiet = yfile_dir_watch_unchanged(seen.watch, seen.watch_generation) && now - seen.checked_at < YFILE_CONTENT_TTL_MS;
+            int fresh = quiet || yfile_content_valid(path, &seen);
+            yfile_dir_watch_put(seen.watch);
+
+            // The entry may have been replaced or evicted meanwhile; only touch it if it still holds our snapshot.
+            AcquireSRWLockExclusive(&c->lock);
+            for (e = c->buckets[b]; e != NULL && strcmp(e->path, path) != 0; e = e->hnext) {}
+            if (e != NULL && e->content != cached) e = NULL;
+            if (fresh) {
+                if (quiet) c->stats.hits++; else c->stats.validated_hits++;
+                if (e != NULL) {
+                    if (!quiet) { e->watch_generation = gen; e->checked_at = now; }
+                    yfile_content_unlink(c, e);
+                    yfile_content_push_front(c, e);
+                }
+                ReleaseSRWLockExclusive(&c->lock);
+                return cached;
+            }
+            if (e != NULL) yfile_content_drop(c, e);
+            ReleaseSRWLockExclusive(&c->lock);
+            file_content_release(cached);
+        }
+
+        // Capture the directory generation before reading, so a change during the load is not missed.
+        yfile_content_entry *fresh_entry = (yfile_content_entry *)calloc(1, sizeof(yfile_content_entry));
+        if (fresh_entry == NULL) return NULL;
+        fresh_entry->watch = yfile_dir_watch_get(path);
+        fresh_entry->watch_generation = yfile_dir_watch_generation(fresh_entry->watch);
+        fresh_entry->checked_at = GetTickCount64();
+        file_content *content = yfile_content_load(path, fresh_entry);
+        if (content == NULL) { yfile_dir_watch_put(fresh_entry->watch); free(fresh_entry); return NULL; }
+
+        AcquireSRWLockExclusive(&c->lock);
+        c->stats.loads++;
+        if (content->size > c->budget / 4 || (fresh_entry->path = (char *)malloc(pathlen + 1)) == NULL) {
+            ReleaseSRWLockExclusive(&c->lock);
+            yfile_dir_watch_put(fresh_entry->watch);
+            free(fresh_entry);
+            return content;
+        }
+        memcpy(fresh_entry->path, path, pathlen + 1);
+
+        // Another thread may have loaded the same path meanwhile; the newest load wins.
+        for (e = c->buckets[b]; e != NULL && strcmp(e->path, path) != 0; e = e->hnext) {}
+        if (e != NULL) yfile_content_drop(c, e);
+
+        fresh_entry->content = content;
+        InterlockedIncrement(&content->refs);
+        fresh_entry->hnext = c->buckets[b];
+        c->buckets[b] = fresh_entry;
+        yfile_content_push_front(c, fresh_entry);
+        c->stats.resident_bytes += content->size;
+        while (c->stats.resident_bytes > c->budget && c->tail != NULL && c->tail != fresh_entry) {
+            yfile_content_drop(c, c->tail);
+            c->stats.evictions++;
+        }
+        ReleaseSRWLockExclusive(&c->lock);
+        return content;
+    }
+
+    /**
+     * @brief Returns the contents of a small file, served from memory while the file is unchanged.
+     *
+     * While the change notifications on the file's directory chain stay quiet, a hit checked within the
+     * last YFILE_CONTENT_TTL_MS is served without any system call. Otherwise the file is opened and its
+     * volume serial number, file index, size, last-write time and change time are compared with those
+     * captured at load. No lock is held across the checks. Paths are matched exactly as given.
+     * @param path File path.
+     * @return Snapshot with one reference held by the caller (release with file_content_release),
+     *         or NULL on failure.
+     */
+    const file_content *file_read_cached(const char *path) {
+        if (path == NULL) return NULL;
+        YFILE_OP_BEGIN(FILE_OP_READ_CACHED, NULL, path);
+        const file_content *content = yfile_read_cached(path);
+        YFILE_OP_END(content != NULL ? content->size : 0, content == NULL);
+        return content;
+    }
+
+    /**
+     * @brief Gets whole-file content cache counters.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 on invalid input.
+     */
+    int file_content_cache_get_stats(file_content_stats *out) {
+        if (out == NULL) return -1;
+        AcquireSRWLockShared(&yfile_contents.lock);
+        *out = yfile_contents.stats;
+        out->budget_bytes = yfile_contents.budget;
+        ReleaseSRWLockShared(&yfile_contents.lock);
+        return 0;
+    }
+
+    /**
+     * @brief Negative lookup cache counters.
+     */
+    typedef struct file_negcache_stats {
+        uint64_t hits;             // Misses answered from memory.
+        uint64_t lookups;          // file_exists calls that reached the file system.
+        uint64_t inserts;
+        uint64_t stale;            // Cached misses discarded because their directory changed.
+        uint64_t capacity;
+    } file_negcache_stats;
+
+    typedef struct yfile_negcache_slot {
+        char *path;
+        yfile_dir_watch *watch;
+        LONG generation;
+    } yfile_negcache_slot;
+
+    typedef struct yfile_negcache {
+        SRWLOCK lock;
+        yfile_negcache_slot *slots;
+        size_t nslots;             // Power of two; slots are direct-mapped by path hash.
+        volatile LONG64 hits, lookups, inserts, stale;
+    } yfile_negcache;
+
+    yfile_negcache yfile_negative = { SRWLOCK_INIT, NULL, 0, 0, 0, 0, 0 };
+
+    int yfile_negcache_exists(const char *filename) {
+        yfile_negcache *c = &yfile_negative;
+        // Key by the absolute path: the same relative name means another file after a directory change.
+        char full[MAX_PATH * 4];
+        DWORD n = GetFullPathNameA(filename, (DWORD)sizeof(full), full, NULL);
+        if (n == 0 || n >= sizeof(full)) {
+            InterlockedIncrement64(&c->lookups);
+            return GetFileAttributesA(filename) != INVALID_FILE_ATTRIBUTES ? 0 : 1;
+        }
+        filename = full;
+        size_t len = strlen(filename);
+        size_t i = yfile_hash32(filename, len) & (c->nslots - 1);
+
+        AcquireSRWLockShared(&c->lock);
+        yfile_negcache_slot *sl = &c->slots[i];
+        int cached = sl->path != NULL && strcmp(sl->path, filename) == 0;
+        int hit = cached && yfile_dir_watch_unchanged(sl->watch, sl->generation);
+        ReleaseSRWLockShared(&c->lock);
+        if (hit) { InterlockedIncrement64(&c->hits); return 1; }
+        if (cached) InterlockedIncrement64(&c->stale);
+
+        // Read the directory generation before probing, so a create racing with the probe is caught.
+        yfile_dir_watch *w = yfile_dir_watch_get(filename);
+        LONG gen = yfile_dir_watch_generation(w);
+        InterlockedIncrement64(&c->lookups);
+        if (GetFileAttributesA(filename) != INVALID_FILE_ATTRIBUTES) { yfile_dir_watch_put(w); return 0; }
+        DWORD err = GetLastError();
+        // Only a missing name is worth remembering; access errors and the like are not cached.
+        if (w == NULL || (err != ERROR_FILE_NOT_FOUND && err != ERROR_PATH_NOT_FOUND)) { yfile_dir_watch_put(w); SetLastError(err); return 1; }
+
+        char *copy = (char *)malloc(len + 1);
+        if (copy == NULL) { yfile_dir_watch_put(w); SetLastError(err); return 1; }
+        memcpy(copy, filename, len + 1);
+        AcquireSRWLockExclusive(&c->lock);
+        sl = &c->slots[i];
+        free(sl->path);
+        yfile_dir_watch *old = sl->watch;
+        sl->path = copy;
+        sl->watch = w;   // The slot keeps the reference.
+        sl->generation = gen;
+        ReleaseSRWLockExclusive(&c->lock);
+        yfile_dir_watch_put(old);
+        InterlockedIncrement64(&c->inserts);
+        SetLastError(err);
+        return 1;
+    }
+
+    /**
+     * @brief Enables the negative lookup cache used by file_exists.
+     *
+     * Paths found missing are remembered in a bounded, direct-mapped table together with the change
+     * generation of their parent directory. A repeated probe is answered from memory until something
+     * in that directory is created, renamed or deleted, or until the directory or one of its ancestors
+     * is renamed or deleted. Paths whose parent directory does not exist or cannot be watched are never
+     * cached. Paths are resolved to absolute form first, so changing the current directory is safe.
+     * @param entries Maximum number of cached misses (rounded up to a power of two).
+     * @return 0 on success, -1 on failure (including when the cache is already enabled).
+     */
+    int file_negcache_enable(size_t entries) {
+        if (entries == 0) return -1;
+        size_t n = 1;
+        while (n < entries) n <<= 1;
+        yfile_negcache *c = &yfile_negative;
+        AcquireSRWLockExclusive(&c->lock);
+        if (c->slots != NULL || (c->slots = (yfile_negcache_slot *)calloc(n, sizeof(yfile_negcache_slot))) == NULL) {
+            ReleaseSRWLockExclusive(&c->lock);
+            return -1;
+        }
+        c->nslots = n;
+        ReleaseSRWLockExclusive(&c->lock);
+        InterlockedExchange(&yfile_negcache_active, 1);
+        return 0;
+    }
+
+    /**
+     * @brief Disables the negative lookup cache, frees its entries and closes their directory watches.
+     * Must not race with file_exists calls on other threads.
+     */
+    void file_negcache_disable(void) {
+        yfile_negcache *c = &yfile_negative;
+        InterlockedExchange(&yfile_negcache_active, 0);
+        AcquireSRWLockExclusive(&c->lock);
+        for (size_t i = 0; i < c->nslots; i++) {
+            free(c->slots[i].path);
+            yfile_dir_watch_put(c->slots[i].watch);
+        }
+        free(c->slots);
+        c->slots = NULL;
+        c->nslots = 0;
+        ReleaseSRWLockExclusive(&c->lock);
+    }
+
+    /**
+     * @brief Gets negative lookup cache counters.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 on invalid input.
+     */
+    int file_negcache_get_stats(file_negcache_stats *out) {
+        if (out == NULL) return -1;
+        yfile_negcache *c = &yfile_negative;
+        out->hits = (uint64_t)c->hits;
+        out->lookups = (uint64_t)c->lookups;
+        out->inserts = (uint64_t)c->inserts;
+        out->stale = (uint64_t)c->stale;
+        out->capacity = c->nslots;
+        return 0;
+    }
+
+#define YFILE_SHM_MAGIC  0x324D485345494659ULL   // "YFIESHM2"
+#define YFILE_SHM_WAYS   8                       // Slots probed per key.
+
+    // Header at the start of a shared cache segment. Counters are shared by every attached process.
+    typedef struct yfile_shm_header {
+        volatile LONG64 magic;     // Written last by the creating process.
+        uint64_t nslots;
+        uint32_t block_size;
+        uint32_t reserved;
+        volatile LONG64 hits, misses, steals;
+    } yfile_shm_header;
+
+    // Slot state word: (writer pid << 32) | sequence. An odd sequence means a writer owns the slot;
+    // readers copy optimistically and retry if the word changed. Because the owner pid lives in the
+    // same word, a slot whose writer died mid-update can be taken over atomically. Pids are reused,
+    // so the writer also stamps owner with its creation-time tag and the sequence it acquired.
+    typedef struct yfile_shm_slot {
+        volatile LONG64 state;
+        volatile LONG64 owner;     // (writer tag << 32) | sequence, see yfile_process_tag.
+        volatile LONG64 last_used; // GetTickCount64 of the last hit or fill.
+        uint64_t file_index;
+        uint64_t block;
+        uint64_t stamp;            // File size and write time folded together; changes on modification.
+        DWORD volume;
+        uint32_t len;              // Valid bytes; 0 for an empty slot.
+    } yfile_shm_slot;
+
+    /**
+     * @brief A process's view of a shared-memory block cache segment.
+     */
+    typedef struct file_shm_cache {
+        HANDLE mapping;
+        yfile_shm_header *hdr;
+        yfile_shm_slot *slots;
+        char *data;
+        DWORD pid;
+        uint32_t tag;              // Creation-time tag of this process.
+    } file_shm_cache;
+
+    /**
+     * @brief Shared cache counters (summed over every attached process).
+     */
+    typedef struct file_shm_stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t steals;           // Slots reclaimed from writers that died mid-update.
+        uint64_t slots;
+        uint32_t block_size;
+    } file_shm_stats;
+
+    // Folds a process's creation time into the tag that tells it apart from later processes with the
+    // same pid. Returns 0 if the time cannot be queried.
+    uint32_t yfile_process_tag(HANDLE process) {
+        FILETIME created, exited, kernel, user;
+        if (!GetProcessTimes(process, &created, &exited, &kernel, &user)) return 0;
+        uint32_t tag = (uint32_t)yfile_mix64(((uint64_t)created.dwHighDateTime << 32) | created.dwLowDateTime);
+        return tag != 0 ? tag : 1;
+    }
+
+    /**
+     * @brief Attaches to (or creates) a named shared-memory block cache.
+     *
+     * The segment is a pagefile-backed file mapping, so it lives only while some process has it
+     * attached. Every process must pass the same size and block size.
+     * @param name Segment name; plain names are placed in the session's Local\ namespace.
+     * @param bytes Data capacity in bytes.
+     * @param block_size Cache block size in bytes (power of two, at least 512).
+     * @return Cache view on success, NULL on failure or geometry mismatch.
+     */
+    file_shm_cache *file_shm_cache_attach(const char *name, uint64_t bytes, uint32_t block_size) {
+        if (name == NULL || block_size < 512 || (block_size & (block_size - 1)) != 0) return NULL;
+        uint64_t nslots = bytes / block_size;
+        if (nslots < YFILE_SHM_WAYS) return NULL;
+
+        char full[MAX_PATH];
+        int n = strchr(name, '\\') != NULL ? snprintf(full, sizeof(full), "%s", name)
+                                             : snprintf(full, sizeof(full), "Local\\yfile.%s", name);
+        if (n < 0 || (size_t)n >= sizeof(full)) return NULL;
+
+        uint64_t total = sizeof(yfile_shm_header) + nslots * sizeof(yfile_shm_slot) + nslots * block_size;
+        file_shm_cache *c = (file_shm_cache *)calloc(1, sizeof(file_shm_cache));
+        if (c == NULL) return NULL;
+        c->pid = GetCurrentProcessId();
+        c->tag = yfile_process_tag(GetCurrentProcess());
+        c->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE | SEC_COMMIT,
+                                        (DWORD)(total >> 32), (DWORD)total, full);
+        if (c->mapping == NULL) { free(c); return NULL; }
+        int created = GetLastError() != ERROR_ALREADY_EXISTS;
+
+        c->hdr = (yfile_shm_header *)MapViewOfFile(c->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (c->hdr == NULL) { CloseHandle(c->mapping); free(c); return NULL; }
+        c->slots = (yfile_shm_slot *)(c->hdr + 1);
+        c->data = (char *)(c->slots + nslots);
+
+        // Fresh pagefile sections are zero-filled, which is already a valid empty cache; the creator
+        // only has to publish the geometry.
+        if (created) {
+            c->hdr->nslots = nslots;
+            c->hdr->block_size = block_size;
+            MemoryBarrier();
+            InterlockedExchange64(&c->hdr->magic, (LONG64)YFILE_SHM_MAGIC);
+        } else {
+            for (int i = 0; i < 1000 && c->hdr->magic != (LONG64)YFILE_SHM_MAGIC; i++) Sleep(1);
+        }
+        if (c->hdr->magic != (LONG64)YFILE_SHM_MAGIC || c->hdr->nslots != nslots || c->hdr->block_size != block_size) {
+            UnmapViewOfFile(c->hdr);
+            CloseHandle(c->mapping);
+            free(c);
+            return NULL;
+        }
+        return c;
+    }
+
+    /**
+     * @brief Detaches from a shared cache. The segment is destroyed when the last process detaches.
+     * @param c Cache view.
+     */
+    void file_shm_cache_detach(file_shm_cache *c) {
+        if (c == NULL) return;
+        UnmapViewOfFile(c->hdr);
+        CloseHandle(c->mapping);
+        free(c);
+    }
+
+    // Returns 1 if the process that owns tag under pid is known to have exited. A live process with
+    // the same pid but another creation time reused the pid, so the owner is gone. tag 0 means unknown.
+    int yfile_process_dead(DWORD pid, uint32_t tag) {
+        HANDLE p = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+        if (p == NULL) return GetLastError() == ERROR_INVALID_PARAMETER;
+        DWORD code = 0;
+        int dead = GetExitCodeProcess(p, &code) && code != STILL_ACTIVE;
+        if (!dead && tag != 0) {
+            uint32_t now = yfile_process_tag(p);
+            dead = now != 0 && now != tag;
+        }
+        CloseHandle(p);
+        return dead;
+    }
+
+    // Copies a cached block if present. Returns valid bytes in the block, or -1 on a miss.
+    int64_t yfile_shm_lookup(file_shm_cache *c, const yfile_shm_slot *key, uint64_t first, char *dst, uint32_t within, uint32_t want) {
+        for (uint32_t w = 0; w < YFILE_SHM_WAYS; w++) {
+            yfile_shm_slot *sl = &c->slots[(first + w) % c->hdr->nslots];
+            LONG64 before = sl->state;
+            if ((before & 1) || sl->len == 0 || sl->file_index != key->file_index || sl->block != key->block ||
+                sl->volume != key->volume || sl->stamp != key->stamp) continue;
+            uint32_t len = sl->len;
+            if (len > c->hdr->block_size) continue;
+            if (within < len) memcpy(dst, c->data + ((first + w) % c->hdr->nslots) * c->hdr->block_size + within, within + want > len ? len - within : want);
+            MemoryBarrier();
+            if (sl->state != before) continue;   // Rewritten while we copied.
+            sl->last_used = (LONG64)GetTickCount64();
+            return len;
+        }
+        return -1;
+    }
+
+    // Publishes a block into the least recently used slot of its window. Best effort: gives up if
+    // every candidate is being written by a live process.
+    void yfile_shm_publish(file_shm_cache *c, const yfile_shm_slot *key, uint64_t first, const char *block, uint32_t len) {
+        uint64_t victim = 0;
+        LONG64 oldest = -1;
+        for (uint32_t w = 0; w < YFILE_SHM_WAYS; w++) {
+            uint64_t i = (first + w) % c->hdr->nslots;
+            yfile_shm_slot *sl = &c->slots[i];
+            if (sl->len == 0 && !(sl->state & 1)) { victim = i; oldest = 0; break; }
+            if (oldest < 0 || sl->last_used < oldest) { victim = i; oldest = sl->last_used; }
+        }
+
+        yfile_shm_slot *sl = &c->slots[victim];
+        LONG64 cur = sl->state;
+        LONG64 seq = cur & 0xFFFFFFFF;
+        if (seq & 1) {
+            DWORD owner = (DWORD)((uint64_t)cur >> 32);
+            // The tag is only trusted once the writer has stamped it for this acquisition; until then
+            // a live process under the pid is taken to be the writer.
+            LONG64 who = sl->owner;
+            uint32_t tag = (who & 0xFFFFFFFF) == seq ? (uint32_t)((uint64_t)who >> 32) : 0;
+            if (owner == c->pid ? tag == 0 || tag == c->tag : !yfile_process_dead(owner, tag)) return;
+            InterlockedIncrement64(&c->hdr->steals);
+        }
+        LONG64 mine = ((LONG64)c->pid << 32) | (((seq + 1) | 1) & 0xFFFFFFFF);
+        if (InterlockedCompareExchange64(&sl->state, mine, cur) != cur) return;
+        InterlockedExchange64(&sl->owner, ((LONG64)c->tag << 32) | (mine & 0xFFFFFFFF));
+
+        sl->len = 0;
+        sl->file_index = key->file_index;
+        sl->block = key->block;
+        sl->volume = key->volume;
+        sl->stamp = key->stamp;
+        memcpy(c->data + victim * c->hdr->block_size, block, len);
+        sl->len = len;
+        sl->last_used = (LONG64)GetTickCount64();
+        MemoryBarrier();
+        InterlockedExchange64(&sl->state, ((mine & 0xFFFFFFFF) + 1) & 0xFFFFFFFF);
+    }
+
+    // file_shm_cache_read without the instrumentation hooks.
+    int64_t yfile_shm_cache_read(file_shm_cache *c, FILE *fp, void *buf, size_t len, int64_t offset) {
+        if (c == NULL || fp == NULL || buf == NULL || offset < 0) return -1;
+        if (len == 0) return 0;
+        HANDLE h = yfile_state_read_handle(fp);
+        BY_HANDLE_FILE_INFORMATION info;
+        if (h == INVALID_HANDLE_VALUE || !GetFileInformationByHandle(h, &info)) return -1;
+
+        yfile_shm_slot key;
+        memset(&key, 0, sizeof(key));
+        key.volume = info.dwVolumeSerialNumber;
+        key.file_index = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+        key.stamp = yfile_mix64((((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow) ^
+                                yfile_mix64(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime));
+
+        uint32_t bs = c->hdr->block_size;
+        char *block = NULL;
+        size_t total = 0;
+        while (total < len) {
+            uint64_t pos = (uint64_t)offset + total;
+            key.block = pos / bs;
+            uint32_t within = (uint32_t)(pos % bs);
+            uint32_t want = (len - total) < (size_t)(bs - within) ? (uint32_t)(len - total) : bs - within;
+            uint64_t first = yfile_mix64(key.file_index ^ ((uint64_t)key.volume << 32) ^ yfile_mix64(key.block)) % c->hdr->nslots;
+
+            int64_t valid = yfile_shm_lookup(c, &key, first, (char *)buf + total, within, want);
+            if (valid >= 0) {
+                InterlockedIncrement64(&c->hdr->hits);
+            } else {
+                InterlockedIncrement64(&c->hdr->misses);
+                if (block == NULL && (block = (char *)file_buffer_alloc(bs)) == NULL) return -1;
+                valid = yfile_pread(h, block, bs, key.block * bs);
+                if (valid < 0) { file_buffer_free(block, bs); return -1; }
+                if ((uint64_t)valid > within) memcpy((char *)buf + total, block + within, (uint32_t)valid - within < want ? (uint32_t)valid - within : want);
+                if (valid > 0) yfile_shm_publish(c, &key, first, block, (uint32_t)valid);
+            }
+
+            if ((uint64_t)valid <= within) break;
+            uint32_t got = (uint32_t)valid - within < want ? (uint32_t)valid - within : want;
+            total += got;
+            if (got < want) break;
+        }
+        if (block != NULL) file_buffer_free(block, bs);
+        return (int64_t)total;
+    }
+
+    /**
+     * @brief Reads from an absolute offset through a shared cache, without moving the file position.
+     *
+     * Blocks are keyed by volume, file index, block number and a stamp derived from the file's size
+     * and last-write time, so modifications by any process make old blocks unreachable. The stamp is
+     * queried once per call.
+     * @param c Cache view.
+     * @param fp Pointer to FILE.
+     * @param buf Destination buffer.
+     * @param len Number of bytes to read.
+     * @param offset Absolute file offset.
+     * @return Number of bytes read (short at end of file), or -1 on error.
+     */
+    int64_t file_shm_cache_read(file_shm_cache *c, FILE *fp, void *buf, size_t len, int64_t offset) {
+        if (c == NULL || fp == NULL || buf == NULL || offset < 0) return -1;
+        if (len == 0) return 0;
+        YFILE_OP_BEGIN(FILE_OP_SHM_READ, fp, NULL);
+        YFILE_OP_ARGS(offset, len);
+        int64_t got = yfile_shm_cache_read(c, fp, buf, len, offset);
+        YFILE_OP_END(got > 0 ? got : 0, got < 0);
+        return got;
+    }
+
+    /**
+     * @brief Gets shared cache counters.
+     * @param c Cache view.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 on invalid input.
+     */
+    int file_shm_cache_get_stats(file_shm_cache *c, file_shm_stats *out) {
+        if (c == NULL || out == NULL) return -1;
+        out->hits = (uint64_t)c->hdr->hits;
+        out->misses = (uint64_t)c->hdr->misses;
+        out->steals = (uint64_t)c->hdr->steals;
+        out->slots = c->hdr->nslots;
+        out->block_size = c->hdr->block_size;
+        return 0;
+    }
+
+#define YFILE_POOL_MIN_SHIFT     12                  // Smallest class: 4 KiB.
+#define YFILE_POOL_MAX_SHIFT     26                  // Largest class: 64 MiB; bigger requests bypass the pool.
+#define YFILE_POOL_CLASSES       (YFILE_POOL_MAX_SHIFT - YFILE_POOL_MIN_SHIFT + 1)
+#define YFILE_POOL_TCACHE_BYTES  (4u << 20)          // Idle bytes a thread may keep per class.
+#define YFILE_POOL_DEPOT_BYTES   (64u << 20)         // Idle bytes the global depot keeps per class.
+#define YFILE_POOL_VIRTUAL_SHIFT 16                  // Classes from 64 KiB up come straight from VirtualAlloc.
+
+    /**
+     * @brief Buffer pool counters.
+     */
+    typedef struct file_buffer_stats {
+        uint64_t allocs;
+        uint64_t frees;
+        uint64_t thread_hits;      // Allocations served from the calling thread's cache.
+        uint64_t depot_hits;       // Allocations served from the global depot.
+        uint64_t os_allocs;        // Allocations that had to ask the OS.
+        uint64_t os_frees;
+        uint64_t cap_failures;     // Allocations refused because of the memory cap.
+        uint64_t owned_bytes;      // In use plus idle.
+        uint64_t peak_owned_bytes;
+        uint64_t cap_bytes;        // 0 = unlimited.
+        uint64_t large_page_allocs;     // OS allocations backed by large pages.
+        uint64_t large_page_fallbacks;  // Large-page allocations that fell back to normal pages.
+        uint64_t large_page_threshold;  // 0 = large pages disabled.
+    } file_buffer_stats;
+
+    // Idle buffers are chained through their first bytes.
+    typedef struct yfile_pool_link {
+        struct yfile_pool_link *next;
+    } yfile_pool_link;
+
+    typedef struct yfile_pool_tcache {
+        yfile_pool_link *head[YFILE_POOL_CLASSES];
+        uint32_t count[YFILE_POOL_CLASSES];
+    } yfile_pool_tcache;
+
+    typedef struct yfile_pool_depot {
+        SRWLOCK lock;
+        yfile_pool_link *head;
+        uint32_t count;
+    } yfile_pool_depot;
+
+    typedef struct yfile_pool {
+        INIT_ONCE once;
+        DWORD fls;                 // Fiber-local slot whose destructor drains a thread's cache on exit.
+        yfile_pool_depot depots[YFILE_POOL_CLASSES];
+        volatile LONG64 owned, peak, cap;
+        volatile LONG64 allocs, frees, thread_hits, depot_hits, os_allocs, os_frees, cap_failures;
+        volatile LONG64 large_threshold;   // Smallest allocation to back with large pages, 0 = off.
+        SIZE_T large_page;                 // Large page size, set once large pages are enabled.
+        volatile LONG64 large_allocs, large_fallbacks;
+    } yfile_pool;
+
+    yfile_pool yfile_buffers = { INIT_ONCE_STATIC_INIT, FLS_OUT_OF_INDEXES };
+
+    void file_buffer_pool_trim(void);
+
+    // Returns the class index for a request, or -1 if it is larger than the biggest class.
+    int yfile_pool_class(size_t size) {
+        int cls = 0;
+        while (cls < YFILE_POOL_CLASSES && ((size_t)1 << (YFILE_POOL_MIN_SHIFT + cls)) < size) cls++;
+        return cls < YFILE_POOL_CLASSES ? cls : -1;
+    }
+
+    // Commits bytes of fresh pages, backed by large pages when they are enabled and bytes is large enough.
+    void *yfile_pool_virtual_alloc(yfile_pool *p, size_t bytes) {
+        size_t threshold = (size_t)p->large_threshold;
+        if (threshold != 0 && bytes >= threshold) {
+            // Large-page allocations must be a whole number of large pages; VirtualFree does not need the size.
+            size_t rounded = (bytes + p->large_page - 1) & ~(p->large_page - 1);
+            void *buf = VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (buf != NULL) {
+                InterlockedIncrement64(&p->large_allocs);
+                return buf;
+            }
+            // Physical memory is too fragmented for contiguous large pages; use normal pages.
+            InterlockedIncrement64(&p->large_fallbacks);
+        }
+        return VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+
+    void *yfile_pool_os_alloc(size_t bytes) {
+        if (bytes >= ((size_t)1 << YFILE_POOL_VIRTUAL_SHIFT)) return yfile_pool_virtual_alloc(&yfile_buffers, bytes);
+        return _aligned_malloc(bytes, (size_t)1 << YFILE_POOL_MIN_SHIFT);
+    }
+
+    void yfile_pool_os_free(void *buf, size_t bytes) {
+        if (bytes >= ((size_t)1 << YFILE_POOL_VIRTUAL_SHIFT)) VirtualFree(buf, 0, MEM_RELEASE);
+        else _aligned_free(buf);
+    }
+
+    // Charges bytes against the cap. Returns 0 if allowed, -1 if the cap would be exceeded.
+    int yfile_pool_charge(yfile_pool *p, size_t bytes) {
+        LONG64 now = InterlockedExchangeAdd64(&p->owned, (LONG64)bytes) + (LONG64)bytes;
+        if (p->cap > 0 && now > p->cap) {
+            InterlockedExchangeAdd64(&p->owned, -(LONG64)bytes);
+            return -1;
+        }
+        LONG64 peak = p->peak;
+        while (now > peak && InterlockedCompareExchange64(&p->peak, now, peak) != peak) peak = p->peak;
+        return 0;
+    }
+
+    // Pushes a buffer into the depot, or returns it to the OS if the depot is full.
+    void yfile_pool_depot_put(yfile_pool *p, int cls, yfile_pool_link *buf) {
+        size_t bytes = (size_t)1 << (YFILE_POOL_MIN_SHIFT + cls);
+        yfile_pool_depot *d = &p->depots[cls];
+        uint32_t limit = (uint32_t)(YFILE_POOL_DEPOT_BYTES / bytes);
+        AcquireSRWLockExclusive(&d->lock);
+        if (d->count < (limit < 2 ? 2 : limit)) {
+            buf->next = d->head;
+            d->head = buf;
+            d->count++;
+            buf = NULL;
+        }
+        ReleaseSRWLockExclusive(&d->lock);
+        if (buf != NULL) {
+            yfile_pool_os_free(buf, bytes);
+            InterlockedExchangeAdd64(&p->owned, -(LONG64)bytes);
+            InterlockedIncrement64(&p->os_frees);
+        }
+    }
+
+    void WINAPI yfile_pool_thread_exit(PVOID data) {
+        yfile_pool_tcache *tc = (yfile_pool_tcache *)data;
+        if (tc == NULL) return;
+        for (int cls = 0; cls < YFILE_POOL_CLASSES; cls++) {
+            while (tc->head[cls] != NULL) {
+                yfile_pool_link *buf = tc->head[cls];
+                tc->head[cls] = buf->next;
+                yfile_pool_depot_put(&yfile_buffers, cls, buf);
+            }
+        }
+        free(tc);
+    }
+
+    BOOL CALLBACK yfile_pool_init(INIT_ONCE *once, PVOID param, PVOID *context) {
+        (void)once; (void)param; (void)context;
+        for (int cls = 0; cls < YFILE_POOL_CLASSES; cls++) InitializeSRWLock(&yfile_buffers.depots[cls].lock);
+        yfile_buffers.fls = FlsAlloc(yfile_pool_thread_exit);
+        return TRUE;
+    }
+
+    // Returns the calling thread's cache, creating it on first use. NULL if thread caching is unavailable.
+    yfile_pool_tcache *yfile_pool_thread_cache(void) {
+        yfile_pool *p = &yfile_buffers;
+        InitOnceExecuteOnce(&p->once, yfile_pool_init, NULL, NULL);
+        if (p->fls == FLS_OUT_OF_INDEXES) return NULL;
+        yfile_pool_tcache *tc = (yfile_pool_tcache *)FlsGetValue(p->fls);
+        if (tc == NULL && (tc = (yfile_pool_tcache *)calloc(1, sizeof(yfile_pool_tcache))) != NULL) {
+            if (!FlsSetValue(p->fls, tc)) { free(tc); tc = NULL; }
+        }
+        return tc;
+    }
+
+    /**
+     * @brief Allocates a page-aligned I/O buffer from the pool.
+     *
+     * Requests are rounded up to a power-of-two class between 4 KiB and 64 MiB and served from the
+     * calling thread's cache, then the shared depot, then the OS. Larger requests go straight to
+     * VirtualAlloc. Contents are not zeroed. yfile uses the pool for all of its chunked I/O buffers.
+     * @param size Requested size in bytes.
+     * @return Buffer on success, NULL on failure or when the memory cap would be exceeded.
+     */
+    void *file_buffer_alloc(size_t size) {
+        yfile_pool *p = &yfile_buffers;
+        if (size == 0) size = 1;
+        int cls = yfile_pool_class(size);
+        size_t bytes = cls >= 0 ? (size_t)1 << (YFILE_POOL_MIN_SHIFT + cls) : size;
+        InterlockedIncrement64(&p->allocs);
+
+        if (cls >= 0) {
+            yfile_pool_tcache *tc = yfile_pool_thread_cache();
+            if (tc != NULL && tc->head[cls] != NULL) {
+                yfile_pool_link *buf = tc->head[cls];
+                tc->head[cls] = buf->next;
+                tc->count[cls]--;
+                InterlockedIncrement64(&p->thread_hits);
+                return buf;
+            }
+
+            yfile_pool_depot *d = &p->depots[cls];
+            AcquireSRWLockExclusive(&d->lock);
+            yfile_pool_link *buf = d->head;
+            if (buf != NULL) { d->head = buf->next; d->count--; }
+            ReleaseSRWLockExclusive(&d->lock);
+            if (buf != NULL) {
+                InterlockedIncrement64(&p->depot_hits);
+                return buf;
+            }
+        }
+
+        // At the cap, idle buffers of other classes are released before refusing the request.
+        if (yfile_pool_charge(p, bytes) != 0 && (file_buffer_pool_trim(), yfile_pool_charge(p, bytes)) != 0) {
+            InterlockedIncrement64(&p->cap_failures);
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return NULL;
+        }
+        void *buf = cls >= 0 ? yfile_pool_os_alloc(bytes) : yfile_pool_virtual_alloc(p, bytes);
+        if (buf == NULL) {
+            InterlockedExchangeAdd64(&p->owned, -(LONG64)bytes);
+            return NULL;
+        }
+        InterlockedIncrement64(&p->os_allocs);
+        return buf;
+    }
+
+    /**
+     * @brief Returns a buffer obtained from file_buffer_alloc.
+     * @param buf Buffer to release. NULL is ignored.
+     * @param size The size that was passed to file_buffer_alloc.
+     */
+    void file_buffer_free(void *buf, size_t size) {
+        yfile_pool *p = &yfile_buffers;
+        if (buf == NULL) return;
+        if (size == 0) size = 1;
+        InterlockedIncrement64(&p->frees);
+
+        int cls = yfile_pool_class(size);
+        if (cls < 0) {
+            VirtualFree(buf, 0, MEM_RELEASE);
+            InterlockedExchangeAdd64(&p->owned, -(LONG64)size);
+            InterlockedIncrement64(&p->os_frees);
+            return;
+        }
+
+        size_t bytes = (size_t)1 << (YFILE_POOL_MIN_SHIFT + cls);
+        // Classes above YFILE_POOL_TCACHE_BYTES get a limit of 0 and go back to the shared depot, so a
+        // thread never parks more than that per class.
+        uint32_t limit = (uint32_t)(YFILE_POOL_TCACHE_BYTES / bytes);
+        yfile_pool_tcache *tc = limit > 0 ? yfile_pool_thread_cache() : NULL;
+        if (tc != NULL && tc->count[cls] < limit) {
+            yfile_pool_link *link = (yfile_pool_link *)buf;
+            link->next = tc->head[cls];
+            tc->head[cls] = link;
+            tc->count[cls]++;
+            return;
+        }
+        yfile_pool_depot_put(p, cls, (yfile_pool_link *)buf);
+    }
+
+    /**
+     * @brief Returns the depot's idle buffers to the OS. Buffers cached by other threads are kept.
+     */
+    void file_buffer_pool_trim(void) {
+        yfile_pool *p = &yfile_buffers;
+        for (int cls = 0; cls < YFILE_POOL_CLASSES; cls++) {
+            size_t bytes = (size_t)1 << (YFILE_POOL_MIN_SHIFT + cls);
+            yfile_pool_depot *d = &p->depots[cls];
+            AcquireSRWLockExclusive(&d->lock);
+            yfile_pool_link *list = d->head;
+            d->head = NULL;
+            d->count = 0;
+            ReleaseSRWLockExclusive(&d->lock);
+            while (list != NULL) {
+                yfile_pool_link *next = list->next;
+                yfile_pool_os_free(list, bytes);
+                InterlockedExchangeAdd64(&p->owned, -(LONG64)bytes);
+                InterlockedIncrement64(&p->os_frees);
+                list = next;
+            }
+        }
+    }
+
+    /**
+     * @brief Sets the pool's memory cap: the most bytes it may own, in use and idle together.
+     * Idle depot buffers are released first when lowering the cap.
+     * @param cap_bytes New cap, 0 for unlimited.
+     * @return 0 on success.
+     */
+    int file_buffer_pool_configure(uint64_t cap_bytes) {
+        InterlockedExchange64(&yfile_buffers.cap, (LONG64)cap_bytes);
+        if (cap_bytes > 0 && (uint64_t)yfile_buffers.owned > cap_bytes) file_buffer_pool_trim();
+        return 0;
+    }
+
+    /**
+     * @brief Gets buffer pool counters.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 on invalid input.
+     */
+    int file_buffer_get_stats(file_buffer_stats *out) {
+        if (out == NULL) return -1;
+        yfile_pool *p = &yfile_buffers;
+        out->allocs = (uint64_t)p->allocs;
+        out->frees = (uint64_t)p->frees;
+        out->thread_hits = (uint64_t)p->thread_hits;
+        out->depot_hits = (uint64_t)p->depot_hits;
+        out->os_allocs = (uint64_t)p->os_allocs;
+        out->os_frees = (uint64_t)p->os_frees;
+        out->cap_failures = (uint64_t)p->cap_failures;
+        out->owned_bytes = (uint64_t)p->owned;
+        out->peak_owned_bytes = (uint64_t)p->peak;
+        out->cap_bytes = (uint64_t)p->cap;
+        out->large_page_allocs = (uint64_t)p->large_allocs;
+        out->large_page_fallbacks = (uint64_t)p->large_fallbacks;
+        out->large_page_threshold = (uint64_t)p->large_threshold;
+        return 0;
+    }
+
+    // Enables SeLockMemoryPrivilege in the process token, which large-page allocations require.
+    int yfile_enable_lock_memory_privilege(void) {
+        HANDLE token;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return -1;
+        TOKEN_PRIVILEGES tp;
+        tp.PrivilegeCount = 1;
+        tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        int ok = LookupPrivilegeValueA(NULL, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid) &&
+                 AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) &&
+                 GetLastError() != ERROR_NOT_ALL_ASSIGNED;  // Succeeds even when the account lacks the right.
+        CloseHandle(token);
+        return ok ? 0 : -1;
+    }
+
+    /**
+     * @brief Backs large pool buffers with large pages to cut TLB misses in bulk copies and scans.
+     *
+     * Needs the "Lock pages in memory" user right. Allocations of at least threshold bytes are
+     * rounded up to whole large pages (2 MiB on x64) and fall back to normal pages whenever the OS
+     * cannot find contiguous physical memory. Large pages are never paged out. Buffers already
+     * idle in the pool keep their current backing.
+     * @param threshold Smallest allocation to back with large pages, clamped up to the large page
+     *        size. 0 disables large pages.
+     * @return 0 on success, -1 if large pages are unsupported or the privilege is not held.
+     */
+    int file_buffer_pool_large_pages(size_t threshold) {
+        yfile_pool *p = &yfile_buffers;
+        if (threshold == 0) {
+            InterlockedExchange64(&p->large_threshold, 0);
+            return 0;
+        }
+        SIZE_T page = GetLargePageMinimum();
+        if (page == 0) {
+            SetLastError(ERROR_NOT_SUPPORTED);
+            return -1;
+        }
+        if (yfile_enable_lock_memory_privilege() != 0) {
+            SetLastError(ERROR_PRIVILEGE_NOT_HELD);
+            return -1;
+        }
+        p->large_page = page;
+        InterlockedExchange64(&p->large_threshold, (LONG64)(threshold < page ? page : threshold));
+        return 0;
+    }
+
+    // One block of arena storage. Blocks are kept across resets and reused in order.
+    typedef struct yfile_arena_block {
+        struct yfile_arena_block *next;
+        size_t size;
+        size_t used;
+    } yfile_arena_block;
+
+    /**
+     * @brief Bump allocator for path strings.
+     *
+     * Every string returned by the file_path_* helpers lives in the arena until the next
+     * file_path_arena_reset. Storage is kept across resets, so once a batch has warmed the arena up,
+     * later batches of the same shape never call malloc.
+     */
+    typedef struct file_path_arena {
+        yfile_arena_block *first;
+        yfile_arena_block *current;
+        size_t block_size;
+    } file_path_arena;
+
+    /**
+     * @brief Initialises an arena.
+     * @param a Arena to initialise.
+     * @param block_size Size of the first block in bytes (later blocks double as needed).
+     * @return 0 on success, -1 on failure.
+     */
+    int file_path_arena_init(file_path_arena *a, size_t block_size) {
+        if (a == NULL) return -1;
+        a->first = a->current = NULL;
+        a->block_size = block_size < 256 ? 256 : block_size;
+        return 0;
+    }
+
+    /**
+     * @brief Releases every string allocated from the arena, keeping its storage for reuse.
+     * @param a Arena.
+     */
+    void file_path_arena_reset(file_path_arena *a) {
+        if (a == NULL) return;
+        for (yfile_arena_block *b = a->first; b != NULL; b = b->next) b->used = 0;
+        a->current = a->first;
+    }
+
+    /**
+     * @brief Frees all arena storage.
+     * @param a Arena.
+     */
+    void file_path_arena_destroy(file_path_arena *a) {
+        if (a == NULL) return;
+        while (a->first != NULL) {
+            yfile_arena_block *next = a->first->next;
+            free(a->first);
+            a->first = next;
+        }
+        a->current = NULL;
+    }
+
+    // Returns len bytes of arena storage, or NULL on allocation failure.
+    char *yfile_arena_alloc(file_path_arena *a, size_t len) {
+        yfile_arena_block *b = a->current;
+        while (b != NULL && b->size - b->used < len) {
+            // Blocks after the current one were emptied by the last reset; move on to them.
+            b = b->next;
+            if (b != NULL) a->current = b;
+        }
+        if (b == NULL) {
+            yfile_arena_block *last = a->first;
+            while (last != NULL && last->next != NULL) last = last->next;
+            size_t size = last != NULL ? last->size * 2 : a->block_size;
+            while (size < len) size *= 2;
+            if ((b = (yfile_arena_block *)malloc(sizeof(yfile_arena_block) + size)) == NULL) return NULL;
+            b->next = NULL;
+            b->size = size;
+            b->used = 0;
+            if (last != NULL) last->next = b; else a->first = b;
+            a->current = b;
+        }
+        char *p = (char *)(b + 1) + b->used;
+        b->used += len;
+        return p;
+    }
+
+    int yfile_is_sep(char c) {
+        return c == '\\' || c == '/';
+    }
+
+    // Length of the root of a path: "\\server\share\", "\\?\X:\", "X:\", "X:", "\" or 0 for relative.
+    size_t yfile_path_root_len(const char *path) {
+        if (yfile_is_sep(path[0]) && yfile_is_sep(path[1])) {
+            // UNC or device path: the root runs through the second component.
+            size_t i = 2, parts = 0;
+            while (path[i] != '\0' && parts < 2) {
+                if (yfile_is_sep(path[i])) parts++;
+                i++;
+            }
+            return i;
+        }
+        if (path[0] != '\0' && path[1] == ':') return yfile_is_sep(path[2]) ? 3 : 2;
+        return yfile_is_sep(path[0]) ? 1 : 0;
+    }
+
+    /**
+     * @brief Copies a string into the arena.
+     * @param a Arena.
+     * @param path String to copy.
+     * @return Arena copy, or NULL on failure.
+     */
+    char *file_path_dup(file_path_arena *a, const char *path) {
+        if (a == NULL || path == NULL) return NULL;
+        size_t len = strlen(path);
+        char *out = yfile_arena_alloc(a, len + 1);
+        if (out != NULL) memcpy(out, path, len + 1);
+        return out;
+    }
+
+    /**
+     * @brief Joins a directory and a name with a single backslash.
+     * @param a Arena.
+     * @param dir Directory; may be empty.
+     * @param name Name to append. If it has a root of its own, it is returned unchanged.
+     * @return Joined path in the arena, or NULL on failure.
+     */
+    char *file_path_join(file_path_arena *a, const char *dir, const char *name) {
+        if (a == NULL || dir == NULL || name == NULL) return NULL;
+        if (yfile_path_root_len(name) > 0 || dir[0] == '\0') return file_path_dup(a, name);
+        size_t dlen = strlen(dir), nlen = strlen(name);
+        int sep = !yfile_is_sep(dir[dlen - 1]) && !(dlen == 2 && dir[1] == ':');
+        char *out = yfile_arena_alloc(a, dlen + sep + nlen + 1);
+        if (out == NULL) return NULL;
+        memcpy(out, dir, dlen);
+        if (sep) out[dlen] = '\\';
+        memcpy(out + dlen + sep, name, nlen + 1);
+        return out;
+    }
+
+    /**
+     * @brief Returns the parent directory of a path.
+     * @param a Arena.
+     * @param path Path; trailing separators are ignored.
+     * @return Parent in the arena ("." for a bare relative name, the root itself for a root),
+     *         or NULL on failure.
+     */
+    char *file_path_parent(file_path_arena *a, const char *path) {
+        if (a == NULL || path == NULL) return NULL;
+        size_t root = yfile_path_root_len(path);
+        size_t end = strlen(path);
+        while (end > root && yfile_is_sep(path[end - 1])) end--;
+        while (end > root && !yfile_is_sep(path[end - 1])) end--;
+        while (end > root && yfile_is_sep(path[end - 1])) end--;
+        if (end == 0) return file_path_dup(a, ".");
+
+        char *out = yfile_arena_alloc(a, end + 1);
+        if (out == NULL) return NULL;
+        memcpy(out, path, end);
+        out[end] = '\0';
+        return out;
+    }
+
+    /**
+     * @brief Normalises a path lexically: separators become single backslashes and "." and ".."
+     * components are resolved. ".." never climbs above a root; leading ".." of relative paths are kept.
+     * The file system is not consulted.
+     * @param a Arena.
+     * @param path Path to normalise.
+     * @return Normalised path in the arena ("." for an empty relative result), or NULL on failure.
+     */
+    char *file_path_normalize(file_path_arena *a, const char *path) {
+        if (a == NULL || path == NULL) return NULL;
+        size_t len = strlen(path);
+        size_t root = yfile_path_root_len(path);
+        char *out = yfile_arena_alloc(a, len + 2);
+        if (out == NULL) return NULL;
+
+        size_t o = 0;
+        for (size_t i = 0; i < root; i++) out[o++] = yfile_is_sep(path[i]) ? '\\' : path[i];
+        size_t floor = o;              // Output may not be trimmed below this point.
+
+        const char *p = path + root;
+        while (*p != '\0') {
+            while (yfile_is_sep(*p)) p++;
+            const char *start = p;
+            while (*p != '\0' && !yfile_is_sep(*p)) p++;
+            size_t clen = (size_t)(p - start);
+            if (clen == 0 || (clen == 1 && start[0] == '.')) continue;
+
+            if (clen == 2 && start[0] == '.' && start[1] == '.') {
+                if (o > floor) {
+                    size_t prev = o;
+                    while (prev > floor && out[prev - 1] != '\\') prev--;
+                    int prev_is_up = o - prev == 2 && out[prev] == '.' && out[prev + 1] == '.';
+                    if (!prev_is_up) {
+                        o = prev > floor ? prev - 1 : floor;
+                        continue;
+                    }
+                } else if (root > 0 && out[root - 1] == '\\') {
+                    continue;          // Cannot climb above an absolute root.
+                }
+            }
+
+            if (o > floor) out[o++] = '\\';
+            memcpy(out + o, start, clen);
+            o += clen;
+        }
+
+        if (o == 0) out[o++] = '.';
+        out[o] = '\0';
+        return out;
+    }
+
+#define FILE_MAPPING_WRITE    0x1      // Map read-write instead of read-only.
+#define FILE_MAPPING_PREFETCH 0x2      // Start reading the whole view into memory right away.
+#define FILE_MAPPING_EXTEND   0x4      // With FILE_MAPPING_WRITE, grow the file to cover a range past its end.
+
+    /**
+     * @brief A view of a file mapped into memory.
+     */
+    typedef struct file_mapping {
+        void *data;        // First byte of the requested range.
+        size_t size;       // Length of the requested range.
+        void *view;        // Start of the view, aligned down to the allocation granularity.
+        HANDLE section;
+    } file_mapping;
+
+    typedef BOOL (WINAPI *yfile_prefetch_virtual_memory_fn)(HANDLE, ULONG_PTR, WIN32_MEMORY_RANGE_ENTRY *, ULONG);
+
+    // Asks the memory manager to page in a range with large, batched reads. No-op before Windows 8.
+    void yfile_prefetch_range(void *addr, size_t len) {
+        static yfile_prefetch_virtual_memory_fn prefetch = NULL;
+        static volatile LONG resolved = 0;
+        if (!resolved) {
+            HMODULE kernel = GetModuleHandleA("kernel32.dll");
+            if (kernel != NULL) prefetch = (yfile_prefetch_virtual_memory_fn)(void (*)(void))GetProcAddress(kernel, "PrefetchVirtualMemory");
+            InterlockedExchange(&resolved, 1);
+        }
+        if (prefetch == NULL) return;
+        WIN32_MEMORY_RANGE_ENTRY range;
+        range.VirtualAddress = addr;
+        range.NumberOfBytes = len;
+        prefetch(GetCurrentProcess(), 1, &range, 0);
+    }
+
+    // file_map without the instrumentation hooks.
+    int yfile_map(FILE *fp, int64_t offset, size_t length, int flags, file_mapping *out) {
+        if (fp == NULL || out == NULL || offset < 0) return -1;
+        memset(out, 0, sizeof(*out));
+        fflush(fp);
+        HANDLE h = (HANDLE)_get_osfhandle(_fileno(fp));
+        LARGE_INTEGER size;
+        if (h == INVALID_HANDLE_VALUE || !GetFileSizeEx(h, &size)) return -1;
+        if (length == 0) {
+            if (offset >= size.QuadPart) { SetLastError(ERROR_HANDLE_EOF); return -1; }
+            length = (size_t)(size.QuadPart - offset);
+        }
+
+        int writable = (flags & FILE_MAPPING_WRITE) != 0;
+        uint64_t end = (uint64_t)offset + length;
+        // A writable section larger than the file silently extends it; only do that when asked to.
+        if (end > (uint64_t)size.QuadPart && (!writable || !(flags & FILE_MAPPING_EXTEND))) {
+            SetLastError(ERROR_HANDLE_EOF);
+            return -1;
+        }
+        HANDLE section = CreateFileMappingA(h, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                            (DWORD)(end >> 32), (DWORD)end, NULL);
+        if (section == NULL) return -1;
+
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        uint64_t base = (uint64_t)offset - (uint64_t)offset % si.dwAllocationGranularity;
+        size_t delta = (size_t)((uint64_t)offset - base);
+        void *view = MapViewOfFile(section, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                                   (DWORD)(base >> 32), (DWORD)base, delta + length);
+        if (view == NULL) {
+            CloseHandle(section);
+            return -1;
+        }
+
+        out->data = (char *)view + delta;
+        out->size = length;
+        out->view = view;
+        out->section = section;
+        if (flags & FILE_MAPPING_PREFETCH) yfile_prefetch_range(out->data, length);
+        return 0;
+    }
+
+    /**
+     * @brief Maps a range of an open file into memory.
+     *
+     * Windows only backs pagefile sections with large pages, so file views always use normal pages;
+     * FILE_MAPPING_PREFETCH is what keeps bulk scans of a view from faulting page by page.
+     * @param fp File pointer.
+     * @param offset Start of the range.
+     * @param length Length of the range, 0 for everything up to the end of the file.
+     * @param flags FILE_MAPPING_* flags.
+     * @param out Receives the mapping.
+     * @return 0 on success, -1 on failure (including an empty range, and a range past the end of the
+     *         file unless FILE_MAPPING_WRITE | FILE_MAPPING_EXTEND grows the file to cover it).
+     */
+    int file_map(FILE *fp, int64_t offset, size_t length, int flags, file_mapping *out) {
+        if (fp == NULL || out == NULL || offset < 0) return -1;
+        YFILE_OP_BEGIN(FILE_OP_MAP, fp, NULL);
+        YFILE_OP_ARGS(offset, length);
+        int ret = yfile_map(fp, offset, length, flags, out);
+        YFILE_OP_END(0, ret != 0);
+        return ret;
+    }
+
+    /**
+     * @brief Unmaps a view created by file_map. Dirty pages of a writable view reach the file lazily.
+     * @param m Mapping.
+     * @return 0 on success, -1 on failure.
+     */
+    int file_unmap(file_mapping *m) {
+        if (m == NULL || m->view == NULL) return -1;
+        int ret = UnmapViewOfFile(m->view) ? 0 : -1;
+        CloseHandle(m->section);
+        memset(m, 0, sizeof(*m));
+        return ret;
+    }
+
+#define FILE_SPLICE_ALL       (-1)           // Move everything up to the end of the input.
+#define YFILE_SPLICE_CHUNK    (1u << 20)     // Bounce buffer size when data has to pass through memory.
+#define YFILE_CLONE_ALIGN     (64u << 10)    // Block clones must be cluster aligned; 64 KiB suits every ReFS cluster size.
+
+    // One end of a splice. Disk files are accessed positionally at the stream's logical offset, so the
+    // CRT buffer is bypassed without disturbing the FILE*; pipes and character devices are streamed.
+    typedef struct yfile_splice_end {
+        FILE *fp;
+        HANDLE h;
+        int seekable;
+        uint64_t pos;
+    } yfile_splice_end;
+
+    int yfile_splice_open(FILE *fp, yfile_splice_end *e) {
+        if (fp == NULL) return -1;
+        e->fp = fp;
+        e->h = (HANDLE)_get_osfhandle(_fileno(fp));
+        if (e->h == INVALID_HANDLE_VALUE) return -1;
+        e->seekable = GetFileType(e->h) == FILE_TYPE_DISK;
+        e->pos = 0;
+        if (e->seekable) {
+            // Take the logical position before fflush drops read-ahead or pushes pending writes.
+            int64_t pos = _ftelli64(fp);
+            if (pos < 0) return -1;
+            e->pos = (uint64_t)pos;
+        }
+        return fflush(fp) == 0 ? 0 : -1;
+    }
+
+    // Moves the FILE* to wherever the positional I/O left off.
+    void yfile_splice_close(yfile_splice_end *e) {
+        if (e->seekable) _fseeki64(e->fp, (int64_t)e->pos, SEEK_SET);
+    }
+
+    // Reads up to len bytes. Pipes return whatever is available rather than waiting to fill buf.
+    // Returns the number of bytes read, 0 at end of input, -1 on error.
+    int64_t yfile_splice_read(yfile_splice_end *e, void *buf, size_t len) {
+        if (e->seekable) {
+            int64_t got = yfile_pread(e->h, buf, len, e->pos);
+            if (got > 0) e->pos += (uint64_t)got;
+            return got;
+        }
+        DWORD got = 0;
+        if (!ReadFile(e->h, buf, (DWORD)len, &got, NULL)) {
+            DWORD err = GetLastError();
+            return err == ERROR_BROKEN_PIPE || err == ERROR_HANDLE_EOF ? 0 : -1;
+        }
+        return (int64_t)got;
+    }
+
+    int yfile_splice_write(yfile_splice_end *e, const void *buf, size_t len) {
+        if (e->seekable) {
+            if (yfile_pwrite(e->h, buf, len, e->pos) != 0) return -1;
+            e->pos += len;
+            return 0;
+        }
+        size_t total = 0;
+        while (total < len) {
+            DWORD put = 0;
+            if (!WriteFile(e->h, (const char *)buf + total, (DWORD)(len - total), &put, NULL) || put == 0) return -1;
+            total += put;
+        }
+        return 0;
+    }
+
+    // Shares whole aligned extents of in with out by block cloning, so no data is read or written.
+    // Only ReFS volumes support it. Returns the number of bytes cloned, or 0 when cloning does not apply.
+    uint64_t yfile_splice_clone(yfile_splice_end *in, yfile_splice_end *out, uint64_t len) {
+        if (!in->seekable || !out->seekable) return 0;
+        if (in->pos % YFILE_CLONE_ALIGN != 0 || out->pos % YFILE_CLONE_ALIGN != 0) return 0;
+
+        LARGE_INTEGER insize, outsize;
+        if (!GetFileSizeEx(in->h, &insize) || !GetFileSizeEx(out->h, &outsize)) return 0;
+        if ((uint64_t)insize.QuadPart <= in->pos) return 0;
+        uint64_t avail = (uint64_t)insize.QuadPart - in->pos;
+        if (len > avail) len = avail;
+        uint64_t bytes = len - len % YFILE_CLONE_ALIGN;
+        if (bytes == 0) return 0;
+
+        // The target range has to exist before extents can be cloned into it.
+        int grew = (uint64_t)outsize.QuadPart < out->pos + bytes;
+        if (grew) {
+            FILE_END_OF_FILE_INFO eof;
+            eof.EndOfFile.QuadPart = (LONGLONG)(out->pos + bytes);
+            if (!SetFileInformationByHandle(out->h, FileEndOfFileInfo, &eof, sizeof(eof))) return 0;
+        }
+
+        DUPLICATE_EXTENTS_DATA dup;
+        dup.FileHandle = in->h;
+        dup.SourceFileOffset.QuadPart = (LONGLONG)in->pos;
+        dup.TargetFileOffset.QuadPart = (LONGLONG)out->pos;
+        dup.ByteCount.QuadPart = (LONGLONG)bytes;
+        DWORD ret;
+        if (!DeviceIoControl(out->h, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &dup, sizeof(dup), NULL, 0, &ret, NULL)) {
+            if (grew) {
+                FILE_END_OF_FILE_INFO eof;
+                eof.EndOfFile = outsize;
+                SetFileInformationByHandle(out->h, FileEndOfFileInfo, &eof, sizeof(eof));
+            }
+            return 0;
+        }
+        in->pos += bytes;
+        out->pos += bytes;
+        return bytes;
+    }
+
+    // Tells the write-side caches that out changed behind the FILE*.
+    void yfile_splice_note_write(FILE *out, uint64_t bytes) {
+        if (bytes == 0) return;
+        yfile_writeback_note(out, (size_t)bytes);
+        if (yfile_cache_active) yfile_cache_note_write(out);
+        yfile_prefetch_note_write(out);
+    }
+
+    /**
+     * @brief Moves data from one stream to another without going through stdio buffers.
+     *
+     * Between files on a ReFS volume, aligned extents are block-cloned and never copied. Everything
+     * else goes through a single pooled buffer with direct handle I/O, which covers pipes, consoles
+     * and volumes that cannot clone. Disk streams are read and written at their current offsets and
+     * left positioned after the moved data. Anything stdio has already buffered from a pipe is not
+     * seen, so do not mix stdio reads with file_splice on the same pipe. out must not be in append mode.
+     * @param in Source stream.
+     * @param out Destination stream.
+     * @param len Bytes to move, or FILE_SPLICE_ALL to move until in reaches end of input.
+     * @return Bytes moved (fewer than len at end of input), or -1 if an error occurred before any data moved.
+     */
+    int64_t file_splice(FILE *in, FILE *out, int64_t len) {
+        yfile_splice_end src, dst;
+        if (yfile_splice_open(in, &src) != 0 || yfile_splice_open(out, &dst) != 0) return -1;
+        YFILE_OP_BEGIN(FILE_OP_SPLICE, out, NULL);
+        YFILE_OP_ARGS(-1, len < 0 ? 0 : len);
+
+        uint64_t want = len < 0 ? UINT64_MAX : (uint64_t)len;
+        uint64_t moved = yfile_splice_clone(&src, &dst, want);
+        char *buf = NULL;
+        int failed = 0;
+        while (moved < want) {
+            if (buf == NULL && (buf = (char *)file_buffer_alloc(YFILE_SPLICE_CHUNK)) == NULL) { failed = 1; break; }
+            size_t n = want - moved < YFILE_SPLICE_CHUNK ? (size_t)(want - moved) : YFILE_SPLICE_CHUNK;
+            int64_t got = yfile_splice_read(&src, buf, n);
+            if (got <= 0) { failed = got < 0; break; }
+            if (yfile_splice_write(&dst, buf, (size_t)got) != 0) { failed = 1; break; }
+            moved += (uint64_t)got;
+        }
+        file_buffer_free(buf, YFILE_SPLICE_CHUNK);
+
+        yfile_splice_close(&src);
+        yfile_splice_close(&dst);
+        yfile_splice_note_write(out, moved);
+        YFILE_OP_END(moved, failed);
+        return failed && moved == 0 ? -1 : (int64_t)moved;
+    }
+
+    /**
+     * @brief Reads data from one stream once and writes it to two others, e.g. to a file and to a
+     * child process's pipe. Follows the same rules as file_splice.
+     * @param in Source stream.
+     * @param out First destination.
+     * @param copy Second destination.
+     * @param len Bytes to move, or FILE_SPLICE_ALL to move until in reaches end of input.
+     * @return Bytes written to both destinations, or -1 if an error occurred before any data moved.
+     */
+    int64_t file_tee(FILE *in, FILE *out, FILE *copy, int64_t len) {
+        yfile_splice_end src, dst1, dst2;
+        if (yfile_splice_open(in, &src) != 0 || yfile_splice_open(out, &dst1) != 0 ||
+            yfile_splice_open(copy, &dst2) != 0) return -1;
+        YFILE_OP_BEGIN(FILE_OP_SPLICE, out, NULL);
+        YFILE_OP_ARGS(-1, len < 0 ? 0 : len);
+
+        uint64_t want = len < 0 ? UINT64_MAX : (uint64_t)len;
+        uint64_t moved = 0;
+        char *buf = (char *)file_buffer_alloc(YFILE_SPLICE_CHUNK);
+        int failed = buf == NULL;
+        while (!failed && moved < want) {
+            size_t n = want - moved < YFILE_SPLICE_CHUNK ? (size_t)(want - moved) : YFILE_SPLICE_CHUNK;
+            int64_t got = yfile_splice_read(&src, buf, n);
+            if (got <= 0) { failed = got < 0; break; }
+            if (yfile_splice_write(&dst1, buf, (size_t)got) != 0 ||
+                yfile_splice_write(&dst2, buf, (size_t)got) != 0) { failed = 1; break; }
+            moved += (uint64_t)got;
+        }
+        file_buffer_free(buf, YFILE_SPLICE_CHUNK);
+
+        yfile_splice_close(&src);
+        yfile_splice_close(&dst1);
+        yfile_splice_close(&dst2);
+        yfile_splice_note_write(out, moved);
+        yfile_splice_note_write(copy, moved);
+        YFILE_OP_END(moved, failed);
+        return failed && moved == 0 ? -1 : (int64_t)moved;
+    }
+
+#define FILE_HIST_SUB_BITS 4               // 16 sub-buckets per power of two: values are kept to within 6.25%.
+#define FILE_HIST_MAX_BITS 40              // Values up to 2^40 (18 minutes in ns, 1 TiB in bytes); larger ones are clamped.
+#define FILE_HIST_BUCKETS  ((FILE_HIST_MAX_BITS - FILE_HIST_SUB_BITS + 1) << FILE_HIST_SUB_BITS)
+
+    /**
+     * @brief Merged latency and size distribution of one operation across all threads.
+     *
+     * Buckets are log-linear, as in HdrHistogram: values below 16 have a bucket each, and every
+     * power of two above that is split into 16 equal buckets. Use file_hist_value to map a bucket
+     * index back to a value and file_hist_percentile to query the distribution.
+     */
+    typedef struct file_latency_snapshot {
+        uint64_t count;
+        uint64_t errors;
+        uint64_t total_ns;
+        uint64_t max_ns;
+        uint64_t total_bytes;
+        uint64_t latency_ns[FILE_HIST_BUCKETS];    // Call durations.
+        uint64_t bytes[FILE_HIST_BUCKETS];         // Bytes moved per call.
+    } file_latency_snapshot;
+
+    /**
+     * @brief Gets the name of an operation, e.g. "write".
+     * @param op Operation.
+     * @return Static string, "unknown" for out-of-range values.
+     */
+    const char *file_op_name(file_op op) {
+        static const char *const names[FILE_OP_COUNT] = {
+            "open", "close", "read", "write", "flush", "seek", "get_size", "truncate", "stat", "exists",
+            "set_attributes", "copy", "move", "delete", "lock", "unlock", "ensure_directory",
+            "secure_delete", "pread", "pwrite", "splice", "sync", "ring_append", "ring_next", "trim_head",
+            "map", "shm_read", "read_cached"
+        };
+        return (unsigned)op < FILE_OP_COUNT ? names[op] : "unknown";
+    }
+
+    /**
+     * @brief Gets the histogram bucket a value falls into.
+     * @param value Value, e.g. a duration in ns or a size in bytes.
+     * @return Bucket index below FILE_HIST_BUCKETS.
+     */
+    uint32_t file_hist_bucket(uint64_t value) {
+        if (value < (1u << FILE_HIST_SUB_BITS)) return (uint32_t)value;
+        if (value >= ((uint64_t)1 << FILE_HIST_MAX_BITS)) return FILE_HIST_BUCKETS - 1;
+        unsigned long msb;
+#if defined(_WIN64)
+        _BitScanReverse64(&msb, value);
+#else
+        // _BitScanReverse64 is x64/ARM64 only; scan the halves on 32-bit targets.
+        if ((uint32_t)(value >> 32) != 0) {
+            _BitScanReverse(&msb, (unsigned long)(value >> 32));
+            msb += 32;
+        } else {
+            _BitScanReverse(&msb, (unsigned long)value);
+        }
+#endif
+        return ((uint32_t)(msb - FILE_HIST_SUB_BITS + 1) << FILE_HIST_SUB_BITS) +
+               (uint32_t)((value >> (msb - FILE_HIST_SUB_BITS)) & ((1u << FILE_HIST_SUB_BITS) - 1));
+    }
+
+    /**
+     * @brief Gets the smallest value that falls into a histogram bucket.
+     * @param bucket Bucket index below FILE_HIST_BUCKETS.
+     * @return Lower bound of the bucket.
+     */
+    uint64_t file_hist_value(uint32_t bucket) {
+        if (bucket < (1u << FILE_HIST_SUB_BITS)) return bucket;
+        uint32_t msb = (bucket >> FILE_HIST_SUB_BITS) + FILE_HIST_SUB_BITS - 1;
+        uint64_t sub = bucket & ((1u << FILE_HIST_SUB_BITS) - 1);
+        return (((uint64_t)1 << FILE_HIST_SUB_BITS) + sub) << (msb - FILE_HIST_SUB_BITS);
+    }
+
+    /**
+     * @brief Computes a percentile from histogram buckets.
+     * @param buckets FILE_HIST_BUCKETS counters, e.g. file_latency_snapshot.latency_ns.
+     * @param percentile Percentile between 0 and 100.
+     * @return Highest value of the bucket holding the percentile, or 0 for an empty histogram.
+     */
+    uint64_t file_hist_percentile(const uint64_t *buckets, double percentile) {
+        if (buckets == NULL) return 0;
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < FILE_HIST_BUCKETS; i++) total += buckets[i];
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t)(percentile / 100.0 * (double)total + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > total) rank = total;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < FILE_HIST_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= rank) return i + 1 < FILE_HIST_BUCKETS ? file_hist_value(i + 1) - 1 : file_hist_value(i);
+        }
+        return file_hist_value(FILE_HIST_BUCKETS - 1);
+    }
+
+#ifdef YFILE_ENABLE_HISTOGRAMS
+
+    // One operation's counters in one thread. Only the owning thread writes them.
+    typedef struct yfile_hist_op {
+        uint64_t count, errors, total_ns, max_ns, total_bytes;
+        uint64_t latency_ns[FILE_HIST_BUCKETS];
+        uint64_t bytes[FILE_HIST_BUCKETS];
+    } yfile_hist_op;
+
+    typedef struct yfile_hist_thread {
+        struct yfile_hist_thread *next, *prev;
+        yfile_hist_op *ops[FILE_OP_COUNT];     // Allocated on the thread's first call of each operation.
+    } yfile_hist_thread;
+
+    typedef struct yfile_hist_registry {
+        INIT_ONCE once;
+        DWORD fls;                             // Fiber-local slot whose destructor retires a thread's counters.
+        SRWLOCK lock;                          // Guards the thread list and the retired totals.
+        yfile_hist_thread *threads;
+        yfile_hist_thread retired;             // Counters of threads that have exited.
+        double ns_per_tick;
+    } yfile_hist_registry;
+
+    yfile_hist_registry yfile_hist = { INIT_ONCE_STATIC_INIT, FLS_OUT_OF_INDEXES, SRWLOCK_INIT };
+
+    void yfile_hist_merge(yfile_hist_op **dst, const yfile_hist_op *src) {
+        if (src == NULL) return;
+        if (*dst == NULL && (*dst = (yfile_hist_op *)calloc(1, sizeof(yfile_hist_op))) == NULL) return;
+        yfile_hist_op *d = *dst;
+        d->count += src->count;
+        d->errors += src->errors;
+        d->total_ns += src->total_ns;
+        d->total_bytes += src->total_bytes;
+        if (src->max_ns > d->max_ns) d->max_ns = src->max_ns;
+        for (uint32_t i = 0; i < FILE_HIST_BUCKETS; i++) {
+            d->latency_ns[i] += src->latency_ns[i];
+            d->bytes[i] += src->bytes[i];
+        }
+    }
+
+    void WINAPI yfile_hist_thread_exit(PVOID data) {
+        yfile_hist_thread *t = (yfile_hist_thread *)data;
+        if (t == NULL) return;
+        AcquireSRWLockExclusive(&yfile_hist.lock);
+        if (t->prev != NULL) t->prev->next = t->next; else yfile_hist.threads = t->next;
+        if (t->next != NULL) t->next->prev = t->prev;
+        for (int op = 0; op < FILE_OP_COUNT; op++) {
+            yfile_hist_merge(&yfile_hist.retired.ops[op], t->ops[op]);
+            free(t->ops[op]);
+        }
+        ReleaseSRWLockExclusive(&yfile_hist.lock);
+        free(t);
+    }
+
+    BOOL CALLBACK yfile_hist_init(INIT_ONCE *once, PVOID param, PVOID *context) {
+        (void)once; (void)param; (void)context;
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        yfile_hist.ns_per_tick = 1e9 / (double)freq.QuadPart;
+        yfile_hist.fls = FlsAlloc(yfile_hist_thread_exit);
+        return TRUE;
+    }
+
+    // Returns the calling thread's counters for op, creating them on first use. NULL if out of memory.
+    yfile_hist_op *yfile_hist_thread_op(file_op op) {
+        yfile_hist_thread *t = NULL;
+        if (yfile_hist.fls != FLS_OUT_OF_INDEXES) t = (yfile_hist_thread *)FlsGetValue(yfile_hist.fls);
+        if (t != NULL && t->ops[op] != NULL) return t->ops[op];
+
+        InitOnceExecuteOnce(&yfile_hist.once, yfile_hist_init, NULL, NULL);
+        if (yfile_hist.fls == FLS_OUT_OF_INDEXES) return NULL;
+        if (t == NULL) {
+            if ((t = (yfile_hist_thread *)calloc(1, sizeof(yfile_hist_thread))) == NULL) return NULL;
+            if (!FlsSetValue(yfile_hist.fls, t)) { free(t); return NULL; }
+            AcquireSRWLockExclusive(&yfile_hist.lock);
+            t->next = yfile_hist.threads;
+            if (t->next != NULL) t->next->prev = t;
+            yfile_hist.threads = t;
+            ReleaseSRWLockExclusive(&yfile_hist.lock);
+        }
+        // Published under the lock so a concurrent snapshot never sees a half-built entry.
+        yfile_hist_op *h = (yfile_hist_op *)calloc(1, sizeof(yfile_hist_op));
+        AcquireSRWLockExclusive(&yfile_hist.lock);
+        t->ops[op] = h;
+        ReleaseSRWLockExclusive(&yfile_hist.lock);
+        return h;
+    }
+
+    void yfile_hist_record(file_op op, int64_t ticks, uint64_t bytes, int failed) {
+        yfile_hist_op *h = yfile_hist_thread_op(op);
+        if (h == NULL) return;
+        uint64_t ns = ticks > 0 ? (uint64_t)((double)ticks * yfile_hist.ns_per_tick) : 0;
+        h->count++;
+        h->errors += failed != 0;
+        h->total_ns += ns;
+        h->total_bytes += bytes;
+        if (ns > h->max_ns) h->max_ns = ns;
+        h->latency_ns[file_hist_bucket(ns)]++;
+        h->bytes[file_hist_bucket(bytes)]++;
+    }
+#endif
+
+    /**
+     * @brief Merges every thread's counters for one operation.
+     *
+     * Counters are only collected when yfile.h is compiled with YFILE_ENABLE_HISTOGRAMS defined;
+     * otherwise the instrumentation compiles away and this function always fails. Threads keep
+     * writing while the snapshot is taken, so it may be a few calls behind.
+     * @param op Operation.
+     * @param out Receives the merged histogram.
+     * @return 0 on success, -1 on invalid input or when histograms are compiled out.
+     */
+    int file_latency_snapshot_op(file_op op, file_latency_snapshot *out) {
+        if (out == NULL || (unsigned)op >= FILE_OP_COUNT) return -1;
+        memset(out, 0, sizeof(*out));
+#ifdef YFILE_ENABLE_HISTOGRAMS
+        yfile_hist_op *merged = NULL;
+        AcquireSRWLockShared(&yfile_hist.lock);
+        yfile_hist_merge(&merged, yfile_hist.retired.ops[op]);
+        for (yfile_hist_thread *t = yfile_hist.threads; t != NULL; t = t->next) yfile_hist_merge(&merged, t->ops[op]);
+        ReleaseSRWLockShared(&yfile_hist.lock);
+        if (merged != NULL) {
+            out->count = merged->count;
+            out->errors = merged->errors;
+            out->total_ns = merged->total_ns;
+            out->max_ns = merged->max_ns;
+            out->total_bytes = merged->total_bytes;
+            memcpy(out->latency_ns, merged->latency_ns, sizeof(out->latency_ns));
+            memcpy(out->bytes, merged->bytes, sizeof(out->bytes));
+            free(merged);
+        }
+        return 0;
+#else
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Clears all histograms. Calls in flight on other threads may still be counted.
+     */
+    void file_latency_reset(void) {
+#ifdef YFILE_ENABLE_HISTOGRAMS
+        AcquireSRWLockExclusive(&yfile_hist.lock);
+        for (int op = 0; op < FILE_OP_COUNT; op++) {
+            if (yfile_hist.retired.ops[op] != NULL) memset(yfile_hist.retired.ops[op], 0, sizeof(yfile_hist_op));
+            for (yfile_hist_thread *t = yfile_hist.threads; t != NULL; t = t->next) {
+                if (t->ops[op] != NULL) memset(t->ops[op], 0, sizeof(yfile_hist_op));
+            }
+        }
+        ReleaseSRWLockExclusive(&yfile_hist.lock);
+#endif
+    }
+
+    /**
+     * @brief Prints one line per operation that has been called: count, errors, latency percentiles and bytes.
+     * @param out Stream to print to, e.g. stderr.
+     * @return 0 on success, -1 on invalid input or when histograms are compiled out.
+     */
+    int file_latency_report(FILE *out) {
+        if (out == NULL) return -1;
+        file_latency_snapshot *snap = (file_latency_snapshot *)malloc(sizeof(file_latency_snapshot));
+        if (snap == NULL) return -1;
+        fprintf(out, "%-16s %10s %8s %10s %10s %10s %10s %10s %14s\n",
+                "op", "count", "errors", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns", "bytes");
+        int ret = 0;
+        for (int op = 0; op < FILE_OP_COUNT; op++) {
+            if (file_latency_snapshot_op((file_op)op, snap) != 0) { ret = -1; break; }
+            if (snap->count == 0) continue;
+            fprintf(out, "%-16s %10llu %8llu %10llu %10llu %10llu %10llu %10llu %14llu\n", file_op_name((file_op)op),
+                    (unsigned long long)snap->count, (unsigned long long)snap->errors,
+                    (unsigned long long)file_hist_percentile(snap->latency_ns, 50),
+                    (unsigned long long)file_hist_percentile(snap->latency_ns, 90),
+                    (unsigned long long)file_hist_percentile(snap->latency_ns, 99),
+                    (unsigned long long)file_hist_percentile(snap->latency_ns, 99.9),
+                    (unsigned long long)snap->max_ns, (unsigned long long)snap->total_bytes);
+        }
+        free(snap);
+        return ret;
+    }
+
+#define FILE_IO_MAX_PREFIXES  32
+#define YFILE_IO_STDIO_BUFFER 4096         // CRT stream buffer size, used to estimate stdio syscalls.
+
+    /**
+     * @brief Accounting counters of one thread.
+     */
+    typedef struct file_io_thread_counters {
+        DWORD thread_id;                   // 0 for the combined counters of threads that have exited.
+        file_io_counters io;
+    } file_io_thread_counters;
+
+    /**
+     * @brief yfile's totals next to the process-wide counters kept by the OS.
+     *
+     * The OS counters cover every ReadFile/WriteFile/DeviceIoControl the process issued, whether
+     * or not it went through yfile. The difference shows I/O that yfile did not attribute. Windows
+     * does not split these counters into file-cache hits and device I/O for a process, so the
+     * bytes that actually reached the disk have to come from ETW DiskIo events.
+     */
+    typedef struct file_io_process_counters {
+        file_io_counters yfile;
+        uint64_t os_read_ops;
+        uint64_t os_write_ops;
+        uint64_t os_other_ops;
+        uint64_t os_bytes_read;
+        uint64_t os_bytes_written;
+        uint64_t os_other_bytes;
+    } file_io_process_counters;
+
+#ifdef YFILE_ENABLE_ACCOUNTING
+    typedef struct yfile_io_prefix {
+        char *prefix;
+        size_t len;
+        file_io_counters io;               // Updated with interlocked adds.
+    } yfile_io_prefix;
+
+    typedef struct yfile_io_thread {
+        struct yfile_io_thread *next, *prev;
+        DWORD thread_id;
+        file_io_counters io;               // Written only by the owning thread.
+    } yfile_io_thread;
+
+    typedef struct yfile_io_registry {
+        INIT_ONCE once;
+        DWORD fls;                         // Fiber-local slot whose destructor retires a thread's counters.
+        SRWLOCK lock;                      // Guards the thread list, the retired totals and prefix registration.
+        yfile_io_thread *threads;
+        file_io_counters retired;
+        yfile_io_prefix prefixes[FILE_IO_MAX_PREFIXES];
+        volatile LONG prefix_count;
+    } yfile_io_registry;
+
+    yfile_io_registry yfile_io = { INIT_ONCE_STATIC_INIT, FLS_OUT_OF_INDEXES, SRWLOCK_INIT };
+
+    void yfile_io_add(file_io_counters *dst, const file_io_counters *d) {
+        dst->read_ops += d->read_ops;
+        dst->write_ops += d->write_ops;
+        dst->other_ops += d->other_ops;
+        dst->bytes_read += d->bytes_read;
+        dst->bytes_written += d->bytes_written;
+        dst->syscalls += d->syscalls;
+        dst->short_reads += d->short_reads;
+        dst->errors += d->errors;
+    }
+
+    // Same as yfile_io_add, for counters that several threads update.
+    void yfile_io_add_shared(file_io_counters *dst, const file_io_counters *d) {
+        volatile LONG64 *out = (volatile LONG64 *)dst;
+        const uint64_t *in = (const uint64_t *)d;
+        for (size_t i = 0; i < sizeof(file_io_counters) / sizeof(uint64_t); i++) {
+            if (in[i] != 0) InterlockedExchangeAdd64(&out[i], (LONG64)in[i]);
+        }
+    }
+
+    void WINAPI yfile_io_thread_exit(PVOID data) {
+        yfile_io_thread *t = (yfile_io_thread *)data;
+        if (t == NULL) return;
+        AcquireSRWLockExclusive(&yfile_io.lock);
+        if (t->prev != NULL) t->prev->next = t->next; else yfile_io.threads = t->next;
+        if (t->next != NULL) t->next->prev = t->prev;
+        yfile_io_add(&yfile_io.retired, &t->io);
+        ReleaseSRWLockExclusive(&yfile_io.lock);
+        free(t);
+    }
+
+    BOOL CALLBACK yfile_io_init(INIT_ONCE *once, PVOID param, PVOID *context) {
+        (void)once; (void)param; (void)context;
+        yfile_io.fls = FlsAlloc(yfile_io_thread_exit);
+        return TRUE;
+    }
+
+    yfile_io_thread *yfile_io_this_thread(void) {
+        yfile_io_thread *t = NULL;
+        if (yfile_io.fls != FLS_OUT_OF_INDEXES) t = (yfile_io_thread *)FlsGetValue(yfile_io.fls);
+        if (t != NULL) return t;
+
+        InitOnceExecuteOnce(&yfile_io.once, yfile_io_init, NULL, NULL);
+        if (yfile_io.fls == FLS_OUT_OF_INDEXES) return NULL;
+        if ((t = (yfile_io_thread *)calloc(1, sizeof(yfile_io_thread))) == NULL) return NULL;
+        if (!FlsSetValue(yfile_io.fls, t)) { free(t); return NULL; }
+        t->thread_id = GetCurrentThreadId();
+        AcquireSRWLockExclusive(&yfile_io.lock);
+        t->next = yfile_io.threads;
+        if (t->next != NULL) t->next->prev = t;
+        yfile_io.threads = t;
+        ReleaseSRWLockExclusive(&yfile_io.lock);
+        return t;
+    }
+
+    // Folds a path character for prefix matching: ASCII lower case, '/' as '\'.
+    char yfile_io_fold(char c) {
+        if (c == '/') return '\\';
+        return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+    }
+
+    // Returns 1 + the index of the longest registered prefix of path, or 0 if none matches.
+    // Case-insensitive; '/' and '\' are interchangeable. Relative paths are resolved against the
+    // current directory, and a prefix only matches whole components: "C:\data" covers "C:\data\x"
+    // but not "C:\database".
+    int yfile_io_match_prefix(const char *path) {
+        LONG count = yfile_io.prefix_count;
+        if (path == NULL || count == 0) return 0;
+        char full[MAX_PATH * 4];
+        DWORD n = GetFullPathNameA(path, (DWORD)sizeof(full), full, NULL);
+        if (n > 0 && n < sizeof(full)) path = full;
+        int best = 0;
+        size_t best_len = 0;
+        for (LONG i = 0; i < count; i++) {
+            const yfile_io_prefix *p = &yfile_io.prefixes[i];
+            if (p->len <= best_len) continue;
+            size_t k = 0;
+            while (k < p->len && path[k] != '\0') {
+                if (yfile_io_fold(path[k]) != p->prefix[k]) break;
+                k++;
+            }
+            if (k < p->len) continue;
+            if (path[k] == '\0' || path[k] == '\\' || path[k] == '/' || p->prefix[k - 1] == '\\') { best = (int)i + 1; best_len = k; }
+        }
+        return best;
+    }
+
+    // Converts one finished call into counter increments.
+    void yfile_io_delta(const yfile_op_ctx *ctx, uint64_t bytes, int failed, file_io_counters *d) {
+        memset(d, 0, sizeof(*d));
+        d->errors = failed != 0;
+        switch (ctx->op) {
+        case FILE_OP_READ:
+        case FILE_OP_PREAD:
+        case FILE_OP_RING_NEXT:
+        case FILE_OP_SHM_READ:
+        case FILE_OP_READ_CACHED:
+            d->read_ops = 1;
+            d->bytes_read = bytes;
+            d->short_reads = !failed && bytes < ctx->length;
+            break;
+        case FILE_OP_WRITE:
+        case FILE_OP_PWRITE:
+        case FILE_OP_SPLICE:
+        case FILE_OP_RING_APPEND:
+            d->write_ops = 1;
+            d->bytes_written = bytes;
+            break;
+        default:
+            d->other_ops = 1;
+            break;
+        }
+        // Buffered stdio calls only reach the OS when the stream buffer fills or drains.
+        if (ctx->op == FILE_OP_READ || ctx->op == FILE_OP_WRITE) d->syscalls = bytes / YFILE_IO_STDIO_BUFFER;
+        else if (ctx->op == FILE_OP_SPLICE) d->syscalls = 2 * ((bytes + YFILE_SPLICE_CHUNK - 1) / YFILE_SPLICE_CHUNK);
+        else d->syscalls = 1;
+    }
+
+    void yfile_io_begin(yfile_op_ctx *ctx) {
+        ctx->state = ctx->fp != NULL ? yfile_state_find(ctx->fp) : NULL;
+        ctx->io_prefix = ctx->state != NULL ? ctx->state->io_prefix : 0;
+    }
+
+    void yfile_io_record(yfile_op_ctx *ctx, uint64_t bytes, int failed) {
+        file_io_counters d;
+        yfile_io_delta(ctx, bytes, failed, &d);
+
+        yfile_state *s = ctx->op == FILE_OP_CLOSE ? NULL : ctx->state;   // file_close has freed it.
+        int prefix = ctx->io_prefix;
+        if (ctx->op == FILE_OP_OPEN && !failed && ctx->fp != NULL) {
+            // Handles opened through yfile get their own counters and keep the prefix their path matched.
+            if ((s = yfile_state_acquire(ctx->fp)) != NULL) s->io_prefix = yfile_io_match_prefix(ctx->path);
+            prefix = s != NULL ? s->io_prefix : 0;
+        } else if (ctx->fp == NULL) {
+            prefix = yfile_io_match_prefix(ctx->path);
+        }
+
+        if (s != NULL) yfile_io_add_shared(&s->io, &d);
+        if (prefix > 0) yfile_io_add_shared(&yfile_io.prefixes[prefix - 1].io, &d);
+        yfile_io_thread *t = yfile_io_this_thread();
+        if (t != NULL) yfile_io_add(&t->io, &d);
+    }
+#endif
+
+    /**
+     * @brief Registers a path prefix to aggregate I/O under, e.g. a tenant's data directory.
+     *
+     * A handle is attributed to the longest registered prefix of the path it was opened with;
+     * path-only calls (exists, copy, delete, ...) are matched on every call. Prefixes and paths are
+     * resolved to absolute form first, and a prefix only matches whole path components. Matching is
+     * case-insensitive and treats '/' and '\' alike. Prefixes cannot be removed.
+     * @param prefix Path prefix.
+     * @return Prefix index for file_io_prefix_counters, or -1 on failure (table full, or accounting
+     *         compiled out).
+     */
+    int file_io_add_prefix(const char *prefix) {
+        if (prefix == NULL || prefix[0] == '\0') return -1;
+#ifdef YFILE_ENABLE_ACCOUNTING
+        char full[MAX_PATH * 4];
+        DWORD n = GetFullPathNameA(prefix, (DWORD)sizeof(full), full, NULL);
+        if (n == 0 || n >= sizeof(full)) return -1;
+        size_t len = n;
+        // "C:\data\" and "C:\data" name the same directory; roots keep their separator.
+        while (len > yfile_path_root_len(full) && (full[len - 1] == '\\' || full[len - 1] == '/')) len--;
+        char *copy = (char *)malloc(len + 1);
+        if (copy == NULL) return -1;
+        for (size_t i = 0; i < len; i++) copy[i] = yfile_io_fold(full[i]);
+        copy[len] = '\0';
+
+        AcquireSRWLockExclusive(&yfile_io.lock);
+        LONG index = yfile_io.prefix_count;
+        if (index < FILE_IO_MAX_PREFIXES) {
+            yfile_io.prefixes[index].prefix = copy;
+            yfile_io.prefixes[index].len = len;
+            InterlockedExchange(&yfile_io.prefix_count, index + 1);   // Publish after the entry is complete.
+        }
+        ReleaseSRWLockExclusive(&yfile_io.lock);
+        if (index >= FILE_IO_MAX_PREFIXES) { free(copy); return -1; }
+        return (int)index;
+#else
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Gets the counters aggregated under a registered prefix.
+     * @param index Index returned by file_io_add_prefix.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 on invalid input.
+     */
+    int file_io_prefix_counters(int index, file_io_counters *out) {
+        if (out == NULL) return -1;
+        memset(out, 0, sizeof(*out));
+#ifdef YFILE_ENABLE_ACCOUNTING
+        if (index < 0 || index >= yfile_io.prefix_count) return -1;
+        *out = yfile_io.prefixes[index].io;
+        return 0;
+#else
+        (void)index;
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Gets the counters of one handle. Only handles opened through yfile are tracked.
+     * @param fp File pointer.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 if fp is not tracked or accounting is compiled out.
+     */
+    int file_io_handle_counters(FILE *fp, file_io_counters *out) {
+        if (out == NULL) return -1;
+        memset(out, 0, sizeof(*out));
+#ifdef YFILE_ENABLE_ACCOUNTING
+        yfile_state *s = yfile_state_find(fp);
+        if (s == NULL) return -1;
+        *out = s->io;
+        return 0;
+#else
+        (void)fp;
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Gets per-thread counters.
+     * @param out Array receiving one entry per thread that has used yfile, plus one entry with
+     *        thread_id 0 for threads that have exited.
+     * @param max Capacity of out.
+     * @return Number of entries available, which may exceed max; -1 if accounting is compiled out.
+     */
+    int file_io_thread_snapshot(file_io_thread_counters *out, size_t max) {
+        if (out == NULL && max > 0) return -1;
+#ifdef YFILE_ENABLE_ACCOUNTING
+        size_t n = 0;
+        AcquireSRWLockShared(&yfile_io.lock);
+        if (n < max) { out[n].thread_id = 0; out[n].io = yfile_io.retired; }
+        n++;
+        for (yfile_io_thread *t = yfile_io.threads; t != NULL; t = t->next, n++) {
+            if (n < max) { out[n].thread_id = t->thread_id; out[n].io = t->io; }
+        }
+        ReleaseSRWLockShared(&yfile_io.lock);
+        return (int)n;
+#else
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Gets yfile's totals over all threads next to the OS counters for the whole process.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 on failure or when accounting is compiled out.
+     */
+    int file_io_process_snapshot(file_io_process_counters *out) {
+        if (out == NULL) return -1;
+        memset(out, 0, sizeof(*out));
+#ifdef YFILE_ENABLE_ACCOUNTING
+        AcquireSRWLockShared(&yfile_io.lock);
+        out->yfile = yfile_io.retired;
+        for (yfile_io_thread *t = yfile_io.threads; t != NULL; t = t->next) yfile_io_add(&out->yfile, &t->io);
+        ReleaseSRWLockShared(&yfile_io.lock);
+
+        IO_COUNTERS os;
+        if (!GetProcessIoCounters(GetCurrentProcess(), &os)) return -1;
+        out->os_read_ops = os.ReadOperationCount;
+        out->os_write_ops = os.WriteOperationCount;
+        out->os_other_ops = os.OtherOperationCount;
+        out->os_bytes_read = os.ReadTransferCount;
+        out->os_bytes_written = os.WriteTransferCount;
+        out->os_other_bytes = os.OtherTransferCount;
+        return 0;
+#else
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return -1;
+#endif
+    }
+
+#define FILE_TRACE_PATH_MAX 96             // Paths longer than this keep their last characters.
+
+    /**
+     * @brief One traced call, as passed to trace hooks and stored in the trace rings.
+     */
+    typedef struct file_trace_event {
+        file_op op;
+        DWORD thread_id;
+        FILE *fp;                          // Handle the call worked on, NULL for path-only calls.
+        int64_t offset;                    // Explicit offset, -1 if the call has none.
+        uint64_t length;                   // Bytes requested, 0 if the call has no length.
+        uint64_t bytes;                    // Bytes moved.
+        int failed;
+        uint64_t start_ns;                 // Relative to file_trace_start; 0 in begin hooks.
+        uint64_t duration_ns;              // 0 in begin hooks.
+        char path[FILE_TRACE_PATH_MAX];    // Path argument, empty for handle calls.
+    } file_trace_event;
+
+    /**
+     * @brief Trace hook. Runs on the calling thread, inside the traced call, so it must be quick and
+     * must not call back into yfile.
+     */
+    typedef void (*file_trace_hook)(const file_trace_event *event, void *user);
+
+#ifdef YFILE_ENABLE_TRACING
+    // One thread's ring. Only the owner writes; readers detect overwritten slots through head.
+    typedef struct yfile_trace_ring {
+        struct yfile_trace_ring *next;
+        DWORD thread_id;
+        volatile LONG exited;
+        uint32_t capacity;                 // Power of two.
+        uint32_t sample_phase;
+        volatile LONG64 head;              // Events ever written.
+        file_trace_event *events;
+    } yfile_trace_ring;
+
+    typedef struct yfile_trace_registry {
+        INIT_ONCE once;
+        DWORD fls;
+        SRWLOCK lock;                      // Guards the ring list.
+        yfile_trace_ring *rings;
+        volatile LONG active;
+        volatile LONG generation;          // Bumped by file_trace_start so threads drop rings of an older size.
+        uint32_t capacity;
+        uint32_t sample_every;
+        int64_t origin;                    // QueryPerformanceCounter ticks at file_trace_start.
+        double ns_per_tick;
+        file_trace_hook begin_hook, end_hook;
+        void *hook_user;
+    } yfile_trace_registry;
+
+    yfile_trace_registry yfile_trace = { INIT_ONCE_STATIC_INIT, FLS_OUT_OF_INDEXES, SRWLOCK_INIT };
+
+    void WINAPI yfile_trace_thread_exit(PVOID data) {
+        // Rings outlive their threads so that the next dump still shows what they did.
+        yfile_trace_ring *r = (yfile_trace_ring *)data;
+        if (r != NULL) InterlockedExchange(&r->exited, 1);
+    }
+
+    BOOL CALLBACK yfile_trace_init(INIT_ONCE *once, PVOID param, PVOID *context) {
+        (void)once; (void)param; (void)context;
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        yfile_trace.ns_per_tick = 1e9 / (double)freq.QuadPart;
+        yfile_trace.fls = FlsAlloc(yfile_trace_thread_exit);
+        return TRUE;
+    }
+
+    yfile_trace_ring *yfile_trace_this_ring(void) {
+        if (yfile_trace.fls == FLS_OUT_OF_INDEXES) return NULL;
+        yfile_trace_ring *r = (yfile_trace_ring *)FlsGetValue(yfile_trace.fls);
+        if (r != NULL && r->capacity == yfile_trace.capacity) return r;
+        if (r != NULL) InterlockedExchange(&r->exited, 1);    // Retire a ring left over from a previous session.
+
+        if ((r = (yfile_trace_ring *)calloc(1, sizeof(yfile_trace_ring))) == NULL) return NULL;
+        r->capacity = yfile_trace.capacity;
+        r->thread_id = GetCurrentThreadId();
+        if ((r->events = (file_trace_event *)malloc(sizeof(file_trace_event) * r->capacity)) == NULL ||
+            !FlsSetValue(yfile_trace.fls, r)) {
+            free(r->events);
+            free(r);
+            return NULL;
+        }
+        AcquireSRWLockExclusive(&yfile_trace.lock);
+        r->next = yfile_trace.rings;
+        yfile_trace.rings = r;
+        ReleaseSRWLockExclusive(&yfile_trace.lock);
+        return r;
+    }
+
+    void yfile_trace_fill(file_trace_event *ev, const yfile_op_ctx *ctx) {
+        ev->op = ctx->op;
+        ev->thread_id = GetCurrentThreadId();
+        ev->fp = ctx->fp;
+        ev->offset = ctx->offset;
+        ev->length = ctx->length;
+        ev->path[0] = '\0';
+        if (ctx->path != NULL) {
+            size_t len = strlen(ctx->path);
+            const char *tail = len < FILE_TRACE_PATH_MAX ? ctx->path : ctx->path + len - (FILE_TRACE_PATH_MAX - 1);
+            memcpy(ev->path, tail, strlen(tail) + 1);
+        }
+    }
+
+    void yfile_trace_begin(yfile_op_ctx *ctx) {
+        file_trace_hook hook = yfile_trace.begin_hook;
+        if (!yfile_trace.active || hook == NULL) return;
+        file_trace_event ev;
+        yfile_trace_fill(&ev, ctx);
+        ev.bytes = 0;
+        ev.failed = 0;
+        ev.start_ns = ev.duration_ns = 0;
+        hook(&ev, yfile_trace.hook_user);
+    }
+
+    void yfile_trace_record(const yfile_op_ctx *ctx, int64_t end, uint64_t bytes, int failed) {
+        if (!yfile_trace.active) return;
+        yfile_trace_ring *r = yfile_trace_this_ring();
+        file_trace_hook hook = yfile_trace.end_hook;
+        int sampled = r != NULL && (yfile_trace.sample_every <= 1 || r->sample_phase++ % yfile_trace.sample_every == 0);
+        if (!sampled && hook == NULL) return;
+
+        file_trace_event local;
+        file_trace_event *ev = sampled ? &r->events[(uint64_t)r->head & (r->capacity - 1)] : &local;
+        yfile_trace_fill(ev, ctx);
+        ev->bytes = bytes;
+        ev->failed = failed;
+        ev->start_ns = ctx->start > yfile_trace.origin ? (uint64_t)((double)(ctx->start - yfile_trace.origin) * yfile_trace.ns_per_tick) : 0;
+        ev->duration_ns = (uint64_t)((double)(end - ctx->start) * yfile_trace.ns_per_tick);
+        if (sampled) InterlockedIncrement64(&r->head);        // Publishes the slot.
+        if (hook != NULL) hook(ev, yfile_trace.hook_user);
+    }
+
+    void yfile_trace_json_string(FILE *out, const char *s) {
+        fputc('"', out);
+        for (; *s; s++) {
+            unsigned char c = (unsigned char)*s;
+            if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+            else if (c < 0x20) fprintf(out, "\\u%04x", c);
+            else fputc(c, out);
+        }
+        fputc('"', out);
+    }
+#endif
+
+    /**
+     * @brief Starts recording traced calls into per-thread rings, discarding any previous trace.
+     *
+     * Tracing is only compiled in when yfile.h is included with YFILE_ENABLE_TRACING defined.
+     * Recording costs a fixed-size copy into the calling thread's ring; nothing is allocated after
+     * a thread's first traced call. When a ring is full the oldest events are overwritten.
+     * @param events_per_thread Ring size, rounded up to a power of two (default 4096 when 0).
+     * @param sample_every Record one call out of every sample_every per thread; 0 or 1 records all.
+     * @return 0 on success, -1 if tracing is compiled out.
+     */
+    int file_trace_start(uint32_t events_per_thread, uint32_t sample_every) {
+#ifdef YFILE_ENABLE_TRACING
+        InitOnceExecuteOnce(&yfile_trace.once, yfile_trace_init, NULL, NULL);
+        uint32_t capacity = 1;
+        while (capacity < (events_per_thread == 0 ? 4096u : events_per_thread) && capacity < (1u << 30)) capacity <<= 1;
+
+        InterlockedExchange(&yfile_trace.active, 0);
+        AcquireSRWLockExclusive(&yfile_trace.lock);
+        // Rings of live threads are reset in place when the size is unchanged; others are replaced lazily.
+        yfile_trace_ring **link = &yfile_trace.rings;
+        while (*link != NULL) {
+            yfile_trace_ring *r = *link;
+            if (r->exited) {
+                *link = r->next;
+                free(r->events);
+                free(r);
+            } else {
+                InterlockedExchange64(&r->head, 0);
+                link = &r->next;
+            }
+        }
+        yfile_trace.capacity = capacity;
+        yfile_trace.sample_every = sample_every;
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        yfile_trace.origin = now.QuadPart;
+        ReleaseSRWLockExclusive(&yfile_trace.lock);
+        InterlockedExchange(&yfile_trace.active, 1);
+        return 0;
+#else
+        (void)events_per_thread; (void)sample_every;
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Stops recording. The rings are kept until the next file_trace_start so they can be dumped.
+     */
+    void file_trace_stop(void) {
+#ifdef YFILE_ENABLE_TRACING
+        InterlockedExchange(&yfile_trace.active, 0);
+#endif
+    }
+
+    /**
+     * @brief Installs hooks called at the start and end of every call while tracing is active.
+     * End hooks see every call regardless of sampling.
+     * @param begin Called before the call does any work, or NULL.
+     * @param end Called with the outcome and duration, or NULL.
+     * @param user Passed to both hooks.
+     * @return 0 on success, -1 if tracing is compiled out.
+     */
+    int file_trace_set_hooks(file_trace_hook begin, file_trace_hook end, void *user) {
+#ifdef YFILE_ENABLE_TRACING
+        yfile_trace.hook_user = user;
+        yfile_trace.begin_hook = begin;
+        yfile_trace.end_hook = end;
+        return 0;
+#else
+        (void)begin; (void)end; (void)user;
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Writes the recorded events as Chrome trace-event JSON, loadable in Perfetto or
+     * chrome://tracing. Safe to call while other threads are still tracing; events overwritten
+     * during the dump are skipped.
+     * @param path Output file.
+     * @return Number of events written, or -1 on failure.
+     */
+    int64_t file_trace_dump(const char *path) {
+        if (path == NULL) return -1;
+#ifdef YFILE_ENABLE_TRACING
+        // Plain stdio, so the dump does not trace itself.
+        FILE *out = fopen(path, "w");
+        if (out == NULL) return -1;
+        file_trace_event *copy = NULL;
+        uint32_t copy_cap = 0;
+        int64_t written = 0;
+        DWORD pid = GetCurrentProcessId();
+
+        fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+        AcquireSRWLockShared(&yfile_trace.lock);
+        for (yfile_trace_ring *r = yfile_trace.rings; r != NULL; r = r->next) {
+            if (copy_cap < r->capacity) {
+                free(copy);
+                copy_cap = 0;
+                if ((copy = (file_trace_event *)malloc(sizeof(file_trace_event) * r->capacity)) == NULL) break;
+                copy_cap = r->capacity;
+            }
+            uint64_t head = (uint64_t)r->head;
+            uint64_t first = head > r->capacity ? head - r->capacity : 0;
+            for (uint64_t i = first; i < head; i++) copy[i - first] = r->events[i & (r->capacity - 1)];
+            // Slots the owner reused while they were being copied are no longer valid, and the slot
+            // after head may be half written unless the owning thread has exited.
+            uint64_t after = (uint64_t)r->head;
+            uint64_t valid = after >= r->capacity ? after - r->capacity + (r->exited ? 0 : 1) : 0;
+            if (valid < first) valid = first;
+
+            for (uint64_t i = valid; i < head; i++) {
+                const file_trace_event *ev = &copy[i - first];
+                fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"yfile\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu,\"args\":{",
+                        written ? "," : "", file_op_name(ev->op), (double)ev->start_ns / 1000.0,
+                        (double)ev->duration_ns / 1000.0, (unsigned long)pid, (unsigned long)ev->thread_id);
+                fprintf(out, "\"result\":\"%s\",\"bytes\":%llu", ev->failed ? "error" : "ok", (unsigned long long)ev->bytes);
+                if (ev->fp != NULL) fprintf(out, ",\"handle\":\"%p\"", (void *)ev->fp);
+                if (ev->offset >= 0) fprintf(out, ",\"offset\":%lld", (long long)ev->offset);
+                if (ev->length > 0) fprintf(out, ",\"length\":%llu", (unsigned long long)ev->length);
+                if (ev->path[0] != '\0') { fprintf(out, ",\"path\":"); yfile_trace_json_string(out, ev->path); }
+                fprintf(out, "}}");
+                written++;
+            }
+        }
+        ReleaseSRWLockShared(&yfile_trace.lock);
+        free(copy);
+        fprintf(out, "\n]}\n");
+        if (fclose(out) != 0) return -1;
+        return written;
+#else
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return -1;
+#endif
+    }
+
+#define FILE_SLOW_IO_PATH_MAX   96         // Paths longer than this keep their last characters.
+#define FILE_SLOW_IO_FRAMES     32
+#define FILE_SLOW_IO_INFLIGHT   8          // Other in-flight calls listed in a report.
+#define YFILE_SLOW_IO_DEPTH     8          // Nested calls tracked per thread.
+
+    /**
+     * @brief A call that was in flight when a slow-I/O report was made.
+     */
+    typedef struct file_slow_io_inflight {
+        file_op op;
+        DWORD thread_id;
+        FILE *fp;
+        uint64_t elapsed_ns;
+        char path[FILE_SLOW_IO_PATH_MAX];
+    } file_slow_io_inflight;
+
+    /**
+     * @brief A call that exceeded its latency threshold.
+     *
+     * hung is set for reports made by the watchdog while the call is still running. Those have no
+     * backtrace, because the stuck thread's stack cannot be captured from the watchdog; the
+     * completed-call report that follows once the call returns does include one.
+     */
+    typedef struct file_slow_io_report {
+        file_op op;
+        DWORD thread_id;
+        FILE *fp;                          // NULL for path-only calls.
+        char path[FILE_SLOW_IO_PATH_MAX];  // Path argument, empty for handle calls.
+        uint64_t length;                   // Bytes requested, 0 if the call has no length.
+        uint64_t bytes;                    // Bytes moved; 0 for hung calls.
+        int failed;
+        int hung;
+        uint64_t duration_ns;              // Elapsed time so far for hung calls.
+        uint64_t threshold_ns;
+        uint32_t frames;
+        void *backtrace[FILE_SLOW_IO_FRAMES];
+        uint32_t in_flight;                // Other calls in flight at report time, across all threads.
+        file_slow_io_inflight others[FILE_SLOW_IO_INFLIGHT];   // The first of them.
+    } file_slow_io_report;
+
+    /**
+     * @brief Receives slow-I/O reports. Completed calls are reported on the thread that made the
+     * call, hung calls on the watchdog thread. Must not call back into yfile.
+     */
+    typedef void (*file_slow_io_callback)(const file_slow_io_report *report, void *user);
+
+#ifdef YFILE_ENABLE_SLOW_IO
+    // One tracked call. seq is odd while the owner rewrites the slot, so readers can detect torn copies.
+    typedef struct yfile_slow_slot {
+        volatile LONG seq;
+        LONG hung_seq;                     // seq of the call the watchdog already reported, watchdog-only.
+        file_op op;
+        FILE *fp;
+        int64_t start;
+        uint64_t length;
+        char path[FILE_SLOW_IO_PATH_MAX];
+    } yfile_slow_slot;
+
+    typedef struct yfile_slow_thread {
+        struct yfile_slow_thread *next, *prev;
+        DWORD thread_id;
+        volatile LONG depth;               // Calls in flight on this thread, including untracked nested ones.
+        yfile_slow_slot slots[YFILE_SLOW_IO_DEPTH];
+    } yfile_slow_thread;
+
+    typedef struct yfile_slow_registry {
+        INIT_ONCE once;
+        DWORD fls;
+        SRWLOCK lock;                      // Guards the thread list; the watchdog scans under it.
+        yfile_slow_thread *threads;
+        volatile LONG active;
+        double ns_per_tick;
+        uint64_t threshold_ns[FILE_OP_COUNT];
+        file_slow_io_callback callback;
+        void *user;
+        FILE *log;
+        uint32_t log_per_minute;
+        SRWLOCK log_lock;
+        uint64_t log_window;               // Minute (GetTickCount64 / 60000) the log budget belongs to.
+        uint32_t log_used;
+        uint64_t log_suppressed;
+        HANDLE watchdog, stop;
+        DWORD interval_ms;
+    } yfile_slow_registry;
+
+    yfile_slow_registry yfile_slow = { INIT_ONCE_STATIC_INIT, FLS_OUT_OF_INDEXES, SRWLOCK_INIT };
+
+    void WINAPI yfile_slow_thread_exit(PVOID data) {
+        yfile_slow_thread *t = (yfile_slow_thread *)data;
+        if (t == NULL) return;
+        AcquireSRWLockExclusive(&yfile_slow.lock);
+        if (t->prev != NULL) t->prev->next = t->next; else yfile_slow.threads = t->next;
+        if (t->next != NULL) t->next->prev = t->prev;
+        ReleaseSRWLockExclusive(&yfile_slow.lock);
+        free(t);
+    }
+
+    BOOL CALLBACK yfile_slow_init(INIT_ONCE *once, PVOID param, PVOID *context) {
+        (void)once; (void)param; (void)context;
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        yfile_slow.ns_per_tick = 1e9 / (double)freq.QuadPart;
+        yfile_slow.fls = FlsAlloc(yfile_slow_thread_exit);
+        InitializeSRWLock(&yfile_slow.log_lock);
+        return TRUE;
+    }
+
+    yfile_slow_thread *yfile_slow_this_thread(void) {
+        if (yfile_slow.fls == FLS_OUT_OF_INDEXES) return NULL;
+        yfile_slow_thread *t = (yfile_slow_thread *)FlsGetValue(yfile_slow.fls);
+        if (t != NULL) return t;
+        if ((t = (yfile_slow_thread *)calloc(1, sizeof(yfile_slow_thread))) == NULL) return NULL;
+        if (!FlsSetValue(yfile_slow.fls, t)) { free(t); return NULL; }
+        t->thread_id = GetCurrentThreadId();
+        AcquireSRWLockExclusive(&yfile_slow.lock);
+        t->next = yfile_slow.threads;
+        if (t->next != NULL) t->next->prev = t;
+        yfile_slow.threads = t;
+        ReleaseSRWLockExclusive(&yfile_slow.lock);
+        return t;
+    }
+
+    void yfile_slow_copy_path(char *dst, const char *path) {
+        dst[0] = '\0';
+        if (path == NULL) return;
+        size_t len = strlen(path);
+        const char *tail = len < FILE_SLOW_IO_PATH_MAX ? path : path + len - (FILE_SLOW_IO_PATH_MAX - 1);
+        memcpy(dst, tail, strlen(tail) + 1);
+    }
+
+    // Copies a slot if it holds a consistent, active call. Returns 1 on success.
+    int yfile_slow_read_slot(const yfile_slow_slot *slot, yfile_slow_slot *out) {
+        LONG seq = slot->seq;
+        if (seq & 1) return 0;
+        MemoryBarrier();
+        *out = *slot;
+        MemoryBarrier();
+        return slot->seq == seq;
+    }
+
+    // Lists in-flight calls other than the one being reported. Called with yfile_slow.lock held.
+    void yfile_slow_collect(file_slow_io_report *r, const yfile_slow_slot *self, int64_t now) {
+        r->in_flight = 0;
+        for (yfile_slow_thread *t = yfile_slow.threads; t != NULL; t = t->next) {
+            LONG depth = t->depth;
+            for (LONG i = 0; i < depth && i < YFILE_SLOW_IO_DEPTH; i++) {
+                yfile_slow_slot copy;
+                if (&t->slots[i] == self || !yfile_slow_read_slot(&t->slots[i], &copy)) continue;
+                if (r->in_flight < FILE_SLOW_IO_INFLIGHT) {
+                    file_slow_io_inflight *o = &r->others[r->in_flight];
+                    o->op = copy.op;
+                    o->thread_id = t->thread_id;
+                    o->fp = copy.fp;
+                    o->elapsed_ns = now > copy.start ? (uint64_t)((double)(now - copy.start) * yfile_slow.ns_per_tick) : 0;
+                    memcpy(o->path, copy.path, sizeof(o->path));
+                }
+                r->in_flight++;
+            }
+        }
+    }
+
+    // Prints a report to the log stream, at most log_per_minute times a minute.
+    void yfile_slow_log(const file_slow_io_report *r) {
+        uint64_t minute = GetTickCount64() / 60000;
+        AcquireSRWLockExclusive(&yfile_slow.log_lock);
+        if (minute != yfile_slow.log_window) { yfile_slow.log_window = minute; yfile_slow.log_used = 0; }
+        if (yfile_slow.log_used >= yfile_slow.log_per_minute) {
+            yfile_slow.log_suppressed++;
+            ReleaseSRWLockExclusive(&yfile_slow.log_lock);
+            return;
+        }
+        yfile_slow.log_used++;
+        uint64_t suppressed = yfile_slow.log_suppressed;
+        yfile_slow.log_suppressed = 0;
+
+        FILE *out = yfile_slow.log;
+        fprintf(out, "yfile: %s %s took %.3f ms (threshold %.3f ms) thread %lu",
+                r->hung ? "hung" : "slow", file_op_name(r->op), (double)r->duration_ns / 1e6,
+                (double)r->threshold_ns / 1e6, (unsigned long)r->thread_id);
+        if (r->path[0] != '\0') fprintf(out, " path \"%s\"", r->path);
+        if (r->fp != NULL) fprintf(out, " handle %p", (void *)r->fp);
+        if (r->length > 0) fprintf(out, " length %llu", (unsigned long long)r->length);
+        if (!r->hung) fprintf(out, " bytes %llu%s", (unsigned long long)r->bytes, r->failed ? " (failed)" : "");
+        fprintf(out, ", %lu other call(s) in flight", (unsigned long)r->in_flight);
+        if (suppressed > 0) fprintf(out, ", %llu report(s) suppressed", (unsigned long long)suppressed);
+        fputc('\n', out);
+        for (uint32_t i = 0; i < r->in_flight && i < FILE_SLOW_IO_INFLIGHT; i++) {
+            const file_slow_io_inflight *o = &r->others[i];
+            fprintf(out, "    in flight: %s for %.3f ms, thread %lu %s\n", file_op_name(o->op),
+                    (double)o->elapsed_ns / 1e6, (unsigned long)o->thread_id, o->path);
+        }
+        for (uint32_t i = 0; i < r->frames; i++) fprintf(out, "    at %p\n", r->backtrace[i]);
+        fflush(out);
+        ReleaseSRWLockExclusive(&yfile_slow.log_lock);
+    }
+
+    void yfile_slow_emit(const file_slow_io_report *r) {
+        file_slow_io_callback cb = yfile_slow.callback;
+        if (cb != NULL) cb(r, yfile_slow.user);
+        else yfile_slow_log(r);
+    }
+
+    void yfile_slow_begin(yfile_op_ctx *ctx) {
+        ctx->slow_tracked = 0;
+        if (!yfile_slow.active) return;
+        yfile_slow_thread *t = yfile_slow_this_thread();
+        if (t == NULL) return;
+        LONG depth = t->depth;
+        if (depth < YFILE_SLOW_IO_DEPTH) {
+            yfile_slow_slot *slot = &t->slots[depth];
+            InterlockedIncrement(&slot->seq);
+            slot->op = ctx->op;
+            slot->fp = ctx->fp;
+            slot->length = ctx->length;
+            yfile_slow_copy_path(slot->path, ctx->path);
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            slot->start = now.QuadPart;
+            InterlockedIncrement(&slot->seq);
+        }
+        InterlockedExchange(&t->depth, depth + 1);
+        ctx->slow_tracked = 1;
+    }
+
+    void yfile_slow_end(yfile_op_ctx *ctx, int64_t end, uint64_t bytes, int failed) {
+        if (!ctx->slow_tracked) return;
+        yfile_slow_thread *t = (yfile_slow_thread *)FlsGetValue(yfile_slow.fls);
+        InterlockedExchange(&t->depth, t->depth - 1);
+
+        uint64_t threshold = yfile_slow.threshold_ns[ctx->op];
+        uint64_t ns = (uint64_t)((double)(end - ctx->start) * yfile_slow.ns_per_tick);
+        if (!yfile_slow.active || threshold == 0 || ns < threshold) return;
+
+        file_slow_io_report *r = (file_slow_io_report *)calloc(1, sizeof(file_slow_io_report));
+        if (r == NULL) return;
+        r->op = ctx->op;
+        r->thread_id = t->thread_id;
+        r->fp = ctx->fp;
+        yfile_slow_copy_path(r->path, ctx->path);
+        r->length = ctx->length;
+        r->bytes = bytes;
+        r->failed = failed;
+        r->duration_ns = ns;
+        r->threshold_ns = threshold;
+        r->frames = CaptureStackBackTrace(2, FILE_SLOW_IO_FRAMES, r->backtrace, NULL);
+        AcquireSRWLockShared(&yfile_slow.lock);
+        yfile_slow_collect(r, NULL, end);
+        ReleaseSRWLockShared(&yfile_slow.lock);
+        yfile_slow_emit(r);
+        free(r);
+    }
+
+    DWORD WINAPI yfile_slow_watchdog(LPVOID param) {
+        (void)param;
+        file_slow_io_report *r = (file_slow_io_report *)malloc(sizeof(file_slow_io_report));
+        if (r == NULL) return 1;
+        while (WaitForSingleObject(yfile_slow.stop, yfile_slow.interval_ms) == WAIT_TIMEOUT) {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            // Reports are emitted outside the lock, so collect at most one per thread per pass.
+            for (;;) {
+                int found = 0;
+                AcquireSRWLockShared(&yfile_slow.lock);
+                for (yfile_slow_thread *t = yfile_slow.threads; t != NULL && !found; t = t->next) {
+                    LONG depth = t->depth;
+                    for (LONG i = 0; i < depth && i < YFILE_SLOW_IO_DEPTH && !found; i++) {
+                        yfile_slow_slot *slot = &t->slots[i], copy;
+                        if (!yfile_slow_read_slot(slot, &copy) || slot->hung_seq == copy.seq) continue;
+                        uint64_t threshold = yfile_slow.threshold_ns[copy.op];
+                        uint64_t elapsed = now.QuadPart > copy.start ? (uint64_t)((double)(now.QuadPart - copy.start) * yfile_slow.ns_per_tick) : 0;
+                        if (threshold == 0 || elapsed < threshold) continue;
+
+                        slot->hung_seq = copy.seq;
+                        memset(r, 0, sizeof(*r));
+                        r->op = copy.op;
+                        r->thread_id = t->thread_id;
+                        r->fp = copy.fp;
+                        memcpy(r->path, copy.path, sizeof(r->path));
+                        r->length = copy.length;
+                        r->hung = 1;
+                        r->duration_ns = elapsed;
+                        r->threshold_ns = threshold;
+                        yfile_slow_collect(r, slot, now.QuadPart);
+                        found = 1;
+                    }
+                }
+                ReleaseSRWLockShared(&yfile_slow.lock);
+                if (!found) break;
+                yfile_slow_emit(r);
+            }
+        }
+        free(r);
+        return 0;
+    }
+#endif
+
+    /**
+     * @brief Starts the slow-I/O detector.
+     *
+     * Only compiled in when yfile.h is included with YFILE_ENABLE_SLOW_IO defined. Every call that
+     * takes longer than its operation's threshold is reported when it returns; the watchdog also
+     * reports calls that are still running past their threshold, once per call.
+     * @param threshold_ns Threshold for every operation; refine per operation with
+     *        file_slow_io_set_threshold.
+     * @param watchdog_interval_ms How often the watchdog looks for hung calls; 0 disables it.
+     * @param callback Receives reports. NULL logs them to stderr instead, see file_slow_io_set_log.
+     * @param user Passed to callback.
+     * @return 0 on success, -1 on failure or when the detector is compiled out.
+     */
+    int file_slow_io_start(uint64_t threshold_ns, uint32_t watchdog_interval_ms, file_slow_io_callback callback, void *user) {
+#ifdef YFILE_ENABLE_SLOW_IO
+        InitOnceExecuteOnce(&yfile_slow.once, yfile_slow_init, NULL, NULL);
+        if (yfile_slow.fls == FLS_OUT_OF_INDEXES || yfile_slow.watchdog != NULL) return -1;
+        for (int op = 0; op < FILE_OP_COUNT; op++) yfile_slow.threshold_ns[op] = threshold_ns;
+        yfile_slow.callback = callback;
+        yfile_slow.user = user;
+        if (yfile_slow.log == NULL) { yfile_slow.log = stderr; yfile_slow.log_per_minute = 10; }
+
+        if (watchdog_interval_ms > 0) {
+            yfile_slow.interval_ms = watchdog_interval_ms;
+            if ((yfile_slow.stop = CreateEventA(NULL, TRUE, FALSE, NULL)) == NULL) return -1;
+            yfile_slow.watchdog = CreateThread(NULL, 64 * 1024, yfile_slow_watchdog, NULL, 0, NULL);
+            if (yfile_slow.watchdog == NULL) {
+                CloseHandle(yfile_slow.stop);
+                yfile_slow.stop = NULL;
+                return -1;
+            }
+        }
+        InterlockedExchange(&yfile_slow.active, 1);
+        return 0;
+#else
+        (void)threshold_ns; (void)watchdog_interval_ms; (void)callback; (void)user;
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Sets the threshold of one operation, e.g. a longer one for FILE_OP_LOCK.
+     * @param op Operation.
+     * @param threshold_ns Threshold, 0 to never report the operation.
+     * @return 0 on success, -1 on invalid input or when the detector is compiled out.
+     */
+    int file_slow_io_set_threshold(file_op op, uint64_t threshold_ns) {
+        if ((unsigned)op >= FILE_OP_COUNT) return -1;
+#ifdef YFILE_ENABLE_SLOW_IO
+        yfile_slow.threshold_ns[op] = threshold_ns;
+        return 0;
+#else
+        (void)threshold_ns;
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Configures the log used when no callback is installed.
+     * @param out Stream to write reports to.
+     * @param max_per_minute Reports printed per minute; further ones are counted and mentioned in the next report.
+     * @return 0 on success, -1 on invalid input or when the detector is compiled out.
+     */
+    int file_slow_io_set_log(FILE *out, uint32_t max_per_minute) {
+        if (out == NULL) return -1;
+#ifdef YFILE_ENABLE_SLOW_IO
+        InitOnceExecuteOnce(&yfile_slow.once, yfile_slow_init, NULL, NULL);
+        AcquireSRWLockExclusive(&yfile_slow.log_lock);
+        yfile_slow.log = out;
+        yfile_slow.log_per_minute = max_per_minute;
+        ReleaseSRWLockExclusive(&yfile_slow.log_lock);
+        return 0;
+#else
+        (void)max_per_minute;
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Stops the detector and its watchdog thread.
+     */
+    void file_slow_io_stop(void) {
+#ifdef YFILE_ENABLE_SLOW_IO
+        InterlockedExchange(&yfile_slow.active, 0);
+        if (yfile_slow.watchdog != NULL) {
+            SetEvent(yfile_slow.stop);
+            WaitForSingleObject(yfile_slow.watchdog, INFINITE);
+            CloseHandle(yfile_slow.watchdog);
+            CloseHandle(yfile_slow.stop);
+            yfile_slow.watchdog = yfile_slow.stop = NULL;
+        }
+#endif
+    }
+
+#define FILE_RECORD_MAGIC      "YFREC001"
+#define FILE_RECORD_VERSION    1
+#define FILE_RECORD_FAILED     0x1         // The call failed.
+#define FILE_RECORD_OPENED     0x2         // The call created the handle (a successful open).
+#define FILE_RECORD_FOREIGN    0x4         // First use of a handle opened before recording started.
+
+    /**
+     * @brief Header at the start of a recording (see file_record_start).
+     */
+    typedef struct file_record_header {
+        char magic[8];                     // FILE_RECORD_MAGIC, not NUL-terminated.
+        uint32_t version;                  // FILE_RECORD_VERSION.
+        uint32_t entry_size;               // sizeof(file_record_entry).
+    } file_record_header;
+
+    /**
+     * @brief One recorded call. Followed by path_length bytes of path and aux_length bytes of the
+     * second string argument (open mode, copy/move destination, lock kind), neither NUL-terminated.
+     * Entries are written in completion order.
+     */
+    typedef struct file_record_entry {
+        uint8_t op;                        // file_op.
+        uint8_t flags;                     // FILE_RECORD_* flags.
+        uint16_t path_length;
+        uint16_t aux_length;
+        uint16_t reserved;
+        uint32_t thread_id;
+        uint32_t handle;                   // Numbers FILE pointers from 1 in order of first use; 0 for path-only calls.
+        int64_t offset;                    // Explicit offset, the resulting position for seeks, -1 if none.
+        uint64_t length;                   // Bytes requested, 0 if the call has no length.
+        uint64_t bytes;                    // Bytes moved.
+        uint64_t start_ns;                 // Relative to file_record_start.
+        uint64_t duration_ns;
+    } file_record_entry;
+
+#ifdef YFILE_ENABLE_RECORDING
+#define YFILE_RECORD_BUFFER (1 << 20)
+
+    typedef struct yfile_record_handle {
+        FILE *fp;
+        uint32_t id;
+    } yfile_record_handle;
+
+    typedef struct yfile_record_state {
+        INIT_ONCE once;
+        DWORD fls;                         // Call depth of the thread, so nested yfile calls are not recorded twice.
+        SRWLOCK lock;                      // Guards everything below.
+        volatile LONG active;
+        HANDLE out;                        // Raw handle, so writing the recording does not record itself.
+        char *buf;
+        size_t used;
+        int failed;                        // A write to the recording failed; it is reported by file_record_stop.
+        int64_t origin;                    // QueryPerformanceCounter ticks at file_record_start.
+        double ns_per_tick;
+        yfile_record_handle *handles;      // Handles currently open, unordered.
+        size_t handle_count, handle_cap;
+        uint32_t next_handle;
+        int64_t entries;
+    } yfile_record_state;
+
+    yfile_record_state yfile_record = { INIT_ONCE_STATIC_INIT, FLS_OUT_OF_INDEXES, SRWLOCK_INIT };
+
+    BOOL CALLBACK yfile_record_init(INIT_ONCE *once, PVOID param, PVOID *context) {
+        (void)once; (void)param; (void)context;
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        yfile_record.ns_per_tick = 1e9 / (double)freq.QuadPart;
+        yfile_record.fls = FlsAlloc(NULL);
+        return TRUE;
+    }
+
+    // Writes out the buffered entries. Called with yfile_record.lock held.
+    void yfile_record_flush(void) {
+        DWORD put;
+        if (yfile_record.used > 0 && !yfile_record.failed &&
+            (!WriteFile(yfile_record.out, yfile_record.buf, (DWORD)yfile_record.used, &put, NULL) || put != yfile_record.used))
+            yfile_record.failed = 1;
+        yfile_record.used = 0;
+    }
+
+    // Numbers fp, adding it on open or on first use and dropping it on close. Called with yfile_record.lock held.
+    uint32_t yfile_record_handle_id(FILE *fp, int opened, int closing, uint8_t *flags) {
+        for (size_t i = 0; i < yfile_record.handle_count; i++) {
+            yfile_record_handle *h = &yfile_record.handles[i];
+            if (h->fp != fp) continue;
+            // A new open at a known address means the old stream was closed outside yfile.
+            if (opened) { h->id = ++yfile_record.next_handle; *flags |= FILE_RECORD_OPENED; }
+            uint32_t id = h->id;
+            if (closing) *h = yfile_record.handles[--yfile_record.handle_count];
+            return id;
+        }
+        uint32_t id = ++yfile_record.next_handle;
+        *flags |= opened ? FILE_RECORD_OPENED : FILE_RECORD_FOREIGN;
+        if (closing) return id;
+        if (yfile_record.handle_count == yfile_record.handle_cap) {
+            size_t cap = yfile_record.handle_cap ? yfile_record.handle_cap * 2 : 64;
+            yfile_record_handle *grown = (yfile_record_handle *)realloc(yfile_record.handles, cap * sizeof(*grown));
+            if (grown == NULL) return id;
+            yfile_record.handles = grown;
+            yfile_record.handle_cap = cap;
+        }
+        yfile_record.handles[yfile_record.handle_count].fp = fp;
+        yfile_record.handles[yfile_record.handle_count++].id = id;
+        return id;
+    }
+
+    void yfile_record_begin(yfile_op_ctx *ctx) {
+        ctx->record_outer = 0;
+        if (!yfile_record.active) return;
+        uintptr_t depth = (uintptr_t)FlsGetValue(yfile_record.fls);
+        if (!FlsSetValue(yfile_record.fls, (PVOID)(depth + 1))) return;
+        ctx->record_outer = depth == 0 ? 1 : 2;
+    }
+
+    void yfile_record_end(yfile_op_ctx *ctx, int64_t end, uint64_t bytes, int failed) {
+        if (ctx->record_outer == 0) return;
+        uintptr_t depth = (uintptr_t)FlsGetValue(yfile_record.fls);
+        FlsSetValue(yfile_record.fls, (PVOID)(depth - 1));
+        if (ctx->record_outer != 1) return;
+
+        file_record_entry e;
+        memset(&e, 0, sizeof(e));
+        e.op = (uint8_t)ctx->op;
+        e.flags = failed ? FILE_RECORD_FAILED : 0;
+        e.thread_id = GetCurrentThreadId();
+        e.offset = ctx->offset;
+        // Seeks keep the position they produced, so relative seeks replay exactly.
+        if (ctx->op == FILE_OP_SEEK && !failed) e.offset = _ftelli64(ctx->fp);
+        e.length = ctx->length;
+        e.bytes = bytes;
+        e.start_ns = ctx->start > yfile_record.origin ? (uint64_t)((double)(ctx->start - yfile_record.origin) * yfile_record.ns_per_tick) : 0;
+        e.duration_ns = (uint64_t)((double)(end - ctx->start) * yfile_record.ns_per_tick);
+        size_t path_length = ctx->path != NULL ? strlen(ctx->path) : 0;
+        size_t aux_length = ctx->aux != NULL ? strlen(ctx->aux) : 0;
+        e.path_length = (uint16_t)(path_length < 0xffff ? path_length : 0xffff);
+        e.aux_length = (uint16_t)(aux_length < 0xffff ? aux_length : 0xffff);
+        size_t need = sizeof(e) + e.path_length + e.aux_length;
+
+        AcquireSRWLockExclusive(&yfile_record.lock);
+        if (yfile_record.active && yfile_record.out != NULL) {
+            if (ctx->fp != NULL)
+                e.handle = yfile_record_handle_id(ctx->fp, ctx->op == FILE_OP_OPEN, ctx->op == FILE_OP_CLOSE, &e.flags);
+            if (yfile_record.used + need > YFILE_RECORD_BUFFER) yfile_record_flush();
+            char *p = yfile_record.buf + yfile_record.used;
+            memcpy(p, &e, sizeof(e));
+            if (e.path_length > 0) memcpy(p + sizeof(e), ctx->path, e.path_length);
+            if (e.aux_length > 0) memcpy(p + sizeof(e) + e.path_length, ctx->aux, e.aux_length);
+            yfile_record.used += need;
+            yfile_record.entries++;
+        }
+        ReleaseSRWLockExclusive(&yfile_record.lock);
+    }
+#endif
+
+    /**
+     * @brief Starts recording every yfile call to a binary file, for replay with file_replay.
+     *
+     * Only compiled in when yfile.h is included with YFILE_ENABLE_RECORDING defined. Each outermost
+     * call becomes one file_record_entry; calls that yfile makes internally are not recorded.
+     * Entries are buffered in memory and written out 1 MiB at a time.
+     * @param path Output file, replaced if it exists.
+     * @return 0 on success, -1 on failure, if already recording, or when recording is compiled out.
+     */
+    int file_record_start(const char *path) {
+        if (path == NULL) return -1;
+#ifdef YFILE_ENABLE_RECORDING
+        InitOnceExecuteOnce(&yfile_record.once, yfile_record_init, NULL, NULL);
+        if (yfile_record.fls == FLS_OUT_OF_INDEXES) return -1;
+        AcquireSRWLockExclusive(&yfile_record.lock);
+        if (yfile_record.out != NULL) {
+            ReleaseSRWLockExclusive(&yfile_record.lock);
+            return -1;
+        }
+        HANDLE out = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        char *buf = out != INVALID_HANDLE_VALUE ? (char *)malloc(YFILE_RECORD_BUFFER) : NULL;
+        file_record_header header;
+        memcpy(header.magic, FILE_RECORD_MAGIC, sizeof(header.magic));
+        header.version = FILE_RECORD_VERSION;
+        header.entry_size = sizeof(file_record_entry);
+        DWORD put;
+        if (buf == NULL || !WriteFile(out, &header, sizeof(header), &put, NULL) || put != sizeof(header)) {
+            free(buf);
+            if (out != INVALID_HANDLE_VALUE) CloseHandle(out);
+            ReleaseSRWLockExclusive(&yfile_record.lock);
+            return -1;
+        }
+        yfile_record.out = out;
+        yfile_record.buf = buf;
+        yfile_record.used = 0;
+        yfile_record.failed = 0;
+        yfile_record.next_handle = 0;
+        yfile_record.entries = 0;
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        yfile_record.origin = now.QuadPart;
+        InterlockedExchange(&yfile_record.active, 1);
+        ReleaseSRWLockExclusive(&yfile_record.lock);
+        return 0;
+#else
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Stops recording and closes the recording file. Calls still running finish unrecorded.
+     * @return Number of entries written, or -1 if not recording or a write failed.
+     */
+    int64_t file_record_stop(void) {
+#ifdef YFILE_ENABLE_RECORDING
+        InterlockedExchange(&yfile_record.active, 0);
+        AcquireSRWLockExclusive(&yfile_record.lock);
+        if (yfile_record.out == NULL) {
+            ReleaseSRWLockExclusive(&yfile_record.lock);
+            return -1;
+        }
+        yfile_record_flush();
+        int64_t written = yfile_record.failed ? -1 : yfile_record.entries;
+        if (!CloseHandle(yfile_record.out)) written = -1;
+        yfile_record.out = NULL;
+        free(yfile_record.buf);
+        yfile_record.buf = NULL;
+        free(yfile_record.handles);
+        yfile_record.handles = NULL;
+        yfile_record.handle_count = yfile_record.handle_cap = 0;
+        ReleaseSRWLockExclusive(&yfile_record.lock);
+        return written;
+#else
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Outcome of file_replay.
+     */
+    typedef struct file_replay_stats {
+        uint64_t entries;                  // Entries in the recording.
+        uint64_t replayed;                 // Calls issued.
+        uint64_t skipped;                  // Entries that cannot be replayed, or whose handle failed to open.
+        uint64_t mismatched;               // Calls that failed where the recorded one succeeded, or the reverse.
+        uint64_t bytes_read;
+        uint64_t bytes_written;
+        uint64_t recorded_ns;              // First recorded call start to last recorded call end.
+        uint64_t elapsed_ns;               // Wall time of the replay, setup excluded.
+    } file_replay_stats;
+
+#define YFILE_REPLAY_THREADS  64           // Recorded threads beyond this share replay threads.
+#define YFILE_REPLAY_BUFFER   (16 << 20)   // Larger transfers are replayed in pieces of this size.
+#define YFILE_REPLAY_PATH     1024
+
+#define YFILE_REPLAY_PENDING  0            // Opened later in the recording.
+#define YFILE_REPLAY_OPEN     1
+#define YFILE_REPLAY_CLOSED   2            // Closed, or its open failed.
+
+    typedef struct yfile_replay_entry {
+        file_record_entry e;
+        const char *path;                  // Into the loaded recording, not NUL-terminated.
+        const char *aux;
+        uint32_t worker;
+    } yfile_replay_entry;
+
+    typedef struct yfile_replay_handle {
+        SRWLOCK lock;                      // Shared for calls on fp, exclusive to open and close it.
+        volatile LONG state;               // YFILE_REPLAY_*.
+        FILE *fp;
+    } yfile_replay_handle;
+
+    // A file the recording expects to exist before its first call, keyed by its scratch path.
+    typedef struct yfile_replay_file {
+        char *path;                        // NULL for an empty slot.
+        uint64_t size;
+        int must_exist;
+    } yfile_replay_file;
+
+    typedef struct yfile_replay_run {
+        const char *scratch;
+        double speed;
+        int64_t origin;                    // QueryPerformanceCounter ticks when the first call is due.
+        double ticks_per_ns;
+        uint64_t first_ns;                 // Recorded start of the first call.
+        yfile_replay_handle *handles;      // Indexed by recorded handle number.
+        size_t buffer_size;
+        volatile LONG64 replayed, skipped, mismatched, bytes_read, bytes_written;
+    } yfile_replay_run;
+
+    typedef struct yfile_replay_worker {
+        yfile_replay_run *run;
+        yfile_replay_entry **entries;      // This worker's calls in start order.
+        size_t count;
+        HANDLE thread;
+    } yfile_replay_worker;
+
+    // Maps a recorded path into the scratch directory. Drive colons become '_', and ".." cannot climb out.
+    int yfile_replay_map(const char *scratch, const char *path, size_t length, char *out) {
+        size_t n = strlen(scratch);
+        if (n >= YFILE_REPLAY_PATH) return -1;
+        memcpy(out, scratch, n);
+        while (n > 0 && (out[n - 1] == '\\' || out[n - 1] == '/')) n--;
+        for (size_t i = 0; i < length; ) {
+            while (i < length && (path[i] == '\\' || path[i] == '/')) i++;
+            size_t start = i;
+            while (i < length && path[i] != '\\' && path[i] != '/') i++;
+            size_t part = i - start;
+            if (part == 0 || (part == 1 && path[start] == '.')) continue;
+            if (n + 1 + part >= YFILE_REPLAY_PATH) return -1;
+            int dotdot = part == 2 && path[start] == '.' && path[start + 1] == '.';
+            out[n++] = '\\';
+            for (size_t k = start; k < i; k++) {
+                char c = path[k];
+                out[n++] = (c == ':' || c == '?' || c == '*' || (dotdot && c == '.')) ? '_' : c;
+            }
+        }
+        out[n] = '\0';
+        return 0;
+    }
+
+    // Creates the directory that holds path.
+    int yfile_replay_parent(const char *path) {
+        char dir[YFILE_REPLAY_PATH];
+        const char *slash = strrchr(path, '\\');
+        if (slash == NULL || slash == path) return 0;
+        memcpy(dir, path, (size_t)(slash - path));
+        dir[slash - path] = '\0';
+        return yfile_ensure_directory(dir, NULL);
+    }
+
+    // Creates path with size bytes of filler unless it already exists. Plain stdio, so setup does
+    // not show up in the histograms or counters of the replay.
+    int yfile_replay_create(const char *path, uint64_t size, const char *fill, size_t fill_size) {
+        if (GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES) return 0;
+        if (yfile_replay_parent(path) != 0) return -1;
+        FILE *fp = fopen(path, "wb");
+        if (fp == NULL) return -1;
+        int ret = 0;
+        for (uint64_t done = 0; done < size && ret == 0; ) {
+            size_t n = size - done < fill_size ? (size_t)(size - done) : fill_size;
+            if (fwrite(fill, 1, n, fp) != n) ret = -1;
+            done += n;
+        }
+        if (fclose(fp) != 0) ret = -1;
+        return ret;
+    }
+
+    // Finds or adds path in the open-addressed file table. Returns NULL when out of memory.
+    yfile_replay_file *yfile_replay_file_get(yfile_replay_file *files, size_t mask, const char *path) {
+        uint32_t hash = 2166136261u;
+        for (const char *p = path; *p; p++) hash = (hash ^ (uint8_t)*p) * 16777619u;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            if (files[i].path == NULL) {
+                size_t length = strlen(path);
+                if ((files[i].path = (char *)malloc(length + 1)) == NULL) return NULL;
+                memcpy(files[i].path, path, length + 1);
+                return &files[i];
+            }
+            if (strcmp(files[i].path, path) == 0) return &files[i];
+        }
+    }
+
+    int yfile_replay_compare_start(const void *a, const void *b) {
+        const yfile_replay_entry *x = *(const yfile_replay_entry *const *)a, *y = *(const yfile_replay_entry *const *)b;
+        return x->e.start_ns < y->e.start_ns ? -1 : x->e.start_ns > y->e.start_ns;
+    }
+
+    int yfile_replay_compare_thread(const void *a, const void *b) {
+        const yfile_replay_entry *x = *(const yfile_replay_entry *const *)a, *y = *(const yfile_replay_entry *const *)b;
+        if (x->e.thread_id != y->e.thread_id) return x->e.thread_id < y->e.thread_id ? -1 : 1;
+        return yfile_replay_compare_start(a, b);
+    }
+
+    int yfile_replay_compare_worker(const void *a, const void *b) {
+        const yfile_replay_entry *x = *(const yfile_replay_entry *const *)a, *y = *(const yfile_replay_entry *const *)b;
+        if (x->worker != y->worker) return x->worker < y->worker ? -1 : 1;
+        return yfile_replay_compare_start(a, b);
+    }
+
+    // Sleeps, then spins, until the call recorded at start_ns is due.
+    void yfile_replay_pace(const yfile_replay_run *run, uint64_t start_ns) {
+        int64_t due = run->origin + (int64_t)((double)(start_ns - run->first_ns) / run->speed * run->ticks_per_ns);
+        for (;;) {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            if (now.QuadPart >= due) return;
+            double ms = (double)(due - now.QuadPart) / run->ticks_per_ns / 1e6;
+            if (ms > 20) Sleep((DWORD)(ms - 16));
+            else SwitchToThread();
+        }
+    }
+
+    // Replays a call on an open handle. Returns 1 if it failed.
+    int yfile_replay_on_handle(yfile_replay_run *run, const yfile_replay_entry *re, FILE *fp, char *buf) {
+        const file_record_entry *e = &re->e;
+        uint64_t done = 0;
+        int failed = 0;
+        switch (e->op) {
+        case FILE_OP_READ:
+            while (done < e->length && !failed) {
+                size_t n = e->length - done < run->buffer_size ? (size_t)(e->length - done) : run->buffer_size;
+                size_t got = file_read(fp, buf, n);
+                done += got;
+                failed = ferror(fp) != 0;
+                if (got < n) break;
+            }
+            InterlockedExchangeAdd64(&run->bytes_read, (LONG64)done);
+            return failed;
+        case FILE_OP_WRITE:
+        case FILE_OP_SPLICE: {
+            // Splices are replayed as writes of what they moved into the output handle.
+            uint64_t length = e->op == FILE_OP_SPLICE ? e->bytes : e->length;
+            while (done < length && !failed) {
+                size_t n = length - done < run->buffer_size ? (size_t)(length - done) : run->buffer_size;
+                size_t put = file_write(fp, buf, n);
+                done += put;
+                failed = put != n;
+            }
+            InterlockedExchangeAdd64(&run->bytes_written, (LONG64)done);
+            return failed;
+        }
+        case FILE_OP_PREAD:
+        case FILE_OP_SHM_READ:
+            // Reads through a shared cache are replayed as plain positional reads.
+            while (done < e->length && !failed) {
+                size_t n = e->length - done < run->buffer_size ? (size_t)(e->length - done) : run->buffer_size;
+                int64_t got = file_pread(fp, buf, n, e->offset + (int64_t)done);
+                failed = got < 0;
+                if (got > 0) done += (uint64_t)got;
+                if (got < (int64_t)n) break;
+            }
+            InterlockedExchangeAdd64(&run->bytes_read, (LONG64)done);
+            return failed;
+        case FILE_OP_PWRITE:
+            while (done < e->length && !failed) {
+                size_t n = e->length - done < run->buffer_size ? (size_t)(e->length - done) : run->buffer_size;
+                failed = file_pwrite(fp, buf, n, e->offset + (int64_t)done) != 0;
+                if (!failed) done += n;
+            }
+            InterlockedExchangeAdd64(&run->bytes_written, (LONG64)done);
+            return failed;
+        case FILE_OP_SEEK:
+            return file_set_offset(fp, e->offset) != 0;
+        case FILE_OP_TRUNCATE:
+            return file_truncate(fp, e->offset) != 0;
+        case FILE_OP_TRIM_HEAD:
+            return file_trim_head(fp, e->length) != 0;
+        case FILE_OP_MAP: {
+            file_mapping m;
+            if (file_map(fp, e->offset, (size_t)e->length, 0, &m) != 0) return 1;
+            return file_unmap(&m) != 0;
+        }
+        case FILE_OP_FLUSH:
+            return file_flush(fp) != 0;
+        case FILE_OP_GET_SIZE:
+            return file_get_size(fp) < 0;
+        case FILE_OP_LOCK:
+            return file_lock(fp, re->e.aux_length > 0 && re->aux[0] == 'e') != 0;
+        default:
+            return file_unlock(fp) != 0;
+        }
+    }
+
+    // Marks the handle of an open that will not be issued as closed, so calls waiting for it give up
+    // and count as skipped instead of spinning forever.
+    void yfile_replay_abandon(yfile_replay_run *run, const yfile_replay_entry *re) {
+        if (re->e.op == FILE_OP_OPEN && re->e.handle != 0) InterlockedExchange(&run->handles[re->e.handle].state, YFILE_REPLAY_CLOSED);
+    }
+
+    // Replays one call. Returns 0 if issued, 1 if skipped, and sets *failed.
+    int yfile_replay_issue(yfile_replay_run *run, const yfile_replay_entry *re, char *buf, int *failed) {
+        const file_record_entry *e = &re->e;
+        char path[YFILE_REPLAY_PATH], aux[YFILE_REPLAY_PATH];
+        if (e->path_length > 0 && yfile_replay_map(run->scratch, re->path, e->path_length, path) != 0) {
+            yfile_replay_abandon(run, re);
+            return 1;
+        }
+
+        switch (e->op) {
+        case FILE_OP_OPEN: {
+            char mode[16];
+            size_t n = e->aux_length < sizeof(mode) - 1 ? e->aux_length : sizeof(mode) - 1;
+            memcpy(mode, re->aux, n);
+            mode[n] = '\0';
+            if (e->handle == 0) {
+                // Failed in the recording, so nothing uses the handle.
+                FILE *fp = file_open(path, mode);
+                if (fp != NULL) fclose(fp);
+                *failed = fp == NULL;
+                return 0;
+            }
+            yfile_replay_handle *h = &run->handles[e->handle];
+            AcquireSRWLockExclusive(&h->lock);
+            h->fp = file_open(path, mode);
+            *failed = h->fp == NULL;
+            InterlockedExchange(&h->state, h->fp != NULL ? YFILE_REPLAY_OPEN : YFILE_REPLAY_CLOSED);
+            ReleaseSRWLockExclusive(&h->lock);
+            return 0;
+        }
+        case FILE_OP_STAT:
+            *failed = file_has_attributes(path, 0) < 0;
+            return 0;
+        case FILE_OP_EXISTS:
+            file_exists(path);
+            *failed = 0;
+            return 0;
+        case FILE_OP_READ_CACHED: {
+            const file_content *content = file_read_cached(path);
+            *failed = content == NULL;
+            if (content != NULL) InterlockedExchangeAdd64(&run->bytes_read, (LONG64)content->size);
+            file_content_release(content);
+            return 0;
+        }
+        case FILE_OP_COPY:
+        case FILE_OP_MOVE:
+            if (yfile_replay_map(run->scratch, re->aux, e->aux_length, aux) != 0) return 1;
+            *failed = (e->op == FILE_OP_COPY ? file_copy_ex(path, aux, 0) : file_move(path, aux)) != 0;
+            return 0;
+        case FILE_OP_DELETE:
+            *failed = file_delete(path) != 0;
+            return 0;
+        case FILE_OP_SECURE_DELETE:
+            *failed = file_secure_delete_ex(path, 1 << 20) != 0;
+            return 0;
+        case FILE_OP_ENSURE_DIRECTORY:
+            *failed = file_ensure_directory_ex(path, NULL) != 0;
+            return 0;
+        case FILE_OP_SET_ATTRIBUTES:
+        case FILE_OP_SYNC:
+            return 1;                      // The recording does not say what to set or which handles to sync.
+        case FILE_OP_RING_APPEND:
+        case FILE_OP_RING_NEXT:
+            return 1;                      // Ring files are not FILE streams, so there is no handle to replay on.
+        default:
+            break;
+        }
+
+        if (e->handle == 0) return 1;
+        yfile_replay_handle *h = &run->handles[e->handle];
+        // The open may still be running on another replay thread; it started earlier, so it cannot wait on us.
+        while (h->state == YFILE_REPLAY_PENDING) SwitchToThread();
+        if (e->op == FILE_OP_CLOSE) {
+            AcquireSRWLockExclusive(&h->lock);
+            int open = h->state == YFILE_REPLAY_OPEN;
+            if (open) {
+                *failed = file_close(h->fp) != 0;
+                h->fp = NULL;
+                InterlockedExchange(&h->state, YFILE_REPLAY_CLOSED);
+            }
+            ReleaseSRWLockExclusive(&h->lock);
+            return !open;
+        }
+        if (e->op == FILE_OP_SEEK && e->offset < 0) return 1;
+        AcquireSRWLockShared(&h->lock);
+        int open = h->state == YFILE_REPLAY_OPEN;
+        if (open) *failed = yfile_replay_on_handle(run, re, h->fp, buf);
+        ReleaseSRWLockShared(&h->lock);
+        return !open;
+    }
+
+    DWORD WINAPI yfile_replay_worker_main(LPVOID param) {
+        yfile_replay_worker *w = (yfile_replay_worker *)param;
+        yfile_replay_run *run = w->run;
+        char *buf = (char *)file_buffer_alloc(run->buffer_size);
+        if (buf == NULL) {
+            for (size_t i = 0; i < w->count; i++) yfile_replay_abandon(run, w->entries[i]);
+            InterlockedExchangeAdd64(&run->skipped, (LONG64)w->count);
+            return 1;
+        }
+        memset(buf, 0x5a, run->buffer_size);
+        for (size_t i = 0; i < w->count; i++) {
+            const yfile_replay_entry *re = w->entries[i];
+            if (run->speed > 0) yfile_replay_pace(run, re->e.start_ns);
+            int failed = 0;
+            if (yfile_replay_issue(run, re, buf, &failed) != 0) {
+                InterlockedIncrement64(&run->skipped);
+                continue;
+            }
+            InterlockedIncrement64(&run->replayed);
+            if (failed != ((re->e.flags & FILE_RECORD_FAILED) != 0)) InterlockedIncrement64(&run->mismatched);
+        }
+        file_buffer_free(buf, run->buffer_size);
+        return 0;
+    }
+
+    // Loads and checks a recording. Entries point into *raw, which the caller frees.
+    yfile_replay_entry *yfile_replay_load(const char *path, char **raw, size_t *count) {
+        *raw = NULL;
+        FILE *fp = fopen(path, "rb");
+        if (fp == NULL) return NULL;
+        int64_t size = _fseeki64(fp, 0, SEEK_END) == 0 ? _ftelli64(fp) : -1;
+        char *data = size >= (int64_t)sizeof(file_record_header) && (uint64_t)size <= SIZE_MAX ? (char *)malloc((size_t)size) : NULL;
+        if (data == NULL || _fseeki64(fp, 0, SEEK_SET) != 0 || fread(data, 1, (size_t)size, fp) != (size_t)size) {
+            free(data);
+            fclose(fp);
+            return NULL;
+        }
+        fclose(fp);
+        file_record_header header;
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, FILE_RECORD_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != FILE_RECORD_VERSION || header.entry_size != sizeof(file_record_entry)) {
+            free(data);
+            SetLastError(ERROR_BAD_FORMAT);
+            return NULL;
+        }
+
+        // Entries are packed back to back, so copy them out to aligned storage. A torn tail is ignored.
+        size_t n = 0, cap = 0;
+        yfile_replay_entry *entries = NULL;
+        for (size_t at = sizeof(header); at + sizeof(file_record_entry) <= (size_t)size; ) {
+            file_record_entry e;
+            memcpy(&e, data + at, sizeof(e));
+            size_t next = at + sizeof(e) + e.path_length + e.aux_length;
+            if (next > (size_t)size || e.op >= FILE_OP_COUNT) break;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 4096;
+                yfile_replay_entry *grown = (yfile_replay_entry *)realloc(entries, cap * sizeof(*grown));
+                if (grown == NULL) { free(entries); free(data); return NULL; }
+                entries = grown;
+            }
+            entries[n].e = e;
+            entries[n].path = data + at + sizeof(e);
+            entries[n].aux = entries[n].path + e.path_length;
+            entries[n].worker = 0;
+            n++;
+            at = next;
+        }
+        if (n == 0) { free(entries); free(data); return NULL; }
+        *raw = data;
+        *count = n;
+        return entries;
+    }
+
+    // Creates the files and directories the recording expects before its first call, and opens
+    // handles that were already open when recording started. order is in start order.
+    int yfile_replay_prepare(yfile_replay_run *run, yfile_replay_entry **order, size_t count, uint32_t handles) {
+        size_t mask = 1023;
+        while (mask < count * 2) mask = mask * 2 + 1;
+        yfile_replay_file *files = (yfile_replay_file *)calloc(mask + 1, sizeof(yfile_replay_file));
+        yfile_replay_file **file_of = (yfile_replay_file **)calloc(handles, sizeof(yfile_replay_file *));
+        uint64_t *pos = (uint64_t *)calloc(handles, sizeof(uint64_t));
+        uint64_t *extent = (uint64_t *)calloc(handles, sizeof(uint64_t));
+        char *unmapped = (char *)calloc(handles, 1);         // Handles whose open is skipped, see below.
+        char *fill = (char *)malloc(1 << 20);
+        int ret = files != NULL && file_of != NULL && pos != NULL && extent != NULL && unmapped != NULL && fill != NULL ? 0 : -1;
+        if (fill != NULL) memset(fill, 0x5a, 1 << 20);
+
+        char path[YFILE_REPLAY_PATH];
+        for (size_t i = 0; i < count && ret == 0; i++) {
+            const file_record_entry *e = &order[i]->e;
+            int ok = !(e->flags & FILE_RECORD_FAILED);
+            uint32_t h = e->handle;
+            if (e->path_length > 0 && yfile_replay_map(run->scratch, order[i]->path, e->path_length, path) != 0) {
+                // The open will be skipped; calls on its handle must be skipped too, not run against a foreign file.
+                if (e->op == FILE_OP_OPEN && h != 0) unmapped[h] = 1;
+                continue;
+            }
+
+            if (e->op == FILE_OP_OPEN) {
+                // Modes without 'w' or 'a' need the file; the others only need its directory.
+                yfile_replay_file *f = yfile_replay_file_get(files, mask, path);
+                if (f == NULL) { ret = -1; break; }
+                size_t m = 0;
+                while (m < e->aux_length && order[i]->aux[m] != 'w' && order[i]->aux[m] != 'a') m++;
+                if (m == e->aux_length && ok) f->must_exist = 1;
+                if (h != 0) file_of[h] = f;
+                continue;
+            }
+            if (h != 0) {
+                if (file_of[h] == NULL && unmapped[h]) continue;
+                if (file_of[h] == NULL) {
+                    snprintf(path, sizeof(path), "%s\\foreign-%lu.dat", run->scratch, (unsigned long)h);
+                    if ((file_of[h] = yfile_replay_file_get(files, mask, path)) == NULL) { ret = -1; break; }
+                    file_of[h]->must_exist = 1;
+                    run->handles[h].state = YFILE_REPLAY_CLOSED;     // Opened below, before the replay starts.
+                }
+                uint64_t end = 0;
+                if (e->op == FILE_OP_READ || e->op == FILE_OP_WRITE || e->op == FILE_OP_SPLICE) end = pos[h] += e->bytes;
+                else if (e->op == FILE_OP_SEEK && e->offset >= 0) pos[h] = (uint64_t)e->offset;
+                else if ((e->op == FILE_OP_PREAD || e->op == FILE_OP_PWRITE || e->op == FILE_OP_SHM_READ) && e->offset >= 0) end = (uint64_t)e->offset + e->bytes;
+                if (end > extent[h]) extent[h] = end;
+                continue;
+            }
+            if (!ok) continue;
+            if (e->op == FILE_OP_READ_CACHED) {
+                yfile_replay_file *f = yfile_replay_file_get(files, mask, path);
+                if (f == NULL) { ret = -1; break; }
+                f->must_exist = 1;
+                if (e->bytes > f->size) f->size = e->bytes;
+            }
+            if (e->op == FILE_OP_DELETE || e->op == FILE_OP_SECURE_DELETE || e->op == FILE_OP_COPY || e->op == FILE_OP_MOVE) {
+                yfile_replay_file *f = yfile_replay_file_get(files, mask, path);
+                if (f == NULL) { ret = -1; break; }
+                f->must_exist = 1;
+                if ((e->op == FILE_OP_COPY || e->op == FILE_OP_MOVE) &&
+                    yfile_replay_map(run->scratch, order[i]->aux, e->aux_length, path) == 0 &&
+                    yfile_replay_file_get(files, mask, path) == NULL) { ret = -1; break; }
+            }
+        }
+
+        for (uint32_t h = 1; h < handles && ret == 0; h++)
+            if (file_of[h] != NULL && extent[h] > file_of[h]->size) file_of[h]->size = extent[h];
+        for (size_t i = 0; i <= mask && files != NULL; i++) {
+            if (files[i].path == NULL) continue;
+            if (ret == 0 && (files[i].must_exist ? yfile_replay_create(files[i].path, files[i].size, fill, 1 << 20)
+                                                  : yfile_replay_parent(files[i].path)) != 0) ret = -1;
+        }
+        for (uint32_t h = 1; h < handles && ret == 0; h++) {
+            if (run->handles[h].state != YFILE_REPLAY_CLOSED || file_of[h] == NULL) continue;
+            if ((run->handles[h].fp = fopen(file_of[h]->path, "r+b")) == NULL) ret = -1;
+            else run->handles[h].state = YFILE_REPLAY_OPEN;
+        }
+
+        for (size_t i = 0; i <= mask && files != NULL; i++) free(files[i].path);
+        free(files);
+        free(file_of);
+        free(pos);
+        free(extent);
+        free(unmapped);
+        free(fill);
+        return ret;
+    }
+
+    /**
+     * @brief Replays a recording made with file_record_start against a scratch directory.
+     *
+     * Every recorded path is mapped under scratch_dir (drive letters become directories, ".." is
+     * neutralised), files the recording reads, deletes, copies or moves are created first, and
+     * handles that were already open when recording started get a file of their own. Each recorded
+     * thread is replayed on its own thread (up to 64) through the public yfile calls, with the
+     * recorded offsets and lengths, so enabling the histograms, counters or tracing around the replay
+     * measures the backend as the original workload saw it. Written data is filler. Attribute changes,
+     * file_sync_many and ring file calls are not replayed, splices are replayed as writes, shared cache
+     * reads as file_pread, and mappings as a read-only file_map and file_unmap.
+     * @param recording File written by file_record_start.
+     * @param scratch_dir Directory to replay into; created if missing.
+     * @param speed Time scale: 1 keeps the recorded timing, 2 replays twice as fast, 0 issues every
+     *        call as soon as the previous one on its thread returns.
+     * @param stats Receives the outcome; may be NULL.
+     * @return 0 on success, -1 if the recording cannot be read or the scratch directory cannot be prepared.
+     */
+    int file_replay(const char *recording, const char *scratch_dir, double speed, file_replay_stats *stats) {
+        if (recording == NULL || scratch_dir == NULL || scratch_dir[0] == '\0' || speed < 0) return -1;
+        char *raw;
+        size_t count = 0;
+        yfile_replay_entry *entries = yfile_replay_load(recording, &raw, &count);
+        if (entries == NULL) return -1;
+
+        yfile_replay_run run;
+        memset(&run, 0, sizeof(run));
+        run.scratch = scratch_dir;
+        run.speed = speed;
+        run.buffer_size = 64 << 10;
+        uint32_t handles = 1;
+        uint64_t last_ns = 0;
+        for (size_t i = 0; i < count; i++) {
+            const file_record_entry *e = &entries[i].e;
+            if (e->handle >= handles) handles = e->handle + 1;
+            uint64_t length = e->op == FILE_OP_SPLICE ? e->bytes : e->length;
+            while (run.buffer_size < length && run.buffer_size < YFILE_REPLAY_BUFFER) run.buffer_size *= 2;
+            if (e->start_ns + e->duration_ns > last_ns) last_ns = e->start_ns + e->duration_ns;
+        }
+
+        yfile_replay_entry **order = (yfile_replay_entry **)malloc(count * sizeof(yfile_replay_entry *));
+        run.handles = (yfile_replay_handle *)calloc(handles, sizeof(yfile_replay_handle));
+        yfile_replay_worker *workers = (yfile_replay_worker *)calloc(YFILE_REPLAY_THREADS, sizeof(yfile_replay_worker));
+        int ret = order != NULL && run.handles != NULL && workers != NULL ? 0 : -1;
+        uint32_t nworkers = 0;
+        if (ret == 0) {
+            for (size_t i = 0; i < count; i++) order[i] = &entries[i];
+            for (uint32_t h = 0; h < handles; h++) InitializeSRWLock(&run.handles[h].lock);
+
+            // Number the recorded threads, folding them onto the replay threads, then group by replay thread.
+            qsort(order, count, sizeof(order[0]), yfile_replay_compare_thread);
+            uint32_t threads = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (i > 0 && order[i]->e.thread_id != order[i - 1]->e.thread_id) threads++;
+                order[i]->worker = threads % YFILE_REPLAY_THREADS;
+            }
+            nworkers = threads + 1 < YFILE_REPLAY_THREADS ? threads + 1 : YFILE_REPLAY_THREADS;
+            run.first_ns = order[0]->e.start_ns;
+            for (size_t i = 1; i < count; i++)
+                if (order[i]->e.start_ns < run.first_ns) run.first_ns = order[i]->e.start_ns;
+
+            qsort(order, count, sizeof(order[0]), yfile_replay_compare_start);
+            if (yfile_ensure_directory(scratch_dir, NULL) != 0 || yfile_replay_prepare(&run, order, count, handles) != 0) ret = -1;
+        }
+
+        if (ret == 0) {
+            qsort(order, count, sizeof(order[0]), yfile_replay_compare_worker);
+            for (size_t i = 0, start = 0; i <= count; i++) {
+                if (i < count && order[i]->worker == order[start]->worker) continue;
+                yfile_replay_worker *w = &workers[order[start]->worker];
+                w->run = &run;
+                w->entries = order + start;
+                w->count = i - start;
+                start = i;
+            }
+            LARGE_INTEGER freq, t0, t1;
+            QueryPerformanceFrequency(&freq);
+            run.ticks_per_ns = (double)freq.QuadPart / 1e9;
+            QueryPerformanceCounter(&t0);
+            run.origin = t0.QuadPart;
+            for (uint32_t i = 0; i < nworkers; i++) {
+                workers[i].thread = CreateThread(NULL, 0, yfile_replay_worker_main, &workers[i], 0, NULL);
+                if (workers[i].thread == NULL) yfile_replay_worker_main(&workers[i]);
+            }
+            for (uint32_t i = 0; i < nworkers; i++) {
+                if (workers[i].thread == NULL) continue;
+                WaitForSingleObject(workers[i].thread, INFINITE);
+                CloseHandle(workers[i].thread);
+            }
+            QueryPerformanceCounter(&t1);
+
+            if (stats != NULL) {
+                stats->entries = count;
+                stats->replayed = (uint64_t)run.replayed;
+                stats->skipped = (uint64_t)run.skipped;
+                stats->mismatched = (uint64_t)run.mismatched;
+                stats->bytes_read = (uint64_t)run.bytes_read;
+                stats->bytes_written = (uint64_t)run.bytes_written;
+                stats->recorded_ns = last_ns - run.first_ns;
+                stats->elapsed_ns = (uint64_t)((double)(t1.QuadPart - t0.QuadPart) / run.ticks_per_ns);
+            }
+        }
+
+        // Handles the recording never closed, foreign ones included.
+        for (uint32_t h = 0; run.handles != NULL && h < handles; h++)
+            if (run.handles[h].state == YFILE_REPLAY_OPEN) file_close(run.handles[h].fp);
+        free(workers);
+        free(run.handles);
+        free(order);
+        free(entries);
+        free(raw);
+        return ret;
+    }
+
+#define YFILE_FAULT_LATENCY_MAX_NS 10000000000ULL   // Cap for EXPONENTIAL and PARETO delays when latency_b is 0 (10 s).
+
+    /**
+     * @brief Latency distributions for injected delays (see file_fault_rule).
+     */
+    typedef enum file_fault_latency {
+        FILE_FAULT_LATENCY_NONE = 0,
+        FILE_FAULT_LATENCY_FIXED,          // latency_a ns.
+        FILE_FAULT_LATENCY_UNIFORM,        // Uniform in [latency_a, latency_b] ns.
+        FILE_FAULT_LATENCY_EXPONENTIAL,    // Mean latency_a ns, capped at latency_b (0 = YFILE_FAULT_LATENCY_MAX_NS).
+        FILE_FAULT_LATENCY_PARETO          // Heavy tail: at least latency_a ns, median twice that, capped at latency_b (0 = YFILE_FAULT_LATENCY_MAX_NS).
+    } file_fault_latency;
+
+    /**
+     * @brief One fault injection rule (see file_fault_add).
+     */
+    typedef struct file_fault_rule {
+        uint32_t ops;                      // Mask of (1u << file_op); 0 matches every operation.
+        const char *path;                  // Wildcard pattern ('*', '?'), case-insensitive, '/' same as '\'.
+                                           // Handle calls match the path the handle was opened with. NULL matches all.
+        double probability;                // Chance that a matching call is hit, 0..1.
+        uint64_t skip;                     // Matching calls let through before the rule can hit.
+        uint64_t max_hits;                 // Hits after which the rule goes quiet, 0 = no limit.
+        DWORD error;                       // Win32 error a hit call fails with (ERROR_DISK_FULL, ERROR_IO_DEVICE, ...), 0 = none.
+        int short_io;                      // Hit reads and writes move only part of their length.
+        file_fault_latency latency;        // Delay added to hit calls.
+        uint64_t latency_a, latency_b;     // Distribution parameters in ns.
+    } file_fault_rule;
+
+    /**
+     * @brief Counters of one rule.
+     */
+    typedef struct file_fault_stats {
+        uint64_t matched;                  // Calls whose operation and path matched.
+        uint64_t hits;                     // Matched calls the rule acted on.
+        uint64_t errors;                   // Hits that failed the call.
+        uint64_t short_ios;                // Hits that shortened a read or write.
+        uint64_t delay_ns;                 // Total injected latency.
+    } file_fault_stats;
+
+#ifdef YFILE_ENABLE_FAULTS
+#define YFILE_FAULT_RULES 32
+
+    typedef struct yfile_fault_slot {
+        file_fault_rule rule;
+        char *path;                        // Owned copy of rule.path.
+        volatile LONG64 matched, hits, errors, short_ios, delay_ns;
+    } yfile_fault_slot;
+
+    typedef struct yfile_fault_registry {
+        SRWLOCK lock;                      // Shared while rules are evaluated, exclusive to change them.
+        volatile LONG count;
+        LONG generation;                   // Bumped whenever rules are added or cleared.
+        uint64_t seed;
+        double ticks_per_ns;
+        yfile_fault_slot slots[YFILE_FAULT_RULES];
+    } yfile_fault_registry;
+
+    yfile_fault_registry yfile_fault = { SRWLOCK_INIT };
+
+    // splitmix64: decisions are a pure function of seed, rule and call number, so a run with the
+    // same seed and the same call sequence hits the same calls.
+    uint64_t yfile_fault_mix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    // Uniform in [0, 1).
+    double yfile_fault_unit(uint64_t x) {
+        return (double)(x >> 11) / 9007199254740992.0;
+    }
+
+    char yfile_fault_fold(char c) {
+        if (c == '/') return '\\';
+        return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+    }
+
+    // Wildcard match; '*' also spans separators.
+    int yfile_fault_match(const char *pattern, const char *path) {
+        const char *star = NULL, *resume = NULL;
+        while (*path != '\0') {
+            if (*pattern == '*') { star = ++pattern; resume = path; continue; }
+            if (*pattern != '\0' && (*pattern == '?' || yfile_fault_fold(*pattern) == yfile_fault_fold(*path))) {
+                pattern++;
+                path++;
+                continue;
+            }
+            if (star == NULL) return 0;
+            pattern = star;
+            path = ++resume;
+        }
+        while (*pattern == '*') pattern++;
+        return *pattern == '\0';
+    }
+
+    uint64_t yfile_fault_latency_ns(const file_fault_rule *rule, uint64_t r) {
+        double u = yfile_fault_unit(r), ns;
+        switch (rule->latency) {
+        case FILE_FAULT_LATENCY_FIXED: return rule->latency_a;
+        case FILE_FAULT_LATENCY_UNIFORM:
+            return rule->latency_b > rule->latency_a ? rule->latency_a + r % (rule->latency_b - rule->latency_a + 1) : rule->latency_a;
+        case FILE_FAULT_LATENCY_EXPONENTIAL: ns = -log(1.0 - u) * (double)rule->latency_a; break;
+        case FILE_FAULT_LATENCY_PARETO: ns = (double)rule->latency_a / (1.0 - u); break;     // Shape 1.
+        default: return 0;
+        }
+        // The tails are unbounded (infinite at u == 1); clamp before converting, which is undefined out of range.
+        uint64_t cap = rule->latency_b > 0 ? rule->latency_b : YFILE_FAULT_LATENCY_MAX_NS;
+        if (!(ns < (double)cap)) return cap;
+        return (uint64_t)ns;
+    }
+
+    // Sleeps while the delay is long enough for the scheduler, then spins off the rest.
+    void yfile_fault_delay(uint64_t ns) {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        int64_t due = now.QuadPart + (int64_t)((double)ns * yfile_fault.ticks_per_ns);
+        for (;;) {
+            QueryPerformanceCounter(&now);
+            if (now.QuadPart >= due) return;
+            double ms = (double)(due - now.QuadPart) / yfile_fault.ticks_per_ns / 1e6;
+            if (ms > 20) Sleep((DWORD)(ms - 16));
+            else SwitchToThread();
+        }
+    }
+
+    // Returns the rules whose path pattern matches path, one bit per rule. Called with the lock held.
+    uint32_t yfile_fault_resolve(const char *path) {
+        uint32_t bits = 0;
+        if (path == NULL) return 0;
+        for (LONG i = 0; i < yfile_fault.count; i++)
+            if (yfile_fault.slots[i].path != NULL && yfile_fault_match(yfile_fault.slots[i].path, path)) bits |= 1u << i;
+        return bits;
+    }
+
+    DWORD yfile_fault_inject(file_op op, FILE *fp, const char *path, size_t *len) {
+        if (yfile_fault.count == 0) return 0;
+        yfile_state *s = fp != NULL ? yfile_state_find(fp) : NULL;
+        DWORD error = 0;
+        uint64_t delay = 0;
+        AcquireSRWLockShared(&yfile_fault.lock);
+        // Rules changed since the handle's matches were resolved: the bits may name other rules now.
+        if (s != NULL && s->fault_generation != yfile_fault.generation) {
+            s->fault_paths = yfile_fault_resolve(s->fault_path);
+            s->fault_generation = yfile_fault.generation;
+        }
+        uint32_t handle_paths = s != NULL ? s->fault_paths : 0;
+        for (LONG i = 0; i < yfile_fault.count; i++) {
+            yfile_fault_slot *f = &yfile_fault.slots[i];
+            if (f->rule.ops != 0 && !(f->rule.ops & (1u << op))) continue;
+            if (f->path != NULL && (fp != NULL ? !(handle_paths & (1u << i)) : path == NULL || !yfile_fault_match(f->path, path))) continue;
+            uint64_t n = (uint64_t)InterlockedIncrement64(&f->matched);
+            if (n <= f->rule.skip) continue;
+            uint64_t r = yfile_fault_mix(yfile_fault.seed ^ ((uint64_t)(i + 1) << 56) ^ n);
+            if (yfile_fault_unit(r) >= f->rule.probability) continue;
+            if ((uint64_t)InterlockedIncrement64(&f->hits) > f->rule.max_hits && f->rule.max_hits > 0) {
+                InterlockedDecrement64(&f->hits);
+                continue;
+            }
+            uint64_t ns = yfile_fault_latency_ns(&f->rule, yfile_fault_mix(r));
+            if (ns > 0) {
+                delay += ns;
+                InterlockedExchangeAdd64(&f->delay_ns, (LONG64)ns);
+            }
+            if (f->rule.error != 0 && error == 0) {
+                error = f->rule.error;
+                InterlockedIncrement64(&f->errors);
+            } else if (f->rule.short_io && len != NULL && *len > 1) {
+                *len = 1 + (size_t)(yfile_fault_mix(r + 1) % (*len - 1));
+                InterlockedIncrement64(&f->short_ios);
+            }
+        }
+        ReleaseSRWLockShared(&yfile_fault.lock);
+        if (delay > 0) yfile_fault_delay(delay);
+        if (error != 0) SetLastError(error);
+        return error;
+    }
+
+    // Keeps the open path of a handle so rules added later can be matched against it.
+    void yfile_fault_opened(FILE *fp, const char *path) {
+        if (fp == NULL || path == NULL) return;
+        yfile_state *s = yfile_state_acquire(fp);
+        if (s == NULL) return;
+        size_t length = strlen(path);
+        char *copy = (char *)malloc(length + 1);
+        if (copy != NULL) memcpy(copy, path, length + 1);
+        AcquireSRWLockShared(&yfile_fault.lock);
+        free(s->fault_path);
+        s->fault_path = copy;
+        s->fault_paths = yfile_fault_resolve(copy);
+        s->fault_generation = yfile_fault.generation;
+        ReleaseSRWLockShared(&yfile_fault.lock);
+    }
+#endif
+
+    /**
+     * @brief Adds a fault injection rule.
+     *
+     * Only compiled in when yfile.h is included with YFILE_ENABLE_FAULTS defined. Rules are checked
+     * in front of the OS call of open, close, read, write, pread, pwrite, flush, truncate, lock,
+     * stat, copy, move, delete, secure delete and directory creation. file_write checks before
+     * every pass of its write loop, so a short write followed by ERROR_DISK_FULL fails it halfway
+     * through the buffer, the way a filling disk does. Every matching rule that hits adds its
+     * latency; the first one with an error fails the call, and short_io shortens file_read,
+     * file_pread and one pass of file_write. Whether a call is hit depends only on the seed, the
+     * rule and how many calls the rule has matched, so single-threaded runs repeat exactly.
+     * Path patterns of handle calls are matched against the path the handle was opened with.
+     * @param rule Rule to add; the path pattern is copied.
+     * @return Rule index for file_fault_get_stats, or -1 on failure (32 rules at most, or faults compiled out).
+     */
+    int file_fault_add(const file_fault_rule *rule) {
+        if (rule == NULL || rule->probability < 0 || rule->probability > 1) return -1;
+#ifdef YFILE_ENABLE_FAULTS
+        char *path = NULL;
+        if (rule->path != NULL) {
+            size_t length = strlen(rule->path);
+            if ((path = (char *)malloc(length + 1)) == NULL) return -1;
+            memcpy(path, rule->path, length + 1);
+        }
+        AcquireSRWLockExclusive(&yfile_fault.lock);
+        if (yfile_fault.ticks_per_ns == 0) {
+            LARGE_INTEGER freq;
+            QueryPerformanceFrequency(&freq);
+            yfile_fault.ticks_per_ns = (double)freq.QuadPart / 1e9;
+        }
+        int index = yfile_fault.count;
+        if (index < YFILE_FAULT_RULES) {
+            yfile_fault_slot *f = &yfile_fault.slots[index];
+            memset(f, 0, sizeof(*f));
+            f->rule = *rule;
+            f->rule.path = f->path = path;
+            yfile_fault.generation++;
+            InterlockedExchange(&yfile_fault.count, index + 1);
+        }
+        ReleaseSRWLockExclusive(&yfile_fault.lock);
+        if (index < YFILE_FAULT_RULES) return index;
+        free(path);
+        return -1;
+#else
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return -1;
+#endif
+    }
+
+    /**
+     * @brief Sets the seed of the hit decisions and restarts every rule's call count.
+     * @param seed Any value; the same seed replays the same faults.
+     */
+    void file_fault_seed(uint64_t seed) {
+#ifdef YFILE_ENABLE_FAULTS
+        AcquireSRWLockExclusive(&yfile_fault.lock);
+        yfile_fault.seed = seed;
+        for (LONG i = 0; i < yfile_fault.count; i++) {
+            yfile_fault_slot *f = &yfile_fault.slots[i];
+            f->matched = f->hits = f->errors = f->short_ios = f->delay_ns = 0;
+        }
+        ReleaseSRWLockExclusive(&yfile_fault.lock);
+#else
+        (void)seed;
+#endif
+    }
+
+    /**
+     * @brief Removes every rule. Indices are reused by later file_fault_add calls; open handles
+     * match their paths against the new rules.
+     */
+    void file_fault_clear(void) {
+#ifdef YFILE_ENABLE_FAULTS
+        AcquireSRWLockExclusive(&yfile_fault.lock);
+        for (LONG i = 0; i < yfile_fault.count; i++) free(yfile_fault.slots[i].path);
+        yfile_fault.generation++;
+        InterlockedExchange(&yfile_fault.count, 0);
+        ReleaseSRWLockExclusive(&yfile_fault.lock);
+#endif
+    }
+
+    /**
+     * @brief Gets the counters of one rule.
+     * @param rule Index returned by file_fault_add.
+     * @param out Receives the counters.
+     * @return 0 on success, -1 on invalid input or when faults are compiled out.
+     */
+    int file_fault_get_stats(int rule, file_fault_stats *out) {
+        if (out == NULL || rule < 0) return -1;
+#ifdef YFILE_ENABLE_FAULTS
+        AcquireSRWLockShared(&yfile_fault.lock);
+        int ok = rule < yfile_fault.count;
+        if (ok) {
+            const yfile_fault_slot *f = &yfile_fault.slots[rule];
+            out->matched = (uint64_t)f->matched;
+            out->hits = (uint64_t)f->hits;
+            out->errors = (uint64_t)f->errors;
+            out->short_ios = (uint64_t)f->short_ios;
+            out->delay_ns = (uint64_t)f->delay_ns;
+        }
+        ReleaseSRWLockShared(&yfile_fault.lock);
+        return ok ? 0 : -1;
+#else
+        return -1;
+#endif
+    }
+
+#ifdef YFILE_INSTRUMENTED
+    void yfile_op_begin(yfile_op_ctx *ctx, file_op op, FILE *fp, const char *path) {
+        ctx->op = op;
+        ctx->fp = fp;
+        ctx->path = path;
+        ctx->aux = NULL;
+        ctx->offset = -1;
+        ctx->length = 0;
+#ifdef YFILE_ENABLE_ACCOUNTING
+        yfile_io_begin(ctx);
+#endif
+#ifdef YFILE_ENABLE_TRACING
+        yfile_trace_begin(ctx);
+#endif
+#ifdef YFILE_ENABLE_SLOW_IO
+        yfile_slow_begin(ctx);
+#endif
+#ifdef YFILE_ENABLE_RECORDING
+        yfile_record_begin(ctx);
+#endif
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        ctx->start = now.QuadPart;
+    }
+
+    void yfile_op_end(yfile_op_ctx *ctx, uint64_t bytes, int failed) {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+#ifdef YFILE_ENABLE_HISTOGRAMS
+        yfile_hist_record(ctx->op, now.QuadPart - ctx->start, bytes, failed);
+#endif
+#ifdef YFILE_ENABLE_ACCOUNTING
+        yfile_io_record(ctx, bytes, failed);
+#endif
+#ifdef YFILE_ENABLE_TRACING
+        yfile_trace_record(ctx, now.QuadPart, bytes, failed);
+#endif
+#ifdef YFILE_ENABLE_SLOW_IO
+        yfile_slow_end(ctx, now.QuadPart, bytes, failed);
+#endif
+#ifdef YFILE_ENABLE_RECORDING
+        yfile_record_end(ctx, now.QuadPart, bytes, failed);
+#endif
+        (void)bytes; (void)failed;
+    }
+#endif
+
 #ifdef __cplusplus
 }
 #endif